@@ -1,28 +1,74 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdlib>
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#else
+#include <chrono>
+#endif
+
+// NOTE: The counter behind the timer is QueryPerformanceCounter on windows and
+// clock_gettime(CLOCK_MONOTONIC) on linux/mac (std::chrono::steady_clock elsewhere).
+// rt_one_weekend's trace recorder (Final_Render/headers/trace.h) reads the same clocks,
+// so QueryTimestampMicroseconds() values go straight onto its timeline.
 class StepTimer {
 private:
-    // -- source timing data uses QPC units
-    LARGE_INTEGER qpc_frequency_;
-    LARGE_INTEGER qpc_last_time_;
-    UINT64 qpc_max_delta_;
+    // -- source timing data uses counter units (QPC units on windows)
+    std::uint64_t qpc_frequency_;
+    std::uint64_t qpc_last_time_;
+    std::uint64_t qpc_max_delta_;
 
     // -- derived timing data uses a canonical tick format
-    UINT64 elapsed_ticks_;
-    UINT64 total_ticks_;
-    UINT64 leftover_ticks_;
+    std::uint64_t elapsed_ticks_;
+    std::uint64_t total_ticks_;
+    std::uint64_t leftover_ticks_;
 
     // -- data for tracking framerate:
-    UINT32 frame_count_;
-    UINT32 frames_per_sec_;
-    UINT32 frames_this_sec_;
-    UINT64 qpc_sec_counter_;
+    std::uint32_t frame_count_;
+    std::uint32_t frames_per_sec_;
+    std::uint32_t frames_this_sec_;
+    std::uint64_t qpc_sec_counter_;
 
     // -- data for configuring fixed timestep mode
     bool is_fixed_timestep_;
-    UINT64 target_elapsed_ticks_;
+    std::uint64_t target_elapsed_ticks_;
 public:
-    static UINT64 const TicksPerSecond = 10'000'000;
+    static std::uint64_t const TicksPerSecond = 10'000'000;
+    //
+    // -- clock backend
+    static std::uint64_t QueryCounter () {
+#if defined(_WIN32)
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return static_cast<std::uint64_t>(counter.QuadPart);
+#elif defined(__unix__) || defined(__APPLE__)
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000ull + static_cast<std::uint64_t>(ts.tv_nsec);
+#else
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+    // -- counter units per second
+    static std::uint64_t QueryFrequency () {
+#if defined(_WIN32)
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        return static_cast<std::uint64_t>(frequency.QuadPart);
+#else
+        return 1'000'000'000ull;
+#endif
+    }
+    // -- the counter in microseconds, the unit of chrome trace timestamps
+    static double QueryTimestampMicroseconds () {
+        std::uint64_t counter = QueryCounter();
+        std::uint64_t frequency = QueryFrequency();
+        return static_cast<double>(counter / frequency) * 1e6 + static_cast<double>(counter % frequency) * 1e6 / frequency;
+    }
     StepTimer () :
         elapsed_ticks_(0),
         total_ticks_(0),
@@ -34,34 +80,34 @@ public:
         is_fixed_timestep_(false),
         target_elapsed_ticks_(TicksPerSecond / 60)
     {
-        QueryPerformanceFrequency(&qpc_frequency_);
-        QueryPerformanceCounter(&qpc_last_time_);
+        qpc_frequency_ = QueryFrequency();
+        qpc_last_time_ = QueryCounter();
         // -- init max delta to 1/10 of a sec
-        qpc_max_delta_ = qpc_frequency_.QuadPart / 10;
+        qpc_max_delta_ = qpc_frequency_ / 10;
     }
 
-    static double TickToSec (UINT64 ticks) { return static_cast<double>(ticks) / TicksPerSecond; }
-    static UINT64 SecToTick (double seconds) { return static_cast<UINT64>(seconds * TicksPerSecond); }
+    static double TickToSec (std::uint64_t ticks) { return static_cast<double>(ticks) / TicksPerSecond; }
+    static std::uint64_t SecToTick (double seconds) { return static_cast<std::uint64_t>(seconds * TicksPerSecond); }
 
     // -- get elapsed time since prev update call
-    UINT64 GetElapsedTicks () const { return elapsed_ticks_; }
+    std::uint64_t GetElapsedTicks () const { return elapsed_ticks_; }
     double GetElaspedSeconds () const { return TickToSec(elapsed_ticks_); }
     // -- get total time since start of program
-    UINT64 GetTotalTicks () const { return total_ticks_; }
+    std::uint64_t GetTotalTicks () const { return total_ticks_; }
     double GetTotalSeconds () const { return TickToSec(total_ticks_); }
     // -- get total number of updates since start of program
-    UINT32 GetFrameCount () const { return frame_count_; }
+    std::uint32_t GetFrameCount () const { return frame_count_; }
     // -- get current frame rate
-    UINT32 GetFramePerSecond () const { return frames_per_sec_; }
+    std::uint32_t GetFramePerSecond () const { return frames_per_sec_; }
     // -- set whether to use fixed or variable timestep
     void SetFixedTimeStep (bool is_fixed) { is_fixed_timestep_ = is_fixed; }
     // -- set how often call update when in fixed rate mode
-    void SetTargetElapsedTicks (UINT64 target_elapsed) { target_elapsed_ticks_ = target_elapsed; }
+    void SetTargetElapsedTicks (std::uint64_t target_elapsed) { target_elapsed_ticks_ = target_elapsed; }
     void SetTargetElapsedSeconds (double target_elapsed) { target_elapsed_ticks_ = SecToTick(target_elapsed); }
     //
     // -- after an intentional timing discontinuty call this to avoid fixed rate attempting unnecessary catchup
     void ResetElapsedTime () {
-        QueryPerformanceCounter(&qpc_last_time_);
+        qpc_last_time_ = QueryCounter();
         leftover_ticks_  = 0;
         frames_per_sec_ = 0;
         frames_this_sec_ = 0;
@@ -72,10 +118,9 @@ public:
     // -- update timer state, calling appropriate LPUDATEFUNC
     void Tick (LPUDATEFUNC update = nullptr) {
         // -- query current time
-        LARGE_INTEGER curr_time;
-        QueryPerformanceCounter(&curr_time);
+        std::uint64_t curr_time = QueryCounter();
 
-        UINT64 dt = curr_time.QuadPart - qpc_last_time_.QuadPart;
+        std::uint64_t dt = curr_time - qpc_last_time_;
 
         qpc_last_time_ = curr_time;
         qpc_sec_counter_ += dt;
@@ -86,9 +131,9 @@ public:
 
         // -- convert QPC units to canonical tick format
         dt *= TicksPerSecond;
-        dt /= qpc_frequency_.QuadPart;
+        dt /= qpc_frequency_;
 
-        UINT32 last_frame_count = frame_count_;
+        std::uint32_t last_frame_count = frame_count_;
         if (is_fixed_timestep_) {
             // -- if app is running very close to targt elapsed time (within 1/4 of ms) just clamp the clock
             // -- to exactly math the target value
@@ -116,10 +161,10 @@ public:
         // -- track frame data
         if (frame_count_ != last_frame_count)
             ++frames_this_sec_;
-        if (qpc_sec_counter_ >= static_cast<UINT64>(qpc_frequency_.QuadPart)) {
+        if (qpc_sec_counter_ >= qpc_frequency_) {
             frames_per_sec_ = frames_this_sec_;
             frames_this_sec_ = 0;
-            qpc_sec_counter_ %= qpc_frequency_.QuadPart;
+            qpc_sec_counter_ %= qpc_frequency_;
         }
     }
 
@@ -0,0 +1,390 @@
+/* ===========================================================
+   #File: animation.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Renders a sequence of frames, refitting the bvhs between frames #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/scene.h"
+#include "headers/light_tree.h"
+#include "headers/render.h"
+#include "headers/progressive.h"
+#include "headers/bvh.h"
+#include "headers/render_setup.h"
+#include "headers/obj_loader.h"
+#include "headers/instance.h"
+#include <string.h>
+#include <omp.h>
+
+// NOTE: The CPU counterpart of MyDemo::OnFrameRender in the dxr tutorials, which turns
+// its instances a little every frame and updates the top-level structure with
+// PERFORM_UPDATE instead of building it again.
+// The final scene's small spheres roll over the ground, each in its own direction and
+// bouncing off the edges, so after a while they are nowhere near the spheres they were
+// grouped with. An -obj mesh turns about its vertical axis (vertices rewritten every
+// frame), or with -instances its copies turn in place like the demo's.
+// Every frame each bvh is refit bottom-up; once its nodes' surface areas (their SAH
+// terms) have grown on average by more than -threshold since its last build, it is
+// rebuilt instead.
+// Frames go to <prefix>0000.ppm, <prefix>0001.ppm, ...; one csv line per frame and
+// structure to stdout.
+// Options:
+//   -frames n      frame count (48)
+//   -spp n         samples per pixel (16)
+//   -width n       image width (400)
+//   -threshold f   relative area growth that triggers a rebuild (0.25)
+//   -rebuild       always rebuild, for comparison
+//   -refit         never rebuild, for comparison
+//   -obj file      add a turning wavefront OBJ mesh
+//   -instances n   with -obj: n turning copies of the mesh instead
+//   -out prefix    frame file prefix ("frame"), "-" to not write frames
+// Usage: animation.exe -frames 96 -out out/frame > anim.csv
+
+#define time_step (1.0f / 24.0f)
+#define arena_half_extent 11.0f
+
+typedef enum { UPDATE_ADAPTIVE, UPDATE_REFIT, UPDATE_REBUILD } update_mode;
+
+//
+// one animated acceleration structure and its bookkeeping
+typedef struct {
+    char const * name;
+    bvh * accel;
+    bvh_quality quality;
+    int rebuilds;
+    double update_seconds;      /* total over the run */
+} animated_bvh;
+
+static render_setup g_setup;     /* the final scene's settings, world and spheres' bvh */
+
+typedef struct {
+    int first;          /* the small spheres are [first, first + count) */
+    int count;
+    vec3f * velocity;
+} rolling_spheres;
+
+//
+// the final scene, with the small spheres over the book's whole -11..11 grid
+static void
+make_world (rolling_spheres * out_rolling) {
+    static lambertian mat_ground;
+    lambertian_init(&mat_ground, (color) { 0.5f, 0.5f, 0.5f });
+    scene_add_plane(&g_setup.world, (point3) { 0.0f, 0.0f, 0.0f }, (vec3f) { 0.0f, 1.0f, 0.0f }, scene_add_material(&g_setup.world, (material *)(&mat_ground)));
+
+    static dielectric mat1;
+    dielectric_init(&mat1, 1.5f);
+    scene_add_sphere(&g_setup.world, (point3) { 0.f, 1.0f, 0.0f }, 1.0f, scene_add_material(&g_setup.world, (material *)(&mat1)));
+
+    static lambertian mat2;
+    lambertian_init(&mat2, (color) { .4f, .2f, 0.1f });
+    scene_add_sphere(&g_setup.world, (point3) { -4.f, 1.0f, 0.0f }, 1.0f, scene_add_material(&g_setup.world, (material *)(&mat2)));
+
+    static metal mat3;
+    metal_init(&mat3, (color) { .7f, .6f, 0.5f }, 0.0f);
+    scene_add_sphere(&g_setup.world, (point3) { 4.f, 1.0f, 0.0f }, 1.0f, scene_add_material(&g_setup.world, (material *)(&mat3)));
+
+    out_rolling->first = g_setup.world.sphere_count;
+    for (int a = -11; a < 11; ++a) {
+        for (int b = -11; b < 11; ++b) {
+            float choose_mat = random_float();
+            point3 center = {a + 0.9f * random_float(), 0.2f, b + 0.9f * random_float()};
+            material * mat_sphere_ptr = NULL;
+            if (choose_mat < 0.8f) {
+                lambertian * lamb_ptr = malloc(sizeof(lambertian));
+                lambertian_init(lamb_ptr, vec3_mul_elementwise(random_vec3(), random_vec3()));
+                mat_sphere_ptr = (material *)lamb_ptr;
+            } else if (choose_mat < 0.95f) {
+                metal * metal_ptr = malloc(sizeof(metal));
+                metal_init(metal_ptr, random_vec3_shifted(0.5f, 1.0f), random_float_shifted(0.0f, 0.5f));
+                mat_sphere_ptr = (material *)metal_ptr;
+            } else {
+                dielectric * diel_ptr = malloc(sizeof(dielectric));
+                dielectric_init(diel_ptr, 1.5f);
+                mat_sphere_ptr = (material *)diel_ptr;
+            }
+            scene_add_sphere(&g_setup.world, center, 0.2f, scene_add_material(&g_setup.world, mat_sphere_ptr));
+        }
+    }
+    out_rolling->count = g_setup.world.sphere_count - out_rolling->first;
+    out_rolling->velocity = malloc(out_rolling->count * sizeof(vec3f));
+    for (int i = 0; i < out_rolling->count; ++i) {
+        float angle = random_float_shifted(0.0f, 6.2831853f);
+        float speed = random_float_shifted(1.0f, 4.0f);
+        out_rolling->velocity[i] = (vec3f) {speed * cosf(angle), 0.0f, speed * sinf(angle)};
+    }
+}
+/* moves the small spheres one step, reflecting them off the arena's edges */
+static void
+roll_spheres (rolling_spheres * me, float dt) {
+    float * coords[2] = {g_setup.world.center_x, g_setup.world.center_z};
+    for (int k = 0; k < me->count; ++k) {
+        int i = me->first + k;
+        for (int c = 0; c < 2; ++c) {
+            float * v = &me->velocity[k].E[2 * c];      /* x, z */
+            float p = coords[c][i] + *v * dt;
+            if (p > arena_half_extent || p < -arena_half_extent) {
+                *v = -*v;
+                p = p > 0.0f ? 2.0f * arena_half_extent - p : -2.0f * arena_half_extent - p;
+            }
+            coords[c][i] = p;
+        }
+    }
+}
+//
+// turning meshes
+typedef struct {
+    point3 * rest_positions;
+    vec3f * rest_normals;
+    point3 pivot;
+} turning_mesh;
+
+static void
+turning_mesh_init (turning_mesh * me, triangle_mesh const * mesh) {
+    me->rest_positions = malloc(mesh->vertex_count * sizeof(point3));
+    memcpy(me->rest_positions, mesh->positions, mesh->vertex_count * sizeof(point3));
+    me->rest_normals = NULL;
+    if (mesh->normals) {
+        me->rest_normals = malloc(mesh->vertex_count * sizeof(vec3f));
+        memcpy(me->rest_normals, mesh->normals, mesh->vertex_count * sizeof(vec3f));
+    }
+    vec3f bmin = mesh->accel.nodes[0].bmin, bmax = mesh->accel.nodes[0].bmax;
+    me->pivot = (point3) {0.5f * (bmin.x + bmax.x), 0.0f, 0.5f * (bmin.z + bmax.z)};
+}
+static void
+turning_mesh_pose (turning_mesh * me, triangle_mesh * mesh, float yaw) {
+    affine3 turn = affine3_trs((vec3f) {0}, yaw, (vec3f) {1.0f, 1.0f, 1.0f});
+    int v;
+#pragma omp parallel for
+    for (v = 0; v < mesh->vertex_count; ++v) {
+        vec3f local = vec3_sub(me->rest_positions[v], me->pivot);
+        mesh->positions[v] = vec3_add(me->pivot, affine3_vector(&turn, local));
+        if (me->rest_normals)
+            mesh->normals[v] = affine3_vector(&turn, me->rest_normals[v]);
+    }
+}
+/* copy i of count on a grid over the arena, turned by yaw on top of its own fixed turn */
+static affine3
+instance_pose (blas const * b, int i, int count, float yaw) {
+    int side = (int)ceilf(sqrtf((float)count));
+    float cell = 2.0f * arena_half_extent / side;
+    float footprint = fmaxf(b->bmax.x - b->bmin.x, b->bmax.z - b->bmin.z);
+    float scale = footprint > 0.0f ? 0.8f * cell / footprint : 1.0f;
+    point3 base = {0.5f * (b->bmin.x + b->bmax.x), b->bmin.y, 0.5f * (b->bmin.z + b->bmax.z)};
+    yaw += 6.2831853f * fmodf(i * 0.618034f, 1.0f);
+    affine3 xf = affine3_trs((vec3f) {0}, yaw, (vec3f) {scale, scale, scale});
+    point3 at = {-arena_half_extent + (i % side + 0.5f) * cell, 0.0f, -arena_half_extent + (i / side + 0.5f) * cell};
+    vec3f offset = vec3_sub(at, affine3_vector(&xf, base));
+    for (int r = 0; r < 3; ++r)
+        xf.m[r][3] = offset.E[r];
+    return xf;
+}
+//
+// refit, then rebuild if the tree got too slow (or as the mode says). returns true on a rebuild
+static bool
+update_bvh (animated_bvh * me, update_mode mode, bool (*refit) (void *), bool (*rebuild) (void *), void * target,
+    float * out_growth, double * out_seconds) {
+    double t0 = omp_get_wtime();
+    bool rebuilt = false;
+    if (UPDATE_REBUILD != mode)
+        refit(target);
+    float cost = bvh_quality_cost(&me->quality, me->accel);
+    *out_growth = cost;
+    if (UPDATE_REBUILD == mode || (UPDATE_ADAPTIVE == mode && bvh_quality_degraded(&me->quality, cost))) {
+        rebuild(target);
+        bvh_quality_reset(&me->quality, me->accel);
+        rebuilt = true;
+        ++me->rebuilds;
+    }
+    *out_seconds = omp_get_wtime() - t0;
+    me->update_seconds += *out_seconds;
+    return rebuilt;
+}
+static bool refit_spheres (void * accel) { return bvh_refit_spheres((bvh *)accel, &g_setup.world); }
+static bool rebuild_spheres (void * accel) { bvh_free((bvh *)accel); return bvh_build_spheres((bvh *)accel, &g_setup.world); }
+static bool refit_mesh (void * mesh) { return triangle_mesh_refit((triangle_mesh *)mesh); }
+static bool rebuild_mesh (void * mesh) { return triangle_mesh_build_bvh((triangle_mesh *)mesh); }
+static bool refit_tlas (void * t) { return tlas_refit((tlas *)t); }
+static bool rebuild_tlas (void * t) { return tlas_build((tlas *)t); }
+
+static bool
+write_frame (char const * path, color const * pixels, int width, int height) {
+    FILE * file = fopen(path, "w");
+    if (NULL == file)
+        return false;
+    fprintf(file, "P3\n%d %d\n255\n", width, height);
+    for (int k = 0; k < width * height; ++k) {
+        int rgb[3];
+        write_color(rgb, pixels[k], 1);
+        fprintf(file, "%d %d %d\n", rgb[0], rgb[1], rgb[2]);
+    }
+    return 0 == fclose(file);
+}
+
+int main (int argc, char ** argv) {
+    int frame_count = 48;
+    int samples_per_pixel = 16;
+    int width = 400;
+    float threshold = 0.25f;
+    update_mode mode = UPDATE_ADAPTIVE;
+    char const * obj_path = NULL;
+    int instance_count = 0;
+    char const * out_prefix = "frame";
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-frames") && i + 1 < argc)
+            frame_count = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-spp") && i + 1 < argc)
+            samples_per_pixel = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-width") && i + 1 < argc)
+            width = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-threshold") && i + 1 < argc)
+            threshold = (float)atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-rebuild"))
+            mode = UPDATE_REBUILD;
+        else if (0 == strcmp(argv[i], "-refit"))
+            mode = UPDATE_REFIT;
+        else if (0 == strcmp(argv[i], "-obj") && i + 1 < argc)
+            obj_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-instances") && i + 1 < argc)
+            instance_count = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-out") && i + 1 < argc)
+            out_prefix = argv[++i];
+    }
+
+    //
+    // -- world setup
+    scene_init(&g_setup.world);
+    scene_settings_default(&g_setup.settings);
+    rolling_spheres rolling;
+    make_world(&rolling);
+    // -- the light tree is built before the meshes come in: nothing emits, so nothing moves in it
+    if (!render_setup_prepare(&g_setup, width))
+        return(1);
+    animated_bvh animated[3];
+    int animated_count = 0;
+    animated[animated_count++] = (animated_bvh) {.name = "spheres", .accel = &g_setup.accel};
+
+    static triangle_mesh mesh;
+    static lambertian mat_mesh;
+    static blas mesh_blas;
+    static tlas instances;
+    turning_mesh turning = {0};
+    triangle_mesh_init(&mesh);
+    tlas_init(&instances);
+    if (obj_path) {
+        scene_file_error error;
+        if (!obj_load(obj_path, &mesh, &error)) {
+            fprintf(stderr, "%s:%d: %s\n", obj_path, error.line, error.message);
+            return(1);
+        }
+        lambertian_init(&mat_mesh, (color) { 0.6f, 0.6f, 0.6f });
+        mesh.mat_ptr = (material *)&mat_mesh;
+        mesh.material_id = g_setup.world.material_count;
+        if (instance_count > 0) {
+            blas_init_mesh(&mesh_blas, &mesh);
+            for (int i = 0; i < instance_count; ++i) {
+                affine3 xf = instance_pose(&mesh_blas, i, instance_count, 0.0f);
+                tlas_add_instance(&instances, &mesh_blas, &xf);
+            }
+            tlas_build(&instances);
+            g_setup.world.instances = &instances;
+            animated[animated_count++] = (animated_bvh) {.name = "tlas", .accel = &instances.accel};
+        } else {
+            mesh.object_id = scene_mesh_id_base + scene_add_mesh(&g_setup.world, &mesh);
+            turning_mesh_init(&turning, &mesh);
+            animated[animated_count++] = (animated_bvh) {.name = "mesh", .accel = &mesh.accel};
+        }
+    }
+    for (int a = 0; a < animated_count; ++a) {
+        animated[a].quality.threshold = threshold;
+        bvh_quality_reset(&animated[a].quality, animated[a].accel);
+    }
+
+    //
+    // -- render setup
+    int height = g_setup.height;
+    int pixel_count = width * height;
+    film fb;
+    film_alloc(&fb, width, height);
+    color * beauty = malloc(pixel_count * sizeof(color));
+
+    //
+    // -- frames
+    printf("frame,structure,update_ms,area_growth,sah_cost,rebuilt,render_s\n");
+    double render_total = 0.0;
+    for (int frame = 0; frame < frame_count; ++frame) {
+        float ms[3], growth[3];
+        bool rebuilt[3] = {false, false, false};
+        if (frame > 0) {
+            // -- move, then bring every structure up to date
+            roll_spheres(&rolling, time_step);
+            float yaw = 0.3f * frame * time_step * 6.2831853f;
+            if (instance_count > 0) {
+                for (int i = 0; i < instances.instance_count; ++i) {
+                    affine3 xf = instance_pose(&mesh_blas, i, instance_count, yaw);
+                    tlas_set_transform(&instances, i, &xf);
+                }
+            } else if (obj_path) {
+                turning_mesh_pose(&turning, &mesh, yaw);
+            }
+            for (int a = 0; a < animated_count; ++a) {
+                void * target = &g_setup.accel;
+                bool (*refit) (void *) = refit_spheres;
+                bool (*rebuild) (void *) = rebuild_spheres;
+                if (animated[a].accel == &instances.accel) {
+                    target = &instances;
+                    refit = refit_tlas;
+                    rebuild = rebuild_tlas;
+                } else if (animated[a].accel == &mesh.accel) {
+                    target = &mesh;
+                    refit = refit_mesh;
+                    rebuild = rebuild_mesh;
+                }
+                double seconds;
+                rebuilt[a] = update_bvh(&animated[a], mode, refit, rebuild, target, &growth[a], &seconds);
+                ms[a] = (float)(1000.0 * seconds);
+            }
+        } else {
+            for (int a = 0; a < animated_count; ++a) {
+                ms[a] = 0.0f;
+                growth[a] = 1.0f;
+            }
+        }
+
+        // -- render, every frame with its own sample streams
+        double render_start = omp_get_wtime();
+        tile_grid grid;
+        tile_grid_init(&grid, width, height, 32, random_hash_seed(2021, frame));
+        memset(fb.sum, 0, pixel_count * sizeof(color));
+        memset(fb.lum_sq, 0, pixel_count * sizeof(float));
+        tile_pass tiles;
+        tile_pass_init(&tiles, samples_per_pixel, samples_per_pixel);
+#pragma omp parallel
+        render_tiles_pass(&g_setup.ctx, &g_setup.cam, &fb, NULL, &grid, &tiles);
+        film_resolve(&fb, &grid, beauty, NULL, NULL);
+        tile_grid_free(&grid);
+        double render_seconds = omp_get_wtime() - render_start;
+        render_total += render_seconds;
+
+        if (0 != strcmp(out_prefix, "-")) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s%04d.ppm", out_prefix, frame);
+            if (!write_frame(path, beauty, width, height))
+                fprintf(stderr, "could not write %s\n", path);
+        }
+        fprintf(stderr, "frame %4d  render %6.2fs", frame, render_seconds);
+        for (int a = 0; a < animated_count; ++a) {
+            printf("%d,%s,%.3f,%.3f,%.1f,%d,%.3f\n", frame, animated[a].name, ms[a], growth[a], bvh_sah_cost(animated[a].accel),
+                rebuilt[a], render_seconds);
+            fprintf(stderr, "  %s %s %7.3fms area x%.2f", animated[a].name, rebuilt[a] ? "rebuild" : "refit  ", ms[a], growth[a]);
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "total render %.2fs\n", render_total);
+    for (int a = 0; a < animated_count; ++a)
+        fprintf(stderr, "%s: %d rebuilds, %.2f ms updating\n", animated[a].name, animated[a].rebuilds, 1000.0 * animated[a].update_seconds);
+
+    return(0);
+}
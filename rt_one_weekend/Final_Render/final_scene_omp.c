@@ -8,206 +8,611 @@
    =========================================================== */
 
 #include "headers/common.h"
-#include <windows.h>
+#include "headers/scene.h"
+#include "headers/light_tree.h"
+#include "headers/render.h"
+#include "headers/image.h"
+#include "headers/denoise.h"
+#include "headers/aov.h"
+#include "headers/progressive.h"
+#include "headers/scene_file.h"
+#include "headers/bvh.h"
+#include "headers/scene_cache.h"
+#include "headers/obj_loader.h"
+#include "headers/sbvh.h"
+#include "headers/instance.h"
+#include "headers/trace.h"
+#include "headers/topology.h"
+#include "headers/numa.h"
+#include <string.h>
+#include <omp.h>
 
 // NOTE(omid): To output the result of the program to .ppm instead of console: 
 // Final_Render.exe > image.ppm
+// Options:
+//   -scene file  render a scene description instead of the built-in final scene
+//                (its image/samples/sky statements still yield to -width, -spp, -night)
+//   -export file write the scene about to be rendered as a scene description
+//   -cache file  with -scene: map the parsed scene + bvh from this binary cache, or
+//                (re)write it when it is missing or the scene file changed
+//   -linear      no bvh, test every sphere (for comparison)
+//   -obj file    add a wavefront OBJ mesh (grey diffuse) to the scene; meshes always
+//                get their own bvh and are not part of -export or -cache
+//   -sbvh        build the -obj mesh's bvh with spatial splits (better for long thin triangles)
+//   -instances n with -obj: place n copies of the mesh on a grid over the ground instead
+//                of the mesh itself (one shared bvh, a top-level bvh over the copies)
+//   -lights f    turn a fraction f of the random small spheres into emitters
+//   -night       dim the sky so the emitters dominate
+//   -spp n       samples per pixel (500)
+//   -width n     image width (1200)
+//   -denoise     a-trous filter guided by first-hit albedo/normal/depth
+//   -pfm file    also write the linear (float) image, e.g. to use as a reference
+//   -ref file    compare against a reference pfm and report the error
+//   -aov file    write beauty + albedo, normal, depth, material id, object id as one multi-layer exr
+//   -pass-spp n          render progressively, n samples per pixel per pass (default: all in one pass)
+//   -budget seconds      stop after this much wall-clock time, even before -spp is reached
+//                        (every tile still gets its first pass; passes default to 4 spp)
+//   -checkpoint file     save the accumulation state there (at the end and periodically)
+//   -checkpoint-every s  seconds between checkpoints (60)
+//   -resume file         continue from a checkpoint of the same scene and options
+//   -threshold e         adaptive: stop sampling a tile once its relative error is below e
+//                        (a few 0.01s); -spp becomes the cap and passes default to 16 spp
+//   -min-spp n           samples a tile takes before it may converge (64)
+//   -report file         per-tile spp/error csv
+//   -primary-cache n     pinhole cameras (aperture 0): samples on n x n fixed positions per
+//                        pixel, each camera ray traced once and its first hit reused
+//   -trace file          record a timeline of the run's phases (scene, bvh, passes, tiles,
+//                        denoise, output) as chrome trace json, written at exit
+//   -stats file          with a RAY_STATS build: the path length and sphere tests per ray
+//                        histograms as csv (the ray stats report goes to stderr anyway)
+//   -numa                numa-aware placement (numa.h): the scene copied to every node or
+//                        spread over them, threads pinned to nodes, each node given its
+//                        band of tiles (not noisiest first) and first writing their pixels
 
 /* Dereferencing null */
 #pragma warning(disable:6011)
 /* X could be 0 */
 #pragma warning(disable:6387)
 
-//
-// linearly blend color1 and color2 based on t parameter                           
-static color
-blend_lin (color c1, color c2, float t) {
-    color ret;
-
-    c1 = vec3_scale(c1, (1.0f - t));
-    c2 = vec3_scale(c2, t);
+scene g_world;
 
-    ret = vec3_add(c1, c2);
-    return ret;
-}
 //
-// compute ray color based on hitting an obj or not (bg)
-// TODO(omid): make hittable_list inherit from hittable to use a hittable here
-static color
-ray_color (ray r, hittable_list * hlist, int depth) {
-    color ret = {0,0,0};
-    hit_record rec;
-    if (depth > 0) {
-        if (hlist_hit(hlist, &r, 0.001f /*Fixing Shadow Acne*/, g_infinity, &rec)) {
-            ray scattered;
-            color attenuation;
-            if (material_scatter(rec.mat_ptr, &r, &rec, &attenuation, &scattered))
-                ret = vec3_mul_elementwise(ray_color(scattered, hlist, depth - 1), attenuation);
-        } else {    // bg: blend white and blue based on ray.y
-            vec3f unit_dir = vec3_normalize(r.dir);
-            float wt = 0.5f * (unit_dir.y + 1.0f);
-            color white = {1.0f, 1.0f, 1.0f};
-            color blue = {.5f, .7f, 1.0f};
-            ret = blend_lin(white, blue, wt);
-        }
+// copies of b on a grid over [-half_extent, half_extent]^2 on the ground, each scaled
+// to fit its cell with a varying turn about y. false when they did not all fit in t
+static bool
+scatter_instances (tlas * t, blas const * b, int count, float half_extent) {
+    int side = (int)ceilf(sqrtf((float)count));
+    float cell = 2.0f * half_extent / side;
+    float footprint = fmaxf(b->bmax.x - b->bmin.x, b->bmax.z - b->bmin.z);
+    float scale = footprint > 0.0f ? 0.8f * cell / footprint : 1.0f;
+    point3 base = {0.5f * (b->bmin.x + b->bmax.x), b->bmin.y, 0.5f * (b->bmin.z + b->bmax.z)};
+    for (int i = 0; i < count; ++i) {
+        float yaw = 6.2831853f * fmodf(i * 0.618034f, 1.0f);     /* golden ratio steps, no rng state touched */
+        affine3 xf = affine3_trs((vec3f) {0}, yaw, (vec3f) {scale, scale, scale});
+        point3 at = {-half_extent + (i % side + 0.5f) * cell, 0.0f, -half_extent + (i / side + 0.5f) * cell};
+        // -- the mesh's bottom center lands on the cell's center
+        vec3f offset = vec3_sub(at, affine3_vector(&xf, base));
+        for (int r = 0; r < 3; ++r)
+            xf.m[r][3] = offset.E[r];
+        if (tlas_add_instance(t, b, &xf) < 0)
+            return false;
     }
-    return ret;
-}
-//
-// translate [0.f, 1.f] to [0, 255]
-static void
-write_color (int out_color[3], color pixel_color, int samples_per_pixel) {
-    float scale = 1.0f / samples_per_pixel;
-    pixel_color = vec3_scale(pixel_color, scale);
-    /* gamma correction */
-    // raising the color to the power of 1/gamma
-    // (gamma = 2.0f)
-    float r = sqrtf(pixel_color.x);
-    float g = sqrtf(pixel_color.y);
-    float b = sqrtf(pixel_color.z);
-    for (int i = 0; i < 3; ++i)
-        out_color[i] = (int)(256 * clamp(pixel_color.E[i], 0.0f, 0.999f));
+    return true;
 }
 
-#define samples_per_pixel 500
-hittable_list * g_world;
-
-int main () {
-    //
-    // -- image setup
-    float aspect_ratio = 3.f / 2.f;
-    int width = 1200;
-    int height = (int)(width / aspect_ratio);
-    int max_depth = 50;
-    int * image_colors = calloc(height * width, 3 * sizeof(int));;
+int main (int argc, char ** argv) {
+    float light_fraction = 0.0f;
+    bool night = false;
+    int samples_per_pixel = 0;      /* 0: keep the scene's */
+    int width = 0;
+    char const * scene_path = NULL;
+    char const * export_path = NULL;
+    char const * cache_path = NULL;
+    bool linear = false;
+    char const * obj_path = NULL;
+    bool sbvh = false;
+    int instance_count = 0;
+    bool denoise = false;
+    char const * pfm_path = NULL;
+    char const * ref_path = NULL;
+    char const * aov_path = NULL;
+    int pass_spp = 0;
+    double budget_seconds = 0.0;
+    char const * checkpoint_path = NULL;
+    double checkpoint_every = 60.0;
+    char const * resume_path = NULL;
+    float threshold = 0.0f;
+    int min_spp = 64;
+    char const * report_path = NULL;
+    int primary_strata = 0;
+    char const * stats_path = NULL;
+    char const * trace_path = NULL;
+    bool numa = false;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-lights") && i + 1 < argc)
+            light_fraction = (float)atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-night"))
+            night = true;
+        else if (0 == strcmp(argv[i], "-spp") && i + 1 < argc)
+            samples_per_pixel = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-width") && i + 1 < argc)
+            width = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-denoise"))
+            denoise = true;
+        else if (0 == strcmp(argv[i], "-pfm") && i + 1 < argc)
+            pfm_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-ref") && i + 1 < argc)
+            ref_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-aov") && i + 1 < argc)
+            aov_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-pass-spp") && i + 1 < argc)
+            pass_spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-budget") && i + 1 < argc)
+            budget_seconds = atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-checkpoint") && i + 1 < argc)
+            checkpoint_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-checkpoint-every") && i + 1 < argc)
+            checkpoint_every = atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-resume") && i + 1 < argc)
+            resume_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-threshold") && i + 1 < argc)
+            threshold = (float)atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-min-spp") && i + 1 < argc)
+            min_spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-report") && i + 1 < argc)
+            report_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-primary-cache") && i + 1 < argc)
+            primary_strata = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-stats") && i + 1 < argc)
+            stats_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-trace") && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-scene") && i + 1 < argc)
+            scene_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-export") && i + 1 < argc)
+            export_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-cache") && i + 1 < argc)
+            cache_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-linear"))
+            linear = true;
+        else if (0 == strcmp(argv[i], "-obj") && i + 1 < argc)
+            obj_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-sbvh"))
+            sbvh = true;
+        else if (0 == strcmp(argv[i], "-instances") && i + 1 < argc)
+            instance_count = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-numa"))
+            numa = true;
+    }
+    if (trace_path)
+        trace_open(trace_path);
 
     //
     // -- g_world setup
-    int const world_cap = 1000;
-    byte * world_memory = malloc(hlist_size(world_cap));
-    g_world = hlist_init(world_memory, world_cap);
-
-    sphere s0 = {0};
-    lambertian mat_ground;
-    lambertian_init(&mat_ground, (color) { 0.5f, 0.5f, 0.5f });
-    sphere_init(&s0, (point3) { 0.0f, -1000.0f, 0.0f }, 1000.0f, (material *)(&mat_ground));
-    hlist_add(g_world, (hittable *)&s0);
-
-    for (int a = -4; a < 4; ++a) {
-        for (int b = -4; b < 4; ++b) {
-            float choose_mat = random_float();
-            point3 center = {a + 0.9f * random_float(), 0.2f, b + 0.9f * random_float()};
-            if (vec3_len(vec3_sub(center, (point3) { 4.0f, 0.2f, 0.0f })) > 0.9f) {
-                if (choose_mat < 0.8f) {
-                    // diffuse
-                    color albedo = vec3_mul_elementwise(random_vec3(), random_vec3());
-                    lambertian * mat_sphere_ptr = malloc(sizeof(lambertian));           // hello mem leak :)
-                    lambertian_init(mat_sphere_ptr, albedo);
-                    sphere * s_ptr = malloc(sizeof(sphere));
-                    sphere_init(s_ptr, center, 0.2f, (material *)(mat_sphere_ptr));
-                    hlist_add(g_world, (hittable *)s_ptr);
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    color albedo = random_vec3_shifted(0.5f, 1.0f);
-                    float fuzz = random_float(0.0f, 0.5f);
-                    metal * mat_sphere_ptr = malloc(sizeof(metal));
-                    metal_init(mat_sphere_ptr, albedo, fuzz);
-                    sphere * s_ptr = malloc(sizeof(sphere));
-                    sphere_init(s_ptr, center, 0.2f, (material *)(mat_sphere_ptr));
-                    hlist_add(g_world, (hittable *)s_ptr);
-                } else {
-                    // dielectric
-                    dielectric * mat_sphere_ptr = malloc(sizeof(dielectric));
-                    dielectric_init(mat_sphere_ptr, 1.5f);
-                    sphere * s_ptr = malloc(sizeof(sphere));
-                    sphere_init(s_ptr, center, 0.2f, (material *)(mat_sphere_ptr));
-                    hlist_add(g_world, (hittable *)s_ptr);
+    trace_scope span = trace_begin("scene");
+    scene_init(&g_world);
+    scene_settings settings;
+    scene_settings_default(&settings);
+    bvh accel = {0};
+    file_map cache_map = {0};
+    uint64_t source_key = 0;
+    if (scene_path && cache_path && hash_file(scene_path, &source_key) &&
+        scene_cache_open(cache_path, source_key, &cache_map, &g_world, &settings, &accel)) {
+        fprintf(stderr, "scene: %d spheres, %d materials, mapped from %s\n",
+            g_world.sphere_count, g_world.material_count, cache_path);
+    } else if (scene_path) {
+        double load_start = omp_get_wtime();
+        scene_file_error error;
+        if (!scene_load(scene_path, &g_world, &settings, &error)) {
+            fprintf(stderr, "%s:%d: %s\n", scene_path, error.line, error.message);
+            return(1);
+        }
+        fprintf(stderr, "scene: %d spheres, %d materials, loaded in %.3fs\n",
+            g_world.sphere_count, g_world.material_count, omp_get_wtime() - load_start);
+    } else {
+
+        static lambertian mat_ground;     /* outlives this block, the scene points at it */
+        lambertian_init(&mat_ground, (color) { 0.5f, 0.5f, 0.5f });
+        scene_add_plane(&g_world, (point3) { 0.0f, 0.0f, 0.0f }, (vec3f) { 0.0f, 1.0f, 0.0f }, scene_add_material(&g_world, (material *)(&mat_ground)));
+
+        for (int a = -4; a < 4; ++a) {
+            for (int b = -4; b < 4; ++b) {
+                float choose_mat = random_float();
+                point3 center = {a + 0.9f * random_float(), 0.2f, b + 0.9f * random_float()};
+                if (vec3_len(vec3_sub(center, (point3) { 4.0f, 0.2f, 0.0f })) > 0.9f) {
+                    material * mat_sphere_ptr = NULL;
+                    if (light_fraction > 0.0f && random_float() < light_fraction) {
+                        // emitter
+                        color emit = vec3_scale(random_vec3_shifted(0.5f, 1.0f), 4.0f);
+                        diffuse_light * light_ptr = malloc(sizeof(diffuse_light));     // hello mem leak :)
+                        diffuse_light_init(light_ptr, emit);
+                        mat_sphere_ptr = (material *)light_ptr;
+                    } else if (choose_mat < 0.8f) {
+                        // diffuse
+                        color albedo = vec3_mul_elementwise(random_vec3(), random_vec3());
+                        lambertian * lamb_ptr = malloc(sizeof(lambertian));             // hello mem leak :)
+                        lambertian_init(lamb_ptr, albedo);
+                        mat_sphere_ptr = (material *)lamb_ptr;
+                    } else if (choose_mat < 0.95) {
+                        // metal
+                        color albedo = random_vec3_shifted(0.5f, 1.0f);
+                        float fuzz = random_float(0.0f, 0.5f);
+                        metal * metal_ptr = malloc(sizeof(metal));
+                        metal_init(metal_ptr, albedo, fuzz);
+                        mat_sphere_ptr = (material *)metal_ptr;
+                    } else {
+                        // dielectric
+                        dielectric * diel_ptr = malloc(sizeof(dielectric));
+                        dielectric_init(diel_ptr, 1.5f);
+                        mat_sphere_ptr = (material *)diel_ptr;
+                    }
+                    scene_add_sphere(&g_world, center, 0.2f, scene_add_material(&g_world, mat_sphere_ptr));
                 }
             }
         }
+
+        static dielectric mat1;
+        dielectric_init(&mat1, 1.5f);
+        scene_add_sphere(&g_world, (point3) { 0.f, 1.0f, 0.0f }, 1.0f, scene_add_material(&g_world, (material *)(&mat1)));
+
+        static lambertian mat2;
+        lambertian_init(&mat2, (color) { .4f, .2f, 0.1f });
+        scene_add_sphere(&g_world, (point3) { -4.f, 1.0f, 0.0f }, 1.0f, scene_add_material(&g_world, (material *)(&mat2)));
+
+        static metal mat3;
+        metal_init(&mat3, (color) { .7f, .6f, 0.5f }, 0.0f);
+        scene_add_sphere(&g_world, (point3) { 4.f, 1.0f, 0.0f }, 1.0f, scene_add_material(&g_world, (material *)(&mat3)));
+    }
+    trace_end(&span);
+    //
+    // -- acceleration structure (cached with the scene's own settings, before any overrides)
+    if (!linear && 0 == accel.node_count) {
+        double build_start = omp_get_wtime();
+        span = trace_begin("bvh build");
+        bvh_build_spheres(&accel, &g_world);
+        trace_end(&span);
+        fprintf(stderr, "bvh: %d nodes, built in %.3fs\n", accel.node_count, omp_get_wtime() - build_start);
+        if (scene_path && cache_path && !scene_cache_write(cache_path, source_key, &g_world, &settings, &accel))
+            fprintf(stderr, "could not write %s\n", cache_path);
+    }
+
+    //
+    // -- triangle mesh
+    static triangle_mesh mesh;
+    static lambertian mat_mesh;
+    uint64_t mesh_key = 0;
+    triangle_mesh_init(&mesh);
+    if (obj_path) {
+        double load_start = omp_get_wtime();
+        span = trace_begin("mesh load");
+        scene_file_error error;
+        if (!obj_load(obj_path, &mesh, &error) || !hash_file(obj_path, &mesh_key)) {
+            fprintf(stderr, "%s:%d: %s\n", obj_path, error.line, error.message);
+            return(1);
+        }
+        if (sbvh) {
+            double build_start = omp_get_wtime();
+            sbvh_stats stats;
+            triangle_mesh_build_sbvh(&mesh, sbvh_default_budget, &stats);
+            fprintf(stderr, "sbvh: %d nodes, %d spatial splits, %d duplicated references, built in %.3fs\n",
+                mesh.accel.node_count, stats.spatial_splits, stats.duplicates, omp_get_wtime() - build_start);
+        }
+        lambertian_init(&mat_mesh, (color) { 0.6f, 0.6f, 0.6f });
+        mesh.mat_ptr = (material *)&mat_mesh;
+        mesh.material_id = g_world.material_count;     /* one past the scene's, for the id aov */
+        fprintf(stderr, "mesh: %d triangles, %d vertices%s, loaded + bvh in %.3fs\n", mesh.triangle_count,
+            mesh.vertex_count, mesh.normals ? " with normals" : "", omp_get_wtime() - load_start);
+        if (instance_count <= 0)
+            mesh.object_id = scene_mesh_id_base + scene_add_mesh(&g_world, &mesh);
+        trace_end(&span);
+    }
+    static blas mesh_blas;
+    static tlas instances;
+    tlas_init(&instances);
+    if (obj_path && instance_count > 0) {
+        double build_start = omp_get_wtime();
+        span = trace_begin("tlas build");
+        blas_init_mesh(&mesh_blas, &mesh);
+        if (!scatter_instances(&instances, &mesh_blas, instance_count, 11.0f) || !tlas_build(&instances)) {
+            fprintf(stderr, "could not place %d instances (out of memory, or more than %d)\n", instance_count, tlas_max_instances);
+            return(1);
+        }
+        trace_end(&span);
+        g_world.instances = &instances;
+        fprintf(stderr, "instances: %d copies, %.1f MB (one copy: %.1f MB), tlas built in %.3fs\n", instances.instance_count,
+            tlas_memory_bytes(&instances) / 1048576.0, blas_memory_bytes(&mesh_blas) / 1048576.0, omp_get_wtime() - build_start);
     }
 
-    sphere s1 = {0};
-    dielectric mat1;
-    dielectric_init(&mat1, 1.5f);
-    sphere_init(&s1, (point3) { 0.f, 1.0f, 0.0f }, 1.0f, (material *)(&mat1));
-    hlist_add(g_world, (hittable *)&s1);
+    if (samples_per_pixel > 0)
+        settings.samples_per_pixel = samples_per_pixel;
+    if (width > 0)
+        settings.width = width;
+    if (night)
+        settings.sky_scale = 0.05f;
+    if (export_path && !scene_save(export_path, &g_world, &settings))
+        fprintf(stderr, "could not write %s\n", export_path);
 
-    sphere s2 = {0};
-    lambertian mat2;
-    lambertian_init(&mat2, (color) { .4f, .2f, 0.1f });
-    sphere_init(&s2, (point3) { -4.f, 1.0f, 0.0f }, 1.0f, (material *)(&mat2));
-    hlist_add(g_world, (hittable *)&s2);
+    //
+    // -- image setup
+    samples_per_pixel = settings.samples_per_pixel;
+    width = settings.width;
+    float aspect_ratio = settings.aspect_ratio;
+    float sky_scale = settings.sky_scale;
+    int height = (int)(width / aspect_ratio);
+    int max_depth = settings.max_depth;
+    int pixel_count = height * width;
+    int * image_colors = calloc(pixel_count, 3 * sizeof(int));
+    color * beauty = calloc(pixel_count, sizeof(color));    /* linear mean radiance */
+    if (threshold > 0.0f && pass_spp <= 0)
+        pass_spp = 16;
+    if (budget_seconds > 0.0 && pass_spp <= 0)
+        pass_spp = tile_pass_budget_spp;
+    if (pass_spp <= 0 || pass_spp > samples_per_pixel)
+        pass_spp = samples_per_pixel;
 
-    sphere s3 = {0};
-    metal mat3;
-    metal_init(&mat3, (color) { .7f, .6f, 0.5f }, 0.0f);
-    sphere_init(&s3, (point3) { 4.f, 1.0f, 0.0f }, 1.0f, (material *)(&mat3));
-    hlist_add(g_world, (hittable *)&s3);
+    //
+    // -- lights setup
+    light_tree lights;
+    span = trace_begin("light tree");
+    int light_count = light_tree_build(&lights, &g_world);
+    trace_end(&span);
+    if (light_count < 0) {
+        fprintf(stderr, "not enough memory for the light tree\n");
+        return(1);
+    }
+    fprintf(stderr, "lights: %d\n", light_count);
+    render_context ctx;
+    render_context_init(&ctx, &g_world, &lights, max_depth);
+    ctx.accel = linear ? NULL : &accel;
+    ctx.sky_scale = sky_scale;
 
     //
     // -- camera setup
     camera cam = {0};
-    point3 lookfrom = {13.f, 2.f, 3.f};
-    point3 lookat = {0.f, 0.f, 0.f};
-    vec3f vup = {0.f, 1.f, 0.f};
-    float dist_to_focus = 10.f;
-    float aperture = .1f;
     camera_init(
         &cam,
-        lookfrom, lookat, vup,
-        20.0f, aspect_ratio,
-        aperture, dist_to_focus
+        settings.lookfrom, settings.lookat, settings.vup,
+        settings.vfov, aspect_ratio,
+        settings.aperture, settings.focus_dist
     );
+    primary_cache primary = {0};
+    if (primary_strata > 0 && settings.aperture > 0.0f) {
+        fprintf(stderr, "-primary-cache needs a pinhole camera (aperture 0), ignored\n");
+        primary_strata = 0;
+    }
+    if (primary_strata > 0) {
+        if (!primary_cache_init(&primary, width, height, primary_strata)) {
+            fprintf(stderr, "not enough memory for a %dx%d primary-hit cache\n", primary_strata, primary_strata);
+            return(1);
+        }
+        ctx.primary = &primary;
+    }
 
     //
-    // -- render
-    printf("P3\n%d %d\n255\n", width, height);
+    // -- feature buffers, the denoiser needs albedo/normal/depth
+    unsigned aov_layers = (aov_path ? AOV_ALL : 0) | (denoise ? (AOV_ALBEDO | AOV_NORMAL | AOV_DEPTH) : 0);
+    aov_buffers aovs = {0};
+    if (aov_layers)
+        aov_alloc(&aovs, width, height, aov_layers);
 
-    int j;
-    int k = 0;
-    color * pixel_colors = calloc(samples_per_pixel, sizeof(color));
-    for (j = height - 1; j >= 0; --j) {
-        fprintf(stderr, "\nScanlines remaining: %d\n", j);
-        //fflush(stdout); // Will now print everything in the stdout buffer
-        for (int i = 0; i < width; ++i) {
-            fprintf(stderr, "\r\t\t%d", i);
-            ZeroMemory(pixel_colors, samples_per_pixel * sizeof(color));
-            int s;
-
-#pragma omp parallel    
-            {
-#pragma omp for
+    //
+    // -- accumulation state
+    // everything that changes the image goes into the key, so a checkpoint is
+    // never resumed into a different scene
+    film fb;
+    tile_grid grid;
+    tile_grid_init(&grid, width, height, 32, 2021);
+    topology * topo = NULL;
+    static numa_scene placed;           /* large */
+    render_context node_ctxs[topology_max_nodes];
+    numa_tile_queue queue;
+    if (numa && linear) {
+        fprintf(stderr, "-numa places the bvh, ignored with -linear\n");
+        numa = false;
+    }
+    if (numa) {
+        span = trace_begin("numa placement");
+        topo = malloc(sizeof(topology));
+        topology_init(topo, omp_get_num_procs());
+        numa_tile_queue_init(&queue, &grid, topo->node_count);
+        if (!numa_scene_place(&placed, topo, &g_world, &accel, numa_default_replicate_limit) ||
+            !numa_film_alloc(&fb, topo, &grid, &queue, width, height)) {
+            fprintf(stderr, "out of memory\n");
+            return(1);
+        }
+        for (int c = 0; c < placed.copies; ++c) {
+            node_ctxs[c] = ctx;
+            node_ctxs[c].world = &placed.worlds[c];
+            node_ctxs[c].accel = &placed.accels[c];
+        }
+        trace_end(&span);
+        fprintf(stderr, "numa: %d nodes, scene %s\n", topo->node_count, placed.replicated ? "replicated" : "interleaved");
+    } else {
+        film_alloc(&fb, width, height);
+    }
+    uint64_t scene_key = hash_seed;
+    scene_key = hash_bytes(scene_key, &width, sizeof(width));
+    scene_key = hash_bytes(scene_key, &max_depth, sizeof(max_depth));
+    scene_key = hash_bytes(scene_key, &sky_scale, sizeof(sky_scale));
+    scene_key = hash_bytes(scene_key, &cam, sizeof(cam));
+    scene_key = scene_content_hash(&g_world, scene_key);
+    scene_key = hash_bytes(scene_key, &mesh_key, sizeof(mesh_key));
+    scene_key = hash_bytes(scene_key, &instance_count, sizeof(instance_count));
+    scene_key = hash_bytes(scene_key, &primary_strata, sizeof(primary_strata));     /* moves the samples */
+    if (resume_path) {
+        if (checkpoint_read(resume_path, scene_key, &fb, &grid, &aovs)) {
+            fprintf(stderr, "resumed from %s\n", resume_path);
+        } else {
+            fprintf(stderr, "%s is not a checkpoint of this scene/options\n", resume_path);
+            return(1);
+        }
+    }
 
-                for (s = 0; s < samples_per_pixel; ++s) {
-                    float u = (float)(i + random_float()) / (width - 1);
-                    float v = (float)(j + +random_float()) / (height - 1);
-                    ray r = camera_cast_ray(&cam, u, v);
-                    pixel_colors[s] = ray_color(r, g_world, max_depth);
-                }
+    //
+    // -- render
+    // NOTE: tiles are distributed over threads (instead of the samples of one pixel)
+    // so there is no fork/join per pixel. a pass adds pass_spp samples to every tile;
+    // once the budget is spent the remaining tiles of the pass are skipped (but for
+    // ones without samples yet), which leaves every tile with a consistent (if lower)
+    // sample count and none black
+    double render_start = omp_get_wtime();
+    double last_checkpoint = render_start;
+    bool out_of_time = false;
+    int * order = malloc(grid.tile_count * sizeof(int));
+    tile_pass tiles;
+    tile_pass_init(&tiles, samples_per_pixel, pass_spp);
+    tiles.order = order;
+    tiles.update_error = true;
+    tiles.threshold = threshold;
+    tiles.min_spp = min_spp;
+    tiles.deadline = budget_seconds > 0.0 ? render_start + budget_seconds : 0.0;
+    tiles.progress = true;
+    trace_scope render_span = trace_begin("render");
+    for (int pass = 0;; ++pass) {
+        // -- converged tiles drop out, so the threads only work on the noisy ones
+        tiles.count = tile_grid_active(&grid, samples_per_pixel, order);
+        if (0 == tiles.count || out_of_time)
+            break;
+        trace_scope pass_span = trace_begin_arg("pass", pass);
+        tiles.done = 0;
+        if (numa) {
+            numa_tile_queue_reset(&queue, &grid);
+#pragma omp parallel
+            {
+                int me = omp_get_thread_num();
+                int node = topology_pin_node(topo, PIN_NUMA, me, omp_get_num_threads());
+                topology_pin(topo, PIN_NUMA, me, omp_get_num_threads());
+                render_context * node_ctx = &node_ctxs[numa_scene_copy(&placed, node)];
+                for (int ti = numa_tile_queue_next(&queue, node); ti >= 0; ti = numa_tile_queue_next(&queue, node))
+                    render_pass_tile(node_ctx, &cam, &fb, &aovs, &grid, &tiles, ti);
+                topology_pin(topo, PIN_NONE, 0, 1);
+            }
+        } else {
+#pragma omp parallel
+            render_tiles_pass(&ctx, &cam, &fb, &aovs, &grid, &tiles);
+        }
+        out_of_time = (tiles.deadline > 0.0 && omp_get_wtime() > tiles.deadline);
+        trace_end(&pass_span);
+        if (checkpoint_path && omp_get_wtime() - last_checkpoint > checkpoint_every) {
+            span = trace_begin("checkpoint");
+            if (!checkpoint_write(checkpoint_path, scene_key, &fb, &grid, &aovs))
+                fprintf(stderr, "\ncould not write %s\n", checkpoint_path);
+            trace_end(&span);
+            last_checkpoint = omp_get_wtime();
+        }
+    }
+    trace_end(&render_span);
+    free(order);
+    double render_seconds = omp_get_wtime() - render_start;
+    int spp_lo = samples_per_pixel;
+    int spp_hi = 0;
+    int converged = 0;
+    double spp_total = 0.0;
+    for (int ti = 0; ti < grid.tile_count; ++ti) {
+        tile * t = &grid.tiles[ti];
+        if (t->spp < spp_lo)
+            spp_lo = t->spp;
+        if (t->spp > spp_hi)
+            spp_hi = t->spp;
+        converged += t->converged;
+        spp_total += (double)t->spp * (t->x1 - t->x0) * (t->y1 - t->y0);
+    }
+    fprintf(stderr, "\nrender: %.2fs (%d spp%s, %d..%d per pixel, %.1f average, %d/%d tiles converged)\n",
+        render_seconds, samples_per_pixel, out_of_time ? ", out of time" : "",
+        spp_lo, spp_hi, spp_total / pixel_count, converged, grid.tile_count);
+    if (ctx.primary) {
+        // -- every camera sample but the traced ones started from a stored hit
+        //    (a resumed run counts only what it traced itself against all samples)
+        int64_t traced = primary_cache_traced(&primary);
+        fprintf(stderr, "primary-hit cache: %lld camera rays traced for %.0f samples, %.1f%% of primary traversals saved\n",
+            (long long)traced, spp_total, 100.0 * (1.0 - traced / spp_total));
+    }
+    if (ray_stats_enabled()) {
+        ray_stats stats;
+        ray_stats_merge(&stats);
+        ray_stats_report(&stats, stderr);
+        FILE * csv = stats_path ? fopen(stats_path, "w") : NULL;
+        if (csv) {
+            ray_stats_write_csv(&stats, csv);
+            fclose(csv);
+        } else if (stats_path) {
+            fprintf(stderr, "could not write %s\n", stats_path);
+        }
+    } else if (stats_path) {
+        fprintf(stderr, "-stats needs a build with RAY_STATS defined\n");
+    }
+    if (report_path) {
+        FILE * report = fopen(report_path, "w");
+        if (report) {
+            tile_grid_report(&grid, report);
+            fclose(report);
+        } else {
+            fprintf(stderr, "could not write %s\n", report_path);
+        }
+    }
+    if (checkpoint_path && !checkpoint_write(checkpoint_path, scene_key, &fb, &grid, &aovs))
+        fprintf(stderr, "could not write %s\n", checkpoint_path);
 
-            }   // end omp parallel
+    float * lum_var = denoise ? malloc(pixel_count * sizeof(float)) : NULL;
+    span = trace_begin("resolve");
+    film_resolve(&fb, &grid, beauty, lum_var, &aovs);
+    trace_end(&span);
 
-            color px = {0};
-            for (s = 0; s < samples_per_pixel; ++s)
-                px = vec3_add(px, pixel_colors[s]);
+    //
+    // -- denoise
+    color * noisy = NULL;
+    if (denoise) {
+        double denoise_start = omp_get_wtime();
+        span = trace_begin("denoise");
+        noisy = malloc(pixel_count * sizeof(color));
+        if (noisy)
+            memcpy(noisy, beauty, pixel_count * sizeof(color));
+        denoise_guides guides = {
+            .albedo = {aovs.albedo[0], aovs.albedo[1], aovs.albedo[2]},
+            .normal = {aovs.normal[0], aovs.normal[1], aovs.normal[2]},
+            .depth = aovs.depth
+        };
+        denoise_params params;
+        denoise_params_default(&params);
+        bool denoised = denoise_beauty(width, height, beauty, lum_var, &guides, &params);
+        trace_end(&span);
+        if (denoised) {
+            fprintf(stderr, "denoise: %.2f ms (%d iterations, %d threads)\n", 1000.0 * (omp_get_wtime() - denoise_start), params.iterations, omp_get_max_threads());
+        } else {
+            fprintf(stderr, "could not denoise (out of memory), the image is written as rendered\n");
+            free(noisy);
+            noisy = NULL;
+        }
+    }
 
-            write_color(&image_colors[k], px, samples_per_pixel);
-            k += 3;
+    //
+    // -- error against the reference
+    if (ref_path) {
+        image ref = {0};
+        if (image_read_pfm(ref_path, &ref) && ref.width == width && ref.height == height) {
+            if (noisy)
+                fprintf(stderr, "noisy:    rmse %.6f relmse %.6f\n", image_rmse(noisy, ref.pixels, pixel_count), image_relmse(noisy, ref.pixels, pixel_count));
+            fprintf(stderr, "%s rmse %.6f relmse %.6f\n", noisy ? "denoised:" : "image:   ", image_rmse(beauty, ref.pixels, pixel_count), image_relmse(beauty, ref.pixels, pixel_count));
+        } else {
+            fprintf(stderr, "could not read a %dx%d reference from %s\n", width, height, ref_path);
         }
+        image_free(&ref);
     }
+    span = trace_begin("image write");
+    if (pfm_path)
+        image_write_pfm(pfm_path, width, height, beauty);
+    if (aov_path && !aov_write_exr(&aovs, aov_path, beauty))
+        fprintf(stderr, "could not write %s\n", aov_path);
 
     //
     // -- output results
-    k = 0;
-    for (j = height - 1; j >= 0; --j) {
-        fprintf(stderr, "\nScanlines remaining: %d", j);
-        //fflush(stdout); // Will now print everything in the stdout buffer
-        for (int i = 0; i < width; ++i) {
-            printf("%d %d %d\n", image_colors[k], image_colors[k + 1], image_colors[k + 2]);
-            k += 3;
-        }
+    printf("P3\n%d %d\n255\n", width, height);
+    for (int k = 0; k < pixel_count; ++k) {
+        write_color(&image_colors[3 * k], beauty[k], 1);
+        printf("%d %d %d\n", image_colors[3 * k], image_colors[3 * k + 1], image_colors[3 * k + 2]);
     }
+    fflush(stdout);
+    trace_end(&span);
 
     return(0);
 }
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "vec3.h"
+#include "image.h"
+
+//
+// arbitrary output variables (AOVs)
+// per-pixel feature buffers captured at the primary hit, stored as SoA planes.
+// only the layers selected by flags are allocated and written.
+typedef enum {
+    AOV_ALBEDO = 1 << 0,
+    AOV_NORMAL = 1 << 1,
+    AOV_DEPTH = 1 << 2,
+    AOV_MATERIAL_ID = 1 << 3,
+    AOV_OBJECT_ID = 1 << 4,
+    AOV_ALL = 0x1f,
+} aov_flags;
+
+/* what one camera sample saw at its first hit, filled by ray_color_aov */
+typedef struct {
+    bool hit;
+    color albedo;       /* attenuation of the first scatter (clamped emission for lights) */
+    vec3f normal;       /* shading normal, facing the ray */
+    point3 p;
+    int material_id;
+    int object_id;
+} aov_sample;
+
+typedef struct {
+    int width;
+    int height;
+    unsigned flags;
+    float * albedo[3];      /* mean over the pixel's samples */
+    float * normal[3];      /* mean, renormalized; 0 for background */
+    float * depth;          /* mean linear (view axis) depth; 0 for background */
+    int32_t * material_id;  /* from the first sample; -1 for background */
+    int32_t * object_id;
+} aov_buffers;
+
+inline bool
+aov_alloc (aov_buffers * me, int width, int height, unsigned flags) {
+    aov_buffers zero = {0};
+    *me = zero;
+    me->width = width;
+    me->height = height;
+    me->flags = flags;
+    size_t count = (size_t)width * height;
+    bool ok = true;
+    for (int c = 0; c < 3; ++c) {
+        if (flags & AOV_ALBEDO)
+            ok &= (NULL != (me->albedo[c] = calloc(count, sizeof(float))));
+        if (flags & AOV_NORMAL)
+            ok &= (NULL != (me->normal[c] = calloc(count, sizeof(float))));
+    }
+    if (flags & AOV_DEPTH)
+        ok &= (NULL != (me->depth = calloc(count, sizeof(float))));
+    if (flags & AOV_MATERIAL_ID)
+        ok &= (NULL != (me->material_id = malloc(count * sizeof(int32_t))));
+    if (flags & AOV_OBJECT_ID)
+        ok &= (NULL != (me->object_id = malloc(count * sizeof(int32_t))));
+    return ok;
+}
+inline void
+aov_free (aov_buffers * me) {
+    for (int c = 0; c < 3; ++c) {
+        free(me->albedo[c]);
+        free(me->normal[c]);
+    }
+    free(me->depth);
+    free(me->material_id);
+    free(me->object_id);
+    aov_buffers zero = {0};
+    *me = zero;
+}
+//
+// accumulates sample s of pixel k; eye/forward define the linear depth axis
+inline void
+aov_add_sample (aov_buffers * me, int k, int s, aov_sample const * smp, point3 eye, vec3f forward) {
+    if (me->albedo[0])
+        for (int c = 0; c < 3; ++c)
+            me->albedo[c][k] += smp->hit ? smp->albedo.E[c] : 1.0f;
+    if (smp->hit) {
+        if (me->normal[0])
+            for (int c = 0; c < 3; ++c)
+                me->normal[c][k] += smp->normal.E[c];
+        if (me->depth)
+            me->depth[k] += vec3_mul_dot(vec3_sub(smp->p, eye), forward);
+    }
+    if (0 == s) {
+        if (me->material_id)
+            me->material_id[k] = smp->hit ? smp->material_id : -1;
+        if (me->object_id)
+            me->object_id[k] = smp->hit ? smp->object_id : -1;
+    }
+}
+/* turns the sums of pixel k into means */
+inline void
+aov_resolve_pixel (aov_buffers * me, int k, float inv_spp) {
+    if (me->albedo[0])
+        for (int c = 0; c < 3; ++c)
+            me->albedo[c][k] *= inv_spp;
+    if (me->normal[0]) {
+        float len2 = 0.0f;
+        for (int c = 0; c < 3; ++c)
+            len2 += me->normal[c][k] * me->normal[c][k];
+        if (len2 > 0.0f)
+            for (int c = 0; c < 3; ++c)
+                me->normal[c][k] /= sqrtf(len2);
+    }
+    if (me->depth)
+        me->depth[k] *= inv_spp;
+}
+inline void
+aov_resolve (aov_buffers * me, int samples_per_pixel) {
+    int count = me->width * me->height;
+    for (int k = 0; k < count; ++k)
+        aov_resolve_pixel(me, k, 1.0f / samples_per_pixel);
+}
+//
+// writes beauty + every allocated layer into one multi-layer EXR
+inline bool
+aov_write_exr (aov_buffers * me, char const * path, color const * beauty) {
+    exr_channel channels[12];
+    int n = 0;
+    char const * rgb[3] = {"R", "G", "B"};
+    char const * albedo[3] = {"albedo.R", "albedo.G", "albedo.B"};
+    char const * normal[3] = {"N.X", "N.Y", "N.Z"};
+    for (int c = 0; c < 3; ++c)
+        channels[n++] = (exr_channel) {rgb[c], EXR_FLOAT, beauty[0].E + c, 3};
+    if (me->albedo[0])
+        for (int c = 0; c < 3; ++c)
+            channels[n++] = (exr_channel) {albedo[c], EXR_FLOAT, me->albedo[c], 1};
+    if (me->normal[0])
+        for (int c = 0; c < 3; ++c)
+            channels[n++] = (exr_channel) {normal[c], EXR_FLOAT, me->normal[c], 1};
+    if (me->depth)
+        channels[n++] = (exr_channel) {"Z", EXR_FLOAT, me->depth, 1};
+    if (me->material_id)
+        channels[n++] = (exr_channel) {"id.material", EXR_UINT, me->material_id, 1};
+    if (me->object_id)
+        channels[n++] = (exr_channel) {"id.object", EXR_UINT, me->object_id, 1};
+    return image_write_exr(path, me->width, me->height, channels, n);
+}
@@ -0,0 +1,454 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "scene.h"
+
+//
+// bounding volume hierarchy over the scene's primitives
+// binned SAH build, flattened depth-first: the first child of an interior node is
+// the next node, the second child is at offset. nodes only hold plain numbers, so
+// the arrays can be written to disk and used straight from a mapped file.
+// ref: Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies" (2007)
+
+typedef struct {
+    vec3f bmin;
+    int32_t offset;     /* leaf: first entry of prim_index, interior: index of the second child */
+    vec3f bmax;
+    int32_t count;      /* leaf: number of primitives, interior: 0 */
+} bvh_node;             /* 32 bytes, two per cache line */
+
+typedef struct {
+    int node_count;
+    bvh_node * nodes;
+    int prim_count;
+    int32_t * prim_index;   /* leaves reference primitives through this */
+    int depth;              /* levels, the root alone is 1; at most bvh_max_depth */
+    bool borrowed;          /* arrays live in memory the bvh does not own (a mapped cache) */
+} bvh;
+
+/* build input: bounds and centroid of one primitive */
+typedef struct {
+    vec3f bmin;
+    vec3f bmax;
+    vec3f centroid;
+    int32_t index;      /* filled by bvh_build */
+} bvh_prim;
+
+#define bvh_bins 16
+#define bvh_max_leaf_size 8
+#define bvh_traversal_cost 1.0f     /* relative to one primitive test */
+#define bvh_stack_size 64
+/* the traversal stacks hold one entry per level at most (bvh_scene_occluded one more at
+   the deepest), so the builders cut the tree here: a node this deep is a leaf however
+   many primitives it has, and a push can never overflow */
+#define bvh_max_depth bvh_stack_size
+
+inline float
+aabb_surface_area (vec3f bmin, vec3f bmax) {
+    vec3f d = vec3_sub(bmax, bmin);
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+//
+// best binned SAH object split of prims[first, first+count) over all three centroid axes
+typedef struct {
+    float cost;         /* INFINITY if there is no split */
+    int axis;           /* -1 if there is no split */
+    int split;          /* first bin of the right side */
+    int bins;
+    vec3f left_min, left_max;
+    vec3f right_min, right_max;
+} bvh_split;
+
+inline bvh_split
+bvh_find_object_split (bvh_prim const * prims, int first, int count, vec3f cmin, vec3f cmax, float parent_area) {
+    bvh_split best = {INFINITY, -1, -1, 0};
+    vec3f extent = vec3_sub(cmax, cmin);
+    /* small nodes get fewer bins, past the top levels setting up and sweeping the bins
+       is what the build spends its time on */
+    int bins = count < bvh_bins ? count : bvh_bins;
+    best.bins = bins;
+    if (count < 2)
+        return best;
+    // -- bin all three axes in one sweep over the primitives
+    vec3f bin_min[3][bvh_bins], bin_max[3][bvh_bins];
+    int bin_count[3][bvh_bins] = {{0}};
+    float scale[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        scale[axis] = extent.E[axis] > 0.0f ? bins / extent.E[axis] : 0.0f;
+        for (int b = 0; b < bins; ++b) {
+            bin_min[axis][b] = (vec3f) {INFINITY, INFINITY, INFINITY};
+            bin_max[axis][b] = (vec3f) {-INFINITY, -INFINITY, -INFINITY};
+        }
+    }
+    for (int i = first; i < first + count; ++i) {
+        bvh_prim const * p = &prims[i];
+        for (int axis = 0; axis < 3; ++axis) {
+            int b = (int)((p->centroid.E[axis] - cmin.E[axis]) * scale[axis]);
+            b = b < bins ? b : bins - 1;
+            bin_min[axis][b] = vec3_min(bin_min[axis][b], p->bmin);
+            bin_max[axis][b] = vec3_max(bin_max[axis][b], p->bmax);
+            ++bin_count[axis][b];
+        }
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent.E[axis] <= 0.0f)
+            continue;
+        // -- sweep from the right to get suffix bounds, then from the left
+        vec3f right_min[bvh_bins], right_max[bvh_bins];
+        int right_count[bvh_bins];
+        vec3f rmin = {INFINITY, INFINITY, INFINITY}, rmax = {-INFINITY, -INFINITY, -INFINITY};
+        int rc = 0;
+        for (int b = bins - 1; b > 0; --b) {
+            rmin = vec3_min(rmin, bin_min[axis][b]);
+            rmax = vec3_max(rmax, bin_max[axis][b]);
+            rc += bin_count[axis][b];
+            right_min[b] = rmin;
+            right_max[b] = rmax;
+            right_count[b] = rc;
+        }
+        vec3f lmin = {INFINITY, INFINITY, INFINITY}, lmax = {-INFINITY, -INFINITY, -INFINITY};
+        int lc = 0;
+        for (int s = 1; s < bins; ++s) {
+            lmin = vec3_min(lmin, bin_min[axis][s - 1]);
+            lmax = vec3_max(lmax, bin_max[axis][s - 1]);
+            lc += bin_count[axis][s - 1];
+            if (0 == lc || 0 == right_count[s])
+                continue;
+            float cost = bvh_traversal_cost +
+                (lc * aabb_surface_area(lmin, lmax) + right_count[s] * aabb_surface_area(right_min[s], right_max[s])) / parent_area;
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.split = s;
+                best.left_min = lmin;
+                best.left_max = lmax;
+                best.right_min = right_min[s];
+                best.right_max = right_max[s];
+            }
+        }
+    }
+    return best;
+}
+/* partitions in place by the split's bins, returns the first primitive of the right side */
+inline int
+bvh_partition_object (bvh_prim * prims, int first, int count, bvh_split const * split, vec3f cmin, vec3f cmax) {
+    int axis = split->axis;
+    float scale = split->bins / (cmax.E[axis] - cmin.E[axis]);
+    int i = first, j = first + count - 1;
+    while (i <= j) {
+        int b = (int)((prims[i].centroid.E[axis] - cmin.E[axis]) * scale);
+        b = b < split->bins ? b : split->bins - 1;
+        if (b < split->split) {
+            ++i;
+        } else {
+            bvh_prim tmp = prims[i];
+            prims[i] = prims[j];
+            prims[j] = tmp;
+            --j;
+        }
+    }
+    return i;
+}
+//
+// recursive build over prims[first, first+count), the node on level depth.
+// the primitives themselves are partitioned (not an index list) so every level
+// streams through memory instead of gathering
+inline int
+bvh_build_recursive (bvh * me, bvh_prim * prims, int first, int count, int depth) {
+    int node_index = me->node_count++;
+    me->depth = depth > me->depth ? depth : me->depth;
+    bvh_node * node = &me->nodes[node_index];
+    vec3f bmin = prims[first].bmin, bmax = prims[first].bmax;
+    vec3f cmin = prims[first].centroid, cmax = cmin;
+    for (int i = first + 1; i < first + count; ++i) {
+        bvh_prim const * p = &prims[i];
+        bmin = vec3_min(bmin, p->bmin);
+        bmax = vec3_max(bmax, p->bmax);
+        cmin = vec3_min(cmin, p->centroid);
+        cmax = vec3_max(cmax, p->centroid);
+    }
+    node->bmin = bmin;
+    node->bmax = bmax;
+
+    // -- leaf cost is one test per primitive
+    float leaf_cost = (float)count;
+    bvh_split split = bvh_find_object_split(prims, first, count, cmin, cmax, aabb_surface_area(bmin, bmax));
+    int mid = -1;
+    if (split.axis >= 0 && (split.cost < leaf_cost || count > bvh_max_leaf_size))
+        mid = bvh_partition_object(prims, first, count, &split, cmin, cmax);
+    else if (count > bvh_max_leaf_size)
+        mid = first + count / 2;    /* coincident centroids, split the list in half */
+    if (mid < 0 || depth == bvh_max_depth) {
+        node->offset = first;
+        node->count = count;
+        return node_index;
+    }
+    bvh_build_recursive(me, prims, first, mid - first, depth + 1);
+    int second = bvh_build_recursive(me, prims, mid, first + count - mid, depth + 1);
+    node->offset = second;
+    node->count = 0;
+    return node_index;
+}
+/* prims are reordered */
+inline bool
+bvh_build (bvh * me, bvh_prim * prims, int count) {
+    bvh zero = {0};
+    *me = zero;
+    if (count <= 0)
+        return true;
+    me->prim_count = count;
+    me->prim_index = malloc(count * sizeof(int32_t));
+    me->nodes = malloc((2 * (size_t)count - 1) * sizeof(bvh_node));
+    if (NULL == me->prim_index || NULL == me->nodes)
+        return false;
+    for (int i = 0; i < count; ++i)
+        prims[i].index = i;
+    bvh_build_recursive(me, prims, 0, count, 1);
+    for (int i = 0; i < count; ++i)
+        me->prim_index[i] = prims[i].index;
+    return true;
+}
+inline void
+bvh_free (bvh * me) {
+    if (!me->borrowed) {
+        free(me->nodes);
+        free(me->prim_index);
+    }
+    bvh zero = {0};
+    *me = zero;
+}
+inline void
+bvh_sphere_prims (scene * world, bvh_prim * out_prims) {
+    for (int i = 0; i < world->sphere_count; ++i) {
+        float r = fabsf(world->radius[i]);     /* negative radius = hollow glass */
+        vec3f ext = {r, r, r};
+        out_prims[i].centroid = scene_sphere_center(world, i);
+        out_prims[i].bmin = vec3_sub(out_prims[i].centroid, ext);
+        out_prims[i].bmax = vec3_add(out_prims[i].centroid, ext);
+    }
+}
+inline bool
+bvh_build_spheres (bvh * me, scene * world) {
+    bvh_prim * prims = malloc((world->sphere_count + 1) * sizeof(bvh_prim));
+    if (NULL == prims)
+        return false;
+    bvh_sphere_prims(world, prims);
+    bool ret = bvh_build(me, prims, world->sphere_count);
+    free(prims);
+    return ret;
+}
+//
+// refit: new bounds for moved or resized primitives, same tree.
+// prims is indexed by primitive (not in build order), only the bounds are read.
+// children always come after their parent in the flattened layout, so one backwards
+// sweep updates every node after the nodes it depends on
+inline bool
+bvh_refit (bvh * me, bvh_prim const * prims) {
+    if (me->borrowed)
+        return false;   /* mapped read-only */
+    for (int n = me->node_count - 1; n >= 0; --n) {
+        bvh_node * node = &me->nodes[n];
+        vec3f bmin, bmax;
+        if (node->count) {
+            bmin = prims[me->prim_index[node->offset]].bmin;
+            bmax = prims[me->prim_index[node->offset]].bmax;
+            for (int k = node->offset + 1; k < node->offset + node->count; ++k) {
+                bmin = vec3_min(bmin, prims[me->prim_index[k]].bmin);
+                bmax = vec3_max(bmax, prims[me->prim_index[k]].bmax);
+            }
+        } else {
+            bmin = vec3_min(me->nodes[n + 1].bmin, me->nodes[node->offset].bmin);
+            bmax = vec3_max(me->nodes[n + 1].bmax, me->nodes[node->offset].bmax);
+        }
+        node->bmin = bmin;
+        node->bmax = bmax;
+    }
+    return true;
+}
+inline bool
+bvh_refit_spheres (bvh * me, scene * world) {
+    bvh_prim * prims = malloc((world->sphere_count + 1) * sizeof(bvh_prim));
+    if (NULL == prims)
+        return false;
+    bvh_sphere_prims(world, prims);
+    bool ret = bvh_refit(me, prims);
+    free(prims);
+    return ret;
+}
+//
+// expected cost of a ray through the tree relative to one primitive test
+// (surface area heuristic with the root's area as the reference)
+inline float
+bvh_sah_cost (bvh const * me) {
+    if (0 == me->node_count)
+        return 0.0f;
+    double root = aabb_surface_area(me->nodes[0].bmin, me->nodes[0].bmax);
+    double cost = 0.0;
+    for (int i = 0; i < me->node_count; ++i) {
+        bvh_node const * n = &me->nodes[i];
+        cost += aabb_surface_area(n->bmin, n->bmax) * (n->count ? n->count : bvh_traversal_cost);
+    }
+    return root > 0.0 ? (float)(cost / root) : 0.0f;
+}
+//
+// refit quality monitor: refitting keeps the topology of the last build, which gets
+// worse as primitives move away from where they were grouped. the whole-tree sah cost
+// is a poor alarm, it is dominated by the few nodes above a huge primitive (the ground
+// sphere) and hardly moves when everything else scatters. instead every node's surface
+// area (its term in the sah) is compared with its area right after the last build, and
+// the mean growth over all nodes is the cost. once it passes 1 + threshold, rebuild
+typedef struct {
+    float threshold;        /* relative growth, e.g. 0.25 */
+    int node_count;
+    float * built_area;     /* per node, at the last build */
+} bvh_quality;
+
+inline float
+bvh_quality_cost (bvh_quality const * me, bvh const * accel) {
+    if (accel->node_count != me->node_count)
+        return INFINITY;    /* a different tree */
+    double sum = 0.0;
+    int counted = 0;
+    for (int i = 0; i < accel->node_count; ++i) {
+        if (me->built_area[i] <= 0.0f)
+            continue;
+        sum += aabb_surface_area(accel->nodes[i].bmin, accel->nodes[i].bmax) / me->built_area[i];
+        ++counted;
+    }
+    return counted ? (float)(sum / counted) : 1.0f;
+}
+inline bool
+bvh_quality_reset (bvh_quality * me, bvh const * accel) {
+    if (accel->node_count != me->node_count) {
+        free(me->built_area);
+        me->built_area = malloc((accel->node_count + 1) * sizeof(float));
+        if (NULL == me->built_area) {
+            me->node_count = 0;
+            return false;
+        }
+        me->node_count = accel->node_count;
+    }
+    for (int i = 0; i < accel->node_count; ++i)
+        me->built_area[i] = aabb_surface_area(accel->nodes[i].bmin, accel->nodes[i].bmax);
+    return true;
+}
+inline bool
+bvh_quality_degraded (bvh_quality const * me, float cost) {
+    return cost > 1.0f + me->threshold;
+}
+inline void
+bvh_quality_free (bvh_quality * me) {
+    free(me->built_area);
+    me->built_area = NULL;
+    me->node_count = 0;
+}
+//
+// traversal
+// slab test against a node, returns the entry distance or INFINITY for a miss
+inline float
+bvh_node_enter (bvh_node const * n, vec3f org, vec3f inv_dir, float tmin, float tmax) {
+    for (int a = 0; a < 3; ++a) {
+        float t0 = (n->bmin.E[a] - org.E[a]) * inv_dir.E[a];
+        float t1 = (n->bmax.E[a] - org.E[a]) * inv_dir.E[a];
+        if (t0 > t1) {
+            float t = t0; t0 = t1; t1 = t;
+        }
+        tmin = t0 > tmin ? t0 : tmin;
+        tmax = t1 < tmax ? t1 : tmax;
+    }
+    return (tmin <= tmax) ? tmin : INFINITY;
+}
+typedef struct {
+    int node;
+    float t;
+} bvh_stack_entry;
+
+//
+// closest hit among the scene's spheres; the near child is visited first and
+// pushed subtrees are dropped once something closer than their entry was found
+inline bool
+bvh_scene_hit (bvh * me, scene * world, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    if (0 == me->node_count)
+        return false;
+    float a = vec3_len_squared(r->dir);
+    vec3f inv_dir = {1.0f / r->dir.x, 1.0f / r->dir.y, 1.0f / r->dir.z};
+    float closest_so_far = tmax;
+    int closest = -1;
+    bvh_stack_entry stack[bvh_stack_size];
+    int sp = 0;
+    int node = 0;
+    if (bvh_node_enter(&me->nodes[0], r->origin, inv_dir, tmin, tmax) == INFINITY)
+        return false;
+    for (;;) {
+        bvh_node const * n = &me->nodes[node];
+        RAY_STAT_ADD(bvh_nodes, 1);
+        if (n->count) {
+            RAY_STAT_ADD(sphere_tests, n->count);
+            for (int k = n->offset; k < n->offset + n->count; ++k) {
+                int i = me->prim_index[k];
+                float t = scene_sphere_intersect(world, i, r, a, tmin, closest_so_far);
+                if (t < closest_so_far) {
+                    closest_so_far = t;
+                    closest = i;
+                }
+            }
+        } else {
+            int c0 = node + 1, c1 = n->offset;
+            float t0 = bvh_node_enter(&me->nodes[c0], r->origin, inv_dir, tmin, closest_so_far);
+            float t1 = bvh_node_enter(&me->nodes[c1], r->origin, inv_dir, tmin, closest_so_far);
+            if (t1 < t0) {
+                int ci = c0; c0 = c1; c1 = ci;
+                float tt = t0; t0 = t1; t1 = tt;
+            }
+            if (t0 != INFINITY) {
+                if (t1 != INFINITY)
+                    stack[sp++] = (bvh_stack_entry) {c1, t1};
+                node = c0;
+                continue;
+            }
+        }
+        // -- pop the next subtree that can still hold a closer hit
+        while (sp > 0 && stack[sp - 1].t > closest_so_far)
+            --sp;
+        if (0 == sp)
+            break;
+        node = stack[--sp].node;
+    }
+    if (closest >= 0)
+        scene_fill_record(world, closest, r, closest_so_far, out_rec);
+    return (closest >= 0);
+}
+/* any-hit query for shadow rays, no ordering needed */
+inline bool
+bvh_scene_occluded (bvh * me, scene * world, ray * r, float tmin, float tmax) {
+    if (0 == me->node_count)
+        return false;
+    float a = vec3_len_squared(r->dir);
+    vec3f inv_dir = {1.0f / r->dir.x, 1.0f / r->dir.y, 1.0f / r->dir.z};
+    int stack[bvh_stack_size];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        bvh_node const * n = &me->nodes[stack[--sp]];
+        RAY_STAT_ADD(bvh_nodes, 1);
+        if (bvh_node_enter(n, r->origin, inv_dir, tmin, tmax) == INFINITY)
+            continue;
+        if (n->count) {
+            for (int k = n->offset; k < n->offset + n->count; ++k) {
+                if (scene_sphere_intersect(world, me->prim_index[k], r, a, tmin, tmax) < tmax) {
+                    RAY_STAT_ADD(sphere_tests, k - n->offset + 1);
+                    return true;
+                }
+            }
+            RAY_STAT_ADD(sphere_tests, n->count);
+        } else {
+            stack[sp++] = n->offset;
+            stack[sp++] = (int)(n - me->nodes) + 1;
+        }
+    }
+    return false;
+}
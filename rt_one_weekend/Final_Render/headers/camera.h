@@ -1,8 +1,71 @@
 #pragma once
 
+#include <stdint.h>
 #include "vec3.h"
 #include "ray.h"
 
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CAMERA_SSE 1
+#endif
+
+//
+// lens samples for camera_cast_rays
+// a (0,2)-sequence (the base 2 radical inverse against Sobol's second dimension), put
+// on the unit disk with the concentric map. every aligned run of 2^m points is
+// stratified in both axes, so the samples of a pixel, taken at (sample ^ scramble),
+// stay stratified for any power of two count, while the per-pixel scramble gives
+// neighbouring pixels different runs
+#define camera_lens_table_bits 12
+#define camera_lens_table_size (1 << camera_lens_table_bits)
+
+typedef struct {
+    float x[camera_lens_table_size];
+    float y[camera_lens_table_size];
+} camera_lens_samples;
+
+inline camera_lens_samples const *
+camera_lens_table (void) {
+    static camera_lens_samples table;
+    static bool ready = false;
+    if (ready)
+        return &table;
+    uint32_t sobol[32];
+    sobol[0] = 1u << 31;
+    for (int b = 1; b < 32; ++b)
+        sobol[b] = sobol[b - 1] ^ (sobol[b - 1] >> 1);
+    for (uint32_t i = 0; i < camera_lens_table_size; ++i) {
+        uint32_t rx = 0, ry = 0;
+        for (int b = 0; b < camera_lens_table_bits; ++b) {
+            if (i & (1u << b)) {
+                rx |= (1u << 31) >> b;
+                ry ^= sobol[b];
+            }
+        }
+        // -- cell centers, mapped from the square onto the disk (Shirley and Chiu)
+        float a = 2.0f * ((rx >> (32 - camera_lens_table_bits)) + 0.5f) / camera_lens_table_size - 1.0f;
+        float b = 2.0f * ((ry >> (32 - camera_lens_table_bits)) + 0.5f) / camera_lens_table_size - 1.0f;
+        float r, phi;
+        if (fabsf(a) > fabsf(b)) {
+            r = a;
+            phi = 0.25f * g_pi * (b / a);
+        } else {
+            r = b;
+            phi = 0.5f * g_pi - 0.25f * g_pi * (a / b);
+        }
+        table.x[i] = r * cosf(phi);
+        table.y[i] = r * sinf(phi);
+    }
+    ready = true;
+    return &table;
+}
+/* the table entry for sample n of pixel k */
+inline uint32_t
+camera_lens_index (uint32_t k, uint32_t n) {
+    uint32_t scramble = (k * 0x9e3779b9u) >> (32 - camera_lens_table_bits);
+    return (n ^ scramble) & (camera_lens_table_size - 1);
+}
+
 typedef struct {
     point3 origin;
     point3 lower_left_corner;
@@ -41,6 +104,7 @@ camera_init (
     cam->lower_left_corner = vec3_subvarg(4, cam->origin, half_horz, half_verz, depth);
 
     cam->lens_radius = aperture / 2.0f;
+    camera_lens_table();    /* built here, before any thread reads it */
 }
 inline ray
 camera_cast_ray (camera * cam, float s, float t) {
@@ -57,3 +121,48 @@ camera_cast_ray (camera * cam, float s, float t) {
     return ret;
 }
 
+//
+// count camera rays at once into out (capacity >= count), the film coordinates in
+// s[] and t[]. lens holds camera_lens_index entries, one per ray; it may be NULL with
+// lens_radius 0. the same sums as camera_cast_ray, four rays per sse step
+inline void
+camera_cast_rays (camera const * cam, float const * s, float const * t, uint32_t const * lens, int count, ray_batch * out) {
+    camera_lens_samples const * table = camera_lens_table();
+    bool thin_lens = (NULL != lens && cam->lens_radius > 0.0f);
+    // -- per axis: the corner relative to the origin, the lens offset bases
+    float base[3], du[3], dv[3];
+    for (int a = 0; a < 3; ++a) {
+        base[a] = cam->lower_left_corner.E[a] - cam->origin.E[a];
+        du[a] = cam->u.E[a] * cam->lens_radius;
+        dv[a] = cam->v.E[a] * cam->lens_radius;
+    }
+    int k = 0;
+#if defined(CAMERA_SSE)
+    for (; k + 4 <= count; k += 4) {
+        __m128 ss = _mm_loadu_ps(s + k);
+        __m128 ts = _mm_loadu_ps(t + k);
+        __m128 lx = _mm_setzero_ps(), ly = _mm_setzero_ps();
+        if (thin_lens) {
+            lx = _mm_setr_ps(table->x[lens[k]], table->x[lens[k + 1]], table->x[lens[k + 2]], table->x[lens[k + 3]]);
+            ly = _mm_setr_ps(table->y[lens[k]], table->y[lens[k + 1]], table->y[lens[k + 2]], table->y[lens[k + 3]]);
+        }
+        for (int a = 0; a < 3; ++a) {
+            __m128 off = _mm_add_ps(_mm_mul_ps(lx, _mm_set1_ps(du[a])), _mm_mul_ps(ly, _mm_set1_ps(dv[a])));
+            __m128 dir = _mm_add_ps(_mm_set1_ps(base[a]), _mm_mul_ps(ss, _mm_set1_ps(cam->horizontal.E[a])));
+            dir = _mm_add_ps(dir, _mm_mul_ps(ts, _mm_set1_ps(cam->vertical.E[a])));
+            _mm_storeu_ps(out->dir[a] + k, _mm_sub_ps(dir, off));
+            _mm_storeu_ps(out->origin[a] + k, _mm_add_ps(_mm_set1_ps(cam->origin.E[a]), off));
+        }
+    }
+#endif
+    for (; k < count; ++k) {
+        float lx = thin_lens ? table->x[lens[k]] : 0.0f;
+        float ly = thin_lens ? table->y[lens[k]] : 0.0f;
+        for (int a = 0; a < 3; ++a) {
+            float off = lx * du[a] + ly * dv[a];
+            out->dir[a][k] = base[a] + s[k] * cam->horizontal.E[a] + t[k] * cam->vertical.E[a] - off;
+            out->origin[a][k] = cam->origin.E[a] + off;
+        }
+    }
+    out->count = count;
+}
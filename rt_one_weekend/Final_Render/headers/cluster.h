@@ -0,0 +1,315 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char ** environ;
+#endif
+#include "progressive.h"
+#include "sample_split.h"
+#include "net.h"
+
+//
+// distributed rendering
+// a coordinator owns the film and a queue of jobs, each a run of consecutive tiles of the
+// tile grid. workers connect (net.h), load the scene file themselves, and loop: take a
+// job, render it, send the tiles' accumulators back. a job is either
+//   tiles         the full sample count, each tile from its initial rng state exactly as
+//                 the single-process renderer would; the float sums are copied in
+//   sample range  samples [first_sample, first_sample + sample_count) of every pixel,
+//                 rendered as in sample_split.h; the fixed-point sums are added in, so
+//                 the ranges of a pixel may be spread over any number of workers
+// a job's result depends only on the job, so any worker can render any job, a job can
+// be rendered twice, and the merged film is bit-identical to a one process render of
+// the same kind.
+// fault tolerance: a job belongs to a worker until its result arrives. when the worker's
+// connection drops (the process died, or tcp keepalive gave up on its machine) or the job
+// runs past the coordinator's timeout, the job goes back to the queue; if the first
+// holder answers after all, whichever result arrives first is merged and the other one
+// dropped. workers may join at any time and take jobs from then on.
+//
+// protocol (net_header framed, host byte order):
+//   worker       HELLO  cluster_hello
+//   coordinator  SETUP  cluster_setup
+//   coordinator  JOB    cluster_job                                 (one at a time)
+//   worker       RESULT cluster_result, float or int64[4 * pixel_count] (then the next JOB)
+//   coordinator  DONE                                              (worker exits)
+#define cluster_magic 0x4d524652u       /* "RFRM" */
+#define cluster_version 2u
+#define cluster_max_workers 60          /* select() takes 64 sockets on win32 */
+
+typedef enum {
+    CLUSTER_HELLO = 1,
+    CLUSTER_SETUP,
+    CLUSTER_JOB,
+    CLUSTER_RESULT,
+    CLUSTER_DONE
+} cluster_message;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    int32_t threads;
+} cluster_hello;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t scene_key;         /* hash_file of the scene; a worker's copy must match */
+    int32_t width;
+    int32_t height;
+    int32_t spp;
+    int32_t pass_spp;
+    int32_t tile_size;
+    uint32_t seed;              /* of the tile grid */
+    char scene_path[512];       /* used unless the worker was given its own */
+} cluster_setup;
+
+typedef struct {
+    int32_t id;
+    int32_t first_tile;
+    int32_t tile_count;
+    int32_t first_sample;
+    int32_t sample_count;       /* 0 for a tile job */
+    int32_t reserved;
+} cluster_job;
+
+typedef struct {
+    int32_t id;
+    int32_t pixel_count;
+    int64_t rays;
+    double seconds;             /* the worker's wall time for the job */
+} cluster_result;
+
+//
+// job queue, on the coordinator
+typedef enum {
+    CLUSTER_JOB_PENDING,
+    CLUSTER_JOB_RUNNING,
+    CLUSTER_JOB_DONE
+} cluster_job_status;
+
+typedef struct {
+    cluster_job job;
+    cluster_job_status status;
+    int worker;                 /* the last one given the job */
+    double started;
+    int attempts;
+} cluster_job_slot;
+
+typedef struct {
+    int count;
+    int done;
+    int requeued;               /* jobs taken back from dead or late workers */
+    cluster_job_slot * slots;
+} cluster_queue;
+
+// jobs of job_tiles consecutive tiles (row-major, so a job is a strip of a tile row or
+// more); with job_spp > 0, each strip once per range of job_spp of the spp samples,
+// range by range
+inline bool
+cluster_queue_init (cluster_queue * me, tile_grid const * grid, int job_tiles, int spp, int job_spp) {
+    job_tiles = job_tiles > 0 ? job_tiles : 1;
+    int strips = (grid->tile_count + job_tiles - 1) / job_tiles;
+    int ranges = job_spp > 0 ? (spp + job_spp - 1) / job_spp : 1;
+    me->count = strips * ranges;
+    me->done = 0;
+    me->requeued = 0;
+    me->slots = calloc(me->count, sizeof(cluster_job_slot));
+    if (NULL == me->slots)
+        return false;
+    for (int j = 0; j < me->count; ++j) {
+        cluster_job_slot * s = &me->slots[j];
+        int strip = j % strips;
+        int range = j / strips;
+        s->job.id = j;
+        s->job.first_tile = strip * job_tiles;
+        s->job.tile_count = (strip + 1) * job_tiles <= grid->tile_count ? job_tiles : grid->tile_count - strip * job_tiles;
+        if (job_spp > 0) {
+            s->job.first_sample = range * job_spp;
+            s->job.sample_count = (range + 1) * job_spp <= spp ? job_spp : spp - range * job_spp;
+        }
+        s->status = CLUSTER_JOB_PENDING;
+        s->worker = -1;
+    }
+    return true;
+}
+inline void
+cluster_queue_free (cluster_queue * me) {
+    free(me->slots);
+    me->slots = NULL;
+    me->count = 0;
+}
+/* the first pending job, now running on worker; -1 when none is pending */
+inline int
+cluster_queue_take (cluster_queue * me, int worker, double now) {
+    for (int j = 0; j < me->count; ++j) {
+        cluster_job_slot * s = &me->slots[j];
+        if (CLUSTER_JOB_PENDING == s->status) {
+            s->status = CLUSTER_JOB_RUNNING;
+            s->worker = worker;
+            s->started = now;
+            ++s->attempts;
+            return j;
+        }
+    }
+    return -1;
+}
+/* the worker is gone: its running jobs go back to the queue. returns how many */
+inline int
+cluster_queue_release (cluster_queue * me, int worker) {
+    int n = 0;
+    for (int j = 0; j < me->count; ++j) {
+        cluster_job_slot * s = &me->slots[j];
+        if (CLUSTER_JOB_RUNNING == s->status && s->worker == worker) {
+            s->status = CLUSTER_JOB_PENDING;
+            ++n;
+        }
+    }
+    me->requeued += n;
+    return n;
+}
+/* jobs running longer than timeout seconds go back to the queue (their holder may still answer) */
+inline int
+cluster_queue_expire (cluster_queue * me, double now, double timeout) {
+    int n = 0;
+    for (int j = 0; timeout > 0.0 && j < me->count; ++j) {
+        cluster_job_slot * s = &me->slots[j];
+        if (CLUSTER_JOB_RUNNING == s->status && now - s->started > timeout) {
+            s->status = CLUSTER_JOB_PENDING;
+            ++n;
+        }
+    }
+    me->requeued += n;
+    return n;
+}
+/* true the first time a job's result comes in, which is the one to merge */
+inline bool
+cluster_queue_finish (cluster_queue * me, int id) {
+    if (id < 0 || id >= me->count || CLUSTER_JOB_DONE == me->slots[id].status)
+        return false;
+    me->slots[id].status = CLUSTER_JOB_DONE;
+    ++me->done;
+    return true;
+}
+//
+// job accumulators: 4 values per pixel (sum r, g, b, lum_sq), tile by tile, rows top to
+// bottom; floats for tile jobs, int64 fixed point for sample ranges
+inline int
+cluster_job_pixels (tile_grid const * grid, cluster_job const * job) {
+    int n = 0;
+    for (int ti = job->first_tile; ti < job->first_tile + job->tile_count; ++ti) {
+        tile const * t = &grid->tiles[ti];
+        n += (t->x1 - t->x0) * (t->y1 - t->y0);
+    }
+    return n;
+}
+inline size_t
+cluster_job_bytes (tile_grid const * grid, cluster_job const * job) {
+    return 4 * (size_t)cluster_job_pixels(grid, job) * (job->sample_count > 0 ? sizeof(int64_t) : sizeof(float));
+}
+inline void
+cluster_pack (film const * fb, tile_grid const * grid, cluster_job const * job, float * out) {
+    for (int ti = job->first_tile; ti < job->first_tile + job->tile_count; ++ti) {
+        tile const * t = &grid->tiles[ti];
+        for (int row = t->y0; row < t->y1; ++row) {
+            for (int i = t->x0; i < t->x1; ++i, out += 4) {
+                int k = row * fb->width + i;
+                out[0] = fb->sum[k].x;
+                out[1] = fb->sum[k].y;
+                out[2] = fb->sum[k].z;
+                out[3] = fb->lum_sq[k];
+            }
+        }
+    }
+}
+/* a job's tiles are disjoint from every other job's, so merging is a copy */
+inline void
+cluster_unpack (film * fb, tile_grid const * grid, cluster_job const * job, float const * in) {
+    for (int ti = job->first_tile; ti < job->first_tile + job->tile_count; ++ti) {
+        tile const * t = &grid->tiles[ti];
+        for (int row = t->y0; row < t->y1; ++row) {
+            for (int i = t->x0; i < t->x1; ++i, in += 4) {
+                int k = row * fb->width + i;
+                fb->sum[k] = (color) {in[0], in[1], in[2]};
+                fb->lum_sq[k] = in[3];
+            }
+        }
+    }
+}
+//
+// local worker processes, for running a cluster on one host
+#if defined(_WIN32)
+typedef HANDLE cluster_process;
+#else
+typedef pid_t cluster_process;
+#endif
+
+/* starts args[0] with args (NULL terminated); false when it could not be started */
+inline bool
+cluster_spawn (char * const * args, cluster_process * out) {
+#if defined(_WIN32)
+    char command[4096] = {0};
+    size_t len = 0;
+    for (int a = 0; args[a]; ++a)
+        len += snprintf(command + len, len < sizeof(command) ? sizeof(command) - len : 0, "%s\"%s\"", a ? " " : "", args[a]);
+    if (len >= sizeof(command))
+        return false;
+    STARTUPINFOA startup = {sizeof(startup)};
+    PROCESS_INFORMATION info;
+    if (!CreateProcessA(NULL, command, NULL, NULL, FALSE, 0, NULL, NULL, &startup, &info))
+        return false;
+    CloseHandle(info.hThread);
+    *out = info.hProcess;
+    return true;
+#else
+    return (0 == posix_spawnp(out, args[0], NULL, NULL, args, environ));
+#endif
+}
+/* waits for the process to exit, returns its exit code */
+inline int
+cluster_wait (cluster_process p) {
+#if defined(_WIN32)
+    DWORD code = 1;
+    WaitForSingleObject(p, INFINITE);
+    GetExitCodeProcess(p, &code);
+    CloseHandle(p);
+    return (int)code;
+#else
+    int status = 0;
+    if (waitpid(p, &status, 0) != p)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+#endif
+}
+inline void
+cluster_pack_fixed (split_film const * sf, tile_grid const * grid, cluster_job const * job, int64_t * out) {
+    for (int ti = job->first_tile; ti < job->first_tile + job->tile_count; ++ti) {
+        tile const * t = &grid->tiles[ti];
+        for (int row = t->y0; row < t->y1; ++row, out += 4 * (t->x1 - t->x0))
+            memcpy(out, &sf->acc[4 * ((size_t)row * sf->width + t->x0)], 4 * (size_t)(t->x1 - t->x0) * sizeof(int64_t));
+    }
+}
+/* sample ranges of a pixel add up, in any order */
+inline void
+cluster_add_fixed (split_film * sf, tile_grid const * grid, cluster_job const * job, int64_t const * in) {
+    for (int ti = job->first_tile; ti < job->first_tile + job->tile_count; ++ti) {
+        tile const * t = &grid->tiles[ti];
+        for (int row = t->y0; row < t->y1; ++row) {
+            int64_t * acc = &sf->acc[4 * ((size_t)row * sf->width + t->x0)];
+            for (int c = 0; c < 4 * (t->x1 - t->x0); ++c)
+                acc[c] += *in++;
+        }
+    }
+}
@@ -12,19 +12,61 @@
 static const float g_pi = 3.1415926535897932385f;
 static const float g_infinity = INFINITY;
 
+#if defined(_MSC_VER)
+#define thread_local_var __declspec(thread)
+#define cache_line_aligned __declspec(align(64))
+#else
+#define thread_local_var __thread
+#define cache_line_aligned __attribute__((aligned(64)))
+#endif
+
 //
 // utility functions
 inline float
 degrees_to_radians (float degree) {
     return (degree * g_pi / 180.0f);
 }
+//
+// random numbers
+// NOTE: rand() shares one state between threads (and serializes them on some CRTs),
+// so every thread owns a pcg32 state instead. The state can be saved and restored
+// so a tile or a checkpoint continues the exact same sequence.
+// ref: O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically Good Algorithms for Random Number Generation"
+static thread_local_var uint64_t g_rng_state = 0x853c49e6748fea9bull;
+
+inline uint32_t
+random_u32 () {
+    uint64_t old = g_rng_state;
+    g_rng_state = old * 6364136223846793005ull + 1442695040888963407ull;
+    uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = (uint32_t)(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+}
+/* well mixed seed for stream i of a run with the given seed (splitmix64) */
+inline uint64_t
+random_hash_seed (uint64_t seed, uint64_t i) {
+    uint64_t z = seed + (i + 1) * 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+inline void
+random_seed (uint64_t seed) {
+    g_rng_state = random_hash_seed(seed, 0);
+}
+inline uint64_t
+random_get_state () {
+    return g_rng_state;
+}
+inline void
+random_set_state (uint64_t state) {
+    g_rng_state = state;
+}
 /* returns a random float in [0,1) */
 inline float
 random_float () {
-    // NOTE(omid): rand() returns a random integer in the range 0 and RAND_MAX
-    // so rand() / RAND_MAX returns a number in [0,1]
-    // and the following line returns a random float in [0,1)
-    return rand() / (RAND_MAX + 1.0f);
+    // top 24 bits -> exactly representable floats in [0,1)
+    return (random_u32() >> 8) * (1.0f / 16777216.0f);
 }
 /* returns a random float in [min,max) */
 inline float
@@ -35,6 +77,18 @@ inline float
 clamp (float x, float min, float max) {
     return x < min ? min : ((x > max) ? max : x);
 }
+//
+// hashing (FNV-1a), for cache and checkpoint keys
+#define hash_seed 0xcbf29ce484222325ull
+inline uint64_t
+hash_bytes (uint64_t h, void const * data, size_t size) {
+    uint8_t const * p = (uint8_t const *)data;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
 
 
 //
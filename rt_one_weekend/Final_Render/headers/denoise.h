@@ -0,0 +1,249 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vec3.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DENOISE_SSE 1
+#endif
+
+//
+// edge-avoiding a-trous wavelet filter
+// ref: Dammertz et al., "Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination Filtering" (2010)
+// the 5x5 B3-spline kernel is applied with growing holes (step 1, 2, 4, ...) and every tap is
+// weighted by how similar its luminance, normal, depth and albedo are to the center pixel.
+// luminance similarity is measured in units of the (propagated) per-pixel std deviation,
+// so the filter backs off where the estimate is already converged.
+// all buffers are planar (one float per pixel per plane) so 4 neighbouring pixels load with one SSE op
+
+typedef struct {
+    float * albedo[3];
+    float * normal[3];
+    float * depth;          /* linear depth, 0 for background */
+} denoise_guides;
+
+typedef struct {
+    int iterations;         /* footprint is 4 * 2^iterations + 1 pixels */
+    float sigma_luminance;  /* in std deviations */
+    float sigma_normal;     /* exponent scale for (1 - n.n'), background pixels have n = 0 */
+    float sigma_depth;      /* relative depth change tolerated per pixel of distance */
+    float sigma_albedo;
+} denoise_params;
+
+inline void
+denoise_params_default (denoise_params * me) {
+    me->iterations = 5;
+    me->sigma_luminance = 4.0f;
+    me->sigma_normal = 64.0f;
+    me->sigma_depth = 0.02f;
+    me->sigma_albedo = 0.1f;
+}
+
+static float const g_atrous_kernel[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+//
+// exponent of the edge-stopping function between pixel p and its tap q
+inline float
+denoise_edge_exponent (denoise_guides const * g, float const * const * src, float const * var,
+                       int p, int q, float lum_p, float inv_sl, float sigma_normal, float inv_sz, float inv_sa2) {
+    float lum_q = 0.2126f * src[0][q] + 0.7152f * src[1][q] + 0.0722f * src[2][q];
+    float e = fabsf(lum_p - lum_q) * inv_sl;
+    float ndot = g->normal[0][p] * g->normal[0][q] + g->normal[1][p] * g->normal[1][q] + g->normal[2][p] * g->normal[2][q];
+    float np2 = g->normal[0][p] * g->normal[0][p] + g->normal[1][p] * g->normal[1][p] + g->normal[2][p] * g->normal[2][p];
+    e += sigma_normal * fmaxf(0.0f, np2 - ndot);    /* np2 is 1, or 0 for background */
+    e += fabsf(g->depth[p] - g->depth[q]) * inv_sz;
+    float da0 = g->albedo[0][p] - g->albedo[0][q];
+    float da1 = g->albedo[1][p] - g->albedo[1][q];
+    float da2 = g->albedo[2][p] - g->albedo[2][q];
+    e += (da0 * da0 + da1 * da1 + da2 * da2) * inv_sa2;
+    return e;
+}
+//
+// scalar path, used near the left/right borders where the taps are clamped away
+inline void
+denoise_pixel (int width, int height, int x, int y, int step, denoise_params const * params, denoise_guides const * g,
+               float const * const * src, float const * var, float ** dst, float * dst_var) {
+    int p = y * width + x;
+    float lum_p = 0.2126f * src[0][p] + 0.7152f * src[1][p] + 0.0722f * src[2][p];
+    float inv_sl = 1.0f / (params->sigma_luminance * sqrtf(fmaxf(var[p], 0.0f)) + 1e-4f);
+    float inv_sz = 1.0f / (params->sigma_depth * step * g->depth[p] + 1e-4f);
+    float inv_sa2 = 1.0f / (params->sigma_albedo * params->sigma_albedo);
+    float sum_w = 0.0f, sum_var = 0.0f;
+    float sum[3] = {0};
+    for (int dy = -2; dy <= 2; ++dy) {
+        int qy = y + dy * step;
+        if (qy < 0 || qy >= height)
+            continue;
+        for (int dx = -2; dx <= 2; ++dx) {
+            int qx = x + dx * step;
+            if (qx < 0 || qx >= width)
+                continue;
+            int q = qy * width + qx;
+            float h = g_atrous_kernel[abs(dx)] * g_atrous_kernel[abs(dy)];
+            float w = h * expf(-fminf(denoise_edge_exponent(g, src, var, p, q, lum_p, inv_sl, params->sigma_normal, inv_sz, inv_sa2), 87.0f));
+            for (int c = 0; c < 3; ++c)
+                sum[c] += w * src[c][q];
+            sum_var += w * w * var[q];
+            sum_w += w;
+        }
+    }
+    float inv_w = 1.0f / sum_w;     /* center tap always contributes */
+    for (int c = 0; c < 3; ++c)
+        dst[c][p] = sum[c] * inv_w;
+    dst_var[p] = sum_var * inv_w * inv_w;
+}
+
+#ifdef DENOISE_SSE
+//
+// exp(-x) for x >= 0: range reduction to 2^n * exp(r), |r| <= ln2/2, degree 5 polynomial
+inline __m128
+denoise_exp_neg_ps (__m128 x) {
+    __m128 y = _mm_sub_ps(_mm_setzero_ps(), _mm_min_ps(x, _mm_set1_ps(87.0f)));
+    __m128i n = _mm_cvtps_epi32(_mm_mul_ps(y, _mm_set1_ps(1.44269504f)));
+    __m128 nf = _mm_cvtepi32_ps(n);
+    __m128 r = _mm_sub_ps(y, _mm_mul_ps(nf, _mm_set1_ps(0.693359375f)));
+    r = _mm_add_ps(r, _mm_mul_ps(nf, _mm_set1_ps(2.12194440e-4f)));
+    __m128 poly = _mm_set1_ps(1.0f / 120.0f);
+    poly = _mm_add_ps(_mm_mul_ps(poly, r), _mm_set1_ps(1.0f / 24.0f));
+    poly = _mm_add_ps(_mm_mul_ps(poly, r), _mm_set1_ps(1.0f / 6.0f));
+    poly = _mm_add_ps(_mm_mul_ps(poly, r), _mm_set1_ps(0.5f));
+    poly = _mm_add_ps(_mm_mul_ps(poly, r), _mm_set1_ps(1.0f));
+    poly = _mm_add_ps(_mm_mul_ps(poly, r), _mm_set1_ps(1.0f));
+    __m128 pow2n = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(poly, pow2n);
+}
+inline __m128
+denoise_abs_ps (__m128 x) {
+    return _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+}
+//
+// 4 pixels [x, x+3] of row y, all taps inside the row
+inline void
+denoise_block_sse (int width, int height, int x, int y, int step, denoise_params const * params, denoise_guides const * g,
+                   float const * const * src, float const * var, float ** dst, float * dst_var) {
+    int p = y * width + x;
+    __m128 kr = _mm_set1_ps(0.2126f), kg = _mm_set1_ps(0.7152f), kb = _mm_set1_ps(0.0722f);
+    __m128 lum_p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(kr, _mm_loadu_ps(src[0] + p)), _mm_mul_ps(kg, _mm_loadu_ps(src[1] + p))), _mm_mul_ps(kb, _mm_loadu_ps(src[2] + p)));
+    __m128 std_p = _mm_sqrt_ps(_mm_max_ps(_mm_loadu_ps(var + p), _mm_setzero_ps()));
+    __m128 inv_sl = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(params->sigma_luminance), std_p), _mm_set1_ps(1e-4f)));
+    __m128 z_p = _mm_loadu_ps(g->depth + p);
+    __m128 inv_sz = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(params->sigma_depth * step), z_p), _mm_set1_ps(1e-4f)));
+    __m128 inv_sa2 = _mm_set1_ps(1.0f / (params->sigma_albedo * params->sigma_albedo));
+    __m128 sig_n = _mm_set1_ps(params->sigma_normal);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 n0 = _mm_loadu_ps(g->normal[0] + p), n1 = _mm_loadu_ps(g->normal[1] + p), n2 = _mm_loadu_ps(g->normal[2] + p);
+    __m128 np2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0, n0), _mm_mul_ps(n1, n1)), _mm_mul_ps(n2, n2));
+    __m128 a0 = _mm_loadu_ps(g->albedo[0] + p), a1 = _mm_loadu_ps(g->albedo[1] + p), a2 = _mm_loadu_ps(g->albedo[2] + p);
+
+    __m128 sum_w = _mm_setzero_ps(), sum_var = _mm_setzero_ps();
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps();
+    for (int dy = -2; dy <= 2; ++dy) {
+        int qy = y + dy * step;
+        if (qy < 0 || qy >= height)
+            continue;
+        for (int dx = -2; dx <= 2; ++dx) {
+            int q = qy * width + x + dx * step;
+            __m128 c0 = _mm_loadu_ps(src[0] + q), c1 = _mm_loadu_ps(src[1] + q), c2 = _mm_loadu_ps(src[2] + q);
+            __m128 lum_q = _mm_add_ps(_mm_add_ps(_mm_mul_ps(kr, c0), _mm_mul_ps(kg, c1)), _mm_mul_ps(kb, c2));
+            __m128 e = _mm_mul_ps(denoise_abs_ps(_mm_sub_ps(lum_p, lum_q)), inv_sl);
+            __m128 ndot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0, _mm_loadu_ps(g->normal[0] + q)), _mm_mul_ps(n1, _mm_loadu_ps(g->normal[1] + q))), _mm_mul_ps(n2, _mm_loadu_ps(g->normal[2] + q)));
+            e = _mm_add_ps(e, _mm_mul_ps(sig_n, _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(np2, ndot))));
+            e = _mm_add_ps(e, _mm_mul_ps(denoise_abs_ps(_mm_sub_ps(z_p, _mm_loadu_ps(g->depth + q))), inv_sz));
+            __m128 d0 = _mm_sub_ps(a0, _mm_loadu_ps(g->albedo[0] + q));
+            __m128 d1 = _mm_sub_ps(a1, _mm_loadu_ps(g->albedo[1] + q));
+            __m128 d2 = _mm_sub_ps(a2, _mm_loadu_ps(g->albedo[2] + q));
+            e = _mm_add_ps(e, _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)), _mm_mul_ps(d2, d2)), inv_sa2));
+            __m128 w = _mm_mul_ps(_mm_set1_ps(g_atrous_kernel[abs(dx)] * g_atrous_kernel[abs(dy)]), denoise_exp_neg_ps(e));
+            s0 = _mm_add_ps(s0, _mm_mul_ps(w, c0));
+            s1 = _mm_add_ps(s1, _mm_mul_ps(w, c1));
+            s2 = _mm_add_ps(s2, _mm_mul_ps(w, c2));
+            sum_var = _mm_add_ps(sum_var, _mm_mul_ps(_mm_mul_ps(w, w), _mm_loadu_ps(var + q)));
+            sum_w = _mm_add_ps(sum_w, w);
+        }
+    }
+    __m128 inv_w = _mm_div_ps(one, sum_w);
+    _mm_storeu_ps(dst[0] + p, _mm_mul_ps(s0, inv_w));
+    _mm_storeu_ps(dst[1] + p, _mm_mul_ps(s1, inv_w));
+    _mm_storeu_ps(dst[2] + p, _mm_mul_ps(s2, inv_w));
+    _mm_storeu_ps(dst_var + p, _mm_mul_ps(sum_var, _mm_mul_ps(inv_w, inv_w)));
+}
+#endif
+//
+// filters the planar color (in place) using the guides
+// var holds the per-pixel variance of the luminance estimate and is updated as well
+// returns false if the scratch buffers could not be allocated
+inline bool
+denoise_atrous (int width, int height, float ** color_planes, float * var, denoise_guides const * g, denoise_params const * params) {
+    size_t count = (size_t)width * height;
+    float * scratch = malloc(4 * count * sizeof(float));
+    if (NULL == scratch)
+        return false;
+    float * ping[4] = {color_planes[0], color_planes[1], color_planes[2], var};
+    float * pong[4] = {scratch, scratch + count, scratch + 2 * count, scratch + 3 * count};
+
+    for (int it = 0; it < params->iterations; ++it) {
+        int step = 1 << it;
+        float const * const * src = (float const * const *)ping;
+        float ** dst = pong;
+        int y;
+#pragma omp parallel for schedule(dynamic)
+        for (y = 0; y < height; ++y) {
+            int x = 0;
+#ifdef DENOISE_SSE
+            int margin = 2 * step;
+            for (; x < margin && x < width; ++x)
+                denoise_pixel(width, height, x, y, step, params, g, src, ping[3], dst, dst[3]);
+            for (; x + 3 + margin < width; x += 4)
+                denoise_block_sse(width, height, x, y, step, params, g, src, ping[3], dst, dst[3]);
+#endif
+            for (; x < width; ++x)
+                denoise_pixel(width, height, x, y, step, params, g, src, ping[3], dst, dst[3]);
+        }
+        for (int c = 0; c < 4; ++c) {
+            float * tmp = ping[c];
+            ping[c] = pong[c];
+            pong[c] = tmp;
+        }
+    }
+    // -- result must end up in the caller's buffers
+    if (ping[0] != color_planes[0]) {
+        for (int c = 0; c < 3; ++c)
+            memcpy(color_planes[c], ping[c], count * sizeof(float));
+        memcpy(var, ping[3], count * sizeof(float));
+    }
+    free(scratch);
+    return true;
+}
+//
+// full post-pass on a mean-radiance image:
+// demodulates albedo (so texture detail is not blurred), filters and remodulates
+// lum_var is the variance of each pixel's mean luminance
+inline bool
+denoise_beauty (int width, int height, color * beauty, float const * lum_var, denoise_guides const * g, denoise_params const * params) {
+    int pixel_count = width * height;
+    float * planes = malloc((size_t)4 * pixel_count * sizeof(float));
+    if (NULL == planes)
+        return false;
+    float * color_planes[3] = {planes, planes + pixel_count, planes + 2 * pixel_count};
+    float * var = planes + (size_t)3 * pixel_count;
+    for (int k = 0; k < pixel_count; ++k) {
+        float alb_lum = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            color_planes[c][k] = beauty[k].E[c] / (g->albedo[c][k] + 0.01f);
+            alb_lum += g->albedo[c][k] * (1.0f / 3.0f);
+        }
+        float demod = alb_lum + 0.01f;
+        var[k] = lum_var[k] / (demod * demod);
+    }
+    bool ret = denoise_atrous(width, height, color_planes, var, g, params);
+    if (ret)
+        for (int k = 0; k < pixel_count; ++k)
+            for (int c = 0; c < 3; ++c)
+                beauty[k].E[c] = color_planes[c][k] * (g->albedo[c][k] + 0.01f);
+    free(planes);
+    return ret;
+}
@@ -8,9 +8,16 @@ struct material;
 typedef struct {
     point3 p;
     vec3f normal;
+    vec3f geometric_normal;     /* of the surface itself, on normal's side; rays leave along it */
     struct material * mat_ptr;     // handling circular referencing
     float t;
     bool front_face;
+    // -- set by every hit of the flat scene (scene_hit): spheres, object id = index, then
+    // planes and quads (plane.h), meshes (triangle_mesh.h) and instances (instance.h: the
+    // instance's object id, its mesh's material), numbered from their scene_*_id_base.
+    // the hittable_list path leaves them unset
+    int material_id;
+    int object_id;
 } hit_record;
 
 /* virtual functions in C */
@@ -39,4 +46,5 @@ inline void
 record_set_normal (hit_record * rec, ray * r, vec3f outward_normal) {
     rec->front_face = vec3_mul_dot(r->dir, outward_normal) < 0.0f;
     rec->normal = rec->front_face ? outward_normal : vec3_scale(outward_normal, -1.0f);
+    rec->geometric_normal = rec->normal;
 }
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vec3.h"
+
+//
+// float rgb images, rows stored top to bottom
+typedef struct {
+    int width;
+    int height;
+    color * pixels;
+} image;
+
+inline bool
+image_alloc (image * me, int width, int height) {
+    me->width = width;
+    me->height = height;
+    me->pixels = calloc((size_t)width * height, sizeof(color));
+    return (NULL != me->pixels);
+}
+inline void
+image_free (image * me) {
+    free(me->pixels);
+    me->pixels = NULL;
+    me->width = me->height = 0;
+}
+//
+// portable float map (PFM): "PF\n w h\n -1\n" + little-endian float rgb rows, bottom to top
+inline bool
+image_write_pfm (char const * path, int width, int height, color const * pixels) {
+    FILE * file = fopen(path, "wb");
+    if (NULL == file)
+        return false;
+    fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+    for (int row = height - 1; row >= 0; --row) {
+        for (int i = 0; i < width; ++i)
+            fwrite(pixels[row * width + i].E, sizeof(float), 3, file);
+    }
+    fclose(file);
+    return true;
+}
+inline bool
+image_read_pfm (char const * path, image * out) {
+    bool ret = false;
+    FILE * file = fopen(path, "rb");
+    if (NULL == file)
+        return false;
+    char magic[3] = {0};
+    int width = 0, height = 0;
+    float scale = 0.0f;
+    // NOTE: only little-endian color PFMs (scale < 0) are supported, which is all we write
+    if (3 == fscanf(file, "%2s %d %d", magic, &width, &height) && 0 == strcmp(magic, "PF") &&
+        1 == fscanf(file, "%f", &scale) && scale < 0.0f && width > 0 && height > 0) {
+        fgetc(file);    /* single whitespace before the raster */
+        if (image_alloc(out, width, height)) {
+            ret = true;
+            for (int row = height - 1; row >= 0 && ret; --row)
+                for (int i = 0; i < width && ret; ++i)
+                    ret = (3 == fread(out->pixels[row * width + i].E, sizeof(float), 3, file));
+            if (!ret)
+                image_free(out);
+        }
+    }
+    fclose(file);
+    return ret;
+}
+//
+// error metrics against a reference (linear radiance)
+inline double
+image_rmse (color const * test, color const * ref, int count) {
+    double sum = 0.0;
+    for (int i = 0; i < count; ++i)
+        for (int c = 0; c < 3; ++c) {
+            double d = (double)test[i].E[c] - ref[i].E[c];
+            sum += d * d;
+        }
+    return sqrt(sum / (3.0 * count));
+}
+/* relative MSE: mean of (test - ref)^2 / (ref^2 + eps), eps hides near-black pixels */
+inline double
+image_relmse (color const * test, color const * ref, int count) {
+    double sum = 0.0;
+    for (int i = 0; i < count; ++i)
+        for (int c = 0; c < 3; ++c) {
+            double d = (double)test[i].E[c] - ref[i].E[c];
+            sum += d * d / ((double)ref[i].E[c] * ref[i].E[c] + 1e-2);
+        }
+    return sum / (3.0 * count);
+}
+//
+// FLIP-style perceptual difference, after Andersson et al., "FLIP: A Difference Evaluator
+// for Alternating Images" (2020), the LDR variant. both images go through the display
+// transform (clamp, gamma 2, as write_color) and are compared the way a viewer ppd pixels
+// per degree away sees them: each opponent channel (YCxCz) is blurred by its contrast
+// sensitivity, the colors are compared in Hunt-adjusted L*a*b* with the HyAB distance,
+// and the error is raised where edges or points differ. 0 means identical, 1 is the most
+// visible difference; returns the mean over the image, out_map (may be NULL) gets every pixel
+#define flip_default_ppd 67.0f     /* 0.7 m from a 0.7 m wide 4k monitor */
+
+inline vec3f
+flip_rgb_to_xyz (vec3f c) {
+    vec3f ret = {
+        0.4124564f * c.x + 0.3575761f * c.y + 0.1804375f * c.z,
+        0.2126729f * c.x + 0.7151522f * c.y + 0.0721750f * c.z,
+        0.0193339f * c.x + 0.1191920f * c.y + 0.9503041f * c.z
+    };
+    return ret;
+}
+inline vec3f
+flip_xyz_to_rgb (vec3f c) {
+    vec3f ret = {
+        3.2404542f * c.x - 1.5371385f * c.y - 0.4985314f * c.z,
+        -0.9692660f * c.x + 1.8760108f * c.y + 0.0415560f * c.z,
+        0.0556434f * c.x - 0.2040259f * c.y + 1.0572252f * c.z
+    };
+    return ret;
+}
+/* linear rgb to Hunt-adjusted L*a*b*, d65 white */
+inline vec3f
+flip_rgb_to_hunt_lab (vec3f c) {
+    vec3f xyz = flip_rgb_to_xyz(c);
+    float r[3] = {xyz.x / 0.950456f, xyz.y, xyz.z / 1.088754f};
+    for (int a = 0; a < 3; ++a)
+        r[a] = r[a] > 0.008856452f ? cbrtf(r[a]) : r[a] / 0.1284185f + 0.137931f;
+    float l = 116.0f * r[1] - 16.0f;
+    vec3f ret = {l, 0.01f * l * 500.0f * (r[0] - r[1]), 0.01f * l * 200.0f * (r[1] - r[2])};
+    return ret;
+}
+inline float
+flip_hyab (vec3f a, vec3f b) {
+    float da = a.y - b.y, db = a.z - b.z;
+    return fabsf(a.x - b.x) + sqrtf(da * da + db * db);
+}
+/* dst = src filtered along rows with kx, then along columns with ky (2r + 1 taps each), edges clamped */
+inline void
+flip_convolve (float const * src, float * dst, float * tmp, int w, int h, float const * kx, float const * ky, int r) {
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            float sum = 0.0f;
+            for (int k = -r; k <= r; ++k) {
+                int xi = x + k < 0 ? 0 : (x + k >= w ? w - 1 : x + k);
+                sum += kx[k + r] * src[y * w + xi];
+            }
+            tmp[y * w + x] = sum;
+        }
+    }
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            float sum = 0.0f;
+            for (int k = -r; k <= r; ++k) {
+                int yi = y + k < 0 ? 0 : (y + k >= h ? h - 1 : y + k);
+                sum += ky[k + r] * tmp[yi * w + x];
+            }
+            dst[y * w + x] = sum;
+        }
+    }
+}
+/* scales the positive taps to sum 1 and the negative ones to sum -1 */
+inline void
+flip_normalize_signed (float * k, int taps) {
+    float pos = 0.0f, neg = 0.0f;
+    for (int i = 0; i < taps; ++i) {
+        if (k[i] > 0.0f)
+            pos += k[i];
+        else
+            neg -= k[i];
+    }
+    for (int i = 0; i < taps; ++i)
+        k[i] /= (k[i] > 0.0f ? pos : (neg > 0.0f ? neg : 1.0f));
+}
+inline double
+image_flip (color const * test, color const * ref, int width, int height, float ppd, float * out_map) {
+    size_t n = (size_t)width * height;
+    // -- contrast sensitivity per channel as one or two gaussians a * sqrt(pi / b) * exp(-pi^2 x^2 / b), x in degrees
+    static float const csf[3][4] = {
+        {1.0f, 0.0047f, 0.0f, 1e-5f},       /* achromatic */
+        {1.0f, 0.0053f, 0.0f, 1e-5f},       /* red-green */
+        {34.1f, 0.04f, 13.5f, 0.025f}       /* blue-yellow */
+    };
+    int r = (int)ceilf(3.0f * sqrtf(0.04f / (2.0f * g_pi * g_pi)) * ppd);
+    float sd = 0.5f * 0.082f * ppd;     /* feature detectors, 0.082 degrees wide */
+    int rf = (int)ceilf(3.0f * sd);
+    int taps = 2 * r + 1, ftaps = 2 * rf + 1;
+    float * kernels = malloc((6 * (size_t)taps + 3 * (size_t)ftaps) * sizeof(float));
+    float * planes = malloc(8 * n * sizeof(float));
+    if (NULL == kernels || NULL == planes) {
+        free(kernels);
+        free(planes);
+        return -1.0;
+    }
+    float * gauss = kernels;                    /* [channel][term][tap] */
+    float * smooth = kernels + 6 * taps;
+    float * edge = smooth + ftaps;
+    float * point = edge + ftaps;
+    float weight[3][2], norm[3];
+    for (int c = 0; c < 3; ++c) {
+        norm[c] = 0.0f;
+        for (int term = 0; term < 2; ++term) {
+            float a = csf[c][2 * term], b = csf[c][2 * term + 1];
+            float * k = gauss + (2 * c + term) * taps;
+            float sum = 0.0f;
+            for (int i = -r; i <= r; ++i) {
+                float x = i / ppd;
+                k[i + r] = expf(-g_pi * g_pi * x * x / b);
+                sum += k[i + r];
+            }
+            weight[c][term] = a * sqrtf(g_pi / b);
+            norm[c] += weight[c][term] * sum * sum;     /* the 2d kernel's total */
+        }
+    }
+    float ssum = 0.0f;
+    for (int i = -rf; i <= rf; ++i) {
+        float g = expf(-(float)(i * i) / (2.0f * sd * sd));
+        smooth[i + rf] = g;
+        edge[i + rf] = -i * g;
+        point[i + rf] = (i * i / (sd * sd) - 1.0f) * g;
+        ssum += g;
+    }
+    for (int i = 0; i < ftaps; ++i)
+        smooth[i] /= ssum;
+    flip_normalize_signed(edge, ftaps);
+    flip_normalize_signed(point, ftaps);
+
+    // -- per image: the filtered colors (hunt lab) and the feature magnitudes
+    float * opp = planes;                   /* 3 planes, YCxCz of one image */
+    float * filtered = planes + 3 * n;      /* 3 planes */
+    float * tmp = planes + 6 * n;
+    float * term = planes + 7 * n;
+    vec3f * lab_px[2];
+    float * edges[2], * points[2];
+    lab_px[0] = malloc(2 * n * sizeof(vec3f));
+    float * features = malloc(4 * n * sizeof(float));
+    if (NULL == lab_px[0] || NULL == features) {
+        free(lab_px[0]);
+        free(features);
+        free(kernels);
+        free(planes);
+        return -1.0;
+    }
+    lab_px[1] = lab_px[0] + n;
+    edges[0] = features;
+    edges[1] = features + n;
+    points[0] = features + 2 * n;
+    points[1] = features + 3 * n;
+    color const * images[2] = {test, ref};
+    for (int m = 0; m < 2; ++m) {
+        for (size_t k = 0; k < n; ++k) {
+            vec3f lin;
+            for (int a = 0; a < 3; ++a) {
+                float v = images[m][k].E[a];
+                v = sqrtf(v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v));     /* what write_color shows */
+                lin.E[a] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+            }
+            vec3f xyz = flip_rgb_to_xyz(lin);
+            float xr = xyz.x / 0.950456f, yr = xyz.y, zr = xyz.z / 1.088754f;
+            opp[k] = 116.0f * yr - 16.0f;
+            opp[n + k] = 500.0f * (xr - yr);
+            opp[2 * n + k] = 200.0f * (yr - zr);
+        }
+        for (int c = 0; c < 3; ++c) {
+            float * out = filtered + c * n;
+            memset(out, 0, n * sizeof(float));
+            for (int t = 0; t < 2; ++t) {
+                if (0.0f == weight[c][t] || 0.0f == csf[c][2 * t])
+                    continue;
+                float const * k = gauss + (2 * c + t) * taps;
+                flip_convolve(opp + c * n, term, tmp, width, height, k, k, r);
+                float scale = weight[c][t] / norm[c];
+                for (size_t i = 0; i < n; ++i)
+                    out[i] += scale * term[i];
+            }
+        }
+        for (size_t k = 0; k < n; ++k) {
+            float yr = (filtered[k] + 16.0f) / 116.0f;
+            vec3f xyz = {(filtered[n + k] / 500.0f + yr) * 0.950456f, yr, (yr - filtered[2 * n + k] / 200.0f) * 1.088754f};
+            vec3f rgb = flip_xyz_to_rgb(xyz);
+            for (int a = 0; a < 3; ++a)
+                rgb.E[a] = rgb.E[a] < 0.0f ? 0.0f : (rgb.E[a] > 1.0f ? 1.0f : rgb.E[a]);
+            lab_px[m][k] = flip_rgb_to_hunt_lab(rgb);
+            opp[k] = (opp[k] + 16.0f) / 116.0f;     /* achromatic in [0, 1] for the features */
+        }
+        float * gx = filtered, * gy = filtered + n;
+        flip_convolve(opp, gx, tmp, width, height, edge, smooth, rf);
+        flip_convolve(opp, gy, tmp, width, height, smooth, edge, rf);
+        for (size_t k = 0; k < n; ++k)
+            edges[m][k] = sqrtf(gx[k] * gx[k] + gy[k] * gy[k]);
+        flip_convolve(opp, gx, tmp, width, height, point, smooth, rf);
+        flip_convolve(opp, gy, tmp, width, height, smooth, point, rf);
+        for (size_t k = 0; k < n; ++k)
+            points[m][k] = sqrtf(gx[k] * gx[k] + gy[k] * gy[k]);
+    }
+
+    // -- color error, compressed so that large differences saturate, raised by feature error
+    float const qc = 0.7f, pc = 0.4f, pt = 0.95f;
+    float cmax = powf(flip_hyab(flip_rgb_to_hunt_lab((vec3f) {0.0f, 1.0f, 0.0f}),
+        flip_rgb_to_hunt_lab((vec3f) {0.0f, 0.0f, 1.0f})), qc);
+    double sum = 0.0;
+    for (size_t k = 0; k < n; ++k) {
+        float de = powf(flip_hyab(lab_px[0][k], lab_px[1][k]), qc);
+        float dc = de < pc * cmax ? pt / (pc * cmax) * de : pt + (de - pc * cmax) / (cmax - pc * cmax) * (1.0f - pt);
+        float de_edge = fabsf(edges[0][k] - edges[1][k]), de_point = fabsf(points[0][k] - points[1][k]);
+        float df = sqrtf((de_edge > de_point ? de_edge : de_point) / sqrtf(2.0f));
+        float e = powf(dc, 1.0f - df);
+        if (out_map)
+            out_map[k] = e;
+        sum += e;
+    }
+    free(features);
+    free(lab_px[0]);
+    free(kernels);
+    free(planes);
+    return sum / n;
+}
+//
+// minimal OpenEXR writer: single part, scanline, uncompressed
+// enough to keep the beauty image and its feature layers in one multi-layer file
+typedef enum {
+    EXR_UINT = 0,
+    EXR_FLOAT = 2,
+} exr_pixel_type;
+
+typedef struct {
+    char const * name;      /* e.g. "R", "albedo.R", "N.X" */
+    exr_pixel_type type;
+    void const * data;      /* 4 bytes per sample */
+    int stride;             /* in elements between two consecutive pixels */
+} exr_channel;
+
+inline void
+exr_put_u32 (FILE * file, uint32_t v) {
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    fwrite(b, 1, 4, file);
+}
+inline void
+exr_put_u64 (FILE * file, uint64_t v) {
+    exr_put_u32(file, (uint32_t)v);
+    exr_put_u32(file, (uint32_t)(v >> 32));
+}
+inline void
+exr_put_f32 (FILE * file, float v) {
+    uint32_t u;
+    memcpy(&u, &v, 4);
+    exr_put_u32(file, u);
+}
+inline void
+exr_put_attr (FILE * file, char const * name, char const * type, uint32_t size) {
+    fwrite(name, 1, strlen(name) + 1, file);
+    fwrite(type, 1, strlen(type) + 1, file);
+    exr_put_u32(file, size);
+}
+static int
+exr_channel_compare (void const * a, void const * b) {
+    return strcmp(((exr_channel const *)a)->name, ((exr_channel const *)b)->name);
+}
+/* channels are sorted in place, EXR requires alphabetical order */
+inline bool
+image_write_exr (char const * path, int width, int height, exr_channel * channels, int channel_count) {
+    FILE * file = fopen(path, "wb");
+    if (NULL == file)
+        return false;
+    qsort(channels, channel_count, sizeof(exr_channel), exr_channel_compare);
+
+    exr_put_u32(file, 20000630);    /* magic */
+    exr_put_u32(file, 2);           /* version 2, single part scanline */
+
+    uint32_t chlist_size = 1;
+    for (int c = 0; c < channel_count; ++c)
+        chlist_size += (uint32_t)strlen(channels[c].name) + 1 + 16;
+    exr_put_attr(file, "channels", "chlist", chlist_size);
+    for (int c = 0; c < channel_count; ++c) {
+        fwrite(channels[c].name, 1, strlen(channels[c].name) + 1, file);
+        exr_put_u32(file, channels[c].type);
+        exr_put_u32(file, 0);       /* pLinear + reserved */
+        exr_put_u32(file, 1);       /* x sampling */
+        exr_put_u32(file, 1);       /* y sampling */
+    }
+    fputc(0, file);
+    exr_put_attr(file, "compression", "compression", 1);
+    fputc(0, file);                 /* NO_COMPRESSION */
+    exr_put_attr(file, "dataWindow", "box2i", 16);
+    exr_put_u32(file, 0); exr_put_u32(file, 0); exr_put_u32(file, width - 1); exr_put_u32(file, height - 1);
+    exr_put_attr(file, "displayWindow", "box2i", 16);
+    exr_put_u32(file, 0); exr_put_u32(file, 0); exr_put_u32(file, width - 1); exr_put_u32(file, height - 1);
+    exr_put_attr(file, "lineOrder", "lineOrder", 1);
+    fputc(0, file);                 /* INCREASING_Y */
+    exr_put_attr(file, "pixelAspectRatio", "float", 4);
+    exr_put_f32(file, 1.0f);
+    exr_put_attr(file, "screenWindowCenter", "v2f", 8);
+    exr_put_f32(file, 0.0f); exr_put_f32(file, 0.0f);
+    exr_put_attr(file, "screenWindowWidth", "float", 4);
+    exr_put_f32(file, 1.0f);
+    fputc(0, file);                 /* end of header */
+
+    // -- offset table, one scanline per chunk
+    uint32_t line_size = 4 * (uint32_t)width * channel_count;
+    uint64_t first_chunk = (uint64_t)ftell(file) + 8ull * height;
+    for (int y = 0; y < height; ++y)
+        exr_put_u64(file, first_chunk + (uint64_t)y * (8 + line_size));
+
+    for (int y = 0; y < height; ++y) {
+        exr_put_u32(file, y);
+        exr_put_u32(file, line_size);
+        for (int c = 0; c < channel_count; ++c) {
+            uint32_t const * data = (uint32_t const *)channels[c].data;
+            for (int x = 0; x < width; ++x)
+                exr_put_u32(file, data[((size_t)y * width + x) * channels[c].stride]);
+        }
+    }
+    bool ret = (0 == ferror(file));
+    fclose(file);
+    return ret;
+}
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "scene.h"
+#include "bvh.h"
+#include "triangle_mesh.h"
+
+//
+// two-level instancing, the DXR model on the cpu
+// a bottom-level structure (blas) is a triangle mesh or a cluster of spheres with
+// its own bvh. an instance places a blas in the world with an affine transform; a
+// top-level bvh (tlas) over the instances' world bounds finds the instances a ray
+// can hit, and the ray is moved into each one's object space instead of moving the
+// geometry. copies cost one instance record each, not one copy of the geometry.
+// an instance keeps only the world-to-object transform: a ray is transformed without
+// normalizing its direction, so the hit distance is the same in both spaces and the
+// world position is just ray_at(world ray, t).
+
+/* object ids of instances start here, above the mesh ids and below the plane ids */
+#define scene_instance_id_base (1 << 25)
+#define tlas_max_instances (scene_plane_id_base - scene_instance_id_base)
+
+/* row-major 3x4, the layout of D3D12_RAYTRACING_INSTANCE_DESC::Transform */
+typedef struct {
+    float m[3][4];
+} affine3;
+
+inline affine3
+affine3_identity (void) {
+    affine3 ret = {{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}};
+    return ret;
+}
+/* scale, then rotate about y, then translate */
+inline affine3
+affine3_trs (vec3f translate, float yaw, vec3f scale) {
+    float c = cosf(yaw), s = sinf(yaw);
+    affine3 ret = {{
+        {c * scale.x, 0.0f, s * scale.z, translate.x},
+        {0.0f, scale.y, 0.0f, translate.y},
+        {-s * scale.x, 0.0f, c * scale.z, translate.z}
+    }};
+    return ret;
+}
+inline point3
+affine3_point (affine3 const * a, point3 p) {
+    point3 ret;
+    for (int i = 0; i < 3; ++i)
+        ret.E[i] = a->m[i][0] * p.x + a->m[i][1] * p.y + a->m[i][2] * p.z + a->m[i][3];
+    return ret;
+}
+inline vec3f
+affine3_vector (affine3 const * a, vec3f v) {
+    vec3f ret;
+    for (int i = 0; i < 3; ++i)
+        ret.E[i] = a->m[i][0] * v.x + a->m[i][1] * v.y + a->m[i][2] * v.z;
+    return ret;
+}
+/* normal back to world space with the inverse transpose, given the inverse */
+inline vec3f
+affine3_normal (affine3 const * inverse, vec3f n) {
+    vec3f ret;
+    for (int i = 0; i < 3; ++i)
+        ret.E[i] = inverse->m[0][i] * n.x + inverse->m[1][i] * n.y + inverse->m[2][i] * n.z;
+    return ret;
+}
+/* returns false for a singular transform */
+inline bool
+affine3_inverse (affine3 const * a, affine3 * out) {
+    float const (*m)[4] = a->m;
+    float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+    if (0.0f == det)
+        return false;
+    float inv_det = 1.0f / det;
+    float r[3][3] = {
+        {c00 * inv_det, (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det, (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det},
+        {c01 * inv_det, (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det, (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det},
+        {c02 * inv_det, (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det, (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det}
+    };
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j)
+            out->m[i][j] = r[i][j];
+        out->m[i][3] = -(r[i][0] * m[0][3] + r[i][1] * m[1][3] + r[i][2] * m[2][3]);
+    }
+    return true;
+}
+//
+// bottom level
+typedef enum {
+    BLAS_MESH = 0,
+    BLAS_SPHERES,
+} blas_type;
+
+typedef struct {
+    blas_type type;
+    triangle_mesh * mesh;       /* BLAS_MESH, with its bvh built */
+    scene * spheres;            /* BLAS_SPHERES */
+    bvh * sphere_accel;
+    vec3f bmin, bmax;           /* object space */
+} blas;
+
+inline void
+blas_init_mesh (blas * me, triangle_mesh * mesh) {
+    blas zero = {0};
+    *me = zero;
+    me->type = BLAS_MESH;
+    me->mesh = mesh;
+    if (mesh->accel.node_count) {
+        me->bmin = mesh->accel.nodes[0].bmin;
+        me->bmax = mesh->accel.nodes[0].bmax;
+    }
+}
+inline void
+blas_init_spheres (blas * me, scene * spheres, bvh * sphere_accel) {
+    blas zero = {0};
+    *me = zero;
+    me->type = BLAS_SPHERES;
+    me->spheres = spheres;
+    me->sphere_accel = sphere_accel;
+    if (sphere_accel->node_count) {
+        me->bmin = sphere_accel->nodes[0].bmin;
+        me->bmax = sphere_accel->nodes[0].bmax;
+    }
+}
+/* bytes of geometry and bvh behind a blas */
+inline size_t
+blas_memory_bytes (blas const * me) {
+    if (BLAS_MESH == me->type) {
+        triangle_mesh const * m = me->mesh;
+        return m->vertex_count * sizeof(point3) * (m->normals ? 2 : 1) + 3 * (size_t)m->triangle_count * sizeof(int32_t) +
+            m->accel.node_count * sizeof(bvh_node) + m->accel.prim_count * sizeof(int32_t);
+    }
+    return me->spheres->sphere_count * (4 * sizeof(float) + sizeof(int32_t)) +
+        me->sphere_accel->node_count * sizeof(bvh_node) + me->sphere_accel->prim_count * sizeof(int32_t);
+}
+inline bool
+blas_hit (blas const * me, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    if (BLAS_MESH == me->type)
+        return triangle_mesh_hit(me->mesh, r, tmin, tmax, out_rec);
+    return bvh_scene_hit(me->sphere_accel, me->spheres, r, tmin, tmax, out_rec);
+}
+inline bool
+blas_occluded (blas const * me, ray * r, float tmin, float tmax) {
+    if (BLAS_MESH == me->type)
+        return triangle_mesh_occluded(me->mesh, r, tmin, tmax);
+    return bvh_scene_occluded(me->sphere_accel, me->spheres, r, tmin, tmax);
+}
+//
+// instance
+typedef struct {
+    affine3 world_to_object;
+    blas const * bottom;
+    int32_t object_id;
+} instance;
+
+/* sets the transform; the world bounds of the instance go to out_bmin/out_bmax */
+inline bool
+instance_init (instance * me, blas const * b, affine3 const * object_to_world, int object_id, vec3f * out_bmin, vec3f * out_bmax) {
+    me->bottom = b;
+    me->object_id = object_id;
+    if (!affine3_inverse(object_to_world, &me->world_to_object))
+        return false;
+    vec3f bmin = {INFINITY, INFINITY, INFINITY}, bmax = {-INFINITY, -INFINITY, -INFINITY};
+    for (int k = 0; k < 8; ++k) {
+        point3 corner = {(k & 1) ? b->bmax.x : b->bmin.x, (k & 2) ? b->bmax.y : b->bmin.y, (k & 4) ? b->bmax.z : b->bmin.z};
+        point3 p = affine3_point(object_to_world, corner);
+        bmin = vec3_min(bmin, p);
+        bmax = vec3_max(bmax, p);
+    }
+    *out_bmin = bmin;
+    *out_bmax = bmax;
+    return true;
+}
+inline bool
+instance_hit (instance const * me, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    ray local = {affine3_point(&me->world_to_object, r->origin), affine3_vector(&me->world_to_object, r->dir)};
+    if (!blas_hit(me->bottom, &local, tmin, tmax, out_rec))
+        return false;
+    // -- same t in both spaces; the normal keeps facing the ray (dot products survive the inverse transpose)
+    out_rec->p = ray_at(r, out_rec->t);
+    out_rec->normal = vec3_normalize(affine3_normal(&me->world_to_object, out_rec->normal));
+    out_rec->geometric_normal = vec3_normalize(affine3_normal(&me->world_to_object, out_rec->geometric_normal));
+    out_rec->object_id = me->object_id;
+    return true;
+}
+inline bool
+instance_occluded (instance const * me, ray * r, float tmin, float tmax) {
+    ray local = {affine3_point(&me->world_to_object, r->origin), affine3_vector(&me->world_to_object, r->dir)};
+    return blas_occluded(me->bottom, &local, tmin, tmax);
+}
+//
+// top level
+typedef struct tlas {
+    int instance_count;
+    int instance_capacity;
+    instance * instances;
+    bvh_prim * bounds;          /* world bounds per instance, kept for rebuilds */
+    bvh accel;
+} tlas;
+
+inline void
+tlas_init (tlas * me) {
+    tlas zero = {0};
+    *me = zero;
+}
+inline void
+tlas_free (tlas * me) {
+    free(me->instances);
+    free(me->bounds);
+    bvh_free(&me->accel);
+    tlas_init(me);
+}
+/* returns the instance index, -1 for a singular transform, when out of memory or past tlas_max_instances */
+inline int
+tlas_add_instance (tlas * me, blas const * b, affine3 const * object_to_world) {
+    if (me->instance_count == tlas_max_instances)
+        return -1;      /* the next id would be a plane's */
+    if (me->instance_count == me->instance_capacity) {
+        int capacity = me->instance_capacity ? 2 * me->instance_capacity : 64;
+        instance * instances = realloc(me->instances, capacity * sizeof(instance));
+        if (NULL == instances)
+            return -1;
+        me->instances = instances;
+        bvh_prim * bounds = realloc(me->bounds, capacity * sizeof(bvh_prim));
+        if (NULL == bounds)
+            return -1;
+        me->bounds = bounds;
+        me->instance_capacity = capacity;
+    }
+    int i = me->instance_count;
+    bvh_prim * p = &me->bounds[i];
+    if (!instance_init(&me->instances[i], b, object_to_world, scene_instance_id_base + i, &p->bmin, &p->bmax))
+        return -1;
+    p->centroid = vec3_scale(vec3_add(p->bmin, p->bmax), 0.5f);
+    return me->instance_count++;
+}
+inline bool
+tlas_build (tlas * me) {
+    bvh_free(&me->accel);
+    bvh_prim * prims = malloc(((size_t)me->instance_count + 1) * sizeof(bvh_prim));
+    if (NULL == prims)
+        return false;
+    memcpy(prims, me->bounds, me->instance_count * sizeof(bvh_prim));
+    bool ret = bvh_build(&me->accel, prims, me->instance_count);
+    free(prims);
+    return ret;
+}
+/* moves instance i, the tlas needs a tlas_refit or tlas_build before tracing */
+inline bool
+tlas_set_transform (tlas * me, int i, affine3 const * object_to_world) {
+    instance * inst = &me->instances[i];
+    bvh_prim * p = &me->bounds[i];
+    if (!instance_init(inst, inst->bottom, object_to_world, inst->object_id, &p->bmin, &p->bmax))
+        return false;
+    p->centroid = vec3_scale(vec3_add(p->bmin, p->bmax), 0.5f);
+    return true;
+}
+/* the cpu side of a DXR top-level update (PERFORM_UPDATE): same tree, new bounds */
+inline bool
+tlas_refit (tlas * me) {
+    return bvh_refit(&me->accel, me->bounds);
+}
+inline size_t
+tlas_memory_bytes (tlas const * me) {
+    return me->instance_count * (sizeof(instance) + sizeof(bvh_prim)) +
+        me->accel.node_count * sizeof(bvh_node) + me->accel.prim_count * sizeof(int32_t);
+}
+//
+// closest hit, same traversal as bvh_scene_hit with instances at the leaves
+inline bool
+tlas_hit (tlas * me, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    bvh * accel = &me->accel;
+    if (0 == accel->node_count)
+        return false;
+    vec3f inv_dir = {1.0f / r->dir.x, 1.0f / r->dir.y, 1.0f / r->dir.z};
+    float closest_so_far = tmax;
+    bool hit = false;
+    bvh_stack_entry stack[bvh_stack_size];
+    int sp = 0;
+    int node = 0;
+    if (bvh_node_enter(&accel->nodes[0], r->origin, inv_dir, tmin, tmax) == INFINITY)
+        return false;
+    for (;;) {
+        bvh_node const * n = &accel->nodes[node];
+        if (n->count) {
+            for (int k = n->offset; k < n->offset + n->count; ++k) {
+                if (instance_hit(&me->instances[accel->prim_index[k]], r, tmin, closest_so_far, out_rec)) {
+                    closest_so_far = out_rec->t;
+                    hit = true;
+                }
+            }
+        } else {
+            int c0 = node + 1, c1 = n->offset;
+            float t0 = bvh_node_enter(&accel->nodes[c0], r->origin, inv_dir, tmin, closest_so_far);
+            float t1 = bvh_node_enter(&accel->nodes[c1], r->origin, inv_dir, tmin, closest_so_far);
+            if (t1 < t0) {
+                int ci = c0; c0 = c1; c1 = ci;
+                float tt = t0; t0 = t1; t1 = tt;
+            }
+            if (t0 != INFINITY) {
+                if (t1 != INFINITY)
+                    stack[sp++] = (bvh_stack_entry) {c1, t1};
+                node = c0;
+                continue;
+            }
+        }
+        while (sp > 0 && stack[sp - 1].t > closest_so_far)
+            --sp;
+        if (0 == sp)
+            break;
+        node = stack[--sp].node;
+    }
+    return hit;
+}
+inline bool
+tlas_occluded (tlas * me, ray * r, float tmin, float tmax) {
+    bvh * accel = &me->accel;
+    if (0 == accel->node_count)
+        return false;
+    vec3f inv_dir = {1.0f / r->dir.x, 1.0f / r->dir.y, 1.0f / r->dir.z};
+    int stack[bvh_stack_size];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        bvh_node const * n = &accel->nodes[stack[--sp]];
+        if (bvh_node_enter(n, r->origin, inv_dir, tmin, tmax) == INFINITY)
+            continue;
+        if (n->count) {
+            for (int k = n->offset; k < n->offset + n->count; ++k)
+                if (instance_occluded(&me->instances[accel->prim_index[k]], r, tmin, tmax))
+                    return true;
+        } else {
+            stack[sp++] = n->offset;
+            stack[sp++] = (int)(n - accel->nodes) + 1;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,370 @@
+#pragma once
+
+#include "vec3.h"
+#include "scene.h"
+#include "bvh.h"
+
+//
+// hierarchical light tree (light BVH)
+// every node stores the bounds, total power and normal/emission cone of the
+// emitters below it; sampling descends the tree picking a child with probability
+// proportional to its estimated contribution at the shading point, so a light is
+// chosen in O(log N) instead of uniformly.
+// ref: Conty Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting" (2018)
+
+typedef struct {
+    int sphere;         /* object id of the emitter in the scene */
+    point3 center;
+    float radius;
+    color emit;
+    float power;        /* luminance(emit) * pi * area */
+} light;
+
+typedef struct {
+    vec3f bmin;
+    vec3f bmax;
+    vec3f axis;         /* normal cone axis */
+    float cos_theta_o;  /* spread of the normals around axis */
+    float cos_theta_e;  /* emission spread around each normal (pi/2 for diffuse) */
+    float power;
+    int32_t offset;     /* leaf: light index, interior: index of the second child */
+    int32_t count;      /* leaf: 1, interior: 0 */
+} light_node;
+
+typedef struct {
+    int light_count;
+    light * lights;
+    int node_count;
+    light_node * nodes;
+} light_tree;
+
+//
+// helpers
+inline float
+luminance (color c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+inline float
+safe_acosf (float x) {
+    return acosf(clamp(x, -1.0f, 1.0f));
+}
+//
+// union of two normal cones (returns the new cos_theta_o, writes the new axis)
+inline float
+light_cone_union (vec3f a_axis, float a_cos, vec3f b_axis, float b_cos, vec3f * out_axis) {
+    float theta_a = safe_acosf(a_cos);
+    float theta_b = safe_acosf(b_cos);
+    float theta_d = safe_acosf(vec3_mul_dot(a_axis, b_axis));
+    if (fminf(theta_d + theta_b, g_pi) <= theta_a) {
+        *out_axis = a_axis;
+        return a_cos;
+    }
+    if (fminf(theta_d + theta_a, g_pi) <= theta_b) {
+        *out_axis = b_axis;
+        return b_cos;
+    }
+    float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+    if (theta_o >= g_pi) {
+        *out_axis = a_axis;
+        return -1.0f;
+    }
+    // -- rotate a's axis towards b's axis by theta_r
+    float theta_r = theta_o - theta_a;
+    vec3f wr = vec3_mul_cross(a_axis, b_axis);
+    if (vec3_len_squared(wr) < 1e-12f) {
+        *out_axis = a_axis;
+        return -1.0f;
+    }
+    wr = vec3_normalize(wr);
+    // rodrigues rotation of a_axis around wr
+    vec3f v = a_axis;
+    vec3f k_x_v = vec3_mul_cross(wr, v);
+    *out_axis = vec3_add(vec3_scale(v, cosf(theta_r)), vec3_scale(k_x_v, sinf(theta_r)));
+    return cosf(theta_o);
+}
+inline void
+light_node_merge (light_node * out, light_node const * a, light_node const * b) {
+    out->bmin = vec3_min(a->bmin, b->bmin);
+    out->bmax = vec3_max(a->bmax, b->bmax);
+    out->power = a->power + b->power;
+    out->cos_theta_o = light_cone_union(a->axis, a->cos_theta_o, b->axis, b->cos_theta_o, &out->axis);
+    out->cos_theta_e = fminf(a->cos_theta_e, b->cos_theta_e);
+}
+inline void
+light_node_from_light (light_node * out, light const * l, int index) {
+    vec3f r = {l->radius, l->radius, l->radius};
+    out->bmin = vec3_sub(l->center, r);
+    out->bmax = vec3_add(l->center, r);
+    // a sphere emits along every outward normal: full cone around any axis
+    out->axis = (vec3f) {0.0f, 1.0f, 0.0f};
+    out->cos_theta_o = -1.0f;
+    out->cos_theta_e = 0.0f;    /* cos(pi/2), lambertian emission */
+    out->power = l->power;
+    out->offset = index;
+    out->count = 1;
+}
+//
+// recursive build over lights[first, first+count), binned on the largest centroid axis
+// with cost = power * surface area (the orientation term is constant for sphere lights)
+#define light_tree_bins 12
+inline int
+light_tree_build_recursive (light_tree * me, int first, int count) {
+    int node_index = me->node_count++;
+    if (1 == count) {
+        light_node_from_light(&me->nodes[node_index], &me->lights[first], first);
+        return node_index;
+    }
+    vec3f cmin = me->lights[first].center;
+    vec3f cmax = cmin;
+    for (int i = first + 1; i < first + count; ++i) {
+        cmin = vec3_min(cmin, me->lights[i].center);
+        cmax = vec3_max(cmax, me->lights[i].center);
+    }
+    vec3f extent = vec3_sub(cmax, cmin);
+    int axis = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+
+    int mid = first + count / 2;
+    if (extent.E[axis] > 0.0f) {
+        float bin_power[light_tree_bins] = {0};
+        vec3f bin_min[light_tree_bins];
+        vec3f bin_max[light_tree_bins];
+        int bin_count[light_tree_bins] = {0};
+        for (int b = 0; b < light_tree_bins; ++b) {
+            bin_min[b] = (vec3f) {INFINITY, INFINITY, INFINITY};
+            bin_max[b] = (vec3f) {-INFINITY, -INFINITY, -INFINITY};
+        }
+        float scale = light_tree_bins / extent.E[axis];
+        for (int i = first; i < first + count; ++i) {
+            light * l = &me->lights[i];
+            int b = (int)((l->center.E[axis] - cmin.E[axis]) * scale);
+            b = b < light_tree_bins ? b : light_tree_bins - 1;
+            vec3f r = {l->radius, l->radius, l->radius};
+            bin_min[b] = vec3_min(bin_min[b], vec3_sub(l->center, r));
+            bin_max[b] = vec3_max(bin_max[b], vec3_add(l->center, r));
+            bin_power[b] += l->power;
+            ++bin_count[b];
+        }
+        // -- sweep split candidates
+        float best_cost = INFINITY;
+        int best_split = -1;
+        for (int s = 1; s < light_tree_bins; ++s) {
+            vec3f lmin = {INFINITY, INFINITY, INFINITY}, lmax = {-INFINITY, -INFINITY, -INFINITY};
+            vec3f rmin = lmin, rmax = lmax;
+            float lp = 0.0f, rp = 0.0f;
+            int lc = 0, rc = 0;
+            for (int b = 0; b < s; ++b) {
+                lmin = vec3_min(lmin, bin_min[b]); lmax = vec3_max(lmax, bin_max[b]);
+                lp += bin_power[b]; lc += bin_count[b];
+            }
+            for (int b = s; b < light_tree_bins; ++b) {
+                rmin = vec3_min(rmin, bin_min[b]); rmax = vec3_max(rmax, bin_max[b]);
+                rp += bin_power[b]; rc += bin_count[b];
+            }
+            if (0 == lc || 0 == rc)
+                continue;
+            // NOTE: +1e-6 keeps zero-power clusters from collapsing the cost
+            float cost = (lp + 1e-6f) * aabb_surface_area(lmin, lmax) + (rp + 1e-6f) * aabb_surface_area(rmin, rmax);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = s;
+            }
+        }
+        if (best_split > 0) {
+            // -- partition in place
+            int i = first, j = first + count - 1;
+            while (i <= j) {
+                int b = (int)((me->lights[i].center.E[axis] - cmin.E[axis]) * scale);
+                b = b < light_tree_bins ? b : light_tree_bins - 1;
+                if (b < best_split) {
+                    ++i;
+                } else {
+                    light tmp = me->lights[i];
+                    me->lights[i] = me->lights[j];
+                    me->lights[j] = tmp;
+                    --j;
+                }
+            }
+            mid = i;
+        }
+    }
+    light_tree_build_recursive(me, first, mid - first);
+    int second = light_tree_build_recursive(me, mid, first + count - mid);
+    light_node * node = &me->nodes[node_index];
+    light_node_merge(node, &me->nodes[node_index + 1], &me->nodes[second]);
+    node->offset = second;
+    node->count = 0;
+    return node_index;
+}
+inline void
+light_tree_free (light_tree * me) {
+    free(me->lights);
+    free(me->nodes);
+    me->lights = NULL;
+    me->nodes = NULL;
+    me->light_count = me->node_count = 0;
+}
+//
+// collects every sphere with an emissive material and builds the tree
+// returns the number of lights found, -1 (and an empty tree) when out of memory
+inline int
+light_tree_build (light_tree * me, scene * world) {
+    hit_record probe = {0};
+    probe.front_face = true;
+    me->light_count = 0;
+    me->lights = NULL;
+    me->node_count = 0;
+    me->nodes = NULL;
+    int capacity = 0;
+    for (int i = 0; i < world->sphere_count; ++i) {
+        color emit = material_emitted(world->materials[world->sphere_mat[i]], &probe);
+        float lum = luminance(emit);
+        if (lum <= 0.0f)
+            continue;
+        if (me->light_count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            light * grown = realloc(me->lights, capacity * sizeof(light));
+            if (NULL == grown) {
+                light_tree_free(me);
+                return -1;
+            }
+            me->lights = grown;
+        }
+        light * l = &me->lights[me->light_count++];
+        l->sphere = i;
+        l->center = scene_sphere_center(world, i);
+        l->radius = fabsf(world->radius[i]);
+        l->emit = emit;
+        l->power = lum * g_pi * 4.0f * g_pi * l->radius * l->radius;
+    }
+    if (me->light_count > 0) {
+        me->nodes = malloc((2 * me->light_count - 1) * sizeof(light_node));
+        if (NULL == me->nodes) {
+            light_tree_free(me);
+            return -1;
+        }
+        light_tree_build_recursive(me, 0, me->light_count);
+    }
+    return me->light_count;
+}
+//
+// estimated contribution of a node's emitters at point p with normal n
+inline float
+light_node_importance (light_node const * node, point3 p, vec3f n) {
+    point3 pc = vec3_scale(vec3_add(node->bmin, node->bmax), 0.5f);
+    float d2 = vec3_len_squared(vec3_sub(p, pc));
+    float half_diag2 = 0.25f * vec3_len_squared(vec3_sub(node->bmax, node->bmin));
+    // -- clamp distance (squared, as d2) to the node's extent so nearby clusters are not over-weighted
+    d2 = fmaxf(d2, half_diag2);
+    vec3f wi = vec3_sub(p, pc);
+    float wi_len = vec3_len(wi);
+    if (wi_len > 0.0f)
+        wi = vec3_scale(wi, 1.0f / wi_len);
+
+    // -- angle subtended by the bounding sphere of the node
+    float cos_theta_b = 1.0f;
+    float sin_theta_b = 0.0f;
+    if (wi_len * wi_len > half_diag2) {
+        float sin2 = half_diag2 / (wi_len * wi_len);
+        cos_theta_b = sqrtf(1.0f - sin2);
+        sin_theta_b = sqrtf(sin2);
+    } else {
+        return node->power / d2;    // p inside the bounds, nothing to cull
+    }
+
+    // -- emitter side: cos(max(0, theta_w - theta_o - theta_b))
+    float cos_theta_w = vec3_mul_dot(node->axis, wi);
+    if (node->cos_theta_o > -1.0f) {
+        float sin_theta_w = sqrtf(fmaxf(0.0f, 1.0f - cos_theta_w * cos_theta_w));
+        float sin_theta_o = sqrtf(fmaxf(0.0f, 1.0f - node->cos_theta_o * node->cos_theta_o));
+        // cos(theta_w - theta_o), then subtract theta_b
+        float cos_x = (cos_theta_w > node->cos_theta_o) ? 1.0f : cos_theta_w * node->cos_theta_o + sin_theta_w * sin_theta_o;
+        float sin_x = (cos_theta_w > node->cos_theta_o) ? 0.0f : sin_theta_w * node->cos_theta_o - cos_theta_w * sin_theta_o;
+        float cos_theta_p = (cos_x > cos_theta_b) ? 1.0f : cos_x * cos_theta_b + sin_x * sin_theta_b;
+        if (cos_theta_p <= node->cos_theta_e)
+            return 0.0f;
+    }
+
+    // -- receiver side: cos(max(0, theta_i - theta_b)), theta_i measured towards the node
+    float cos_theta_i = -vec3_mul_dot(n, wi);
+    float sin_theta_i = sqrtf(fmaxf(0.0f, 1.0f - cos_theta_i * cos_theta_i));
+    float cos_theta_ip = (cos_theta_i > cos_theta_b) ? 1.0f : cos_theta_i * cos_theta_b + sin_theta_i * sin_theta_b;
+    cos_theta_ip = fmaxf(cos_theta_ip, 0.0f);
+
+    return node->power * cos_theta_ip / d2;
+}
+//
+// picks one light for the shading point (p, n)
+// u is a uniform number in [0,1), reused while descending
+// returns light index or -1, writes the discrete probability of the pick
+inline int
+light_tree_sample (light_tree * me, point3 p, vec3f n, float u, float * out_pmf) {
+    float pmf = 1.0f;
+    int index = 0;
+    if (0 == me->light_count)
+        return -1;
+    while (0 == me->nodes[index].count) {
+        int left = index + 1;
+        int right = me->nodes[index].offset;
+        float il = light_node_importance(&me->nodes[left], p, n);
+        float ir = light_node_importance(&me->nodes[right], p, n);
+        if (il + ir <= 0.0f)
+            return -1;
+        float pl = il / (il + ir);
+        if (u < pl) {
+            index = left;
+            u = fminf(u / pl, 0.99999994f);
+            pmf *= pl;
+        } else {
+            index = right;
+            u = fminf((u - pl) / (1.0f - pl), 0.99999994f);
+            pmf *= 1.0f - pl;
+        }
+    }
+    *out_pmf = pmf;
+    return me->nodes[index].offset;
+}
+/* reference strategy: uniform light picking */
+inline int
+light_uniform_sample (light_tree * me, float u, float * out_pmf) {
+    if (0 == me->light_count)
+        return -1;
+    int ret = (int)(u * me->light_count);
+    ret = ret < me->light_count ? ret : me->light_count - 1;
+    *out_pmf = 1.0f / me->light_count;
+    return ret;
+}
+//
+// samples a direction towards sphere light l from p (uniform in the subtended cone)
+// returns false if p is inside the light, writes direction, distance to the light and solid angle pdf
+inline bool
+light_sample_sphere (light const * l, point3 p, float u1, float u2, vec3f * out_wi, float * out_dist, float * out_pdf) {
+    vec3f to_c = vec3_sub(l->center, p);
+    float d2 = vec3_len_squared(to_c);
+    float r2 = l->radius * l->radius;
+    if (d2 <= r2)
+        return false;
+    float d = sqrtf(d2);
+    vec3f w = vec3_scale(to_c, 1.0f / d);
+    float sin2_max = r2 / d2;
+    float cos_max = sqrtf(fmaxf(0.0f, 1.0f - sin2_max));
+    // NOTE: 1 - cos_max written as sin2/(1+cos) to keep precision for tiny far lights
+    float one_minus_cos_max = sin2_max / (1.0f + cos_max);
+    float one_minus_cos = u1 * one_minus_cos_max;
+    float cos_theta = 1.0f - one_minus_cos;
+    float sin_theta = sqrtf(fmaxf(0.0f, one_minus_cos * (2.0f - one_minus_cos)));
+    float phi = 2.0f * g_pi * u2;
+
+    // -- orthonormal basis around w
+    vec3f a = fabsf(w.x) > 0.9f ? (vec3f) {0.0f, 1.0f, 0.0f} : (vec3f) {1.0f, 0.0f, 0.0f};
+    vec3f v = vec3_normalize(vec3_mul_cross(w, a));
+    vec3f uu = vec3_mul_cross(w, v);
+    vec3f wi = vec3_add(vec3_scale(w, cos_theta), vec3_add(vec3_scale(uu, sin_theta * cosf(phi)), vec3_scale(v, sin_theta * sinf(phi))));
+
+    // -- distance to the near intersection with the light
+    float b = vec3_mul_dot(wi, to_c);
+    float disc = fmaxf(0.0f, b * b - (d2 - r2));
+    *out_wi = wi;
+    *out_dist = b - sqrtf(disc);
+    *out_pdf = 1.0f / (2.0f * g_pi * one_minus_cos_max);
+    return true;
+}
@@ -2,12 +2,21 @@
 
 #include "vec3.h"
 #include "ray.h"
+#include "ray_stats.h"
 
 struct hit_record;
 
 /* virtual functions in C */
 struct MatVtbl;
 
+/* concrete type behind a material, so scenes can be written back out */
+typedef enum {
+    MATERIAL_LAMBERTIAN = 0,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC,
+    MATERIAL_DIFFUSE_LIGHT,
+} material_type;
+
 typedef struct material {
     struct MatVtbl * vptr;
 } material;
@@ -17,13 +26,40 @@ struct MatVtbl {
     bool (*scatter)(material * me, ray * r_in, hit_record * rec, color * attenuation, ray * r_scatterd);
 
     /* additional virtual functions */
+    // NOTE: optional, NULL means the material does not emit / is a delta (specular) lobe
+    color (*emitted)(material * me, hit_record * rec);
+    color (*eval)(material * me, hit_record * rec, vec3f wi);   /* brdf * cos(wi) */
+
+    material_type type;
 };
 
-/* virtual function stub */
+/* virtual function stubs */
 inline bool
 material_scatter (struct material * me, ray * r_in, hit_record * rec, color * attenuation, ray * r_scatterd) {
     return me->vptr->scatter(me, r_in, rec, attenuation, r_scatterd);
 }
+inline color
+material_emitted (struct material * me, hit_record * rec) {
+    color ret = {0};
+    if (me->vptr->emitted)
+        ret = me->vptr->emitted(me, rec);
+    return ret;
+}
+inline material_type
+material_get_type (struct material * me) {
+    return me->vptr->type;
+}
+inline bool
+material_has_eval (struct material * me) {
+    return (NULL != me->vptr->eval);
+}
+inline color
+material_eval (struct material * me, hit_record * rec, vec3f wi) {
+    color ret = {0};
+    if (me->vptr->eval)
+        ret = me->vptr->eval(me, rec, wi);
+    return ret;
+}
 
 //
 //  Inhertance in C
@@ -53,10 +89,18 @@ lambertian_scatter (material * me, ray * r_in, hit_record * rec, color * attenua
     ret = true;
     return ret;
 }
+inline color
+lambertian_eval (material * me, hit_record * rec, vec3f wi) {
+    lambertian * lamb = (lambertian *)me;  /* explicit downcast */
+    float cos_theta = fmaxf(vec3_mul_dot(rec->normal, wi), 0.0f);
+    return vec3_scale(lamb->albedo, cos_theta / g_pi);
+}
 inline void
 lambertian_init (lambertian * me, color a) {
     static struct MatVtbl vtbl = {  /* lambertian vtable */
-        .scatter = lambertian_scatter
+        .scatter = lambertian_scatter,
+        .eval = lambertian_eval,
+        .type = MATERIAL_LAMBERTIAN
     };
     me->super.vptr = &vtbl;
     me->albedo = a;
@@ -85,7 +129,8 @@ metal_scatter (material * me, ray * r_in, hit_record * rec, color * attenuation,
 inline void
 metal_init (metal * me, color a, float fuzz) {
     static struct MatVtbl vtbl = {  /* metal vtable */
-        .scatter = metal_scatter
+        .scatter = metal_scatter,
+        .type = MATERIAL_METAL
     };
     me->super.vptr = &vtbl;
     me->albedo = a;
@@ -123,10 +168,13 @@ dielectric_scatter (material * me, ray * r_in, hit_record * rec, color * attenua
 
     bool cannot_refract = (refraction_ratio * sin_theta) > 1.0f;
     vec3f direction;
-    if (cannot_refract || (dielectric_reflectance(cos_theta, refraction_ratio) > random_float()))
+    if (cannot_refract || (dielectric_reflectance(cos_theta, refraction_ratio) > random_float())) {
         direction = vec3_reflect(unit_direction, rec->normal);
-    else
+        RAY_STATS_ONLY(if (cannot_refract) RAY_STAT_ADD(dielectric_tir, 1); else RAY_STAT_ADD(dielectric_reflect, 1);)
+    } else {
         direction = vec3_refract(unit_direction, rec->normal, refraction_ratio);
+        RAY_STAT_ADD(dielectric_refract, 1);
+    }
 
     r_scatterd->origin = rec->p;
     r_scatterd->dir = direction;
@@ -136,8 +184,49 @@ dielectric_scatter (material * me, ray * r_in, hit_record * rec, color * attenua
 inline void
 dielectric_init (dielectric * me, float ir) {
     static struct MatVtbl vtbl = {  /* dielectric vtable */
-        .scatter = dielectric_scatter
+        .scatter = dielectric_scatter,
+        .type = MATERIAL_DIELECTRIC
     };
     me->super.vptr = &vtbl;
     me->index_of_refraction = ir;
 }
+//
+// 4. diffuse light (emissive) material
+typedef struct {
+    material super;
+
+    color emit;     /* emitted radiance */
+} diffuse_light;
+//
+// overriding virtual functions
+inline bool
+diffuse_light_scatter (material * me, ray * r_in, hit_record * rec, color * attenuation, ray * r_scatterd) {
+    return false;   // lights absorb, paths terminate on them
+}
+inline color
+diffuse_light_emitted (material * me, hit_record * rec) {
+    diffuse_light * light = (diffuse_light *)me;  /* explicit downcast */
+    color ret = {0};
+    if (rec->front_face)    // one-sided emitter, matches the power used by the light tree
+        ret = light->emit;
+    return ret;
+}
+inline void
+diffuse_light_init (diffuse_light * me, color emit) {
+    static struct MatVtbl vtbl = {  /* diffuse light vtable */
+        .scatter = diffuse_light_scatter,
+        .emitted = diffuse_light_emitted,
+        .type = MATERIAL_DIFFUSE_LIGHT
+    };
+    me->super.vptr = &vtbl;
+    me->emit = emit;
+}
+//
+// room for any of the materials above, for loaders that allocate them in bulk
+typedef union {
+    material super;
+    lambertian lambertian;
+    metal metal;
+    dielectric dielectric;
+    diffuse_light diffuse_light;
+} material_storage;
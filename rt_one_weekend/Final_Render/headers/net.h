@@ -0,0 +1,264 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//
+// sockets
+// blocking stream sockets over tcp or unix domain sockets, named by one address string:
+//   unix:/tmp/render.sock   a unix domain socket (windows 10 has them too)
+//   host:port               tcp, host may be a name; port alone listens on every interface
+// messages are framed by a net_header (type + payload size) in host byte order, so both
+// ends must have the same endianness (as for checkpoints and the scene cache)
+#if defined(_WIN32)
+typedef SOCKET net_socket;
+#define net_invalid INVALID_SOCKET
+#else
+typedef int net_socket;
+#define net_invalid (-1)
+#endif
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;      /* bytes of payload after the header */
+} net_header;
+
+/* once per process, before any other call */
+inline bool
+net_startup (void) {
+#if defined(_WIN32)
+    WSADATA data;
+    return (0 == WSAStartup(MAKEWORD(2, 2), &data));
+#else
+    // -- a write to a peer that died must fail, not kill us
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+inline void
+net_close (net_socket s) {
+    if (net_invalid == s)
+        return;
+#if defined(_WIN32)
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+/* splits "host:port" (or "port"); false for unix addresses */
+inline bool
+net_split_address (char const * address, char * host, size_t host_size, char * port, size_t port_size) {
+    if (0 == strncmp(address, "unix:", 5))
+        return false;
+    char const * colon = strrchr(address, ':');
+    size_t host_len = colon ? (size_t)(colon - address) : 0;
+    if (host_len >= host_size)
+        return false;
+    memcpy(host, address, host_len);
+    host[host_len] = '\0';
+    snprintf(port, port_size, "%s", colon ? colon + 1 : address);
+    return true;
+}
+inline bool
+net_unix_address (char const * address, struct sockaddr_un * out) {
+    memset(out, 0, sizeof(*out));
+    out->sun_family = AF_UNIX;
+    size_t len = strlen(address + 5);
+    if (len >= sizeof(out->sun_path))
+        return false;
+    memcpy(out->sun_path, address + 5, len + 1);
+    return true;
+}
+//
+// a socket accepting connections on address, net_invalid on failure.
+// a unix socket's file is replaced, and should be removed with net_unlink when done
+inline net_socket
+net_listen (char const * address) {
+    net_socket s = net_invalid;
+    if (0 == strncmp(address, "unix:", 5)) {
+        struct sockaddr_un addr;
+        if (!net_unix_address(address, &addr))
+            return net_invalid;
+        remove(addr.sun_path);
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (net_invalid != s && 0 != bind(s, (struct sockaddr *)&addr, sizeof(addr))) {
+            net_close(s);
+            s = net_invalid;
+        }
+    } else {
+        char host[256], port[32];
+        struct addrinfo hints = {0};
+        struct addrinfo * found = NULL;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (!net_split_address(address, host, sizeof(host), port, sizeof(port)) ||
+            0 != getaddrinfo(host[0] ? host : NULL, port, &hints, &found))
+            return net_invalid;
+        for (struct addrinfo * a = found; a && net_invalid == s; a = a->ai_next) {
+            s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (net_invalid == s)
+                continue;
+            int on = 1;
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char const *)&on, sizeof(on));
+            if (0 != bind(s, a->ai_addr, (int)a->ai_addrlen)) {
+                net_close(s);
+                s = net_invalid;
+            }
+        }
+        freeaddrinfo(found);
+    }
+    if (net_invalid != s && 0 != listen(s, 64)) {
+        net_close(s);
+        s = net_invalid;
+    }
+    return s;
+}
+inline void
+net_unlink (char const * address) {
+    struct sockaddr_un addr;
+    if (0 == strncmp(address, "unix:", 5) && net_unix_address(address, &addr))
+        remove(addr.sun_path);
+}
+inline net_socket
+net_connect (char const * address) {
+    net_socket s = net_invalid;
+    if (0 == strncmp(address, "unix:", 5)) {
+        struct sockaddr_un addr;
+        if (!net_unix_address(address, &addr))
+            return net_invalid;
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (net_invalid != s && 0 != connect(s, (struct sockaddr *)&addr, sizeof(addr))) {
+            net_close(s);
+            s = net_invalid;
+        }
+        return s;
+    }
+    char host[256], port[32];
+    struct addrinfo hints = {0};
+    struct addrinfo * found = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (!net_split_address(address, host, sizeof(host), port, sizeof(port)) ||
+        0 != getaddrinfo(host[0] ? host : "127.0.0.1", port, &hints, &found))
+        return net_invalid;
+    for (struct addrinfo * a = found; a && net_invalid == s; a = a->ai_next) {
+        s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (net_invalid != s && 0 != connect(s, a->ai_addr, (int)a->ai_addrlen)) {
+            net_close(s);
+            s = net_invalid;
+        }
+    }
+    freeaddrinfo(found);
+    if (net_invalid != s) {
+        int on = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char const *)&on, sizeof(on));
+    }
+    return s;
+}
+inline net_socket
+net_accept (net_socket listener) {
+    net_socket s = accept(listener, NULL, NULL);
+    if (net_invalid != s) {
+        // -- notices a peer whose machine went away without closing (on tcp; unix sockets ignore both)
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, (char const *)&on, sizeof(on));
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char const *)&on, sizeof(on));
+    }
+    return s;
+}
+/* a receive that waits longer than this fails, so a peer stalled mid-message cannot hang us */
+inline void
+net_set_timeout (net_socket s, double seconds) {
+#if defined(_WIN32)
+    DWORD ms = (DWORD)(seconds * 1000.0);
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char const *)&ms, sizeof(ms));
+#else
+    struct timeval tv = {(time_t)seconds, (suseconds_t)((seconds - (time_t)seconds) * 1e6)};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+}
+//
+// whole buffers; false once the peer is gone (or timed out)
+inline bool
+net_send_all (net_socket s, void const * data, size_t size) {
+    char const * p = (char const *)data;
+    while (size > 0) {
+        int chunk = size > (1u << 30) ? (1 << 30) : (int)size;
+#if defined(MSG_NOSIGNAL)
+        int n = (int)send(s, p, chunk, MSG_NOSIGNAL);
+#else
+        int n = (int)send(s, p, chunk, 0);
+#endif
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+inline bool
+net_recv_all (net_socket s, void * data, size_t size) {
+    char * p = (char *)data;
+    while (size > 0) {
+        int chunk = size > (1u << 30) ? (1 << 30) : (int)size;
+        int n = (int)recv(s, p, chunk, 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+inline bool
+net_send_message (net_socket s, uint32_t type, void const * payload, size_t size) {
+    net_header header = {type, (uint32_t)size};
+    return net_send_all(s, &header, sizeof(header)) && (0 == size || net_send_all(s, payload, size));
+}
+/* the header of the next message; its payload is read separately with net_recv_all */
+inline bool
+net_recv_header (net_socket s, net_header * out) {
+    return net_recv_all(s, out, sizeof(*out));
+}
+//
+// waits up to seconds for any of sockets to be readable; ready[i] is set for those that are.
+// returns how many are, -1 on error
+inline int
+net_wait_readable (net_socket const * sockets, int count, double seconds, bool * ready) {
+    fd_set set;
+    FD_ZERO(&set);
+    net_socket highest = 0;
+    for (int i = 0; i < count; ++i) {
+        ready[i] = false;
+        if (net_invalid == sockets[i])
+            continue;
+        FD_SET(sockets[i], &set);
+        highest = sockets[i] > highest ? sockets[i] : highest;
+    }
+    struct timeval tv = {(long)seconds, (long)((seconds - (long)seconds) * 1e6)};
+    int n = select((int)highest + 1, &set, NULL, NULL, &tv);
+    for (int i = 0; n > 0 && i < count; ++i)
+        ready[i] = (net_invalid != sockets[i] && FD_ISSET(sockets[i], &set));
+    return n;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "scene.h"
+#include "bvh.h"
+#include "progressive.h"
+#include "topology.h"
+
+//
+// numa-aware placement
+// an os puts a page on the node of the thread that first writes it. memory the main
+// thread mallocs and fills (the whole scene, the film) thus sits on one node, and on a
+// multi-socket machine the other sockets' threads read it remotely. here memory is
+// taken in whole pages straight from the os (VirtualAlloc / mmap, untouched) and first
+// written by threads pinned to the node it should live on:
+//   scene     the sphere arrays and the bvh are copied once per node when they are
+//             small (every thread reads its own node's copy), and spread page by page
+//             over all nodes when they are big (every node serves a share of the reads)
+//   film      tiles are handed out by a queue that gives every node a band of tile rows
+//             (stealing from the others when its band is done), and each node writes
+//             the zeros of its band's pixels itself, so the pages of a band live where
+//             it is rendered
+// threads find their node with topology_pin_node. on a single node machine everything
+// still works, there is just nothing to gain.
+#define numa_default_replicate_limit (256u << 20)     /* bytes of scene per copy */
+
+inline size_t
+numa_page_size (void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+/* zeroed pages no thread has touched yet, NULL when out of memory */
+inline void *
+numa_pages_alloc (size_t size) {
+#if defined(_WIN32)
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void * p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (MAP_FAILED == p) ? NULL : p;
+#endif
+}
+inline void
+numa_pages_free (void * p, size_t size) {
+    if (NULL == p)
+        return;
+#if defined(_WIN32)
+    (void)size;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
+}
+//
+// places fresh pages: all of them on node, or round robin over the nodes when node < 0.
+// one thread per node, pinned to it, writes the first byte of each of its pages
+inline void
+numa_first_touch (topology const * topo, void * p, size_t size, int node) {
+    size_t page = numa_page_size();
+    size_t pages = (size + page - 1) / page;
+    int nodes = topo->node_count > 0 ? topo->node_count : 1;
+    int t;
+#pragma omp parallel for num_threads(nodes) schedule(static, 1)
+    for (t = 0; t < nodes; ++t) {
+        if (node >= 0 && t != node)
+            continue;
+        topology_pin(topo, PIN_NUMA, t, nodes);
+        size_t step = node >= 0 ? 1 : (size_t)nodes;
+        for (size_t k = node >= 0 ? 0 : (size_t)t; k < pages; k += step)
+            ((volatile char *)p)[k * page] = 0;
+        topology_pin(topo, PIN_NONE, 0, 1);
+    }
+}
+//
+// scene placement
+// the copies borrow everything but the sphere arrays and the bvh from the source scene
+// (materials, planes, meshes, the light tree are small or have their own bvh), so the
+// source must outlive them; they are released with numa_scene_free, never scene_free
+#define numa_align(x) (((x) + 63) & ~(size_t)63)
+
+typedef struct {
+    bool replicated;        /* one copy per node, else one copy spread over them */
+    int copies;
+    size_t copy_size;       /* bytes */
+    void * blocks[topology_max_nodes];
+    scene worlds[topology_max_nodes];
+    bvh accels[topology_max_nodes];
+} numa_scene;
+
+inline bool
+numa_scene_place (numa_scene * me, topology const * topo, scene * world, bvh * accel, size_t replicate_limit) {
+    memset(me, 0, sizeof(*me));
+    size_t n = world->sphere_count;
+    size_t sphere_bytes = numa_align(n * sizeof(float));
+    size_t size = 4 * sphere_bytes + numa_align(n * sizeof(int32_t)) +
+        numa_align(accel->node_count * sizeof(bvh_node)) + numa_align(accel->prim_count * sizeof(int32_t));
+    int nodes = topo->node_count > 0 ? topo->node_count : 1;
+    me->replicated = (size <= replicate_limit);
+    me->copies = me->replicated ? nodes : 1;
+    me->copy_size = size;
+    for (int c = 0; c < me->copies; ++c) {
+        char * block = numa_pages_alloc(size);
+        if (NULL == block)
+            return false;
+        me->blocks[c] = block;
+        numa_first_touch(topo, block, size, me->replicated ? c : -1);
+        // -- same layout as the source arrays, copied into the placed pages
+        scene * w = &me->worlds[c];
+        *w = *world;
+        w->borrowed = true;
+        w->sphere_capacity = (int)n;
+        w->center_x = (float *)block;
+        w->center_y = (float *)(block + sphere_bytes);
+        w->center_z = (float *)(block + 2 * sphere_bytes);
+        w->radius = (float *)(block + 3 * sphere_bytes);
+        w->sphere_mat = (int32_t *)(block + 4 * sphere_bytes);
+        memcpy(w->center_x, world->center_x, n * sizeof(float));
+        memcpy(w->center_y, world->center_y, n * sizeof(float));
+        memcpy(w->center_z, world->center_z, n * sizeof(float));
+        memcpy(w->radius, world->radius, n * sizeof(float));
+        memcpy(w->sphere_mat, world->sphere_mat, n * sizeof(int32_t));
+        bvh * b = &me->accels[c];
+        *b = *accel;
+        b->borrowed = true;
+        b->nodes = (bvh_node *)(block + 4 * sphere_bytes + numa_align(n * sizeof(int32_t)));
+        b->prim_index = (int32_t *)((char *)b->nodes + numa_align(accel->node_count * sizeof(bvh_node)));
+        memcpy(b->nodes, accel->nodes, accel->node_count * sizeof(bvh_node));
+        memcpy(b->prim_index, accel->prim_index, accel->prim_count * sizeof(int32_t));
+    }
+    return true;
+}
+/* the copy node's threads should read */
+inline int
+numa_scene_copy (numa_scene const * me, int node) {
+    return (me->replicated && node >= 0 && node < me->copies) ? node : 0;
+}
+inline void
+numa_scene_free (numa_scene * me) {
+    for (int c = 0; c < me->copies; ++c)
+        numa_pages_free(me->blocks[c], me->copy_size);
+    memset(me, 0, sizeof(*me));
+}
+//
+// tile queue
+// node k owns tiles [k * n / nodes, (k + 1) * n / nodes) of the row-major grid, a band of
+// tile rows. its threads take them front to back; a node out of work takes from the back
+// of the band with the most tiles left, so the owner keeps its nearby tiles longest.
+// which tile renders where does not change the image, tiles carry their own rng
+typedef struct {
+    int node_count;
+    int first[topology_max_nodes];
+    int next[topology_max_nodes];
+    int end[topology_max_nodes];
+} numa_tile_queue;
+
+inline void
+numa_tile_queue_init (numa_tile_queue * me, tile_grid const * grid, int node_count) {
+    me->node_count = node_count > 0 ? node_count : 1;
+    for (int k = 0; k < me->node_count; ++k) {
+        me->first[k] = (int)((int64_t)k * grid->tile_count / me->node_count);
+        me->end[k] = (int)((int64_t)(k + 1) * grid->tile_count / me->node_count);
+        me->next[k] = me->first[k];
+    }
+}
+/* before every pass, from one thread */
+inline void
+numa_tile_queue_reset (numa_tile_queue * me, tile_grid const * grid) {
+    numa_tile_queue_init(me, grid, me->node_count);
+}
+/* the next tile for a thread of node, -1 once the pass is done */
+inline int
+numa_tile_queue_next (numa_tile_queue * me, int node) {
+    int ret = -1;
+    node = (node >= 0 && node < me->node_count) ? node : 0;
+#pragma omp critical(numa_tile_queue)
+    {
+        if (me->next[node] < me->end[node]) {
+            ret = me->next[node]++;
+        } else {
+            int victim = -1;
+            for (int k = 0; k < me->node_count; ++k)
+                if (me->end[k] - me->next[k] > 0 && (victim < 0 || me->end[k] - me->next[k] > me->end[victim] - me->next[victim]))
+                    victim = k;
+            if (victim >= 0)
+                ret = --me->end[victim];
+        }
+    }
+    return ret;
+}
+//
+// a film whose pixels are first written by the node whose band of tiles they are in;
+// release with numa_film_free
+inline bool
+numa_film_alloc (film * fb, topology const * topo, tile_grid const * grid, numa_tile_queue const * queue, int width, int height) {
+    size_t count = (size_t)width * height;
+    fb->width = width;
+    fb->height = height;
+    fb->sum = numa_pages_alloc(count * sizeof(color));
+    fb->lum_sq = numa_pages_alloc(count * sizeof(float));
+    if (NULL == fb->sum || NULL == fb->lum_sq)
+        return false;
+    int nodes = queue->node_count;
+    int t;
+#pragma omp parallel for num_threads(nodes) schedule(static, 1)
+    for (t = 0; t < nodes; ++t) {
+        topology_pin(topo, PIN_NUMA, t, nodes);
+        for (int ti = queue->first[t]; ti < queue->end[t]; ++ti) {
+            tile const * tl = &grid->tiles[ti];
+            for (int row = tl->y0; row < tl->y1; ++row) {
+                memset(&fb->sum[(size_t)row * width + tl->x0], 0, (tl->x1 - tl->x0) * sizeof(color));
+                memset(&fb->lum_sq[(size_t)row * width + tl->x0], 0, (tl->x1 - tl->x0) * sizeof(float));
+            }
+        }
+        topology_pin(topo, PIN_NONE, 0, 1);
+    }
+    return true;
+}
+inline void
+numa_film_free (film * fb) {
+    size_t count = (size_t)fb->width * fb->height;
+    numa_pages_free(fb->sum, count * sizeof(color));
+    numa_pages_free(fb->lum_sq, count * sizeof(float));
+    fb->sum = NULL;
+    fb->lum_sq = NULL;
+}
@@ -0,0 +1,434 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vec3.h"
+#include "scene_file.h"
+#include "triangle_mesh.h"
+
+//
+// wavefront OBJ loader
+// the file is streamed in blocks; every block is cut into chunks at line ends that
+// are parsed in parallel in two passes: the first counts vertices, normals and
+// triangles per chunk, a prefix sum gives each chunk its output offsets, the second
+// writes straight into the shared arrays. only the block being parsed is in memory
+// besides the mesh itself.
+// supported: v, vn and f with v, v/vt, v//vn and v/vt/vn corners (negative = relative),
+// polygons are fan triangulated. everything else (vt, groups, materials) is skipped.
+#define obj_block_size (32 << 20)
+#define obj_chunk_size (1 << 20)
+
+typedef struct {
+    char const * begin;
+    char const * end;           /* one past the chunk's last '\n' */
+    int64_t vertex_count;
+    int64_t normal_count;
+    int64_t triangle_count;
+    int line_count;
+    int error_line;             /* chunk-local, 0 = no error */
+    char const * error;
+} obj_chunk;
+
+typedef struct {
+    int64_t vertex_count, vertex_capacity;
+    point3 * positions;
+    int64_t normal_count, normal_capacity;
+    vec3f * normals;
+    int64_t triangle_count, triangle_capacity;
+    int32_t * corner_v;         /* 3 per triangle, 0-based */
+    int32_t * corner_n;         /* 3 per triangle, -1 without normal */
+} obj_arrays;
+
+#define obj_is_blank(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+
+inline char const *
+obj_skip_blank (char const * p) {
+    while (obj_is_blank(*p))
+        ++p;
+    return p;
+}
+inline char const *
+obj_next_line (char const * p) {
+    while (*p != '\n' && *p != '\0')
+        ++p;
+    return (*p == '\n') ? p + 1 : p;
+}
+/* statement keyword of a line: 'v', 'n' (vn), 'f' or 0 for anything skipped */
+inline char
+obj_statement (char const ** p) {
+    char const * s = obj_skip_blank(*p);
+    char kind = 0;
+    if (s[0] == 'v' && obj_is_blank(s[1])) {
+        kind = 'v';
+        s += 1;
+    } else if (s[0] == 'v' && s[1] == 'n' && obj_is_blank(s[2])) {
+        kind = 'n';
+        s += 2;
+    } else if (s[0] == 'f' && obj_is_blank(s[1])) {
+        kind = 'f';
+        s += 1;
+    }
+    *p = s;
+    return kind;
+}
+//
+// pass 1
+inline void
+obj_count_chunk (obj_chunk * me) {
+    char const * p = me->begin;
+    while (p < me->end) {
+        char kind = obj_statement(&p);
+        if ('v' == kind) {
+            ++me->vertex_count;
+        } else if ('n' == kind) {
+            ++me->normal_count;
+        } else if ('f' == kind) {
+            int corners = 0;
+            for (p = obj_skip_blank(p); *p != '\n' && *p != '#'; p = obj_skip_blank(p)) {
+                ++corners;
+                while (!lexer_is_delimiter(*p))
+                    ++p;
+            }
+            me->triangle_count += corners > 2 ? corners - 2 : 0;
+        }
+        p = obj_next_line(p);
+        ++me->line_count;
+    }
+}
+//
+// one index of a face corner, turned 0-based; count is the number of elements
+// defined so far (the base of negative indices)
+inline bool
+obj_parse_index (char const ** p, int64_t count, int32_t * out) {
+    char const * s = *p;
+    bool negative = false;
+    if (*s == '-' || *s == '+')
+        negative = (*s++ == '-');
+    if (!lexer_is_digit(*s))
+        return false;
+    int64_t value = 0;
+    for (; lexer_is_digit(*s); ++s)
+        if (value <= INT32_MAX)
+            value = value * 10 + (*s - '0');
+    int64_t index = negative ? count - value : value - 1;
+    if (0 == value || index < 0 || index > INT32_MAX)
+        return false;
+    *out = (int32_t)index;
+    *p = s;
+    return true;
+}
+inline bool
+obj_parse_corner (char const ** p, int64_t vertex_count, int64_t normal_count, int32_t * out_v, int32_t * out_n) {
+    char const * s = *p;
+    int32_t vt;
+    *out_n = -1;
+    if (!obj_parse_index(&s, vertex_count, out_v))
+        return false;
+    if (*s == '/') {
+        ++s;
+        if (*s != '/' && !obj_parse_index(&s, INT32_MAX, &vt))    /* texture coordinates are not kept */
+            return false;
+        if (*s == '/') {
+            ++s;
+            if (!obj_parse_index(&s, normal_count, out_n))
+                return false;
+        }
+    }
+    if (!lexer_is_delimiter(*s))
+        return false;
+    *p = s;
+    return true;
+}
+//
+// pass 2: the chunk's first vertex/normal/triangle go to the given offsets
+inline void
+obj_parse_chunk (obj_chunk * me, obj_arrays * out, int64_t v, int64_t vn, int64_t tri) {
+    scene_lexer lx = {0};
+    char const * p = me->begin;
+    int line = 1;
+    while (p < me->end && NULL == me->error) {
+        char kind = obj_statement(&p);
+        if ('v' == kind || 'n' == kind) {
+            float xyz[3];
+            lx.cur = p;
+            if (lexer_float(&lx, &xyz[0]) && lexer_float(&lx, &xyz[1]) && lexer_float(&lx, &xyz[2])) {
+                vec3f e = {xyz[0], xyz[1], xyz[2]};
+                if ('v' == kind)
+                    out->positions[v++] = e;
+                else
+                    out->normals[vn++] = e;
+                p = lx.cur;
+            } else {
+                me->error = ('v' == kind) ? "malformed vertex" : "malformed normal";
+            }
+        } else if ('f' == kind) {
+            int32_t first_v = -1, first_n = -1, prev_v = -1, prev_n = -1;
+            int corners = 0;
+            for (p = obj_skip_blank(p); *p != '\n' && *p != '#' && NULL == me->error; p = obj_skip_blank(p)) {
+                int32_t cv, cn;
+                if (!obj_parse_corner(&p, v, vn, &cv, &cn)) {
+                    me->error = "malformed face corner";
+                    break;
+                }
+                if (0 == corners) {
+                    first_v = cv; first_n = cn;
+                } else if (corners >= 2) {
+                    int32_t * tv = &out->corner_v[3 * tri];
+                    int32_t * tn = &out->corner_n[3 * tri];
+                    tv[0] = first_v; tv[1] = prev_v; tv[2] = cv;
+                    tn[0] = first_n; tn[1] = prev_n; tn[2] = cn;
+                    ++tri;
+                }
+                prev_v = cv; prev_n = cn;
+                ++corners;
+            }
+        }
+        if (me->error) {
+            me->error_line = line;
+            break;
+        }
+        p = obj_next_line(p);
+        ++line;
+    }
+}
+inline bool
+obj_grow (void ** array, int64_t * capacity, int64_t needed, size_t element_size) {
+    if (needed <= *capacity)
+        return true;
+    int64_t cap = *capacity ? 2 * *capacity : 1024;
+    while (cap < needed)
+        cap *= 2;
+    void * p = realloc(*array, (size_t)cap * element_size);
+    if (NULL == p)
+        return false;
+    *array = p;
+    *capacity = cap;
+    return true;
+}
+//
+// parses one block of whole lines (text[size] must be '\0'); line is the number
+// of the block's first line in the file
+inline bool
+obj_parse_block (char const * text, size_t size, obj_arrays * out, int * line, scene_file_error * out_error) {
+    int chunk_count = 0;
+    obj_chunk chunks[obj_block_size / obj_chunk_size + 2];
+    for (size_t start = 0; start < size; ++chunk_count) {
+        size_t end = start + obj_chunk_size;
+        if (end >= size) {
+            end = size;
+        } else {
+            char const * nl = memchr(text + end, '\n', size - end);
+            end = nl ? (size_t)(nl - text) + 1 : size;
+        }
+        obj_chunk zero = {0};
+        chunks[chunk_count] = zero;
+        chunks[chunk_count].begin = text + start;
+        chunks[chunk_count].end = text + end;
+        start = end;
+    }
+    int k;
+#pragma omp parallel for schedule(dynamic)
+    for (k = 0; k < chunk_count; ++k)
+        obj_count_chunk(&chunks[k]);
+
+    int64_t v_base[obj_block_size / obj_chunk_size + 2], vn_base[obj_block_size / obj_chunk_size + 2];
+    int64_t tri_base[obj_block_size / obj_chunk_size + 2];
+    int64_t v = out->vertex_count, vn = out->normal_count, tri = out->triangle_count;
+    for (k = 0; k < chunk_count; ++k) {
+        v_base[k] = v; vn_base[k] = vn; tri_base[k] = tri;
+        v += chunks[k].vertex_count;
+        vn += chunks[k].normal_count;
+        tri += chunks[k].triangle_count;
+    }
+    if (v > INT32_MAX || tri > INT32_MAX / 3 ||
+        !obj_grow((void **)&out->positions, &out->vertex_capacity, v, sizeof(point3)) ||
+        !obj_grow((void **)&out->normals, &out->normal_capacity, vn, sizeof(vec3f)) ||
+        !obj_grow((void **)&out->corner_v, &out->triangle_capacity, tri, 3 * sizeof(int32_t))) {
+        out_error->line = *line;
+        out_error->message = "mesh too large";
+        return false;
+    }
+    /* corner_n follows corner_v's capacity */
+    int32_t * corner_n = realloc(out->corner_n, (size_t)out->triangle_capacity * 3 * sizeof(int32_t));
+    if (NULL == corner_n) {
+        out_error->line = *line;
+        out_error->message = "mesh too large";
+        return false;
+    }
+    out->corner_n = corner_n;
+#pragma omp parallel for schedule(dynamic)
+    for (k = 0; k < chunk_count; ++k)
+        obj_parse_chunk(&chunks[k], out, v_base[k], vn_base[k], tri_base[k]);
+
+    for (k = 0; k < chunk_count; ++k) {
+        if (chunks[k].error) {
+            out_error->line = *line + chunks[k].error_line - 1;
+            out_error->message = chunks[k].error;
+            return false;
+        }
+        *line += chunks[k].line_count;
+    }
+    out->vertex_count = v;
+    out->normal_count = vn;
+    out->triangle_count = tri;
+    return true;
+}
+//
+// turns the per-corner (position, normal) pairs into shared vertices: each distinct
+// pair becomes one vertex of the mesh, found through an open-addressing hash table
+inline bool
+obj_weld_normals (obj_arrays * in, triangle_mesh * mesh) {
+    int64_t corners = 3 * in->triangle_count;
+    int64_t table_size = 1;
+    while (table_size < 2 * corners)
+        table_size *= 2;
+    int32_t * table = malloc((size_t)table_size * sizeof(int32_t));
+    int32_t * key_v = malloc((size_t)(corners + 1) * sizeof(int32_t));
+    int32_t * key_n = malloc((size_t)(corners + 1) * sizeof(int32_t));
+    mesh->indices = malloc((size_t)(corners + 1) * sizeof(int32_t));
+    bool ok = table && key_v && key_n && mesh->indices;
+    int32_t count = 0;
+    if (ok) {
+        memset(table, 0xff, (size_t)table_size * sizeof(int32_t));
+        for (int64_t c = 0; c < corners; ++c) {
+            int32_t cv = in->corner_v[c], cn = in->corner_n[c];
+            uint64_t h = ((uint64_t)(uint32_t)cv * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)(uint32_t)cn * 0xc2b2ae3d27d4eb4full);
+            int64_t slot = (int64_t)((h ^ (h >> 32)) & (uint64_t)(table_size - 1));
+            while (table[slot] >= 0 && !(key_v[table[slot]] == cv && key_n[table[slot]] == cn))
+                slot = (slot + 1) & (table_size - 1);
+            if (table[slot] < 0) {
+                key_v[count] = cv;
+                key_n[count] = cn;
+                table[slot] = count++;
+            }
+            mesh->indices[c] = table[slot];
+        }
+        mesh->positions = malloc(((size_t)count + 1) * sizeof(point3));
+        mesh->normals = malloc(((size_t)count + 1) * sizeof(vec3f));
+        ok = mesh->positions && mesh->normals;
+    }
+    if (ok) {
+        int32_t i;
+        vec3f none = {0};      /* corners without a normal fall back to the geometric one */
+#pragma omp parallel for
+        for (i = 0; i < count; ++i) {
+            mesh->positions[i] = in->positions[key_v[i]];
+            mesh->normals[i] = key_n[i] >= 0 ? vec3_normalize(in->normals[key_n[i]]) : none;
+        }
+        mesh->vertex_count = count;
+    } else {
+        // -- nothing half-built is left in the mesh
+        free(mesh->indices);
+        free(mesh->positions);
+        free(mesh->normals);
+        mesh->indices = NULL;
+        mesh->positions = NULL;
+        mesh->normals = NULL;
+    }
+    free(table);
+    free(key_v);
+    free(key_n);
+    return ok;
+}
+//
+// loads path into mesh (initialized with triangle_mesh_init) and builds its bvh
+inline bool
+obj_load (char const * path, triangle_mesh * mesh, scene_file_error * out_error) {
+    scene_file_error unused;
+    out_error = out_error ? out_error : &unused;
+    out_error->line = 0;
+    out_error->message = NULL;
+    FILE * file = fopen(path, "rb");
+    if (NULL == file) {
+        out_error->message = "could not open file";
+        return false;
+    }
+    obj_arrays arrays = {0};
+    char * block = malloc(obj_block_size + 2);
+    bool ok = (NULL != block);
+    int line = 1;
+    size_t carry = 0;
+    while (ok) {
+        size_t n = fread(block + carry, 1, obj_block_size - carry, file);
+        size_t size = carry + n;
+        bool last = (n == 0) || feof(file);
+        // -- parse up to the last complete line, the rest is carried into the next block
+        size_t whole = size;
+        if (!last) {
+            while (whole > 0 && block[whole - 1] != '\n')
+                --whole;
+            if (0 == whole) {
+                out_error->line = line;
+                out_error->message = "line too long";
+                ok = false;
+                break;
+            }
+        } else if (size > 0 && block[size - 1] != '\n') {
+            block[whole++] = '\n';
+        }
+        char saved = block[whole];
+        block[whole] = '\0';
+        ok = obj_parse_block(block, whole, &arrays, &line, out_error);
+        block[whole] = saved;
+        if (last)
+            break;
+        carry = size - whole;
+        memmove(block, block + whole, carry);
+    }
+    if (ok && ferror(file)) {
+        out_error->message = "could not read file";
+        ok = false;
+    }
+    fclose(file);
+    free(block);
+
+    // -- indices may point forward in the file, so they are checked once everything is read
+    int64_t bad = 0;
+    int c;
+    int corners = (int)(3 * arrays.triangle_count);
+#pragma omp parallel for reduction(+:bad)
+    for (c = 0; c < (ok ? corners : 0); ++c)
+        bad += (arrays.corner_v[c] >= arrays.vertex_count) || (arrays.corner_n[c] >= arrays.normal_count);
+    if (ok && bad) {
+        out_error->message = "face index out of range";
+        ok = false;
+    }
+    if (ok && arrays.normal_count > 0) {
+        ok = obj_weld_normals(&arrays, mesh);
+        free(arrays.corner_v);
+        free(arrays.positions);
+    } else if (ok) {
+        mesh->positions = arrays.positions;
+        mesh->vertex_count = (int)arrays.vertex_count;
+        mesh->indices = arrays.corner_v;
+    } else {
+        free(arrays.corner_v);
+        free(arrays.positions);
+    }
+    free(arrays.corner_n);
+    free(arrays.normals);
+    if (ok) {
+        mesh->triangle_count = (int)arrays.triangle_count;
+        ok = triangle_mesh_build_bvh(mesh);
+        if (!ok)
+            out_error->message = "out of memory";
+    } else if (NULL == out_error->message) {
+        out_error->message = "out of memory";
+    }
+    return ok;
+}
+//
+// writes the mesh's positions and triangles (no normals) as OBJ; %.9g round-trips a float
+inline bool
+obj_save (char const * path, triangle_mesh const * mesh) {
+    FILE * file = fopen(path, "w");
+    if (NULL == file)
+        return false;
+    for (int i = 0; i < mesh->vertex_count; ++i)
+        fprintf(file, "v %.9g %.9g %.9g\n", mesh->positions[i].x, mesh->positions[i].y, mesh->positions[i].z);
+    for (int t = 0; t < mesh->triangle_count; ++t)
+        fprintf(file, "f %d %d %d\n", mesh->indices[3 * t] + 1, mesh->indices[3 * t + 1] + 1, mesh->indices[3 * t + 2] + 1);
+    return (0 == fclose(file));
+}
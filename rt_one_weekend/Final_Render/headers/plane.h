@@ -0,0 +1,103 @@
+#pragma once
+
+#include "hittable.h"
+#include "ray.h"
+
+//
+// infinite planes and bounded quads (parallelograms)
+// a ground plane has no useful bounding box, so planes stay out of the bvh and are
+// tested on their own next to it (a handful at most). the book's radius-1000 ground
+// sphere instead puts a box around everything at the top of the tree and costs every
+// ray a quadratic with terms around 1e6.
+// intersection: t = dot(n, origin - o) / dot(n, d), where origin - o is exact when the
+// ray starts near the plane's own point (and Sterbenz-exact for an axis-aligned one).
+// the hit point is then put back on the plane along n, so its error no longer grows
+// with t: an axis-aligned ground gets its height exactly, whatever the scene's scale
+#define scene_plane_id_base (1 << 26)
+
+typedef struct {
+    hittable super;
+
+    point3 origin;      /* a point on the plane, the quad's corner */
+    vec3f normal;       /* unit, cross(edge_u, edge_v) for a quad */
+    vec3f edge_u;       /* quad edges, zero for an infinite plane */
+    vec3f edge_v;
+    vec3f w;            /* cross(u, v) / |cross(u, v)|^2, gives the quad coordinates */
+    bool bounded;
+    struct material * mat_ptr;
+    int material_id;
+} plane;
+
+/* returns t in (tmin, tmax), or tmax for a miss */
+inline float
+plane_intersect (plane const * me, ray * r, float tmin, float tmax) {
+    float denom = vec3_mul_dot(me->normal, r->dir);
+    if (denom == 0.0f)
+        return tmax;    /* parallel */
+    float t = vec3_mul_dot(me->normal, vec3_sub(me->origin, r->origin)) / denom;
+    if (!(t > tmin && t < tmax))
+        return tmax;    /* also catches nan */
+    if (me->bounded) {
+        vec3f planar = vec3_sub(ray_at(r, t), me->origin);
+        float alpha = vec3_mul_dot(me->w, vec3_mul_cross(planar, me->edge_v));
+        float beta = vec3_mul_dot(me->w, vec3_mul_cross(me->edge_u, planar));
+        if (alpha < 0.0f || alpha > 1.0f || beta < 0.0f || beta > 1.0f)
+            return tmax;
+    }
+    return t;
+}
+inline void
+plane_fill_record (plane const * me, ray * r, float t, hit_record * out_rec) {
+    out_rec->t = t;
+    point3 p = ray_at(r, t);
+    // -- snap the point onto the plane
+    float off = vec3_mul_dot(me->normal, vec3_sub(p, me->origin));
+    out_rec->p = vec3_sub(p, vec3_scale(me->normal, off));
+    for (int a = 0; a < 3; ++a)
+        if (me->normal.E[a] == 1.0f || me->normal.E[a] == -1.0f)
+            out_rec->p.E[a] = me->origin.E[a];
+    record_set_normal(out_rec, r, me->normal);
+    out_rec->mat_ptr = me->mat_ptr;
+    out_rec->material_id = me->material_id;
+}
+inline bool
+plane_hit (hittable * me, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    plane * pl = (plane *)me;  /* explicit downcast */
+    float t = plane_intersect(pl, r, tmin, tmax);
+    if (t >= tmax)
+        return false;
+    plane_fill_record(pl, r, t, out_rec);
+    return true;
+}
+inline void
+plane_set_vtable (plane * me) {
+    static struct HitVtbl vtbl = {  /* plane vtable */
+        .hit = plane_hit
+    };
+    me->super.vptr = &vtbl;
+}
+/* the infinite plane through p with normal n (need not be unit) */
+inline void
+plane_init (plane * me, point3 p, vec3f n, struct material * mat) {
+    plane_set_vtable(me);
+    me->origin = p;
+    me->normal = vec3_normalize(n);
+    me->edge_u = me->edge_v = me->w = (vec3f) {0};
+    me->bounded = false;
+    me->mat_ptr = mat;
+    me->material_id = 0;
+}
+/* the parallelogram corner + a*u + b*v, a, b in [0, 1]; it faces cross(u, v) */
+inline void
+quad_init (plane * me, point3 corner, vec3f u, vec3f v, struct material * mat) {
+    plane_set_vtable(me);
+    vec3f n = vec3_mul_cross(u, v);
+    me->origin = corner;
+    me->normal = vec3_normalize(n);
+    me->edge_u = u;
+    me->edge_v = v;
+    me->w = vec3_scale(n, 1.0f / vec3_len_squared(n));
+    me->bounded = true;
+    me->mat_ptr = mat;
+    me->material_id = 0;
+}
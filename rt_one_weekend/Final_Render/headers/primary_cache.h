@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+
+//
+// primary-hit cache
+// with a pinhole camera (aperture 0) a camera ray depends only on where in the pixel it
+// starts. the samples of a pixel are then spread over strata x strata fixed sub-pixel
+// positions (stratum centers, in turn) instead of random jitter, and the first hit of
+// each position is traced once and kept: every later sample, in this pass or the next,
+// starts its path from the stored hit. the hit point is recomputed from the (identical)
+// ray and t, so an entry holds t, the facing normal and the ids.
+// entries are filled lazily by the tile that owns the pixel, so there are no races
+
+typedef struct {
+    float t;                    /* primary_hit_untraced, INFINITY for a miss */
+    vec3f normal;
+    vec3f geometric_normal;
+    struct material * mat_ptr;
+    int32_t material_id;
+    uint32_t object_id : 31;
+    uint32_t front_face : 1;
+} primary_hit;
+
+#define primary_hit_untraced (-1.0f)
+
+typedef struct {
+    int width;
+    int height;
+    int strata;         /* per axis, strata * strata positions per pixel */
+    primary_hit * hits; /* [pixel][stratum] */
+} primary_cache;
+
+inline bool
+primary_cache_init (primary_cache * me, int width, int height, int strata) {
+    size_t count = (size_t)width * height * strata * strata;
+    me->width = width;
+    me->height = height;
+    me->strata = strata;
+    me->hits = malloc(count * sizeof(primary_hit));
+    if (NULL == me->hits)
+        return false;
+    for (size_t i = 0; i < count; ++i)
+        me->hits[i].t = primary_hit_untraced;
+    return true;
+}
+inline void
+primary_cache_free (primary_cache * me) {
+    free(me->hits);
+    me->hits = NULL;
+}
+/* the slot of sample s (counted over all passes) of pixel k, and its offset within the pixel */
+inline primary_hit *
+primary_cache_slot (primary_cache * me, int k, int s, float * out_du, float * out_dv) {
+    int stratum = s % (me->strata * me->strata);
+    *out_du = (stratum % me->strata + 0.5f) / me->strata;
+    *out_dv = (stratum / me->strata + 0.5f) / me->strata;
+    return &me->hits[(size_t)k * me->strata * me->strata + stratum];
+}
+inline void
+primary_hit_store (primary_hit * me, bool hit, hit_record const * rec) {
+    if (!hit) {
+        me->t = INFINITY;
+        return;
+    }
+    me->t = rec->t;
+    me->normal = rec->normal;
+    me->geometric_normal = rec->geometric_normal;
+    me->mat_ptr = rec->mat_ptr;
+    me->material_id = rec->material_id;
+    me->object_id = (uint32_t)rec->object_id;
+    me->front_face = rec->front_face;
+}
+/* false for a miss */
+inline bool
+primary_hit_load (primary_hit const * me, ray * r, hit_record * out_rec) {
+    if (me->t == INFINITY)
+        return false;
+    out_rec->t = me->t;
+    out_rec->p = ray_at(r, me->t);
+    out_rec->normal = me->normal;
+    out_rec->geometric_normal = me->geometric_normal;
+    out_rec->mat_ptr = me->mat_ptr;
+    out_rec->material_id = me->material_id;
+    out_rec->object_id = (int)me->object_id;
+    out_rec->front_face = me->front_face;
+    return true;
+}
+/* camera rays traced into the cache so far; every other primary sample reused one */
+inline int64_t
+primary_cache_traced (primary_cache const * me) {
+    size_t count = (size_t)me->width * me->height * me->strata * me->strata;
+    int64_t ret = 0;
+    for (size_t i = 0; i < count; ++i)
+        ret += (me->hits[i].t != primary_hit_untraced);
+    return ret;
+}
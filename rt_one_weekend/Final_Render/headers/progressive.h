@@ -0,0 +1,424 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <omp.h>
+#include "vec3.h"
+#include "camera.h"
+#include "render.h"
+#include "aov.h"
+#include "trace.h"
+
+//
+// progressive rendering
+// the image is rendered in passes of a few samples per pixel over a grid of tiles.
+// every tile owns its rng state and sample count, so a pass can stop at any tile
+// (time budget) and a run can be checkpointed and resumed bit-exactly
+// (given the same pass size, which fixes how the tile consumes its rng stream).
+
+/* accumulated (not yet averaged) radiance */
+typedef struct {
+    int width;
+    int height;
+    color * sum;        /* sum of radiance samples */
+    float * lum_sq;     /* sum of squared luminance, for the variance of the estimate */
+} film;
+
+typedef struct {
+    int x0, y0;         /* [x0,x1) x [y0,y1), rows top to bottom */
+    int x1, y1;
+    int spp;            /* samples taken so far by every pixel of the tile */
+    int converged;      /* set once error drops below the threshold, the tile is then skipped */
+    float error;        /* estimated relative error of the tile's pixels, see tile_update_error */
+    uint64_t rng_state;
+} tile;
+
+typedef struct {
+    int tile_size;
+    int tiles_x;
+    int tiles_y;
+    int tile_count;
+    tile * tiles;
+} tile_grid;
+
+inline bool
+film_alloc (film * me, int width, int height) {
+    me->width = width;
+    me->height = height;
+    me->sum = calloc((size_t)width * height, sizeof(color));
+    me->lum_sq = calloc((size_t)width * height, sizeof(float));
+    return (me->sum && me->lum_sq);
+}
+inline void
+film_free (film * me) {
+    free(me->sum);
+    free(me->lum_sq);
+    me->sum = NULL;
+    me->lum_sq = NULL;
+}
+inline bool
+tile_grid_init (tile_grid * me, int width, int height, int tile_size, uint64_t seed) {
+    me->tile_size = tile_size;
+    me->tiles_x = (width + tile_size - 1) / tile_size;
+    me->tiles_y = (height + tile_size - 1) / tile_size;
+    me->tile_count = me->tiles_x * me->tiles_y;
+    me->tiles = calloc(me->tile_count, sizeof(tile));
+    if (NULL == me->tiles)
+        return false;
+    for (int ty = 0; ty < me->tiles_y; ++ty) {
+        for (int tx = 0; tx < me->tiles_x; ++tx) {
+            tile * t = &me->tiles[ty * me->tiles_x + tx];
+            t->x0 = tx * tile_size;
+            t->y0 = ty * tile_size;
+            t->x1 = (t->x0 + tile_size < width) ? t->x0 + tile_size : width;
+            t->y1 = (t->y0 + tile_size < height) ? t->y0 + tile_size : height;
+            t->spp = 0;
+            t->converged = 0;
+            t->error = FLT_MAX;
+            t->rng_state = random_hash_seed(seed, ty * me->tiles_x + tx);
+        }
+    }
+    return true;
+}
+inline void
+tile_grid_free (tile_grid * me) {
+    free(me->tiles);
+    me->tiles = NULL;
+    me->tile_count = 0;
+}
+//
+// adds pass_spp samples to every pixel of the tile
+// aovs may be NULL (or have no layers) to skip feature capture.
+// with ctx->primary the samples sit on its strata and start from the cached first hits.
+// the camera rays of a row (pixel by pixel, pass_spp each) are made in one batch, the
+// lens positions coming from the camera's low-discrepancy table
+inline void
+render_tile_pass (render_context * ctx, camera * cam, film * fb, aov_buffers * aovs, tile * t, int pass_spp) {
+    bool capture = (aovs && aovs->flags);
+    primary_cache * cache = ctx->primary;
+    int n = (t->x1 - t->x0) * pass_spp;
+    float * film_s = malloc(2 * (size_t)n * sizeof(float));
+    float * film_t = film_s + n;
+    uint32_t * lens = malloc((size_t)n * sizeof(uint32_t));
+    primary_hit ** slots = malloc((size_t)n * sizeof(primary_hit *));
+    ray_batch batch;
+    if (NULL == film_s || NULL == lens || NULL == slots || !ray_batch_alloc(&batch, n)) {
+        fprintf(stderr, "render_tile_pass: out of memory\n");
+        exit(1);
+    }
+    random_set_state(t->rng_state);
+    for (int row = t->y0; row < t->y1; ++row) {
+        int j = fb->height - 1 - row;
+        int m = 0;
+        for (int i = t->x0; i < t->x1; ++i) {
+            int k = row * fb->width + i;
+            for (int s = 0; s < pass_spp; ++s, ++m) {
+                float du, dv;
+                slots[m] = NULL;
+                if (cache) {
+                    slots[m] = primary_cache_slot(cache, k, t->spp + s, &du, &dv);
+                } else {
+                    du = random_float();
+                    dv = random_float();
+                }
+                film_s[m] = (float)(i + du) / (fb->width - 1);
+                film_t[m] = (float)(j + dv) / (fb->height - 1);
+                lens[m] = camera_lens_index((uint32_t)k, (uint32_t)(t->spp + s));
+            }
+        }
+        camera_cast_rays(cam, film_s, film_t, lens, n, &batch);
+        m = 0;
+        for (int i = t->x0; i < t->x1; ++i) {
+            int k = row * fb->width + i;
+            color px = {0};
+            float px_lum_sq = 0.0f;
+            for (int s = 0; s < pass_spp; ++s, ++m) {
+                ray r = ray_batch_get(&batch, m);
+                color c;
+                if (capture) {
+                    aov_sample smp = {0};
+                    c = ray_trace_path(ctx, r, slots[m], &smp);
+                    aov_add_sample(aovs, k, t->spp + s, &smp, cam->origin, vec3_negate(cam->w));
+                } else {
+                    c = ray_trace_path(ctx, r, slots[m], NULL);
+                }
+                px = vec3_add(px, c);
+                float l = luminance(c);
+                px_lum_sq += l * l;
+            }
+            fb->sum[k] = vec3_add(fb->sum[k], px);
+            fb->lum_sq[k] += px_lum_sq;
+        }
+    }
+    ray_batch_free(&batch);
+    free(slots);
+    free(lens);
+    free(film_s);
+    t->spp += pass_spp;
+    t->rng_state = random_get_state();
+}
+//
+// convergence
+// per-pixel relative standard error of the mean luminance, sqrt(var / n) / (mean + 0.1)
+// (the offset keeps dark pixels from never converging), combined as the RMS over the tile.
+// a tile is converged once it has min_spp samples and its error is below threshold;
+// threshold 0 disables it
+inline void
+tile_update_error (film * fb, tile * t, float threshold, int min_spp) {
+    if (t->spp < 2) {
+        t->error = FLT_MAX;
+        return;
+    }
+    float inv = 1.0f / t->spp;
+    double err_sq = 0.0;
+    for (int row = t->y0; row < t->y1; ++row) {
+        for (int i = t->x0; i < t->x1; ++i) {
+            int k = row * fb->width + i;
+            float mean_lum = luminance(fb->sum[k]) * inv;
+            float var = fmaxf(0.0f, fb->lum_sq[k] * inv - mean_lum * mean_lum) / (t->spp - 1);
+            err_sq += var / ((mean_lum + 0.1f) * (mean_lum + 0.1f));
+        }
+    }
+    t->error = (float)sqrt(err_sq / ((t->x1 - t->x0) * (t->y1 - t->y0)));
+    t->converged = (threshold > 0.0f && t->spp >= min_spp && t->error < threshold);
+}
+//
+// fills out_order with the tiles that still need samples, noisiest first, so when the
+// time budget runs out the remaining samples went where they mattered most.
+// returns the count
+inline int
+tile_grid_active (tile_grid * me, int max_spp, int * out_order) {
+    int n = 0;
+    for (int ti = 0; ti < me->tile_count; ++ti)
+        if (me->tiles[ti].spp < max_spp && !me->tiles[ti].converged)
+            out_order[n++] = ti;
+    /* insertion sort: stable (deterministic) and the list is short */
+    for (int a = 1; a < n; ++a) {
+        int ti = out_order[a];
+        int b = a;
+        for (; b > 0 && me->tiles[out_order[b - 1]].error < me->tiles[ti].error; --b)
+            out_order[b] = out_order[b - 1];
+        out_order[b] = ti;
+    }
+    return n;
+}
+//
+// the tile scheduler
+// one pass over the tiles order[0, count) (every tile of the grid when order is NULL):
+// each gets pass_spp more samples, fewer where that would take it past max_spp, and the
+// threads take the tiles one at a time as they free up, so there is no fork/join per
+// pixel and a slow tile holds up only its own thread. the loop is an orphaned omp for:
+// called in a parallel region it shares the tiles among the region's threads, which may
+// set themselves up first (pin, pick a context), and returns on all of them once the
+// pass is done; called outside of one it renders every tile on this thread.
+// converged tiles are skipped, and so are tiles whose turn comes after the deadline once
+// they have had a pass: every tile gets its first samples however short the budget, so
+// none is left black, and the others keep a consistent (if lower) sample count
+#define tile_pass_budget_spp 4     /* pass size under a deadline, so a pass is short to finish */
+
+typedef struct {
+    cache_line_aligned double busy;     /* seconds in the thread's tiles */
+    int64_t rays;
+    int tiles;
+} tile_thread_stats;
+
+typedef struct {
+    int const * order;
+    int count;
+    int max_spp;
+    int pass_spp;
+    bool update_error;          /* tile_update_error after every tile, with threshold and min_spp */
+    float threshold;
+    int min_spp;
+    double deadline;            /* omp_get_wtime() past which tiles are skipped, 0 for none */
+    bool progress;              /* tiles remaining on stderr */
+    int done;                   /* tiles of the pass rendered so far, with progress */
+    tile_thread_stats * stats;  /* added to, one per thread of the region; may be NULL */
+} tile_pass;
+
+inline void
+tile_pass_init (tile_pass * me, int max_spp, int pass_spp) {
+    memset(me, 0, sizeof(*me));
+    me->max_spp = max_spp;
+    me->pass_spp = pass_spp;
+}
+/* tile ti's share of the pass, for schedulers of their own (numa.h's queue) */
+inline void
+render_pass_tile (render_context * ctx, camera * cam, film * fb, aov_buffers * aovs, tile_grid * grid, tile_pass * pass, int ti) {
+    tile * t = &grid->tiles[ti];
+    int n = pass->max_spp - t->spp;
+    if (n <= 0 || t->converged || (pass->deadline > 0.0 && t->spp > 0 && omp_get_wtime() > pass->deadline))
+        return;
+    tile_thread_stats * mine = pass->stats ? &pass->stats[omp_get_thread_num()] : NULL;
+    double t0 = mine ? omp_get_wtime() : 0.0;
+    int64_t before = g_rays_traced;
+    trace_scope span = trace_begin_arg("tile", ti);
+    render_tile_pass(ctx, cam, fb, aovs, t, n < pass->pass_spp ? n : pass->pass_spp);
+    if (pass->update_error)
+        tile_update_error(fb, t, pass->threshold, pass->min_spp);
+    trace_end(&span);
+    if (mine) {
+        mine->rays += g_rays_traced - before;
+        mine->busy += omp_get_wtime() - t0;
+        ++mine->tiles;
+    }
+    if (pass->progress) {
+#pragma omp critical
+        {
+            ++pass->done;
+            fprintf(stderr, "\rTiles remaining in pass: %d ", (pass->order ? pass->count : grid->tile_count) - pass->done);
+        }
+    }
+}
+inline void
+render_tiles_pass (render_context * ctx, camera * cam, film * fb, aov_buffers * aovs, tile_grid * grid, tile_pass * pass) {
+    int count = pass->order ? pass->count : grid->tile_count;
+    int a;
+#pragma omp for schedule(dynamic)
+    for (a = 0; a < count; ++a)
+        render_pass_tile(ctx, cam, fb, aovs, grid, pass, pass->order ? pass->order[a] : a);
+}
+//
+// per-tile report, one csv row per tile
+inline void
+tile_grid_report (tile_grid * me, FILE * out) {
+    fprintf(out, "tile,x0,y0,x1,y1,spp,error,converged\n");
+    for (int ti = 0; ti < me->tile_count; ++ti) {
+        tile * t = &me->tiles[ti];
+        fprintf(out, "%d,%d,%d,%d,%d,%d,%g,%d\n", ti, t->x0, t->y0, t->x1, t->y1, t->spp,
+            t->error == FLT_MAX ? -1.0 : t->error, t->converged);
+    }
+}
+//
+// mean radiance of every pixel (each tile has its own sample count)
+// out_lum_var (variance of the mean luminance) and aovs may be NULL; aovs are resolved in place
+inline void
+film_resolve (film * fb, tile_grid * grid, color * out_mean, float * out_lum_var, aov_buffers * aovs) {
+    for (int ti = 0; ti < grid->tile_count; ++ti) {
+        tile * t = &grid->tiles[ti];
+        float inv = t->spp > 0 ? 1.0f / t->spp : 0.0f;
+        for (int row = t->y0; row < t->y1; ++row) {
+            for (int i = t->x0; i < t->x1; ++i) {
+                int k = row * fb->width + i;
+                out_mean[k] = vec3_scale(fb->sum[k], inv);
+                if (out_lum_var) {
+                    float mean_lum = luminance(out_mean[k]);
+                    out_lum_var[k] = (t->spp > 1) ?
+                        fmaxf(0.0f, fb->lum_sq[k] * inv - mean_lum * mean_lum) / (t->spp - 1) :
+                        mean_lum * mean_lum;
+                }
+                if (aovs && aovs->flags)
+                    aov_resolve_pixel(aovs, k, inv);
+            }
+        }
+    }
+}
+//
+// checkpoints
+// layout (little-endian, as written by the host):
+//   checkpoint_header
+//   tile  [tile_count]            sample count, convergence + rng state per tile
+//   color sum[w*h], float lum_sq[w*h]
+//   aov planes present in aov_flags, in aov_buffers member order (sums, not resolved)
+#define checkpoint_magic 0x4b435452u     /* "RTCK" */
+#define checkpoint_version 2u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t scene_key;     /* caller's hash of everything that changes the image */
+    int32_t width;
+    int32_t height;
+    int32_t tile_size;
+    int32_t tile_count;
+    uint32_t aov_flags;
+    uint32_t reserved;
+} checkpoint_header;
+
+inline size_t
+checkpoint_aov_planes (aov_buffers * aovs, float ** out_planes, int32_t ** out_ids) {
+    size_t n = 0;
+    if (aovs) {
+        for (int c = 0; c < 3; ++c)
+            if (aovs->albedo[c]) out_planes[n++] = aovs->albedo[c];
+        for (int c = 0; c < 3; ++c)
+            if (aovs->normal[c]) out_planes[n++] = aovs->normal[c];
+        if (aovs->depth) out_planes[n++] = aovs->depth;
+        out_ids[0] = aovs->material_id;
+        out_ids[1] = aovs->object_id;
+    } else {
+        out_ids[0] = out_ids[1] = NULL;
+    }
+    return n;
+}
+//
+// writes to path.tmp first and renames, so a crash mid-write keeps the previous checkpoint
+inline bool
+checkpoint_write (char const * path, uint64_t scene_key, film * fb, tile_grid * grid, aov_buffers * aovs) {
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE * file = fopen(tmp_path, "wb");
+    if (NULL == file)
+        return false;
+    checkpoint_header header = {
+        .magic = checkpoint_magic,
+        .version = checkpoint_version,
+        .scene_key = scene_key,
+        .width = fb->width,
+        .height = fb->height,
+        .tile_size = grid->tile_size,
+        .tile_count = grid->tile_count,
+        .aov_flags = aovs ? aovs->flags : 0
+    };
+    size_t count = (size_t)fb->width * fb->height;
+    float * planes[7];
+    int32_t * ids[2];
+    size_t plane_count = checkpoint_aov_planes(aovs, planes, ids);
+    bool ok = (1 == fwrite(&header, sizeof(header), 1, file));
+    ok = ok && (grid->tile_count == (int)fwrite(grid->tiles, sizeof(tile), grid->tile_count, file));
+    ok = ok && (count == fwrite(fb->sum, sizeof(color), count, file));
+    ok = ok && (count == fwrite(fb->lum_sq, sizeof(float), count, file));
+    for (size_t p = 0; p < plane_count; ++p)
+        ok = ok && (count == fwrite(planes[p], sizeof(float), count, file));
+    for (int p = 0; p < 2; ++p)
+        if (ids[p])
+            ok = ok && (count == fwrite(ids[p], sizeof(int32_t), count, file));
+    ok = (0 == fclose(file)) && ok;
+    if (ok) {
+        remove(path);   /* rename does not replace on win32 */
+        ok = (0 == rename(tmp_path, path));
+    }
+    return ok;
+}
+//
+// restores tiles, film and aovs; everything must already be allocated with the same
+// size, tile size and aov layers, and scene_key must match
+inline bool
+checkpoint_read (char const * path, uint64_t scene_key, film * fb, tile_grid * grid, aov_buffers * aovs) {
+    FILE * file = fopen(path, "rb");
+    if (NULL == file)
+        return false;
+    checkpoint_header header;
+    size_t count = (size_t)fb->width * fb->height;
+    float * planes[7];
+    int32_t * ids[2];
+    size_t plane_count = checkpoint_aov_planes(aovs, planes, ids);
+    bool ok = (1 == fread(&header, sizeof(header), 1, file)) &&
+        header.magic == checkpoint_magic && header.version == checkpoint_version &&
+        header.scene_key == scene_key && header.width == fb->width && header.height == fb->height &&
+        header.tile_size == grid->tile_size && header.tile_count == grid->tile_count &&
+        header.aov_flags == (aovs ? aovs->flags : 0);
+    ok = ok && (grid->tile_count == (int)fread(grid->tiles, sizeof(tile), grid->tile_count, file));
+    ok = ok && (count == fread(fb->sum, sizeof(color), count, file));
+    ok = ok && (count == fread(fb->lum_sq, sizeof(float), count, file));
+    for (size_t p = 0; p < plane_count; ++p)
+        ok = ok && (count == fread(planes[p], sizeof(float), count, file));
+    for (int p = 0; p < 2; ++p)
+        if (ids[p])
+            ok = ok && (count == fread(ids[p], sizeof(int32_t), count, file));
+    fclose(file);
+    return ok;
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "vec3.h"
 
 typedef struct {
@@ -15,4 +18,75 @@ ray_at (ray * r, float t) {
     point3 P = vec3_add(r->origin, tB);
     return P;
 }
+//
+// a batch of rays as SoA arrays (x, y, z of the origins, then of the directions),
+// filled by camera_cast_rays
+typedef struct {
+    int count;
+    int capacity;
+    float * origin[3];
+    float * dir[3];
+} ray_batch;
+
+inline bool
+ray_batch_alloc (ray_batch * me, int capacity) {
+    me->count = 0;
+    me->capacity = capacity;
+    float * block = malloc(6 * (size_t)capacity * sizeof(float));
+    for (int a = 0; a < 3; ++a) {
+        me->origin[a] = block ? block + a * (size_t)capacity : NULL;
+        me->dir[a] = block ? block + (3 + a) * (size_t)capacity : NULL;
+    }
+    return (NULL != block);
+}
+inline void
+ray_batch_free (ray_batch * me) {
+    free(me->origin[0]);
+    for (int a = 0; a < 3; ++a)
+        me->origin[a] = me->dir[a] = NULL;
+    me->count = me->capacity = 0;
+}
+inline ray
+ray_batch_get (ray_batch const * me, int k) {
+    ray ret = {
+        {me->origin[0][k], me->origin[1][k], me->origin[2][k]},
+        {me->dir[0][k], me->dir[1][k], me->dir[2][k]}
+    };
+    return ret;
+}
+//
+// spawning rays off a surface
+// a computed hit point is off the true surface by a few ulps of its own coordinates, so
+// a fixed tmin (0.001, "Fixing Shadow Acne") is too big near the origin (light leaks at
+// contacts) and too small once coordinates reach 1e4..1e6 (acne). instead the point is
+// pushed along the geometric normal by a fixed number of ulps per coordinate, integer
+// arithmetic on the float bits, which scales with the point's own precision; near zero,
+// where ulps shrink to nothing, a small fixed offset takes over. spawned rays use tmin 0.
+// ref: Waechter, Binder, "A Fast and Robust Method for Avoiding Self-Intersection" (Ray Tracing Gems, ch. 6)
+#define ray_origin_threshold (1.0f / 32.0f)
+#define ray_offset_float_scale (1.0f / 65536.0f)
+#define ray_offset_int_scale 256.0f
 
+/* n points to the side the new ray leaves into */
+inline point3
+ray_offset_origin (point3 p, vec3f n) {
+    point3 ret;
+    for (int a = 0; a < 3; ++a) {
+        int32_t of = (int32_t)(ray_offset_int_scale * n.E[a]);
+        int32_t bits;
+        memcpy(&bits, &p.E[a], sizeof(bits));
+        bits += (p.E[a] < 0.0f) ? -of : of;
+        float moved;
+        memcpy(&moved, &bits, sizeof(moved));
+        ret.E[a] = fabsf(p.E[a]) < ray_origin_threshold ? p.E[a] + ray_offset_float_scale * n.E[a] : moved;
+    }
+    return ret;
+}
+/* a ray leaving the surface at p with normal n (either orientation) along dir */
+inline ray
+ray_spawn (point3 p, vec3f n, vec3f dir) {
+    if (vec3_mul_dot(n, dir) < 0.0f)
+        n = vec3_negate(n);
+    ray ret = {ray_offset_origin(p, n), dir};
+    return ret;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+//
+// ray statistics
+// where the time goes: path lengths, how paths end, traversal work per ray, what the
+// dielectrics do. compiled in only with RAY_STATS defined (/DRAY_STATS, -DRAY_STATS);
+// without it the RAY_STAT_* macros are empty and the counters cost nothing.
+// every thread counts into its own slot, padded to whole cache lines so no two threads
+// ever write the same line, and ray_stats_merge adds the slots up after the render
+#define ray_stats_length_bins 65    /* 0..63 segments, then 64 or more */
+#define ray_stats_test_bins 24      /* 0, 1, 2-3, 4-7 ... sphere tests */
+
+typedef struct {
+    int64_t paths;                  /* ray_trace_path calls, one per camera sample */
+    int64_t segments;               /* closest-hit lookups along the paths (cached primary hits included) */
+    int64_t ends_escaped;           /* paths that left the scene */
+    int64_t ends_absorbed;          /* scatter returned false: emitters, metal scattered below the surface */
+    int64_t closest_rays;           /* render_hit queries */
+    int64_t shadow_rays;            /* render_occluded queries */
+    int64_t bvh_nodes;              /* nodes visited by the sphere bvh */
+    int64_t sphere_tests;           /* ray-sphere intersections, closest-hit and shadow rays */
+    int64_t dielectric_reflect;     /* reflected by the fresnel term */
+    int64_t dielectric_tir;         /* total internal reflection */
+    int64_t dielectric_refract;
+    int64_t path_length[ray_stats_length_bins];
+    int64_t tests_per_ray[ray_stats_test_bins];     /* closest-hit rays only */
+} ray_stats;
+
+/* the bucket of n in tests_per_ray */
+inline int
+ray_stats_log2_bin (int64_t n) {
+    int bin = 0;
+    while (n > 0 && bin < ray_stats_test_bins - 1) {
+        n >>= 1;
+        ++bin;
+    }
+    return bin;
+}
+
+#if defined(RAY_STATS)
+#define ray_stats_max_threads 256   /* threads past this share the last slot (and may lose counts) */
+
+typedef struct {
+    ray_stats s;
+    char pad[64 - sizeof(ray_stats) % 64];
+} ray_stats_slot;
+
+static cache_line_aligned ray_stats_slot g_ray_stats[ray_stats_max_threads];
+static int g_ray_stats_threads = 0;
+static thread_local_var ray_stats * g_ray_stats_local = NULL;
+
+/* the calling thread's counters, a slot is handed out on first use */
+inline ray_stats *
+ray_stats_local (void) {
+    if (NULL == g_ray_stats_local) {
+#pragma omp critical(ray_stats_slots)
+        {
+            int slot = g_ray_stats_threads < ray_stats_max_threads ? g_ray_stats_threads++ : ray_stats_max_threads - 1;
+            g_ray_stats_local = &g_ray_stats[slot].s;
+        }
+    }
+    return g_ray_stats_local;
+}
+#define RAY_STAT_ADD(field, n) (ray_stats_local()->field += (n))
+#define RAY_STATS_ONLY(code) code
+#else
+#define RAY_STAT_ADD(field, n) ((void)0)
+#define RAY_STATS_ONLY(code)
+#endif
+
+inline bool
+ray_stats_enabled (void) {
+#if defined(RAY_STATS)
+    return true;
+#else
+    return false;
+#endif
+}
+/* all threads' counters summed into out; zeros when compiled out */
+inline void
+ray_stats_merge (ray_stats * out) {
+    memset(out, 0, sizeof(ray_stats));
+#if defined(RAY_STATS)
+    int64_t * sum = (int64_t *)out;
+    for (int t = 0; t < ray_stats_max_threads; ++t) {
+        int64_t const * c = (int64_t const *)&g_ray_stats[t].s;
+        for (size_t f = 0; f < sizeof(ray_stats) / sizeof(int64_t); ++f)
+            sum[f] += c[f];
+    }
+#endif
+}
+inline void
+ray_stats_reset (void) {
+#if defined(RAY_STATS)
+    for (int t = 0; t < ray_stats_max_threads; ++t)
+        memset(&g_ray_stats[t].s, 0, sizeof(ray_stats));
+#endif
+}
+//
+// output
+inline double
+ray_stats_ratio (int64_t a, int64_t b) {
+    return b ? (double)a / b : 0.0;
+}
+inline void
+ray_stats_histogram (FILE * out, int64_t const * bins, int count, bool log2_buckets) {
+    int64_t peak = 1;
+    int last = 0;
+    int64_t total = 0;
+    for (int b = 0; b < count; ++b) {
+        peak = bins[b] > peak ? bins[b] : peak;
+        last = bins[b] ? b : last;
+        total += bins[b];
+    }
+    for (int b = 0; b <= last; ++b) {
+        char label[32];
+        if (!log2_buckets)
+            snprintf(label, sizeof(label), b == count - 1 ? "%d+" : "%d", b);
+        else if (b <= 1)
+            snprintf(label, sizeof(label), "%d", b);
+        else
+            snprintf(label, sizeof(label), b == count - 1 ? "%lld+" : "%lld-%lld", 1ll << (b - 1), (1ll << b) - 1);
+        int bar = (int)(50 * bins[b] / peak);
+        fprintf(out, "  %9s %12lld %6.2f%% ", label, (long long)bins[b], 100.0 * ray_stats_ratio(bins[b], total));
+        for (int k = 0; k < bar; ++k)
+            fputc('#', out);
+        fputc('\n', out);
+    }
+}
+inline void
+ray_stats_report (ray_stats const * st, FILE * out) {
+    int64_t cut = st->paths - st->ends_escaped - st->ends_absorbed;
+    int64_t dielectric = st->dielectric_reflect + st->dielectric_tir + st->dielectric_refract;
+    fprintf(out, "ray stats:\n");
+    fprintf(out, "  paths           %12lld  %.2f segments per path\n", (long long)st->paths,
+        ray_stats_ratio(st->segments, st->paths));
+    fprintf(out, "  path ends       escaped %.2f%%  absorbed %.2f%%  max_depth %.2f%%\n",
+        100.0 * ray_stats_ratio(st->ends_escaped, st->paths), 100.0 * ray_stats_ratio(st->ends_absorbed, st->paths),
+        100.0 * ray_stats_ratio(cut, st->paths));
+    fprintf(out, "  rays            %12lld closest-hit, %lld shadow\n", (long long)st->closest_rays, (long long)st->shadow_rays);
+    fprintf(out, "  per ray         %.2f bvh nodes, %.2f sphere tests\n",
+        ray_stats_ratio(st->bvh_nodes, st->closest_rays + st->shadow_rays),
+        ray_stats_ratio(st->sphere_tests, st->closest_rays + st->shadow_rays));
+    fprintf(out, "  dielectric      %12lld scatters: reflect %.2f%%  total internal %.2f%%  refract %.2f%%\n",
+        (long long)dielectric, 100.0 * ray_stats_ratio(st->dielectric_reflect, dielectric),
+        100.0 * ray_stats_ratio(st->dielectric_tir, dielectric), 100.0 * ray_stats_ratio(st->dielectric_refract, dielectric));
+    fprintf(out, "segments per path:\n");
+    ray_stats_histogram(out, st->path_length, ray_stats_length_bins, false);
+    fprintf(out, "sphere tests per closest-hit ray:\n");
+    ray_stats_histogram(out, st->tests_per_ray, ray_stats_test_bins, true);
+}
+/* both histograms as csv: histogram,bin,count */
+inline void
+ray_stats_write_csv (ray_stats const * st, FILE * out) {
+    fprintf(out, "histogram,bin,count\n");
+    for (int b = 0; b < ray_stats_length_bins; ++b)
+        fprintf(out, "segments_per_path,%d,%lld\n", b, (long long)st->path_length[b]);
+    for (int b = 0; b < ray_stats_test_bins; ++b)
+        fprintf(out, "sphere_tests_per_ray,%lld,%lld\n", b ? 1ll << (b - 1) : 0ll, (long long)st->tests_per_ray[b]);
+}
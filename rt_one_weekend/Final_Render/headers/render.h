@@ -0,0 +1,221 @@
+#pragma once
+
+#include "vec3.h"
+#include "ray.h"
+#include "scene.h"
+#include "material.h"
+#include "light_tree.h"
+#include "bvh.h"
+#include "triangle_mesh.h"
+#include "instance.h"
+#include "aov.h"
+#include "primary_cache.h"
+
+//
+// how shadow rays pick an emitter
+typedef enum {
+    LIGHT_SAMPLING_NONE = 0,    /* pure path tracing, lights are only found by chance */
+    LIGHT_SAMPLING_UNIFORM,
+    LIGHT_SAMPLING_TREE,
+} light_sampling;
+
+typedef struct {
+    scene * world;
+    bvh * accel;                /* may be NULL, then the spheres are scanned linearly */
+    light_tree * lights;        /* may be NULL */
+    light_sampling light_mode;
+    int max_depth;
+    float sky_scale;            /* 1 for the book's sky, 0 for a night scene */
+    primary_cache * primary;    /* may be NULL; only valid for a pinhole camera */
+} render_context;
+
+inline void
+render_context_init (render_context * me, scene * world, light_tree * lights, int max_depth) {
+    me->world = world;
+    me->accel = NULL;
+    me->lights = lights;
+    me->light_mode = (lights && lights->light_count > 0) ? LIGHT_SAMPLING_TREE : LIGHT_SAMPLING_NONE;
+    me->max_depth = max_depth;
+    me->sky_scale = 1.0f;
+    me->primary = NULL;
+}
+//
+// linearly blend color1 and color2 based on t parameter
+inline color
+blend_lin (color c1, color c2, float t) {
+    color ret;
+
+    c1 = vec3_scale(c1, (1.0f - t));
+    c2 = vec3_scale(c2, t);
+
+    ret = vec3_add(c1, c2);
+    return ret;
+}
+//
+// rays traced by this thread so far, closest-hit and shadow queries alike (for benchmarks)
+static thread_local_var int64_t g_rays_traced = 0;
+
+//
+// spheres first, then the planes, every mesh and the instances with the interval shrunk
+// to the closest hit so far
+inline bool
+render_hit (render_context * ctx, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    ++g_rays_traced;
+    RAY_STAT_ADD(closest_rays, 1);
+    RAY_STATS_ONLY(int64_t tests_before = ray_stats_local()->sphere_tests;)
+    bool hit = ctx->accel ? bvh_scene_hit(ctx->accel, ctx->world, r, tmin, tmax, out_rec)
+                          : scene_hit(ctx->world, r, tmin, tmax, out_rec);
+    if (scene_planes_hit(ctx->world, r, tmin, hit ? out_rec->t : tmax, out_rec))
+        hit = true;
+    for (int m = 0; m < ctx->world->mesh_count; ++m)
+        if (triangle_mesh_hit(ctx->world->meshes[m], r, tmin, hit ? out_rec->t : tmax, out_rec))
+            hit = true;
+    if (ctx->world->instances && tlas_hit(ctx->world->instances, r, tmin, hit ? out_rec->t : tmax, out_rec))
+        hit = true;
+    RAY_STATS_ONLY(RAY_STAT_ADD(tests_per_ray[ray_stats_log2_bin(ray_stats_local()->sphere_tests - tests_before)], 1);)
+    return hit;
+}
+inline bool
+render_occluded (render_context * ctx, ray * r, float tmin, float tmax) {
+    ++g_rays_traced;
+    RAY_STAT_ADD(shadow_rays, 1);
+    if (ctx->accel ? bvh_scene_occluded(ctx->accel, ctx->world, r, tmin, tmax) : scene_occluded(ctx->world, r, tmin, tmax))
+        return true;
+    if (scene_planes_occluded(ctx->world, r, tmin, tmax))
+        return true;
+    for (int m = 0; m < ctx->world->mesh_count; ++m)
+        if (triangle_mesh_occluded(ctx->world->meshes[m], r, tmin, tmax))
+            return true;
+    return ctx->world->instances && tlas_occluded(ctx->world->instances, r, tmin, tmax);
+}
+inline color
+sky_color (ray * r) {
+    // bg: blend white and blue based on ray.y
+    vec3f unit_dir = vec3_normalize(r->dir);
+    float wt = 0.5f * (unit_dir.y + 1.0f);
+    color white = {1.0f, 1.0f, 1.0f};
+    color blue = {.5f, .7f, 1.0f};
+    return blend_lin(white, blue, wt);
+}
+//
+// next event estimation: one shadow ray towards a light picked by ctx->light_mode
+inline color
+sample_direct_light (render_context * ctx, hit_record * rec) {
+    color ret = {0};
+    float pmf = 0.0f;
+    int li = -1;
+    if (LIGHT_SAMPLING_TREE == ctx->light_mode)
+        li = light_tree_sample(ctx->lights, rec->p, rec->normal, random_float(), &pmf);
+    else
+        li = light_uniform_sample(ctx->lights, random_float(), &pmf);
+    if (li < 0 || pmf <= 0.0f)
+        return ret;
+
+    light * l = &ctx->lights->lights[li];
+    vec3f wi;
+    float dist, pdf;
+    if (!light_sample_sphere(l, rec->p, random_float(), random_float(), &wi, &dist, &pdf))
+        return ret;
+    color f = material_eval(rec->mat_ptr, rec, wi);
+    if (f.x + f.y + f.z <= 0.0f)
+        return ret;
+    ray shadow = ray_spawn(rec->p, rec->geometric_normal, wi);
+    if (render_occluded(ctx, &shadow, 0.0f, dist * (1.0f - 1e-4f)))
+        return ret;
+    ret = vec3_scale(vec3_mul_elementwise(f, l->emit), 1.0f / (pdf * pmf));
+    return ret;
+}
+//
+// compute ray color based on hitting an obj or not (bg)
+// iterative form of the recursive ray_color: throughput is carried along the path
+// out_aov may be NULL; callers go through ray_color / ray_color_aov so the NULL
+// case is a constant and the capture code folds away.
+// primary (may be NULL) is r's slot in the primary-hit cache: traced into once, then
+// the path starts from it
+inline color
+ray_trace_path (render_context * ctx, ray r, primary_hit * primary, aov_sample * out_aov) {
+    color radiance = {0};
+    color throughput = {1.0f, 1.0f, 1.0f};
+    bool nee = (LIGHT_SAMPLING_NONE != ctx->light_mode) && ctx->lights && (ctx->lights->light_count > 0);
+    bool count_emitted = true;
+    RAY_STATS_ONLY(int length = 0;)
+    for (int depth = ctx->max_depth; depth > 0; --depth) {
+        hit_record rec;
+        bool hit;
+        RAY_STATS_ONLY(++length;)
+        if (primary && depth == ctx->max_depth) {
+            if (primary_hit_untraced == primary->t) {
+                hit = render_hit(ctx, &r, 0.0f, g_infinity, &rec);
+                primary_hit_store(primary, hit, &rec);
+            } else {
+                hit = primary_hit_load(primary, &r, &rec);
+            }
+        } else {
+            hit = render_hit(ctx, &r, 0.0f, g_infinity, &rec);
+        }
+        if (!hit) {
+            if (out_aov && depth == ctx->max_depth)
+                out_aov->hit = false;
+            radiance = vec3_add(radiance, vec3_mul_elementwise(throughput, vec3_scale(sky_color(&r), ctx->sky_scale)));
+            RAY_STAT_ADD(ends_escaped, 1);
+            break;
+        }
+        // -- emission already accounted for by the shadow ray of the previous diffuse bounce;
+        //    emissive meshes, instances and planes are not in the light tree, so they are always counted
+        if (count_emitted || rec.object_id >= scene_mesh_id_base)
+            radiance = vec3_add(radiance, vec3_mul_elementwise(throughput, material_emitted(rec.mat_ptr, &rec)));
+        if (nee && material_has_eval(rec.mat_ptr)) {
+            radiance = vec3_add(radiance, vec3_mul_elementwise(throughput, sample_direct_light(ctx, &rec)));
+            count_emitted = false;
+        } else {
+            count_emitted = true;
+        }
+        ray scattered;
+        color attenuation;
+        bool scattered_ok = material_scatter(rec.mat_ptr, &r, &rec, &attenuation, &scattered);
+        if (out_aov && depth == ctx->max_depth) {
+            out_aov->hit = true;
+            out_aov->normal = rec.normal;
+            out_aov->p = rec.p;
+            out_aov->material_id = rec.material_id;
+            out_aov->object_id = rec.object_id;
+            if (scattered_ok) {
+                out_aov->albedo = attenuation;
+            } else {
+                color e = material_emitted(rec.mat_ptr, &rec);
+                out_aov->albedo = (color) {fminf(e.x, 1.0f), fminf(e.y, 1.0f), fminf(e.z, 1.0f)};
+            }
+        }
+        if (!scattered_ok) {
+            RAY_STAT_ADD(ends_absorbed, 1);
+            break;
+        }
+        throughput = vec3_mul_elementwise(throughput, attenuation);
+        r = ray_spawn(rec.p, rec.geometric_normal, scattered.dir);     /* instead of a tmin epsilon */
+    }
+    // -- paths neither escaped nor absorbed were cut off by max_depth
+    RAY_STAT_ADD(paths, 1);
+    RAY_STAT_ADD(segments, length);
+    RAY_STATS_ONLY(RAY_STAT_ADD(path_length[length < ray_stats_length_bins - 1 ? length : ray_stats_length_bins - 1], 1);)
+    return radiance;
+}
+inline color
+ray_color (render_context * ctx, ray r) {
+    return ray_trace_path(ctx, r, NULL, NULL);
+}
+inline color
+ray_color_aov (render_context * ctx, ray r, aov_sample * out_aov) {
+    return ray_trace_path(ctx, r, NULL, out_aov);
+}
+//
+// translate [0.f, 1.f] to [0, 255]
+inline void
+write_color (int out_color[3], color pixel_color, int samples_per_pixel) {
+    float scale = 1.0f / samples_per_pixel;
+    pixel_color = vec3_scale(pixel_color, scale);
+    /* gamma correction */
+    // raising the color to the power of 1/gamma
+    // (gamma = 2.0f), the display transform image_flip assumes
+    for (int i = 0; i < 3; ++i)
+        out_color[i] = (int)(256 * clamp(sqrtf(fmaxf(pixel_color.E[i], 0.0f)), 0.0f, 0.999f));
+}
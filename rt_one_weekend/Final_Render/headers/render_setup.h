@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scene.h"
+#include "scene_file.h"
+#include "bvh.h"
+#include "light_tree.h"
+#include "camera.h"
+#include "render.h"
+
+//
+// render setup
+// what every app does between a scene and its first tile: the scene's settings, a bvh
+// over its spheres, the light tree, a render context and the camera, for an image width
+// that keeps the settings' aspect ratio. the context points into the struct, which must
+// not move once prepared
+typedef struct {
+    scene world;
+    scene_settings settings;
+    bvh accel;
+    light_tree lights;
+    render_context ctx;
+    camera cam;
+    int width;
+    int height;
+} render_setup;
+
+/* the scene file into world and settings; false (having said why on stderr) when it could not */
+inline bool
+render_setup_load (render_setup * me, char const * path) {
+    scene_init(&me->world);
+    scene_settings_default(&me->settings);
+    scene_file_error error;
+    if (!scene_load(path, &me->world, &me->settings, &error)) {
+        fprintf(stderr, "%s:%d: %s\n", path, error.line, error.message);
+        return false;
+    }
+    return true;
+}
+//
+// for the world and settings in me, however they got there; width 0 keeps the settings'.
+// false (having said so) when out of memory
+inline bool
+render_setup_prepare (render_setup * me, int width) {
+    if (!bvh_build_spheres(&me->accel, &me->world)) {
+        fprintf(stderr, "out of memory\n");
+        return false;
+    }
+    if (light_tree_build(&me->lights, &me->world) < 0) {
+        fprintf(stderr, "out of memory\n");
+        bvh_free(&me->accel);
+        return false;
+    }
+    render_context_init(&me->ctx, &me->world, &me->lights, me->settings.max_depth);
+    me->ctx.accel = &me->accel;
+    me->ctx.sky_scale = me->settings.sky_scale;
+    me->width = width > 0 ? width : me->settings.width;
+    me->height = (int)(me->width / me->settings.aspect_ratio);
+    memset(&me->cam, 0, sizeof(me->cam));
+    camera_init(&me->cam, me->settings.lookfrom, me->settings.lookat, me->settings.vup, me->settings.vfov,
+        me->settings.aspect_ratio, me->settings.aperture, me->settings.focus_dist);
+    return true;
+}
+inline void
+render_setup_free (render_setup * me) {
+    light_tree_free(&me->lights);
+    bvh_free(&me->accel);
+    scene_free(&me->world);
+}
+//
+// command line
+// "1,8,32": the positive numbers of a comma separated list, at most max of them
+inline int
+parse_int_list (char const * list, int * out, int max) {
+    int count = 0;
+    while (*list && count < max) {
+        int n = atoi(list);
+        if (n > 0)
+            out[count++] = n;
+        while (*list && *list != ',')
+            ++list;
+        if (*list == ',')
+            ++list;
+    }
+    return count;
+}
+/* the thread counts a scaling run sweeps by default: 1, 2, 4 ... and procs itself */
+inline int
+thread_sweep_default (int procs, int * out, int max) {
+    int count = 0;
+    for (int n = 1; n < procs && count < max - 1; n *= 2)
+        out[count++] = n;
+    out[count++] = procs;
+    return count;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "vec3.h"
+#include "camera.h"
+#include "render.h"
+#include "progressive.h"
+
+//
+// sample splitting
+// the samples of a pixel are numbered, and all that sample s of pixel k uses is a function
+// of (seed, k, s): its film position is point s of a (0,2)-sequence scrambled per pixel, its
+// lens position entry s of the camera's table, and its path draws from an rng stream seeded
+// by hashing (seed, k, s). any range of sample indices can thus be rendered anywhere, by
+// any number of processes, and a range can be split again later.
+// samples go into a fixed-point accumulator, one int64 per channel. integer addition is
+// associative, so ranges merged in any order and grouping give the same bits as all the
+// samples rendered in one go, which float sums (render_tile_pass) cannot promise.
+// resolution is 2^-24 per sample, far below what the output resolves, and 2^-32 for squared
+// luminance, so the variance of pixels as dark as 1e-4 does not round away. every sample is
+// clamped at 2^50 in fixed point (radiance 2^26, squared luminance 2^18, i.e. luminance 512)
+// so split_max_spp samples of a pixel fit an int64
+#define split_sum_scale 16777216.0              /* 2^24 */
+#define split_lum_sq_scale 4294967296.0         /* 2^32 */
+#define split_sample_limit_log2 50
+#define split_sample_limit ((double)(1ll << split_sample_limit_log2))
+#define split_max_spp 8191                      /* (2^63 - 1) / 2^50 */
+
+/* does not compile (negative array size) when split_max_spp clamped samples overflow */
+typedef char split_sum_fits_int64[(INT64_MAX >> split_sample_limit_log2) >= split_max_spp ? 1 : -1];
+
+/* the fixed-point twin of film: 4 int64 per pixel, sum r, g, b and lum_sq */
+typedef struct {
+    int width;
+    int height;
+    int64_t * acc;
+} split_film;
+
+inline bool
+split_film_alloc (split_film * me, int width, int height) {
+    me->width = width;
+    me->height = height;
+    me->acc = calloc(4 * (size_t)width * height, sizeof(int64_t));
+    return (NULL != me->acc);
+}
+inline void
+split_film_free (split_film * me) {
+    free(me->acc);
+    me->acc = NULL;
+}
+inline void
+split_film_clear_tile (split_film * me, tile const * t) {
+    for (int row = t->y0; row < t->y1; ++row)
+        memset(&me->acc[4 * ((size_t)row * me->width + t->x0)], 0, 4 * (size_t)(t->x1 - t->x0) * sizeof(int64_t));
+}
+/* NaN samples count as 0, they would poison the integer sum for good */
+inline int64_t
+split_fixed (float v, double scale) {
+    double x = v * scale;
+    if (!(x == x))
+        return 0;
+    x = x < -split_sample_limit ? -split_sample_limit : (x > split_sample_limit ? split_sample_limit : x);
+    return (int64_t)floor(x + 0.5);
+}
+//
+// film position of sample s of a pixel: the base 2 radical inverse against Sobol's second
+// dimension (the camera lens table's sequence, at full precision) at index s ^ scramble.
+// the pixel's own scramble, not the lens's, keeps the two from pairing up
+inline void
+split_sample_jitter (uint32_t scramble, uint32_t s, float * out_du, float * out_dv) {
+    uint32_t i = s ^ scramble;
+    uint32_t rx = 0, ry = 0;
+    uint32_t v = 1u << 31;
+    for (int b = 0; i; ++b, i >>= 1, v ^= v >> 1) {
+        if (i & 1u) {
+            rx |= (1u << 31) >> b;
+            ry ^= v;
+        }
+    }
+    *out_du = (rx >> 8) * (1.0f / 16777216.0f);
+    *out_dv = (ry >> 8) * (1.0f / 16777216.0f);
+}
+//
+// adds samples [first, first + count) of every pixel of the tile.
+// the camera rays of a row are made in batches of up to split_batch_spp samples per pixel
+#define split_batch_spp 8
+
+inline void
+render_tile_samples (render_context * ctx, camera * cam, split_film * sf, tile const * t, int first, int count, uint64_t seed) {
+    int n = (t->x1 - t->x0) * split_batch_spp;
+    float * film_s = malloc(2 * (size_t)n * sizeof(float));
+    float * film_t = film_s + n;
+    uint32_t * lens = malloc((size_t)n * sizeof(uint32_t));
+    ray_batch batch;
+    if (NULL == film_s || NULL == lens || !ray_batch_alloc(&batch, n)) {
+        fprintf(stderr, "render_tile_samples: out of memory\n");
+        exit(1);
+    }
+    for (int row = t->y0; row < t->y1; ++row) {
+        int j = sf->height - 1 - row;
+        for (int s0 = first; s0 < first + count; s0 += split_batch_spp) {
+            int batch_spp = first + count - s0 < split_batch_spp ? first + count - s0 : split_batch_spp;
+            int m = 0;
+            for (int i = t->x0; i < t->x1; ++i) {
+                uint32_t k = (uint32_t)(row * sf->width + i);
+                uint32_t scramble = (uint32_t)random_hash_seed(seed, k);
+                for (int s = s0; s < s0 + batch_spp; ++s, ++m) {
+                    float du, dv;
+                    split_sample_jitter(scramble, (uint32_t)s, &du, &dv);
+                    film_s[m] = (float)(i + du) / (sf->width - 1);
+                    film_t[m] = (float)(j + dv) / (sf->height - 1);
+                    lens[m] = camera_lens_index(k, (uint32_t)s);
+                }
+            }
+            camera_cast_rays(cam, film_s, film_t, lens, m, &batch);
+            m = 0;
+            for (int i = t->x0; i < t->x1; ++i) {
+                size_t k = (size_t)row * sf->width + i;
+                uint64_t pixel_seed = random_hash_seed(seed ^ 0x5a5a5a5a5a5a5a5aull, k);
+                int64_t * acc = &sf->acc[4 * k];
+                for (int s = s0; s < s0 + batch_spp; ++s, ++m) {
+                    random_set_state(random_hash_seed(pixel_seed, (uint64_t)s));
+                    color c = ray_trace_path(ctx, ray_batch_get(&batch, m), NULL, NULL);
+                    float l = luminance(c);
+                    acc[0] += split_fixed(c.x, split_sum_scale);
+                    acc[1] += split_fixed(c.y, split_sum_scale);
+                    acc[2] += split_fixed(c.z, split_sum_scale);
+                    acc[3] += split_fixed(l * l, split_lum_sq_scale);
+                }
+            }
+        }
+    }
+    ray_batch_free(&batch);
+    free(lens);
+    free(film_s);
+}
+//
+// mean radiance of every pixel after spp samples; out_lum_var may be NULL
+inline void
+split_film_resolve (split_film const * sf, int spp, color * out_mean, float * out_lum_var) {
+    size_t count = (size_t)sf->width * sf->height;
+    double inv = spp > 0 ? 1.0 / spp : 0.0;
+    for (size_t k = 0; k < count; ++k) {
+        int64_t const * acc = &sf->acc[4 * k];
+        out_mean[k] = (color) {
+            (float)(acc[0] / split_sum_scale * inv), (float)(acc[1] / split_sum_scale * inv), (float)(acc[2] / split_sum_scale * inv)
+        };
+        if (out_lum_var) {
+            float mean_lum = luminance(out_mean[k]);
+            out_lum_var[k] = (spp > 1) ?
+                fmaxf(0.0f, (float)(acc[3] / split_lum_sq_scale * inv) - mean_lum * mean_lum) / (spp - 1) :
+                mean_lum * mean_lum;
+        }
+    }
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "vec3.h"
+#include "bvh.h"
+#include "triangle_mesh.h"
+
+//
+// spatial split bvh (SBVH) over a triangle mesh
+// besides the binned object split, a node may be split by a plane in space: triangles
+// straddling the plane are clipped and referenced from both sides, so long thin
+// triangles no longer blow up the bounds of whole subtrees. the output is an ordinary
+// bvh whose prim_index can reference a triangle more than once; traversal is unchanged.
+// ref: Stich, Friedrich, Dietrich, "Spatial Splits in Bounding Volume Hierarchies" (HPG 2009)
+#define sbvh_spatial_bins 32
+/* spatial splits are only searched where the object split's children overlap by more than
+   alpha * root area. the paper's 1e-5 gave the same trees on our meshes at 3x the build time */
+#define sbvh_alpha 1e-4f
+#define sbvh_default_budget 0.5f    /* extra references allowed, as a fraction of the triangle count */
+
+typedef struct {
+    bvh * out;
+    triangle_mesh const * mesh;
+    float min_overlap;          /* sbvh_alpha * root area */
+    int64_t references_left;    /* duplications the budget still allows */
+    int index_count;
+    int spatial_splits;
+    int duplicates;
+} sbvh_builder;
+
+/* statistics of a finished build */
+typedef struct {
+    int spatial_splits;
+    int duplicates;             /* references beyond one per triangle */
+} sbvh_stats;
+
+inline void
+sbvh_grow (vec3f * bmin, vec3f * bmax, vec3f p) {
+    *bmin = vec3_min(*bmin, p);
+    *bmax = vec3_max(*bmax, p);
+}
+inline bool
+sbvh_is_empty (bvh_prim const * ref) {
+    return ref->bmin.x > ref->bmax.x || ref->bmin.y > ref->bmax.y || ref->bmin.z > ref->bmax.z;
+}
+//
+// splits reference ref at plane pos on axis into the bounds of the triangle parts
+// on either side, both clipped to ref's current bounds
+inline void
+sbvh_split_reference (triangle_mesh const * mesh, bvh_prim const * ref, int axis, float pos, bvh_prim * out_left, bvh_prim * out_right) {
+    vec3f lmin = {INFINITY, INFINITY, INFINITY}, lmax = {-INFINITY, -INFINITY, -INFINITY};
+    vec3f rmin = lmin, rmax = lmax;
+    int32_t const * idx = &mesh->indices[3 * ref->index];
+    point3 v0 = mesh->positions[idx[2]];
+    for (int k = 0; k < 3; ++k) {
+        point3 v1 = mesh->positions[idx[k]];
+        float a0 = v0.E[axis], a1 = v1.E[axis];
+        if (a0 <= pos)
+            sbvh_grow(&lmin, &lmax, v0);
+        if (a0 >= pos)
+            sbvh_grow(&rmin, &rmax, v0);
+        if ((a0 < pos && a1 > pos) || (a0 > pos && a1 < pos)) {
+            float t = (pos - a0) / (a1 - a0);
+            t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+            vec3f x = vec3_add(v0, vec3_scale(vec3_sub(v1, v0), t));
+            x.E[axis] = pos;
+            sbvh_grow(&lmin, &lmax, x);
+            sbvh_grow(&rmin, &rmax, x);
+        }
+        v0 = v1;
+    }
+    lmax.E[axis] = pos < lmax.E[axis] ? pos : lmax.E[axis];
+    rmin.E[axis] = pos > rmin.E[axis] ? pos : rmin.E[axis];
+    // -- the reference may already be a clipped part of its triangle
+    out_left->bmin = vec3_max(lmin, ref->bmin);
+    out_left->bmax = vec3_min(lmax, ref->bmax);
+    out_right->bmin = vec3_max(rmin, ref->bmin);
+    out_right->bmax = vec3_min(rmax, ref->bmax);
+    out_left->centroid = vec3_scale(vec3_add(out_left->bmin, out_left->bmax), 0.5f);
+    out_right->centroid = vec3_scale(vec3_add(out_right->bmin, out_right->bmax), 0.5f);
+    out_left->index = out_right->index = ref->index;
+}
+//
+// best spatial split: every reference is chopped into the bins it spans, entry and
+// exit counts give the number of references on either side of each plane
+typedef struct {
+    float cost;
+    int axis;
+    float pos;
+    int left_count, right_count;    /* straddling references counted on both sides */
+    vec3f left_min, left_max;
+    vec3f right_min, right_max;
+} sbvh_spatial_split;
+
+inline sbvh_spatial_split
+sbvh_find_spatial_split (triangle_mesh const * mesh, bvh_prim const * refs, int count, vec3f bmin, vec3f bmax, float parent_area) {
+    sbvh_spatial_split best = {INFINITY, -1};
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = bmin.E[axis], extent = bmax.E[axis] - lo;
+        if (extent <= 0.0f)
+            continue;
+        float bin_size = extent / sbvh_spatial_bins, inv_bin_size = sbvh_spatial_bins / extent;
+        vec3f bin_min[sbvh_spatial_bins], bin_max[sbvh_spatial_bins];
+        int entry[sbvh_spatial_bins] = {0}, exit[sbvh_spatial_bins] = {0};
+        for (int b = 0; b < sbvh_spatial_bins; ++b) {
+            bin_min[b] = (vec3f) {INFINITY, INFINITY, INFINITY};
+            bin_max[b] = (vec3f) {-INFINITY, -INFINITY, -INFINITY};
+        }
+        for (int i = 0; i < count; ++i) {
+            int b0 = (int)((refs[i].bmin.E[axis] - lo) * inv_bin_size);
+            int b1 = (int)((refs[i].bmax.E[axis] - lo) * inv_bin_size);
+            b0 = b0 < 0 ? 0 : (b0 < sbvh_spatial_bins ? b0 : sbvh_spatial_bins - 1);
+            b1 = b1 < b0 ? b0 : (b1 < sbvh_spatial_bins ? b1 : sbvh_spatial_bins - 1);
+            bvh_prim rest = refs[i];
+            for (int b = b0; b < b1; ++b) {
+                bvh_prim left, right;
+                sbvh_split_reference(mesh, &rest, axis, lo + (b + 1) * bin_size, &left, &right);
+                bin_min[b] = vec3_min(bin_min[b], left.bmin);
+                bin_max[b] = vec3_max(bin_max[b], left.bmax);
+                rest = right;
+            }
+            bin_min[b1] = vec3_min(bin_min[b1], rest.bmin);
+            bin_max[b1] = vec3_max(bin_max[b1], rest.bmax);
+            ++entry[b0];
+            ++exit[b1];
+        }
+        vec3f right_min[sbvh_spatial_bins], right_max[sbvh_spatial_bins];
+        int right_count[sbvh_spatial_bins];
+        vec3f rmin = {INFINITY, INFINITY, INFINITY}, rmax = {-INFINITY, -INFINITY, -INFINITY};
+        int rc = 0;
+        for (int b = sbvh_spatial_bins - 1; b > 0; --b) {
+            rmin = vec3_min(rmin, bin_min[b]);
+            rmax = vec3_max(rmax, bin_max[b]);
+            rc += exit[b];
+            right_min[b] = rmin;
+            right_max[b] = rmax;
+            right_count[b] = rc;
+        }
+        vec3f lmin = {INFINITY, INFINITY, INFINITY}, lmax = {-INFINITY, -INFINITY, -INFINITY};
+        int lc = 0;
+        for (int s = 1; s < sbvh_spatial_bins; ++s) {
+            lmin = vec3_min(lmin, bin_min[s - 1]);
+            lmax = vec3_max(lmax, bin_max[s - 1]);
+            lc += entry[s - 1];
+            if (0 == lc || 0 == right_count[s])
+                continue;
+            float cost = bvh_traversal_cost +
+                (lc * aabb_surface_area(lmin, lmax) + right_count[s] * aabb_surface_area(right_min[s], right_max[s])) / parent_area;
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.pos = lo + s * bin_size;
+                best.left_count = lc;
+                best.right_count = right_count[s];
+                best.left_min = lmin;
+                best.left_max = lmax;
+                best.right_min = right_min[s];
+                best.right_max = right_max[s];
+            }
+        }
+    }
+    return best;
+}
+//
+// distributes refs over two new arrays; a straddling reference goes to one side
+// whole when that is cheaper than splitting it ("reference unsplitting") or when the
+// duplication budget is spent. returns false if a side ended up empty
+inline bool
+sbvh_partition_spatial (sbvh_builder * me, bvh_prim const * refs, int count, sbvh_spatial_split const * split,
+    bvh_prim ** out_left, int * out_left_count, bvh_prim ** out_right, int * out_right_count) {
+    int axis = split->axis;
+    bvh_prim * left = malloc(((size_t)count + 1) * sizeof(bvh_prim));
+    bvh_prim * right = malloc(((size_t)count + 1) * sizeof(bvh_prim));
+    int nl = 0, nr = 0;
+    /* sides as estimated by the split, updated as straddlers are placed */
+    float left_n = (float)split->left_count, right_n = (float)split->right_count;
+    vec3f lmin = split->left_min, lmax = split->left_max, rmin = split->right_min, rmax = split->right_max;
+    int duplicates = 0;
+    for (int i = 0; left && right && i < count; ++i) {
+        bvh_prim const * ref = &refs[i];
+        if (ref->bmax.E[axis] <= split->pos) {
+            left[nl++] = *ref;
+        } else if (ref->bmin.E[axis] >= split->pos) {
+            right[nr++] = *ref;
+        } else {
+            float area_l = aabb_surface_area(lmin, lmax), area_r = aabb_surface_area(rmin, rmax);
+            float cost_split = area_l * left_n + area_r * right_n;
+            float cost_left = aabb_surface_area(vec3_min(lmin, ref->bmin), vec3_max(lmax, ref->bmax)) * left_n + area_r * (right_n - 1.0f);
+            float cost_right = area_l * (left_n - 1.0f) + aabb_surface_area(vec3_min(rmin, ref->bmin), vec3_max(rmax, ref->bmax)) * right_n;
+            bool can_split = me->references_left > duplicates;
+            bvh_prim part_l, part_r;
+            if (can_split && cost_split <= cost_left && cost_split <= cost_right)
+                sbvh_split_reference(me->mesh, ref, axis, split->pos, &part_l, &part_r);
+            // -- within its clipped bounds the triangle may not reach across the plane
+            if (can_split && cost_split <= cost_left && cost_split <= cost_right &&
+                !sbvh_is_empty(&part_l) && !sbvh_is_empty(&part_r)) {
+                left[nl++] = part_l;
+                right[nr++] = part_r;
+                ++duplicates;
+            } else if (cost_left <= cost_right || (!can_split && ref->centroid.E[axis] < split->pos)) {
+                left[nl++] = *ref;
+                lmin = vec3_min(lmin, ref->bmin);
+                lmax = vec3_max(lmax, ref->bmax);
+                right_n -= 1.0f;
+            } else {
+                right[nr++] = *ref;
+                rmin = vec3_min(rmin, ref->bmin);
+                rmax = vec3_max(rmax, ref->bmax);
+                left_n -= 1.0f;
+            }
+        }
+    }
+    if (NULL == left || NULL == right || 0 == nl || 0 == nr) {
+        free(left);
+        free(right);
+        return false;
+    }
+    me->references_left -= duplicates;
+    me->duplicates += duplicates;
+    *out_left = left;
+    *out_left_count = nl;
+    *out_right = right;
+    *out_right_count = nr;
+    return true;
+}
+//
+// builds the subtree over refs[0, count), its root on level depth; refs stays owned by the caller
+inline int
+sbvh_build_recursive (sbvh_builder * me, bvh_prim * refs, int count, int depth) {
+    bvh * out = me->out;
+    int node_index = out->node_count++;
+    out->depth = depth > out->depth ? depth : out->depth;
+    vec3f bmin = refs[0].bmin, bmax = refs[0].bmax;
+    vec3f cmin = refs[0].centroid, cmax = cmin;
+    for (int i = 1; i < count; ++i) {
+        bmin = vec3_min(bmin, refs[i].bmin);
+        bmax = vec3_max(bmax, refs[i].bmax);
+        cmin = vec3_min(cmin, refs[i].centroid);
+        cmax = vec3_max(cmax, refs[i].centroid);
+    }
+    out->nodes[node_index].bmin = bmin;
+    out->nodes[node_index].bmax = bmax;
+
+    float parent_area = aabb_surface_area(bmin, bmax);
+    float leaf_cost = (float)count;
+    bvh_split object = bvh_find_object_split(refs, 0, count, cmin, cmax, parent_area);
+    sbvh_spatial_split spatial = {INFINITY, -1};
+    // -- spatial splits only pay off where the object split's children overlap a lot
+    if (object.axis >= 0 && me->references_left > 0) {
+        vec3f omin = vec3_max(object.left_min, object.right_min), omax = vec3_min(object.left_max, object.right_max);
+        bool overlap = omin.x <= omax.x && omin.y <= omax.y && omin.z <= omax.z;
+        if (overlap && aabb_surface_area(omin, omax) > me->min_overlap)
+            spatial = sbvh_find_spatial_split(me->mesh, refs, count, bmin, bmax, parent_area);
+    }
+    float best_cost = spatial.cost < object.cost ? spatial.cost : object.cost;
+    bool split = (object.axis >= 0 || spatial.axis >= 0) && (best_cost < leaf_cost || count > bvh_max_leaf_size) &&
+        depth < bvh_max_depth;
+    if (split && spatial.cost < object.cost) {
+        bvh_prim * left, * right;
+        int nl, nr;
+        if (sbvh_partition_spatial(me, refs, count, &spatial, &left, &nl, &right, &nr)) {
+            ++me->spatial_splits;
+            sbvh_build_recursive(me, left, nl, depth + 1);
+            free(left);
+            int second = sbvh_build_recursive(me, right, nr, depth + 1);
+            free(right);
+            out->nodes[node_index].offset = second;
+            out->nodes[node_index].count = 0;
+            return node_index;
+        }
+    }
+    int mid = -1;
+    if (split && object.axis >= 0)
+        mid = bvh_partition_object(refs, 0, count, &object, cmin, cmax);
+    else if (count > bvh_max_leaf_size && depth < bvh_max_depth)
+        mid = count / 2;            /* coincident centroids, split the list in half */
+    if (mid < 0) {
+        out->nodes[node_index].offset = me->index_count;
+        out->nodes[node_index].count = count;
+        for (int i = 0; i < count; ++i)
+            out->prim_index[me->index_count++] = refs[i].index;
+        return node_index;
+    }
+    sbvh_build_recursive(me, refs, mid, depth + 1);
+    int second = sbvh_build_recursive(me, refs + mid, count - mid, depth + 1);
+    out->nodes[node_index].offset = second;
+    out->nodes[node_index].count = 0;
+    return node_index;
+}
+//
+// replaces the mesh's bvh with an SBVH; budget is the fraction of extra references
+// (duplicated triangles) allowed, 0 gives a plain binned SAH tree
+inline bool
+triangle_mesh_build_sbvh (triangle_mesh * me, float budget, sbvh_stats * out_stats) {
+    int count = me->triangle_count;
+    bvh_free(&me->accel);
+    if (out_stats) {
+        sbvh_stats zero = {0};
+        *out_stats = zero;
+    }
+    if (count <= 0)
+        return true;
+    int64_t max_refs = count + (int64_t)(budget * count);
+    max_refs = max_refs < INT32_MAX / 2 ? max_refs : INT32_MAX / 2;
+    bvh_prim * refs = malloc(((size_t)count + 1) * sizeof(bvh_prim));
+    me->accel.prim_index = malloc((size_t)max_refs * sizeof(int32_t));
+    me->accel.nodes = malloc((2 * (size_t)max_refs - 1) * sizeof(bvh_node));
+    if (NULL == refs || NULL == me->accel.prim_index || NULL == me->accel.nodes) {
+        free(refs);
+        bvh_free(&me->accel);
+        return false;
+    }
+    int32_t i;
+#pragma omp parallel for
+    for (i = 0; i < count; ++i) {
+        point3 p0 = triangle_mesh_vertex(me, i, 0), p1 = triangle_mesh_vertex(me, i, 1), p2 = triangle_mesh_vertex(me, i, 2);
+        refs[i].bmin = vec3_min(p0, vec3_min(p1, p2));
+        refs[i].bmax = vec3_max(p0, vec3_max(p1, p2));
+        refs[i].centroid = vec3_scale(vec3_add(refs[i].bmin, refs[i].bmax), 0.5f);
+        refs[i].index = i;
+    }
+    vec3f bmin = refs[0].bmin, bmax = refs[0].bmax;
+    for (i = 1; i < count; ++i) {
+        bmin = vec3_min(bmin, refs[i].bmin);
+        bmax = vec3_max(bmax, refs[i].bmax);
+    }
+    sbvh_builder builder = {
+        .out = &me->accel,
+        .mesh = me,
+        .min_overlap = sbvh_alpha * aabb_surface_area(bmin, bmax),
+        .references_left = max_refs - count
+    };
+    sbvh_build_recursive(&builder, refs, count, 1);
+    free(refs);
+    me->accel.prim_count = builder.index_count;
+    if (out_stats) {
+        out_stats->spatial_splits = builder.spatial_splits;
+        out_stats->duplicates = builder.duplicates;
+    }
+    return true;
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "material.h"
+#include "plane.h"
+#include "ray_stats.h"
+
+struct triangle_mesh;
+struct tlas;
+
+//
+// flat scene container
+// spheres are stored as SoA arrays and reference materials by index
+// so the world can be scanned linearly and enumerated (e.g. for emitters).
+// planes and quads are few and unbounded (or nearly), they are kept out of the bvh.
+// triangle meshes and the instance tlas are referenced, not owned; they carry their own bvh
+typedef struct {
+    int sphere_count;
+    int sphere_capacity;
+    float * center_x;
+    float * center_y;
+    float * center_z;
+    float * radius;
+    int32_t * sphere_mat;
+
+    int material_count;
+    int material_capacity;
+    material ** materials;
+    material_storage * owned_materials;     /* allocated by a loader, freed with the scene */
+    bool borrowed;      /* sphere arrays live in memory the scene does not own (a mapped cache), read-only */
+
+    int plane_count;
+    plane * planes;     /* material by material_id, mat_ptr is not used */
+
+    int mesh_count;
+    struct triangle_mesh ** meshes;
+    struct tlas * instances;    /* may be NULL */
+} scene;
+
+inline void
+scene_init (scene * me) {
+    scene zero = {0};
+    *me = zero;
+}
+/* grows one array, it is left as it was on failure */
+inline bool
+scene_grow (void ** array, size_t size) {
+    void * grown = realloc(*array, size);
+    if (NULL == grown)
+        return false;
+    *array = grown;
+    return true;
+}
+/* false when out of memory, the spheres already added stay valid */
+inline bool
+scene_reserve_spheres (scene * me, int capacity) {
+    if (capacity <= me->sphere_capacity)
+        return true;
+    if (!scene_grow((void **)&me->center_x, capacity * sizeof(float)) ||
+        !scene_grow((void **)&me->center_y, capacity * sizeof(float)) ||
+        !scene_grow((void **)&me->center_z, capacity * sizeof(float)) ||
+        !scene_grow((void **)&me->radius, capacity * sizeof(float)) ||
+        !scene_grow((void **)&me->sphere_mat, capacity * sizeof(int32_t)))
+        return false;
+    me->sphere_capacity = capacity;
+    return true;
+}
+/* returns material id, -1 when out of memory */
+inline int
+scene_add_material (scene * me, material * mat) {
+    if (me->material_count == me->material_capacity) {
+        int capacity = me->material_capacity ? 2 * me->material_capacity : 16;
+        if (!scene_grow((void **)&me->materials, capacity * sizeof(material *)))
+            return -1;
+        me->material_capacity = capacity;
+    }
+    me->materials[me->material_count] = mat;
+    return me->material_count++;
+}
+/* returns sphere (object) id, -1 when out of memory */
+inline int
+scene_add_sphere (scene * me, point3 center, float radius, int mat_id) {
+    if (me->sphere_count == me->sphere_capacity &&
+        !scene_reserve_spheres(me, me->sphere_capacity ? 2 * me->sphere_capacity : 64))
+        return -1;
+    int i = me->sphere_count++;
+    me->center_x[i] = center.x;
+    me->center_y[i] = center.y;
+    me->center_z[i] = center.z;
+    me->radius[i] = radius;
+    me->sphere_mat[i] = mat_id;
+    return i;
+}
+/* returns plane (object) index, object ids start at scene_plane_id_base; -1 when out of memory */
+inline int
+scene_add_plane (scene * me, point3 p, vec3f n, int mat_id) {
+    if (!scene_grow((void **)&me->planes, (me->plane_count + 1) * sizeof(plane)))
+        return -1;
+    plane * pl = &me->planes[me->plane_count];
+    plane_init(pl, p, n, NULL);
+    pl->material_id = mat_id;
+    return me->plane_count++;
+}
+inline int
+scene_add_quad (scene * me, point3 corner, vec3f u, vec3f v, int mat_id) {
+    if (!scene_grow((void **)&me->planes, (me->plane_count + 1) * sizeof(plane)))
+        return -1;
+    plane * pl = &me->planes[me->plane_count];
+    quad_init(pl, corner, u, v, NULL);
+    pl->material_id = mat_id;
+    return me->plane_count++;
+}
+/* returns mesh index, the mesh must outlive the scene; -1 when out of memory */
+inline int
+scene_add_mesh (scene * me, struct triangle_mesh * mesh) {
+    if (!scene_grow((void **)&me->meshes, (me->mesh_count + 1) * sizeof(struct triangle_mesh *)))
+        return -1;
+    me->meshes[me->mesh_count] = mesh;
+    return me->mesh_count++;
+}
+inline point3
+scene_sphere_center (scene * me, int i) {
+    point3 ret = {me->center_x[i], me->center_y[i], me->center_z[i]};
+    return ret;
+}
+inline void
+scene_free (scene * me) {
+    if (!me->borrowed) {
+        free(me->center_x);
+        free(me->center_y);
+        free(me->center_z);
+        free(me->radius);
+        free(me->sphere_mat);
+    }
+    free(me->planes);
+    free(me->materials);
+    free(me->owned_materials);
+    free(me->meshes);
+    scene_init(me);
+}
+//
+// returns the nearest root of sphere i in (tmin, tmax), or tmax if none
+// robust for big spheres (Ray Tracing Gems, ch. 7): b^2 - ac is formed as a(r^2 - |l|^2)
+// with l the center's offset from the ray's line, instead of a difference of two terms
+// around |oc|^4 that cancels for a far or huge sphere; the near root comes from c / q,
+// so -b +- sqrt never subtracts nearly equal values either
+inline float
+scene_sphere_intersect (scene * me, int i, ray * r, float a, float tmin, float tmax) {
+    float ocx = r->origin.x - me->center_x[i];
+    float ocy = r->origin.y - me->center_y[i];
+    float ocz = r->origin.z - me->center_z[i];
+    float half_b = ocx * r->dir.x + ocy * r->dir.y + ocz * r->dir.z;
+    float radius_sq = me->radius[i] * me->radius[i];
+    float s = half_b / a;
+    float lx = ocx - s * r->dir.x, ly = ocy - s * r->dir.y, lz = ocz - s * r->dir.z;
+    float discriminant = a * (radius_sq - (lx * lx + ly * ly + lz * lz));
+    if (discriminant < 0.0f)
+        return tmax;
+    float c = ocx * ocx + ocy * ocy + ocz * ocz - radius_sq;
+    float q = -(half_b + (half_b < 0.0f ? -sqrtf(discriminant) : sqrtf(discriminant)));
+    float t0 = c / q, t1 = q / a;
+    if (t0 > t1) {
+        float tt = t0; t0 = t1; t1 = tt;
+    }
+    float root = t0;
+    if (root < tmin || root > tmax) {
+        root = t1;
+        if (root < tmin || root > tmax)
+            return tmax;
+    }
+    return root;
+}
+inline void
+scene_fill_record (scene * me, int i, ray * r, float t, hit_record * out_rec) {
+    out_rec->t = t;
+    out_rec->p = ray_at(r, t);
+    vec3f outward_normal = vec3_scale(vec3_sub(out_rec->p, scene_sphere_center(me, i)), 1.0f / me->radius[i]);
+    record_set_normal(out_rec, r, outward_normal);
+    out_rec->mat_ptr = me->materials[me->sphere_mat[i]];
+    out_rec->material_id = me->sphere_mat[i];
+    out_rec->object_id = i;
+}
+inline bool
+scene_hit (scene * me, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    float a = vec3_len_squared(r->dir);
+    float closest_so_far = tmax;
+    int closest = -1;
+    RAY_STAT_ADD(sphere_tests, me->sphere_count);
+    for (int i = 0; i < me->sphere_count; ++i) {
+        float t = scene_sphere_intersect(me, i, r, a, tmin, closest_so_far);
+        if (t < closest_so_far) {
+            closest_so_far = t;
+            closest = i;
+        }
+    }
+    if (closest >= 0)
+        scene_fill_record(me, closest, r, closest_so_far, out_rec);
+    return (closest >= 0);
+}
+/* any-hit query for shadow rays, no record is produced */
+inline bool
+scene_occluded (scene * me, ray * r, float tmin, float tmax) {
+    float a = vec3_len_squared(r->dir);
+    for (int i = 0; i < me->sphere_count; ++i) {
+        if (scene_sphere_intersect(me, i, r, a, tmin, tmax) < tmax) {
+            RAY_STAT_ADD(sphere_tests, i + 1);
+            return true;
+        }
+    }
+    RAY_STAT_ADD(sphere_tests, me->sphere_count);
+    return false;
+}
+//
+// planes, tested next to whatever holds the spheres
+inline bool
+scene_planes_hit (scene * me, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    float closest_so_far = tmax;
+    int closest = -1;
+    for (int i = 0; i < me->plane_count; ++i) {
+        float t = plane_intersect(&me->planes[i], r, tmin, closest_so_far);
+        if (t < closest_so_far) {
+            closest_so_far = t;
+            closest = i;
+        }
+    }
+    if (closest >= 0) {
+        plane_fill_record(&me->planes[closest], r, closest_so_far, out_rec);
+        out_rec->mat_ptr = me->materials[me->planes[closest].material_id];
+        out_rec->object_id = scene_plane_id_base + closest;
+    }
+    return (closest >= 0);
+}
+inline bool
+scene_planes_occluded (scene * me, ray * r, float tmin, float tmax) {
+    for (int i = 0; i < me->plane_count; ++i)
+        if (plane_intersect(&me->planes[i], r, tmin, tmax) < tmax)
+            return true;
+    return false;
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vec3.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "bvh.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//
+// binary scene + bvh cache
+// the sphere SoA arrays, the material table and the flattened bvh written back to back,
+// each section 64-byte aligned and located by an offset from the start of the file.
+// opening a cache maps the file and points the scene and bvh straight into it, so
+// nothing is parsed, copied or built. only the materials (a vtable pointer each) are
+// rebuilt from their parameters, and the few planes (they carry one too).
+// a cache is keyed by a hash of the source scene file's bytes and rejected when the
+// source, the format or the bvh build parameters change.
+//
+// layout (little-endian, as written by the host):
+//   scene_cache_header
+//   float center_x[n], center_y[n], center_z[n], radius[n]; int32_t sphere_mat[n]
+//   cache_material materials[material_count]
+//   cache_plane planes[plane_count]
+//   bvh_node nodes[node_count]; int32_t prim_index[n]
+#define scene_cache_magic 0x48435352u   /* "RSCH" */
+#define scene_cache_version 3u
+#define scene_cache_align 64
+
+typedef struct {
+    uint64_t offset;    /* from the start of the file */
+    uint64_t size;      /* bytes */
+} cache_section;
+
+typedef struct {
+    int32_t type;       /* material_type */
+    float params[4];    /* see material_params */
+} cache_material;
+
+typedef struct {
+    int32_t bounded;    /* quad */
+    int32_t material_id;
+    float origin[3];
+    float normal[3];    /* infinite planes */
+    float edge_u[3];    /* quads */
+    float edge_v[3];
+} cache_plane;
+
+enum {
+    CACHE_CENTER_X = 0,
+    CACHE_CENTER_Y,
+    CACHE_CENTER_Z,
+    CACHE_RADIUS,
+    CACHE_SPHERE_MAT,
+    CACHE_MATERIALS,
+    CACHE_PLANES,
+    CACHE_NODES,
+    CACHE_PRIM_INDEX,
+    CACHE_SECTION_COUNT
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_key;    /* hash of the source scene file */
+    uint64_t file_size;
+    uint32_t bvh_params;    /* bins, leaf size; a different build makes the cache stale */
+    int32_t sphere_count;
+    int32_t material_count;
+    int32_t plane_count;
+    int32_t node_count;
+    int32_t bvh_depth;
+    scene_settings settings;
+    cache_section sections[CACHE_SECTION_COUNT];
+} scene_cache_header;
+
+#define scene_cache_bvh_params ((uint32_t)(bvh_bins << 16 | bvh_max_leaf_size))
+
+//
+// read-only file mapping
+typedef struct {
+    void * base;
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} file_map;
+
+inline bool
+file_map_open (char const * path, file_map * out_map) {
+    file_map zero = {0};
+    *out_map = zero;
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == file)
+        return false;
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    void * base = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+        base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (NULL == base) {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    out_map->file = file;
+    out_map->mapping = mapping;
+    out_map->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void * base = MAP_FAILED;
+    if (0 == fstat(fd, &st) && st.st_size > 0)
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);     /* the mapping keeps the file alive */
+    if (MAP_FAILED == base)
+        return false;
+    out_map->size = st.st_size;
+#endif
+    out_map->base = base;
+    return true;
+}
+inline void
+file_map_close (file_map * me) {
+    if (NULL == me->base)
+        return;
+#if defined(_WIN32)
+    UnmapViewOfFile(me->base);
+    CloseHandle(me->mapping);
+    CloseHandle(me->file);
+#else
+    munmap(me->base, me->size);
+#endif
+    file_map zero = {0};
+    *me = zero;
+}
+//
+// content hash of a file, 8 bytes per step (FNV-1a style on words), so keying a
+// big scene costs about as much as reading it
+inline bool
+hash_file (char const * path, uint64_t * out_hash) {
+    FILE * file = fopen(path, "rb");
+    if (NULL == file)
+        return false;
+    enum { chunk = 1 << 20 };
+    uint64_t * buffer = malloc(chunk);
+    uint64_t h = hash_seed;
+    size_t n = 0;
+    while (buffer && (n = fread(buffer, 1, chunk, file)) > 0) {
+        size_t words = n / 8;
+        for (size_t i = 0; i < words; ++i) {
+            h ^= buffer[i];
+            h *= 0x100000001b3ull;
+            h ^= h >> 29;
+        }
+        h = hash_bytes(h, (uint8_t *)buffer + 8 * words, n - 8 * words);
+    }
+    bool ret = (NULL != buffer) && !ferror(file);
+    free(buffer);
+    fclose(file);
+    *out_hash = h;
+    return ret;
+}
+//
+// writing
+inline bool
+cache_write_section (FILE * file, cache_section * section, void const * data, size_t size, uint64_t * cursor) {
+    static uint8_t const zeros[scene_cache_align] = {0};
+    size_t pad = (size_t)((scene_cache_align - *cursor % scene_cache_align) % scene_cache_align);
+    if (pad && pad != fwrite(zeros, 1, pad, file))
+        return false;
+    section->offset = *cursor + pad;
+    section->size = size;
+    *cursor = section->offset + size;
+    return (0 == size) || (size == fwrite(data, 1, size, file));
+}
+inline bool
+scene_cache_write (char const * path, uint64_t source_key, scene * world, scene_settings const * settings, bvh * accel) {
+    FILE * file = fopen(path, "wb");
+    if (NULL == file)
+        return false;
+    scene_cache_header header = {
+        .magic = scene_cache_magic,
+        .version = scene_cache_version,
+        .source_key = source_key,
+        .bvh_params = scene_cache_bvh_params,
+        .sphere_count = world->sphere_count,
+        .material_count = world->material_count,
+        .plane_count = world->plane_count,
+        .node_count = accel->node_count,
+        .bvh_depth = accel->depth,
+        .settings = *settings
+    };
+    cache_material * mats = calloc(world->material_count + 1, sizeof(cache_material));
+    for (int i = 0; mats && i < world->material_count; ++i) {
+        mats[i].type = material_get_type(world->materials[i]);
+        material_params(world->materials[i], mats[i].params);
+    }
+    cache_plane * planes = calloc(world->plane_count + 1, sizeof(cache_plane));
+    for (int i = 0; planes && i < world->plane_count; ++i) {
+        plane const * pl = &world->planes[i];
+        planes[i].bounded = pl->bounded;
+        planes[i].material_id = pl->material_id;
+        memcpy(planes[i].origin, pl->origin.E, sizeof(planes[i].origin));
+        memcpy(planes[i].normal, pl->normal.E, sizeof(planes[i].normal));
+        memcpy(planes[i].edge_u, pl->edge_u.E, sizeof(planes[i].edge_u));
+        memcpy(planes[i].edge_v, pl->edge_v.E, sizeof(planes[i].edge_v));
+    }
+    size_t n = world->sphere_count;
+    // -- header goes first, written again once the offsets are known
+    uint64_t cursor = sizeof(header);
+    bool ok = (NULL != mats) && (NULL != planes) && (1 == fwrite(&header, sizeof(header), 1, file));
+    ok = ok && cache_write_section(file, &header.sections[CACHE_CENTER_X], world->center_x, n * sizeof(float), &cursor);
+    ok = ok && cache_write_section(file, &header.sections[CACHE_CENTER_Y], world->center_y, n * sizeof(float), &cursor);
+    ok = ok && cache_write_section(file, &header.sections[CACHE_CENTER_Z], world->center_z, n * sizeof(float), &cursor);
+    ok = ok && cache_write_section(file, &header.sections[CACHE_RADIUS], world->radius, n * sizeof(float), &cursor);
+    ok = ok && cache_write_section(file, &header.sections[CACHE_SPHERE_MAT], world->sphere_mat, n * sizeof(int32_t), &cursor);
+    ok = ok && cache_write_section(file, &header.sections[CACHE_MATERIALS], mats, world->material_count * sizeof(cache_material), &cursor);
+    ok = ok && cache_write_section(file, &header.sections[CACHE_PLANES], planes, world->plane_count * sizeof(cache_plane), &cursor);
+    ok = ok && cache_write_section(file, &header.sections[CACHE_NODES], accel->nodes, accel->node_count * sizeof(bvh_node), &cursor);
+    ok = ok && cache_write_section(file, &header.sections[CACHE_PRIM_INDEX], accel->prim_index, accel->prim_count * sizeof(int32_t), &cursor);
+    header.file_size = cursor;
+    ok = ok && (0 == fseek(file, 0, SEEK_SET)) && (1 == fwrite(&header, sizeof(header), 1, file));
+    ok = (0 == fclose(file)) && ok;
+    free(mats);
+    free(planes);
+    if (!ok)
+        remove(path);
+    return ok;
+}
+//
+// maps a cache and points world/accel into it; world must be freshly initialized.
+// map has to stay open as long as world and accel are used
+inline bool
+scene_cache_open (char const * path, uint64_t source_key, file_map * map, scene * world, scene_settings * settings, bvh * accel) {
+    if (!file_map_open(path, map))
+        return false;
+    uint8_t const * base = (uint8_t const *)map->base;
+    scene_cache_header const * h = (scene_cache_header const *)base;
+    bool ok = map->size >= sizeof(*h) && h->magic == scene_cache_magic && h->version == scene_cache_version &&
+        h->source_key == source_key && h->bvh_params == scene_cache_bvh_params && h->file_size == map->size &&
+        h->bvh_depth <= bvh_max_depth;
+    uint64_t const n = ok ? (uint64_t)h->sphere_count : 0;
+    uint64_t const expected[CACHE_SECTION_COUNT] = {
+        n * sizeof(float), n * sizeof(float), n * sizeof(float), n * sizeof(float), n * sizeof(int32_t),
+        (ok ? (uint64_t)h->material_count : 0) * sizeof(cache_material),
+        (ok ? (uint64_t)h->plane_count : 0) * sizeof(cache_plane),
+        (ok ? (uint64_t)h->node_count : 0) * sizeof(bvh_node), n * sizeof(int32_t)
+    };
+    for (int s = 0; ok && s < CACHE_SECTION_COUNT; ++s)
+        ok = h->sections[s].size == expected[s] && h->sections[s].offset % scene_cache_align == 0 &&
+            h->sections[s].offset + h->sections[s].size <= map->size;
+    cache_material const * mats = ok ? (cache_material const *)(base + h->sections[CACHE_MATERIALS].offset) : NULL;
+    for (int i = 0; ok && i < h->material_count; ++i)
+        ok = (mats[i].type >= MATERIAL_LAMBERTIAN && mats[i].type <= MATERIAL_DIFFUSE_LIGHT);
+    cache_plane const * planes = ok ? (cache_plane const *)(base + h->sections[CACHE_PLANES].offset) : NULL;
+    for (int i = 0; ok && i < h->plane_count; ++i)
+        ok = (planes[i].material_id >= 0 && planes[i].material_id < h->material_count);
+    if (!ok) {
+        file_map_close(map);
+        return false;
+    }
+    *settings = h->settings;
+    world->sphere_count = h->sphere_count;
+    world->sphere_capacity = h->sphere_count;
+    world->center_x = (float *)(base + h->sections[CACHE_CENTER_X].offset);
+    world->center_y = (float *)(base + h->sections[CACHE_CENTER_Y].offset);
+    world->center_z = (float *)(base + h->sections[CACHE_CENTER_Z].offset);
+    world->radius = (float *)(base + h->sections[CACHE_RADIUS].offset);
+    world->sphere_mat = (int32_t *)(base + h->sections[CACHE_SPHERE_MAT].offset);
+    world->borrowed = true;
+    // -- materials hold a vtable pointer, those are the only thing rebuilt
+    world->owned_materials = malloc((h->material_count + 1) * sizeof(material_storage));
+    for (int i = 0; i < h->material_count; ++i)
+        scene_add_material(world, material_init_from_params(&world->owned_materials[i], (material_type)mats[i].type, mats[i].params));
+    for (int i = 0; i < h->plane_count; ++i) {
+        cache_plane const * pl = &planes[i];
+        point3 origin = {pl->origin[0], pl->origin[1], pl->origin[2]};
+        if (pl->bounded)
+            scene_add_quad(world, origin, (vec3f) {pl->edge_u[0], pl->edge_u[1], pl->edge_u[2]},
+                (vec3f) {pl->edge_v[0], pl->edge_v[1], pl->edge_v[2]}, pl->material_id);
+        else
+            scene_add_plane(world, origin, (vec3f) {pl->normal[0], pl->normal[1], pl->normal[2]}, pl->material_id);
+    }
+    accel->node_count = h->node_count;
+    accel->depth = h->bvh_depth;
+    accel->nodes = (bvh_node *)(base + h->sections[CACHE_NODES].offset);
+    accel->prim_count = h->sphere_count;
+    accel->prim_index = (int32_t *)(base + h->sections[CACHE_PRIM_INDEX].offset);
+    accel->borrowed = true;
+    return true;
+}
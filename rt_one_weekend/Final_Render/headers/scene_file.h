@@ -0,0 +1,594 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "vec3.h"
+#include "scene.h"
+#include "material.h"
+
+//
+// scene description files
+// plain text, one statement per line, '#' starts a comment:
+//
+//   image       <width> <aspect_ratio>
+//   samples     <samples_per_pixel>
+//   max_depth   <n>
+//   sky         <scale>                       1 = the book's sky, 0 = night
+//   camera      <lookfrom xyz> <lookat xyz> <vup xyz> <vfov> <aperture> <focus_dist>
+//   lambertian  <albedo rgb>                  materials get ids 0, 1, 2... in file order
+//   metal       <albedo rgb> <fuzz>
+//   dielectric  <index_of_refraction>
+//   light       <emit rgb>
+//   sphere      <center xyz> <radius> <material id>
+//   plane       <point xyz> <normal xyz> <material id>
+//   quad        <corner xyz> <edge u xyz> <edge v xyz> <material id>
+//
+// statements are keyword + a fixed number of numbers, so the parser is a single pass
+// over the file buffer; tokens are slices of the buffer and nothing is allocated
+// besides the scene arrays themselves. a long run of spheres that ends the file (what
+// scene_save and the generators write) is split at line starts and parsed in parallel.
+
+typedef struct {
+    int width;
+    float aspect_ratio;
+    int samples_per_pixel;
+    int max_depth;
+    float sky_scale;
+    point3 lookfrom;
+    point3 lookat;
+    vec3f vup;
+    float vfov;             /* vertical, degrees */
+    float aperture;
+    float focus_dist;
+} scene_settings;
+
+/* the final scene's setup */
+inline void
+scene_settings_default (scene_settings * me) {
+    me->width = 1200;
+    me->aspect_ratio = 3.f / 2.f;
+    me->samples_per_pixel = 500;
+    me->max_depth = 50;
+    me->sky_scale = 1.0f;
+    me->lookfrom = (point3) {13.f, 2.f, 3.f};
+    me->lookat = (point3) {0.f, 0.f, 0.f};
+    me->vup = (vec3f) {0.f, 1.f, 0.f};
+    me->vfov = 20.0f;
+    me->aperture = .1f;
+    me->focus_dist = 10.f;
+}
+//
+// tokenizer
+// works on a '\0'-terminated buffer, so the hot loops need no end-of-buffer tests;
+// any byte <= ' ' other than '\0' counts as white space
+typedef struct {
+    char const * cur;
+    int line;
+} scene_lexer;
+
+#define lexer_is_digit(c) ((unsigned)((c) - '0') < 10u)
+#define lexer_is_delimiter(c) ((unsigned char)(c) <= ' ' || (c) == '#')
+
+inline void
+lexer_skip_space (scene_lexer * lx) {
+    char const * p = lx->cur;
+    for (;;) {
+        char c = *p;
+        if (c == '#') {
+            while (*p != '\n' && *p != '\0')
+                ++p;
+        } else if ((unsigned char)c <= ' ' && c != '\0') {
+            lx->line += (c == '\n');
+            ++p;
+        } else {
+            break;
+        }
+    }
+    lx->cur = p;
+}
+/* next whitespace-delimited token; returns its length, 0 at the end of the buffer */
+inline int
+lexer_word (scene_lexer * lx, char const ** out_word) {
+    lexer_skip_space(lx);
+    char const * p = lx->cur;
+    while (!lexer_is_delimiter(*p))
+        ++p;
+    *out_word = lx->cur;
+    int len = (int)(p - lx->cur);
+    lx->cur = p;
+    return len;
+}
+//
+// decimal float without strtod (which is slow and honours the locale):
+// up to 19 significant digits are gathered in an integer, then scaled by a power of ten
+inline bool
+lexer_float (scene_lexer * lx, float * out) {
+    static double const pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    /* multiplying by these is a few ulps of a double off, far below float precision */
+    static double const neg_pow10[] = {
+        1e-0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9, 1e-10, 1e-11,
+        1e-12, 1e-13, 1e-14, 1e-15, 1e-16, 1e-17, 1e-18, 1e-19, 1e-20, 1e-21, 1e-22
+    };
+    lexer_skip_space(lx);
+    char const * p = lx->cur;
+    bool negative = false;
+    if (*p == '-' || *p == '+')
+        negative = (*p++ == '-');
+    char const * digits_start = p;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; lexer_is_digit(*p); ++p) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += (mantissa != 0);
+        } else {
+            ++exponent;
+        }
+    }
+    if (*p == '.') {
+        for (++p; lexer_is_digit(*p); ++p) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += (mantissa != 0);
+                --exponent;
+            }
+        }
+    }
+    if (p == digits_start || (p == digits_start + 1 && *digits_start == '.'))
+        return false;
+    if (*p == 'e' || *p == 'E') {
+        ++p;
+        bool exp_negative = false;
+        if (*p == '-' || *p == '+')
+            exp_negative = (*p++ == '-');
+        if (!lexer_is_digit(*p))
+            return false;
+        int e = 0;
+        for (; lexer_is_digit(*p); ++p)
+            if (e < 10000)
+                e = e * 10 + (*p - '0');
+        exponent += exp_negative ? -e : e;
+    }
+    if (!lexer_is_delimiter(*p))
+        return false;
+    double value = (double)mantissa;
+    if (exponent < 0)
+        value = (exponent >= -22) ? value * neg_pow10[-exponent] : value * pow(10.0, exponent);
+    else if (exponent > 0)
+        value = (exponent <= 22) ? value * pow10[exponent] : value * pow(10.0, exponent);
+    *out = (float)(negative ? -value : value);
+    lx->cur = p;
+    return true;
+}
+inline bool
+lexer_int (scene_lexer * lx, int * out) {
+    lexer_skip_space(lx);
+    char const * p = lx->cur;
+    bool negative = false;
+    if (*p == '-' || *p == '+')
+        negative = (*p++ == '-');
+    if (!lexer_is_digit(*p))
+        return false;
+    int64_t value = 0;
+    for (; lexer_is_digit(*p); ++p)
+        if (value <= INT32_MAX)
+            value = value * 10 + (*p - '0');
+    if (!lexer_is_delimiter(*p) || value > INT32_MAX)
+        return false;
+    *out = (int)(negative ? -value : value);
+    lx->cur = p;
+    return true;
+}
+inline bool
+lexer_floats (scene_lexer * lx, float * out, int count) {
+    for (int i = 0; i < count; ++i)
+        if (!lexer_float(lx, &out[i]))
+            return false;
+    return true;
+}
+//
+// loading
+typedef struct {
+    int line;
+    char const * message;
+} scene_file_error;
+
+#define scene_keyword(word, len, kw) ((len) == (int)sizeof(kw) - 1 && 0 == memcmp((word), (kw), (len)))
+
+//
+// the sphere tail
+// a chunk of sphere statements, parsed straight into its slice [first, first + count) of
+// the scene arrays
+typedef struct {
+    char const * begin;
+    char const * end;
+    int first;
+    int count;
+    int lines;
+    bool ok;
+} scene_sphere_chunk;
+
+#define scene_parallel_min_bytes (1 << 20)
+
+/* the first line after p that starts with a letter, i.e. a keyword: no statement spans it */
+inline char const *
+scene_next_statement (char const * p, char const * end) {
+    while (p < end) {
+        char const * nl = memchr(p, '\n', end - p);
+        if (NULL == nl)
+            return end;
+        p = nl + 1;
+        if (p < end && (unsigned)((*p | 0x20) - 'a') < 26u)
+            return p;
+    }
+    return end;
+}
+/* lines of [p, end) whose first word is sphere */
+inline int
+scene_count_spheres (char const * p, char const * end) {
+    int count = 0;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        /* p[6] is at most the next chunk's first byte or the buffer's '\0' */
+        if (end - p >= 6 && 0 == memcmp(p, "sphere", 6) && lexer_is_delimiter(p[6]))
+            ++count;
+        char const * nl = memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+    }
+    return count;
+}
+inline bool
+scene_parse_sphere_chunk (scene_sphere_chunk * me, scene * world, int mat_count) {
+    scene_lexer lx = {me->begin, 0};
+    float v[4];
+    int i = me->first;
+    int last = me->first + me->count;
+    for (;;) {
+        lexer_skip_space(&lx);
+        if (lx.cur >= me->end)
+            break;
+        char const * word;
+        int len = lexer_word(&lx, &word);
+        int mat_id;
+        if (!scene_keyword(word, len, "sphere") || i == last || !lexer_floats(&lx, v, 4) || !lexer_int(&lx, &mat_id) ||
+            mat_id < 0 || mat_id >= mat_count)
+            return false;
+        world->center_x[i] = v[0];
+        world->center_y[i] = v[1];
+        world->center_z[i] = v[2];
+        world->radius[i] = v[3];
+        world->sphere_mat[i] = mat_id;
+        ++i;
+    }
+    me->lines = lx.line;
+    return (i == last);
+}
+//
+// [text, end) from a sphere keyword to the end of the file, on every thread: the chunks
+// count their spheres, the arrays are reserved for all of them, then every chunk parses
+// into its own slice. false, with the scene as it was, when that is not a plain run of
+// well-formed spheres of the mat_count materials so far (or memory ran out); the caller's
+// parser then takes it, and reports errors with their lines. *out_lines: the newlines read
+inline bool
+scene_parse_sphere_tail (char const * text, char const * end, scene * world, int mat_count, int * out_lines) {
+    int chunk_count = omp_get_max_threads();
+    if (chunk_count < 2 || end - text < scene_parallel_min_bytes)
+        return false;
+    scene_sphere_chunk * chunks = malloc(chunk_count * sizeof(scene_sphere_chunk));
+    if (NULL == chunks)
+        return false;
+    char const * begin = text;
+    for (int k = 0; k < chunk_count; ++k) {
+        chunks[k].begin = begin;
+        begin = (k + 1 == chunk_count) ? end : scene_next_statement(text + (end - text) / chunk_count * (k + 1), end);
+        if (begin < chunks[k].begin)
+            begin = chunks[k].begin;
+        chunks[k].end = begin;
+    }
+    int k;
+#pragma omp parallel for schedule(static, 1)
+    for (k = 0; k < chunk_count; ++k)
+        chunks[k].count = scene_count_spheres(chunks[k].begin, chunks[k].end);
+    int total = world->sphere_count;
+    for (k = 0; k < chunk_count; ++k) {
+        chunks[k].first = total;
+        total += chunks[k].count;
+    }
+    bool ret = scene_reserve_spheres(world, total);
+    if (ret) {
+#pragma omp parallel for schedule(static, 1)
+        for (k = 0; k < chunk_count; ++k)
+            chunks[k].ok = scene_parse_sphere_chunk(&chunks[k], world, mat_count);
+        *out_lines = 0;
+        for (k = 0; k < chunk_count; ++k) {
+            ret = ret && chunks[k].ok;
+            *out_lines += chunks[k].lines;
+        }
+    }
+    if (ret)
+        world->sphere_count = total;
+    free(chunks);
+    return ret;
+}
+//
+// parses a whole '\0'-terminated file held in memory (size excludes the terminator) into
+// an empty scene. materials are allocated in one block owned by the scene
+inline bool
+scene_parse (char const * text, size_t size, scene * world, scene_settings * settings, scene_file_error * out_error) {
+    scene_lexer lx = {text, 1};
+    material_storage * mats = NULL;
+    int mat_count = 0;
+    int mat_capacity = 0;
+    char const * error = NULL;
+    float v[12];
+    bool tail_tried = false;
+    /* sphere lines are rarely shorter than ~32 bytes, reserving up front avoids regrowing
+       (and copying) the arrays of big scenes */
+    if (!scene_reserve_spheres(world, (int)(size / 32) + 16))
+        error = "out of memory";
+    while (NULL == error) {
+        char const * word;
+        int len = lexer_word(&lx, &word);
+        if (0 == len)
+            break;
+        if (scene_keyword(word, len, "sphere")) {
+            if (!tail_tried) {
+                int lines;
+                tail_tried = true;
+                if (scene_parse_sphere_tail(word, text + size, world, mat_count, &lines)) {
+                    lx.cur = text + size;
+                    lx.line += lines;
+                    continue;
+                }
+            }
+            int mat_id;
+            if (!lexer_floats(&lx, v, 4) || !lexer_int(&lx, &mat_id)) {
+                error = "sphere: expected <center xyz> <radius> <material id>";
+                break;
+            }
+            if (mat_id < 0 || mat_id >= mat_count) {
+                error = "sphere: material id is not defined (yet)";
+                break;
+            }
+            if (scene_add_sphere(world, (point3) {v[0], v[1], v[2]}, v[3], mat_id) < 0) {
+                error = "out of memory";
+                break;
+            }
+        } else if (scene_keyword(word, len, "plane") || scene_keyword(word, len, "quad")) {
+            bool quad = ('q' == word[0]);
+            int mat_id;
+            if (!lexer_floats(&lx, v, quad ? 9 : 6) || !lexer_int(&lx, &mat_id)) {
+                error = quad ? "quad: expected <corner xyz> <edge u xyz> <edge v xyz> <material id>"
+                             : "plane: expected <point xyz> <normal xyz> <material id>";
+                break;
+            }
+            if (mat_id < 0 || mat_id >= mat_count) {
+                error = quad ? "quad: material id is not defined (yet)" : "plane: material id is not defined (yet)";
+                break;
+            }
+            int added = quad ?
+                scene_add_quad(world, (point3) {v[0], v[1], v[2]}, (vec3f) {v[3], v[4], v[5]}, (vec3f) {v[6], v[7], v[8]}, mat_id) :
+                scene_add_plane(world, (point3) {v[0], v[1], v[2]}, (vec3f) {v[3], v[4], v[5]}, mat_id);
+            if (added < 0) {
+                error = "out of memory";
+                break;
+            }
+        } else if (scene_keyword(word, len, "lambertian") || scene_keyword(word, len, "metal") ||
+                   scene_keyword(word, len, "dielectric") || scene_keyword(word, len, "light")) {
+            if (mat_count == mat_capacity) {
+                int capacity = mat_capacity ? 2 * mat_capacity : 16;
+                material_storage * grown = realloc(mats, capacity * sizeof(material_storage));
+                if (NULL == grown) {
+                    error = "out of memory";
+                    break;
+                }
+                mats = grown;
+                mat_capacity = capacity;
+            }
+            material_storage * m = &mats[mat_count];
+            if ('l' == word[0] && 'a' == word[1]) {
+                if (!lexer_floats(&lx, v, 3)) { error = "lambertian: expected <albedo rgb>"; break; }
+                lambertian_init(&m->lambertian, (color) {v[0], v[1], v[2]});
+            } else if ('m' == word[0]) {
+                if (!lexer_floats(&lx, v, 4)) { error = "metal: expected <albedo rgb> <fuzz>"; break; }
+                metal_init(&m->metal, (color) {v[0], v[1], v[2]}, v[3]);
+            } else if ('d' == word[0]) {
+                if (!lexer_floats(&lx, v, 1)) { error = "dielectric: expected <index of refraction>"; break; }
+                dielectric_init(&m->dielectric, v[0]);
+            } else {
+                if (!lexer_floats(&lx, v, 3)) { error = "light: expected <emit rgb>"; break; }
+                diffuse_light_init(&m->diffuse_light, (color) {v[0], v[1], v[2]});
+            }
+            ++mat_count;
+        } else if (scene_keyword(word, len, "image")) {
+            if (!lexer_int(&lx, &settings->width) || !lexer_float(&lx, &settings->aspect_ratio)) {
+                error = "image: expected <width> <aspect ratio>";
+                break;
+            }
+        } else if (scene_keyword(word, len, "samples")) {
+            if (!lexer_int(&lx, &settings->samples_per_pixel)) { error = "samples: expected <samples per pixel>"; break; }
+        } else if (scene_keyword(word, len, "max_depth")) {
+            if (!lexer_int(&lx, &settings->max_depth)) { error = "max_depth: expected <n>"; break; }
+        } else if (scene_keyword(word, len, "sky")) {
+            if (!lexer_float(&lx, &settings->sky_scale)) { error = "sky: expected <scale>"; break; }
+        } else if (scene_keyword(word, len, "camera")) {
+            if (!lexer_floats(&lx, v, 12)) {
+                error = "camera: expected <lookfrom xyz> <lookat xyz> <vup xyz> <vfov> <aperture> <focus dist>";
+                break;
+            }
+            settings->lookfrom = (point3) {v[0], v[1], v[2]};
+            settings->lookat = (point3) {v[3], v[4], v[5]};
+            settings->vup = (vec3f) {v[6], v[7], v[8]};
+            settings->vfov = v[9];
+            settings->aperture = v[10];
+            settings->focus_dist = v[11];
+        } else {
+            error = "unknown statement";
+            break;
+        }
+    }
+    // -- the material block is final now, so its addresses can be handed out
+    world->owned_materials = mats;
+    for (int i = 0; NULL == error && i < mat_count; ++i)
+        if (scene_add_material(world, &mats[i].super) < 0)
+            error = "out of memory";
+    if (out_error) {
+        out_error->line = lx.line;
+        out_error->message = error;
+    }
+    return (NULL == error);
+}
+inline bool
+scene_load (char const * path, scene * world, scene_settings * settings, scene_file_error * out_error) {
+    FILE * file = fopen(path, "rb");
+    if (NULL == file) {
+        if (out_error) {
+            out_error->line = 0;
+            out_error->message = "could not open file";
+        }
+        return false;
+    }
+    // -- a long is 32 bits on windows, files can be bigger than that
+#if defined(_WIN32)
+    _fseeki64(file, 0, SEEK_END);
+    int64_t size = _ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+#else
+    fseeko(file, 0, SEEK_END);
+    int64_t size = ftello(file);
+    fseeko(file, 0, SEEK_SET);
+#endif
+    char * text = (size >= 0 && (uint64_t)size < SIZE_MAX) ? malloc((size_t)size + 1) : NULL;
+    bool ret = (NULL != text) && ((size_t)size == fread(text, 1, (size_t)size, file));
+    if (text)
+        text[ret ? size : 0] = '\0';
+    fclose(file);
+    if (ret) {
+        ret = scene_parse(text, (size_t)size, world, settings, out_error);
+    } else if (out_error) {
+        out_error->line = 0;
+        out_error->message = "could not read file";
+    }
+    free(text);
+    return ret;
+}
+//
+// a material's type and parameters as plain numbers, returns how many
+inline int
+material_params (material * m, float out[4]) {
+    switch (material_get_type(m)) {
+    case MATERIAL_LAMBERTIAN: {
+        color a = ((lambertian *)m)->albedo;
+        out[0] = a.x; out[1] = a.y; out[2] = a.z;
+        return 3;
+    }
+    case MATERIAL_METAL: {
+        metal * mt = (metal *)m;
+        out[0] = mt->albedo.x; out[1] = mt->albedo.y; out[2] = mt->albedo.z; out[3] = mt->fuzziness;
+        return 4;
+    }
+    case MATERIAL_DIELECTRIC:
+        out[0] = ((dielectric *)m)->index_of_refraction;
+        return 1;
+    case MATERIAL_DIFFUSE_LIGHT: {
+        color e = ((diffuse_light *)m)->emit;
+        out[0] = e.x; out[1] = e.y; out[2] = e.z;
+        return 3;
+    }
+    }
+    return 0;
+}
+/* the inverse of material_params */
+inline material *
+material_init_from_params (material_storage * m, material_type type, float const params[4]) {
+    switch (type) {
+    case MATERIAL_LAMBERTIAN:
+        lambertian_init(&m->lambertian, (color) {params[0], params[1], params[2]});
+        break;
+    case MATERIAL_METAL:
+        metal_init(&m->metal, (color) {params[0], params[1], params[2]}, params[3]);
+        break;
+    case MATERIAL_DIELECTRIC:
+        dielectric_init(&m->dielectric, params[0]);
+        break;
+    case MATERIAL_DIFFUSE_LIGHT:
+        diffuse_light_init(&m->diffuse_light, (color) {params[0], params[1], params[2]});
+        break;
+    }
+    return &m->super;
+}
+/* hash of the geometry and materials, for keys of caches and checkpoints */
+inline uint64_t
+scene_content_hash (scene * world, uint64_t h) {
+    size_t n = world->sphere_count;
+    h = hash_bytes(h, &world->sphere_count, sizeof(int));
+    h = hash_bytes(h, world->center_x, n * sizeof(float));
+    h = hash_bytes(h, world->center_y, n * sizeof(float));
+    h = hash_bytes(h, world->center_z, n * sizeof(float));
+    h = hash_bytes(h, world->radius, n * sizeof(float));
+    h = hash_bytes(h, world->sphere_mat, n * sizeof(int32_t));
+    h = hash_bytes(h, &world->plane_count, sizeof(int));
+    for (int i = 0; i < world->plane_count; ++i) {
+        plane const * pl = &world->planes[i];
+        vec3f geometry[4] = {pl->origin, pl->normal, pl->edge_u, pl->edge_v};
+        h = hash_bytes(h, geometry, sizeof(geometry));
+        h = hash_bytes(h, &pl->material_id, sizeof(int));
+    }
+    for (int i = 0; i < world->material_count; ++i) {
+        float params[4];
+        material_type type = material_get_type(world->materials[i]);
+        h = hash_bytes(h, &type, sizeof(type));
+        h = hash_bytes(h, params, material_params(world->materials[i], params) * sizeof(float));
+    }
+    return h;
+}
+//
+// writing
+// %.9g round-trips a float, so save -> load gives back the same scene bit for bit
+inline bool
+scene_save (char const * path, scene * world, scene_settings const * s) {
+    FILE * file = fopen(path, "w");
+    if (NULL == file)
+        return false;
+    fprintf(file, "image %d %.9g\n", s->width, s->aspect_ratio);
+    fprintf(file, "samples %d\n", s->samples_per_pixel);
+    fprintf(file, "max_depth %d\n", s->max_depth);
+    fprintf(file, "sky %.9g\n", s->sky_scale);
+    fprintf(file, "camera %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g\n",
+        s->lookfrom.x, s->lookfrom.y, s->lookfrom.z, s->lookat.x, s->lookat.y, s->lookat.z,
+        s->vup.x, s->vup.y, s->vup.z, s->vfov, s->aperture, s->focus_dist);
+    fprintf(file, "\n# materials\n");
+    static char const * keywords[] = {"lambertian", "metal", "dielectric", "light"};
+    for (int i = 0; i < world->material_count; ++i) {
+        float params[4];
+        int count = material_params(world->materials[i], params);
+        fprintf(file, "%s", keywords[material_get_type(world->materials[i])]);
+        for (int p = 0; p < count; ++p)
+            fprintf(file, " %.9g", params[p]);
+        fprintf(file, "\n");
+    }
+    if (world->plane_count)
+        fprintf(file, "\n# planes\n");
+    for (int i = 0; i < world->plane_count; ++i) {
+        plane const * pl = &world->planes[i];
+        if (pl->bounded)
+            fprintf(file, "quad %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g %d\n", pl->origin.x, pl->origin.y, pl->origin.z,
+                pl->edge_u.x, pl->edge_u.y, pl->edge_u.z, pl->edge_v.x, pl->edge_v.y, pl->edge_v.z, pl->material_id);
+        else
+            fprintf(file, "plane %.9g %.9g %.9g  %.9g %.9g %.9g %d\n", pl->origin.x, pl->origin.y, pl->origin.z,
+                pl->normal.x, pl->normal.y, pl->normal.z, pl->material_id);
+    }
+    fprintf(file, "\n# spheres\n");
+    for (int i = 0; i < world->sphere_count; ++i)
+        fprintf(file, "sphere %.9g %.9g %.9g %.9g %d\n",
+            world->center_x[i], world->center_y[i], world->center_z[i], world->radius[i], world->sphere_mat[i]);
+    return (0 == fclose(file));
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vec3.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "triangle_mesh.h"
+
+//
+// procedural stress scenes
+// n spheres (or triangles) scattered through a volume, for scaling studies far beyond
+// the few hundred spheres of the book's final scene. the layouts stress different
+// parts of a bvh:
+//   uniform       evenly spread through a wide, flat box (the final scene, scaled up)
+//   clustered     gaussian clumps around a few centers, mostly empty space between
+//   long_thin     a box 128 times longer than it is thick, so splits favour one axis
+//   nested_glass  groups of three concentric spheres (glass shell, hollow glass, core),
+//                 boxes inside boxes and rays that refract through every layer
+// primitive sizes follow the mean spacing of the layout (its volume over n), so a scene
+// looks the same at any n, only finer; overlap is the mean diameter over that spacing
+// (below 1 most primitives are apart, above 1 most of them intersect).
+// the materials are a fixed palette: a grey ground, one glass, then palette_variants
+// of each type (lambertian, metal, dielectric, light); every primitive draws its type
+// from mix and one of the type's variants at random. everything comes from one rng
+// stream seeded with seed, so the same parameters give the same scene bit for bit.
+#define scene_gen_palette_variants 16
+#define scene_gen_ground_material 0
+#define scene_gen_glass_material 1
+#define scene_gen_material_count (2 + 4 * scene_gen_palette_variants)
+
+typedef enum {
+    SCENE_GEN_UNIFORM,
+    SCENE_GEN_CLUSTERED,
+    SCENE_GEN_LONG_THIN,
+    SCENE_GEN_NESTED_GLASS,
+    SCENE_GEN_LAYOUT_COUNT
+} scene_gen_layout;
+
+static char const * g_scene_gen_layout_names[SCENE_GEN_LAYOUT_COUNT] = {
+    "uniform", "clustered", "long_thin", "nested_glass"
+};
+
+typedef struct {
+    int count;                  /* primitives (spheres or triangles) */
+    scene_gen_layout layout;
+    float extent;               /* half width of the volume */
+    float overlap;              /* mean diameter over mean spacing */
+    float mix[4];               /* relative amounts of lambertian, metal, dielectric, light */
+    int clusters;               /* clustered layout */
+    uint64_t seed;
+} scene_gen_params;
+
+/* volume the primitives are placed in, and cluster centers for the clustered layout */
+typedef struct {
+    vec3f center;
+    vec3f half;
+    float spacing;
+    float sigma;                /* clustered: spread of a clump */
+    point3 * cluster_centers;
+} scene_gen_volume;
+
+inline void
+scene_gen_params_default (scene_gen_params * me) {
+    me->count = 100000;
+    me->layout = SCENE_GEN_UNIFORM;
+    me->extent = 100.0f;
+    me->overlap = 0.5f;
+    me->mix[0] = 0.8f;          /* the final scene's proportions */
+    me->mix[1] = 0.15f;
+    me->mix[2] = 0.05f;
+    me->mix[3] = 0.0f;
+    me->clusters = 32;
+    me->seed = 2021;
+}
+/* layout from its name, -1 if unknown */
+inline int
+scene_gen_layout_from_name (char const * name) {
+    for (int k = 0; k < SCENE_GEN_LAYOUT_COUNT; ++k)
+        if (0 == strcmp(name, g_scene_gen_layout_names[k]))
+            return k;
+    return -1;
+}
+inline float
+scene_gen_gaussian (void) {
+    float u = 1.0f - random_float();    /* (0, 1] */
+    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * g_pi * random_float());
+}
+/* draws the cluster centers (on the caller's rng stream), false when out of memory */
+inline bool
+scene_gen_volume_init (scene_gen_volume * me, scene_gen_params const * p) {
+    float e = p->extent;
+    me->cluster_centers = NULL;
+    me->sigma = 0.0f;
+    if (SCENE_GEN_LONG_THIN == p->layout) {
+        me->half = (vec3f) {8.0f * e, e / 16.0f, e / 16.0f};
+    } else {
+        me->half = (vec3f) {e, e / 4.0f, e};
+    }
+    me->center = (vec3f) {0.0f, me->half.y, 0.0f};      /* resting on the ground, y = 0 */
+    float volume = 8.0f * me->half.x * me->half.y * me->half.z;
+    if (SCENE_GEN_CLUSTERED == p->layout) {
+        int k = p->clusters > 0 ? p->clusters : 1;
+        me->cluster_centers = malloc(k * sizeof(point3));
+        if (NULL == me->cluster_centers)
+            return false;
+        for (int c = 0; c < k; ++c)
+            me->cluster_centers[c] = vec3_add(me->center, vec3_mul_elementwise(me->half, random_vec3_shifted(-1.0f, 1.0f)));
+        // -- the clumps' spread is a tenth of the box's half height, they rarely touch
+        me->sigma = 0.1f * me->half.y;
+        float clump = 4.0f * me->sigma;
+        volume = k * clump * clump * clump;
+    }
+    me->spacing = cbrtf(volume / (p->count > 0 ? p->count : 1));
+    return true;
+}
+inline void
+scene_gen_volume_free (scene_gen_volume * me) {
+    free(me->cluster_centers);
+    me->cluster_centers = NULL;
+}
+inline point3
+scene_gen_position (scene_gen_volume const * v, scene_gen_params const * p) {
+    if (SCENE_GEN_CLUSTERED == p->layout) {
+        int k = p->clusters > 0 ? p->clusters : 1;
+        point3 c = v->cluster_centers[random_u32() % (uint32_t)k];
+        vec3f offset = {scene_gen_gaussian(), scene_gen_gaussian(), scene_gen_gaussian()};
+        return vec3_add(c, vec3_scale(offset, v->sigma));
+    }
+    return vec3_add(v->center, vec3_mul_elementwise(v->half, random_vec3_shifted(-1.0f, 1.0f)));
+}
+inline float
+scene_gen_radius (scene_gen_volume const * v, scene_gen_params const * p) {
+    return 0.5f * p->overlap * v->spacing * random_float_shifted(0.5f, 1.5f);
+}
+/* palette id of a random material drawn from the mix */
+inline int
+scene_gen_material (scene_gen_params const * p) {
+    float total = p->mix[0] + p->mix[1] + p->mix[2] + p->mix[3];
+    float u = random_float() * (total > 0.0f ? total : 1.0f);
+    int type = 0;
+    while (type < 3 && u >= p->mix[type]) {
+        u -= p->mix[type];
+        ++type;
+    }
+    if (total <= 0.0f)
+        type = 0;
+    return 2 + type * scene_gen_palette_variants + (int)(random_u32() % scene_gen_palette_variants);
+}
+/* the palette, in material id order, into storage[scene_gen_material_count] */
+inline void
+scene_gen_palette (material_storage * storage) {
+    lambertian_init(&storage[scene_gen_ground_material].lambertian, (color) {0.5f, 0.5f, 0.5f});
+    dielectric_init(&storage[scene_gen_glass_material].dielectric, 1.5f);
+    for (int k = 0; k < scene_gen_palette_variants; ++k) {
+        float t = (k + 0.5f) / scene_gen_palette_variants;
+        color hue = {0.5f + 0.5f * cosf(6.2831853f * t), 0.5f + 0.5f * cosf(6.2831853f * (t + 0.333f)),
+            0.5f + 0.5f * cosf(6.2831853f * (t + 0.667f))};
+        material_storage * m = &storage[2 + k];
+        lambertian_init(&m->lambertian, vec3_mul_elementwise(hue, hue));
+        m = &storage[2 + scene_gen_palette_variants + k];
+        metal_init(&m->metal, vec3_add(vec3_scale(hue, 0.5f), (color) {0.5f, 0.5f, 0.5f}), 0.5f * t);
+        m = &storage[2 + 2 * scene_gen_palette_variants + k];
+        dielectric_init(&m->dielectric, 1.3f + 0.5f * t);
+        m = &storage[2 + 3 * scene_gen_palette_variants + k];
+        diffuse_light_init(&m->diffuse_light, vec3_scale(vec3_add(hue, (color) {1.0f, 1.0f, 1.0f}), 2.0f));
+    }
+}
+/* a camera that sees the whole volume from above and in front */
+inline void
+scene_gen_settings (scene_gen_volume const * v, scene_settings * settings) {
+    scene_settings_default(settings);
+    float reach = vec3_len(v->half);
+    vec3f from = vec3_normalize((vec3f) {0.35f, 0.5f, 1.0f});
+    settings->lookat = v->center;
+    settings->lookfrom = vec3_add(v->center, vec3_scale(from, 2.2f * reach));
+    settings->vup = (vec3f) {0.0f, 1.0f, 0.0f};
+    settings->vfov = 30.0f;
+    settings->aperture = 0.0f;
+    settings->focus_dist = 2.2f * reach;
+}
+//
+// spheres into an empty scene (which owns the palette), plus a ground plane at y = 0
+inline bool
+scene_gen_spheres (scene * world, scene_settings * settings, scene_gen_params const * p) {
+    random_set_state(random_hash_seed(p->seed, 0));
+    scene_gen_volume v;
+    if (!scene_gen_volume_init(&v, p))
+        return false;
+    material_storage * mats = malloc(scene_gen_material_count * sizeof(material_storage));
+    if (NULL == mats) {
+        scene_gen_volume_free(&v);
+        return false;
+    }
+    scene_gen_palette(mats);
+    world->owned_materials = mats;
+    bool grown = true;
+    for (int i = 0; i < scene_gen_material_count; ++i)
+        grown = grown && scene_add_material(world, &mats[i].super) >= 0;
+    grown = grown && scene_add_plane(world, (point3) {0.0f, 0.0f, 0.0f}, (vec3f) {0.0f, 1.0f, 0.0f}, scene_gen_ground_material) >= 0;
+    // -- with all the spheres reserved, adding them cannot fail
+    if (!grown || !scene_reserve_spheres(world, p->count)) {
+        scene_gen_volume_free(&v);
+        return false;
+    }
+    int i = 0;
+    if (SCENE_GEN_NESTED_GLASS == p->layout) {
+        // -- a group takes the room of its three spheres
+        for (; i + 3 <= p->count; i += 3) {
+            point3 c = scene_gen_position(&v, p);
+            float r = 1.44f * scene_gen_radius(&v, p);     /* cbrt(3) */
+            scene_add_sphere(world, c, r, scene_gen_glass_material);
+            scene_add_sphere(world, c, -0.9f * r, scene_gen_glass_material);
+            scene_add_sphere(world, c, 0.5f * r, scene_gen_material(p));
+        }
+    }
+    for (; i < p->count; ++i) {
+        point3 c = scene_gen_position(&v, p);
+        scene_add_sphere(world, c, scene_gen_radius(&v, p), scene_gen_material(p));
+    }
+    scene_gen_settings(&v, settings);
+    scene_gen_volume_free(&v);
+    return true;
+}
+//
+// triangles into a mesh (initialized with triangle_mesh_init), three vertices of its own
+// each, on a sphere of the radius a sphere would have; the nested layout makes groups of
+// three concentric copies of one triangle. the mesh's bvh is not built; settings gets
+// the same camera as the spheres'
+inline bool
+scene_gen_triangles (triangle_mesh * mesh, scene_settings * settings, scene_gen_params const * p) {
+    random_set_state(random_hash_seed(p->seed, 0));
+    scene_gen_volume v;
+    if (!scene_gen_volume_init(&v, p))
+        return false;
+    mesh->positions = malloc(3 * (size_t)p->count * sizeof(point3));
+    mesh->indices = malloc(3 * (size_t)p->count * sizeof(int32_t));
+    if (NULL == mesh->positions || NULL == mesh->indices) {
+        scene_gen_volume_free(&v);
+        return false;
+    }
+    int i = 0;
+    while (i < p->count) {
+        point3 c = scene_gen_position(&v, p);
+        float r = scene_gen_radius(&v, p);
+        vec3f corner[3] = {random_unit_vector(), random_unit_vector(), random_unit_vector()};
+        int copies = 1;
+        float scale[3] = {1.0f, 0.9f, 0.5f};
+        if (SCENE_GEN_NESTED_GLASS == p->layout && i + 3 <= p->count) {
+            copies = 3;
+            r *= 1.44f;
+        }
+        for (int k = 0; k < copies; ++k, ++i) {
+            for (int a = 0; a < 3; ++a) {
+                mesh->positions[3 * i + a] = vec3_add(c, vec3_scale(corner[a], scale[k] * r));
+                mesh->indices[3 * i + a] = 3 * i + a;
+            }
+        }
+    }
+    mesh->vertex_count = 3 * p->count;
+    mesh->triangle_count = p->count;
+    scene_gen_settings(&v, settings);
+    scene_gen_volume_free(&v);
+    return true;
+}
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+//
+// processor topology and thread pinning
+// every logical processor with its numa node, package (socket), physical core and smt
+// slot, read from GetLogicalProcessorInformationEx on windows and from sysfs on linux
+// (/sys/devices/system/{cpu,node}). elsewhere, or when that fails, the processors are
+// all taken as one node of single-threaded cores. pinning sets the calling thread's
+// affinity: SetThreadGroupAffinity on windows, the sched_setaffinity system call on
+// linux (the libc wrapper and its cpu_set_t need _GNU_SOURCE before every include).
+// placement policies, for thread t of n:
+//   none       no affinity, the os schedules the thread anywhere
+//   compact    the t-th processor in (node, core, smt) order: smt siblings first, then
+//              the next core, and a node is full before the next one is used
+//   scatter    round robin over the nodes, the cores within them, then smt slots:
+//              as much cache and memory bandwidth per thread as there is
+//   numa       the whole of node t * nodes / n (threads split into equal blocks per
+//              node), the os places the thread within its node
+#define topology_max_cpus 1024
+#define topology_max_nodes 64
+
+typedef enum {
+    PIN_NONE,
+    PIN_COMPACT,
+    PIN_SCATTER,
+    PIN_NUMA,
+    PIN_POLICY_COUNT
+} pin_policy;
+
+static char const * g_pin_policy_names[PIN_POLICY_COUNT] = {"none", "compact", "scatter", "numa"};
+
+typedef struct {
+    int16_t group;      /* windows processor group, 0 elsewhere */
+    int16_t number;     /* within its group (windows), the os cpu number (linux) */
+    int node;           /* dense, 0 .. node_count - 1 */
+    int package;
+    int core;           /* physical core, dense over the machine */
+    int core_rank;      /* the core's position within its node */
+    int smt;            /* 0 for a core's first hardware thread */
+} topology_cpu;
+
+typedef struct {
+    int cpu_count;
+    int node_count;
+    int package_count;
+    int core_count;
+    int node_ids[topology_max_nodes];   /* the os's number of every node */
+    topology_cpu cpus[topology_max_cpus];
+    int compact[topology_max_cpus];     /* cpus in compact order */
+    int scatter[topology_max_cpus];     /* cpus in scatter order */
+} topology;
+
+/* pin_policy from its name, -1 if unknown */
+inline int
+pin_policy_from_name (char const * name) {
+    for (int k = 0; k < PIN_POLICY_COUNT; ++k)
+        if (0 == strcmp(name, g_pin_policy_names[k]))
+            return k;
+    return -1;
+}
+//
+// discovery
+#if defined(__linux__)
+inline int
+topology_read_int (char const * path, int fallback) {
+    FILE * file = fopen(path, "r");
+    int ret = fallback;
+    if (file) {
+        if (1 != fscanf(file, "%d", &ret))
+            ret = fallback;
+        fclose(file);
+    }
+    return ret;
+}
+/* calls out(cpu, user) for every cpu of a sysfs list ("0-3,8,10-11"), false if the file is missing */
+inline bool
+topology_read_list (char const * path, void (*out)(int, void *), void * user) {
+    FILE * file = fopen(path, "r");
+    if (NULL == file)
+        return false;
+    int lo, hi;
+    while (1 == fscanf(file, "%d", &lo)) {
+        hi = lo;
+        int c = fgetc(file);
+        if ('-' == c) {
+            if (1 != fscanf(file, "%d", &hi))
+                break;
+            c = fgetc(file);
+        }
+        for (int cpu = lo; cpu <= hi; ++cpu)
+            out(cpu, user);
+        if (',' != c)
+            break;
+    }
+    fclose(file);
+    return true;
+}
+inline void
+topology_add_online (int cpu, void * user) {
+    topology * me = user;
+    if (me->cpu_count < topology_max_cpus) {
+        topology_cpu * c = &me->cpus[me->cpu_count++];
+        c->group = 0;
+        c->number = (int16_t)cpu;
+        c->node = -1;
+    }
+}
+typedef struct {
+    topology * topo;
+    int node;
+} topology_node_fill;
+
+inline void
+topology_set_node (int cpu, void * user) {
+    topology_node_fill * fill = user;
+    for (int k = 0; k < fill->topo->cpu_count; ++k)
+        if (fill->topo->cpus[k].number == cpu)
+            fill->topo->cpus[k].node = fill->node;
+}
+inline bool
+topology_discover (topology * me) {
+    if (!topology_read_list("/sys/devices/system/cpu/online", topology_add_online, me) || 0 == me->cpu_count)
+        return false;
+    char path[128];
+    for (int k = 0; k < me->cpu_count; ++k) {
+        topology_cpu * c = &me->cpus[k];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c->number);
+        c->package = topology_read_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", c->number);
+        c->core = topology_read_int(path, c->number);   /* per package for now, made dense below */
+    }
+    // -- node numbers may have gaps (and node 0 may have no cpus), they are made dense
+    int node_count = 0;
+    for (int node = 0; node < 256 && node_count < topology_max_nodes; ++node) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        topology_node_fill fill = {me, node_count};
+        if (!topology_read_list(path, topology_set_node, &fill))
+            continue;
+        int cpus = 0;
+        for (int k = 0; k < me->cpu_count; ++k)
+            cpus += (me->cpus[k].node == node_count);
+        if (cpus > 0)
+            me->node_ids[node_count++] = node;
+    }
+    for (int k = 0; k < me->cpu_count; ++k)
+        if (me->cpus[k].node < 0)
+            me->cpus[k].node = 0;
+    return true;
+}
+#elif defined(_WIN32)
+inline bool
+topology_discover (topology * me) {
+    DWORD size = 0;
+    GetLogicalProcessorInformationEx(RelationAll, NULL, &size);
+    char * buffer = malloc(size);
+    if (NULL == buffer || !GetLogicalProcessorInformationEx(RelationAll, (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)buffer, &size)) {
+        free(buffer);
+        return false;
+    }
+    // -- processors come from the core records, then packages and nodes are looked up by mask
+    int core = 0, package = 0, node_count = 0;
+    for (DWORD at = 0; at < size; ) {
+        SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX * info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)(buffer + at);
+        if (RelationProcessorCore == info->Relationship) {
+            GROUP_AFFINITY const * g = &info->Processor.GroupMask[0];
+            for (int bit = 0; bit < 64 && me->cpu_count < topology_max_cpus; ++bit) {
+                if (g->Mask & ((KAFFINITY)1 << bit)) {
+                    topology_cpu * c = &me->cpus[me->cpu_count++];
+                    c->group = (int16_t)g->Group;
+                    c->number = (int16_t)bit;
+                    c->core = core;
+                    c->node = 0;
+                    c->package = 0;
+                }
+            }
+            ++core;
+        }
+        at += info->Size;
+    }
+    for (DWORD at = 0; at < size; ) {
+        SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX * info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)(buffer + at);
+        if (RelationProcessorPackage == info->Relationship || RelationNumaNode == info->Relationship) {
+            bool is_node = (RelationNumaNode == info->Relationship);
+            GROUP_AFFINITY const * g = is_node ? &info->NumaNode.GroupMask : &info->Processor.GroupMask[0];
+            for (int k = 0; k < me->cpu_count; ++k) {
+                topology_cpu * c = &me->cpus[k];
+                if (c->group == g->Group && (g->Mask & ((KAFFINITY)1 << c->number))) {
+                    if (is_node)
+                        c->node = node_count;
+                    else
+                        c->package = package;
+                }
+            }
+            if (is_node && node_count < topology_max_nodes)
+                me->node_ids[node_count] = info->NumaNode.NodeNumber;
+            node_count += is_node;
+            package += !is_node;
+        }
+        at += info->Size;
+    }
+    free(buffer);
+    return (me->cpu_count > 0);
+}
+#else
+inline bool
+topology_discover (topology * me) {
+    (void)me;
+    return false;
+}
+#endif
+
+static topology * g_topology_sort;     /* the topology being ordered, qsort has no user pointer */
+
+inline int
+topology_compare_compact (void const * a, void const * b) {
+    topology_cpu const * x = &g_topology_sort->cpus[*(int const *)a];
+    topology_cpu const * y = &g_topology_sort->cpus[*(int const *)b];
+    if (x->node != y->node) return x->node - y->node;
+    if (x->core != y->core) return x->core - y->core;
+    return x->smt - y->smt;
+}
+inline int
+topology_compare_scatter (void const * a, void const * b) {
+    topology_cpu const * x = &g_topology_sort->cpus[*(int const *)a];
+    topology_cpu const * y = &g_topology_sort->cpus[*(int const *)b];
+    if (x->smt != y->smt) return x->smt - y->smt;
+    if (x->core_rank != y->core_rank) return x->core_rank - y->core_rank;
+    return x->node - y->node;
+}
+//
+// fills me; falls back to fallback_cpus cpus on one node when the os will not say
+inline void
+topology_init (topology * me, int fallback_cpus) {
+    memset(me, 0, sizeof(*me));
+    if (!topology_discover(me)) {
+        memset(me, 0, sizeof(*me));
+        me->cpu_count = fallback_cpus < topology_max_cpus ? fallback_cpus : topology_max_cpus;
+        for (int k = 0; k < me->cpu_count; ++k) {
+            me->cpus[k].number = (int16_t)k;
+            me->cpus[k].core = k;
+        }
+    }
+    // -- dense core numbers over (package, core id), smt slots and per-node core ranks
+    int n = me->cpu_count;
+    int key[topology_max_cpus], core_node[topology_max_cpus];
+    int cores = 0;
+    me->node_count = 0;
+    me->package_count = 0;
+    for (int k = 0; k < n; ++k) {
+        topology_cpu * c = &me->cpus[k];
+        me->node_count = c->node + 1 > me->node_count ? c->node + 1 : me->node_count;
+        me->package_count = c->package + 1 > me->package_count ? c->package + 1 : me->package_count;
+        key[k] = c->package * 65536 + c->core;
+    }
+    for (int k = 0; k < n; ++k) {
+        topology_cpu * c = &me->cpus[k];
+        int first = 0;
+        c->smt = 0;
+        while (key[first] != key[k])
+            ++first;
+        for (int i = first; i < k; ++i)
+            c->smt += (key[i] == key[k]);
+        if (first == k) {
+            core_node[cores] = c->node;
+            c->core = cores++;
+        } else {
+            c->core = me->cpus[first].core;
+        }
+        c->core_rank = 0;
+        for (int i = 0; i < c->core; ++i)
+            c->core_rank += (core_node[i] == c->node);
+    }
+    me->core_count = cores;
+    for (int k = 0; k < n; ++k)
+        me->compact[k] = me->scatter[k] = k;
+    g_topology_sort = me;
+    qsort(me->compact, n, sizeof(int), topology_compare_compact);
+    qsort(me->scatter, n, sizeof(int), topology_compare_scatter);
+}
+//
+// pinning
+inline bool
+topology_set_affinity (topology const * me, bool const * use) {
+#if defined(_WIN32)
+    GROUP_AFFINITY affinity = {0};
+    bool any = false;
+    for (int k = 0; k < me->cpu_count; ++k) {
+        // -- one group at a time: the group of the first cpu wins
+        if (use[k] && (!any || me->cpus[k].group == affinity.Group)) {
+            affinity.Group = me->cpus[k].group;
+            affinity.Mask |= (KAFFINITY)1 << me->cpus[k].number;
+            any = true;
+        }
+    }
+    return any && SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL);
+#elif defined(__linux__)
+    unsigned long mask[topology_max_cpus / (8 * sizeof(unsigned long))] = {0};
+    int bits = 8 * sizeof(unsigned long);
+    for (int k = 0; k < me->cpu_count; ++k)
+        if (use[k] && me->cpus[k].number < topology_max_cpus)
+            mask[me->cpus[k].number / bits] |= 1ul << (me->cpus[k].number % bits);
+    return (0 == syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask));
+#else
+    (void)me;
+    (void)use;
+    return false;
+#endif
+}
+/* places the calling thread, thread of thread_count, by policy; false if the os refused */
+inline bool
+topology_pin (topology const * me, pin_policy policy, int thread, int thread_count) {
+    bool use[topology_max_cpus];
+    int n = me->cpu_count;
+    for (int k = 0; k < n; ++k)
+        use[k] = (PIN_NONE == policy);
+    if (PIN_COMPACT == policy) {
+        use[me->compact[thread % n]] = true;
+    } else if (PIN_SCATTER == policy) {
+        use[me->scatter[thread % n]] = true;
+    } else if (PIN_NUMA == policy) {
+        int node = (int)((int64_t)thread * me->node_count / (thread_count > 0 ? thread_count : 1));
+        for (int k = 0; k < n; ++k)
+            use[k] = (me->cpus[k].node == node);
+    }
+    return topology_set_affinity(me, use);
+}
+/* the numa node the calling thread's policy puts it on, -1 when it may run anywhere */
+inline int
+topology_pin_node (topology const * me, pin_policy policy, int thread, int thread_count) {
+    int n = me->cpu_count;
+    switch (policy) {
+    case PIN_COMPACT: return me->cpus[me->compact[thread % n]].node;
+    case PIN_SCATTER: return me->cpus[me->scatter[thread % n]].node;
+    case PIN_NUMA: return (int)((int64_t)thread * me->node_count / (thread_count > 0 ? thread_count : 1));
+    default: return -1;
+    }
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+//
+// timeline traces
+// scoped markers around the phases of a run, written as chrome trace json (load it in
+// chrome://tracing or ui.perfetto.dev), one track per thread:
+//
+//   trace_scope s = trace_begin("bvh build");
+//   ...
+//   trace_end(&s);
+//
+// names are stored by pointer and written as they are, so they must be string literals
+// (no quotes or backslashes). every thread appends to its own buffer, a list of event
+// blocks only that thread writes to, so recording takes no locks; a thread takes one
+// (a critical section) only to register its buffer, the first time it records.
+// trace_open arms recording and registers trace_flush with atexit, which writes every
+// buffer once the program is done. before trace_open, markers cost a test of a flag.
+// timestamps come from QueryPerformanceCounter / clock_gettime(CLOCK_MONOTONIC), the
+// clocks behind dxr_101_tutorials' StepTimer, in microseconds
+#define trace_block_events 4096
+
+typedef struct {
+    char const * name;
+    double ts;          /* start, microseconds */
+    double dur;
+    int64_t arg;        /* written as args.n when not trace_no_arg */
+} trace_event;
+
+#define trace_no_arg INT64_MIN
+
+typedef struct trace_block {
+    struct trace_block * next;
+    int count;
+    trace_event events[trace_block_events];
+} trace_block;
+
+typedef struct trace_buffer {
+    struct trace_buffer * next;     /* all registered buffers */
+    int tid;
+    trace_block * first;
+    trace_block * last;
+} trace_buffer;
+
+typedef struct {
+    char const * name;
+    double ts;
+    int64_t arg;
+} trace_scope;
+
+static bool g_trace_enabled = false;
+static char const * g_trace_path = NULL;
+static trace_buffer * g_trace_buffers = NULL;
+static int g_trace_threads = 0;
+static thread_local_var trace_buffer * g_trace_local = NULL;
+
+inline double
+trace_clock_us (void) {
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)(counter.QuadPart / frequency.QuadPart) * 1e6 +
+        (double)(counter.QuadPart % frequency.QuadPart) * 1e6 / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+#endif
+}
+/* the calling thread's buffer, registered on first use; NULL when out of memory */
+inline trace_buffer *
+trace_local_buffer (void) {
+    if (NULL == g_trace_local) {
+        trace_buffer * buf = calloc(1, sizeof(trace_buffer));
+        if (NULL == buf)
+            return NULL;
+#pragma omp critical(trace_buffers)
+        {
+            buf->tid = g_trace_threads++;
+            buf->next = g_trace_buffers;
+            g_trace_buffers = buf;
+        }
+        g_trace_local = buf;
+    }
+    return g_trace_local;
+}
+inline void
+trace_record (char const * name, double ts, double dur, int64_t arg) {
+    trace_buffer * buf = trace_local_buffer();
+    if (NULL == buf)
+        return;
+    if (NULL == buf->last || trace_block_events == buf->last->count) {
+        trace_block * block = malloc(sizeof(trace_block));
+        if (NULL == block)
+            return;
+        block->next = NULL;
+        block->count = 0;
+        if (buf->last)
+            buf->last->next = block;
+        else
+            buf->first = block;
+        buf->last = block;
+    }
+    trace_event * e = &buf->last->events[buf->last->count++];
+    e->name = name;
+    e->ts = ts;
+    e->dur = dur;
+    e->arg = arg;
+}
+inline trace_scope
+trace_begin_arg (char const * name, int64_t arg) {
+    trace_scope ret = {name, g_trace_enabled ? trace_clock_us() : 0.0, arg};
+    return ret;
+}
+inline trace_scope
+trace_begin (char const * name) {
+    return trace_begin_arg(name, trace_no_arg);
+}
+inline void
+trace_end (trace_scope const * s) {
+    if (g_trace_enabled)
+        trace_record(s->name, s->ts, trace_clock_us() - s->ts, s->arg);
+}
+//
+// output
+// complete ("X") events per thread plus a thread_name record for every track; the main
+// thread is normally the first to record, so it gets track 0
+inline bool
+trace_write (char const * path) {
+    FILE * out = fopen(path, "w");
+    if (NULL == out)
+        return false;
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (trace_buffer * buf = g_trace_buffers; buf; buf = buf->next) {
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+            first ? "" : ",\n", buf->tid, 0 == buf->tid ? "main" : "thread", buf->tid);
+        first = false;
+        for (trace_block * block = buf->first; block; block = block->next) {
+            for (int k = 0; k < block->count; ++k) {
+                trace_event const * e = &block->events[k];
+                fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    e->name, buf->tid, e->ts, e->dur);
+                if (trace_no_arg != e->arg)
+                    fprintf(out, ", \"args\": {\"n\": %lld}", (long long)e->arg);
+                fputc('}', out);
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return (0 == fclose(out));
+}
+/* atexit handler: writes the trace once, all threads are idle by then */
+inline void
+trace_flush (void) {
+    if (!g_trace_enabled || NULL == g_trace_path)
+        return;
+    g_trace_enabled = false;
+    if (!trace_write(g_trace_path))
+        fprintf(stderr, "could not write %s\n", g_trace_path);
+}
+/* starts recording, path is written at exit (and must outlive the program, e.g. an argv entry) */
+inline void
+trace_open (char const * path) {
+    g_trace_path = path;
+    g_trace_enabled = true;
+    trace_local_buffer();   /* the caller, normally the main thread, takes track 0 */
+    atexit(trace_flush);
+}
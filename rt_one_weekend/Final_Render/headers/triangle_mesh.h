@@ -0,0 +1,272 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "vec3.h"
+#include "ray.h"
+#include "hittable.h"
+#include "material.h"
+#include "bvh.h"
+
+//
+// indexed triangle mesh
+// positions (and optional per-vertex normals) are shared between triangles through
+// an index buffer, the same layout as a vertex/index buffer pair on the gpu side.
+// every mesh owns a bvh over its triangles.
+
+/* object ids of meshes start here, so they never collide with sphere ids */
+#define scene_mesh_id_base (1 << 24)
+
+typedef struct triangle_mesh {
+    hittable super;
+
+    int vertex_count;
+    point3 * positions;
+    vec3f * normals;        /* per vertex, may be NULL for flat shading */
+    int triangle_count;
+    int32_t * indices;      /* 3 per triangle */
+    struct material * mat_ptr;
+    int material_id;
+    int object_id;
+    bvh accel;
+} triangle_mesh;
+
+//
+// watertight ray/triangle test
+// ref: Woop, Benthin, Wald, "Watertight Ray/Triangle Intersection" (JCGT 2013)
+// the ray is sheared so it runs along +z through the origin; the edge functions are
+// then evaluated in 2d, so rays through a shared edge or vertex hit exactly one of
+// the triangles (no cracks). per-ray setup is done once in triangle_ray.
+typedef struct {
+    int kx, ky, kz;
+    float sx, sy, sz;
+} triangle_ray;
+
+inline triangle_ray
+triangle_ray_setup (ray * r) {
+    triangle_ray ret;
+    float ax = fabsf(r->dir.x), ay = fabsf(r->dir.y), az = fabsf(r->dir.z);
+    ret.kz = (ax > ay) ? ((ax > az) ? 0 : 2) : ((ay > az) ? 1 : 2);
+    ret.kx = (ret.kz + 1) % 3;
+    ret.ky = (ret.kx + 1) % 3;
+    if (r->dir.E[ret.kz] < 0.0f) {     /* keep the winding */
+        int k = ret.kx; ret.kx = ret.ky; ret.ky = k;
+    }
+    ret.sx = r->dir.E[ret.kx] / r->dir.E[ret.kz];
+    ret.sy = r->dir.E[ret.ky] / r->dir.E[ret.kz];
+    ret.sz = 1.0f / r->dir.E[ret.kz];
+    return ret;
+}
+//
+// returns t in (tmin, tmax) or tmax for a miss; out_bary gets the weights of p0, p1, p2.
+// two sided
+inline float
+triangle_intersect (triangle_ray const * tr, ray * r, point3 p0, point3 p1, point3 p2, float tmin, float tmax, float out_bary[3]) {
+    vec3f a = vec3_sub(p0, r->origin);
+    vec3f b = vec3_sub(p1, r->origin);
+    vec3f c = vec3_sub(p2, r->origin);
+    float ax = a.E[tr->kx] - tr->sx * a.E[tr->kz];
+    float ay = a.E[tr->ky] - tr->sy * a.E[tr->kz];
+    float bx = b.E[tr->kx] - tr->sx * b.E[tr->kz];
+    float by = b.E[tr->ky] - tr->sy * b.E[tr->kz];
+    float cx = c.E[tr->kx] - tr->sx * c.E[tr->kz];
+    float cy = c.E[tr->ky] - tr->sy * c.E[tr->kz];
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+    // -- exactly on an edge in float: redo the edge functions in double
+    if (0.0f == u || 0.0f == v || 0.0f == w) {
+        u = (float)((double)cx * by - (double)cy * bx);
+        v = (float)((double)ax * cy - (double)ay * cx);
+        w = (float)((double)bx * ay - (double)by * ax);
+    }
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+        return tmax;
+    float det = u + v + w;
+    if (0.0f == det)
+        return tmax;
+    float az = tr->sz * a.E[tr->kz];
+    float bz = tr->sz * b.E[tr->kz];
+    float cz = tr->sz * c.E[tr->kz];
+    float inv_det = 1.0f / det;
+    float t = (u * az + v * bz + w * cz) * inv_det;
+    if (!(t > tmin && t < tmax))
+        return tmax;
+    out_bary[0] = u * inv_det;
+    out_bary[1] = v * inv_det;
+    out_bary[2] = w * inv_det;
+    return t;
+}
+//
+// mesh
+inline point3
+triangle_mesh_vertex (triangle_mesh * me, int tri, int k) {
+    return me->positions[me->indices[3 * tri + k]];
+}
+inline void
+triangle_mesh_fill_record (triangle_mesh * me, int tri, ray * r, float t, float const bary[3], hit_record * out_rec) {
+    int32_t const * idx = &me->indices[3 * tri];
+    point3 p0 = me->positions[idx[0]], p1 = me->positions[idx[1]], p2 = me->positions[idx[2]];
+    vec3f geometric = vec3_normalize(vec3_mul_cross(vec3_sub(p1, p0), vec3_sub(p2, p0)));
+    vec3f n = geometric;
+    if (me->normals) {
+        n = vec3_add(vec3_add(vec3_scale(me->normals[idx[0]], bary[0]), vec3_scale(me->normals[idx[1]], bary[1])),
+            vec3_scale(me->normals[idx[2]], bary[2]));
+        float len2 = vec3_len_squared(n);
+        n = (len2 > 0.0f) ? vec3_scale(n, 1.0f / sqrtf(len2)) : geometric;
+        // -- keep the shading normal on the geometric normal's side
+        if (vec3_mul_dot(n, geometric) < 0.0f)
+            n = vec3_negate(n);
+    }
+    out_rec->t = t;
+    out_rec->p = ray_at(r, t);
+    out_rec->front_face = vec3_mul_dot(r->dir, geometric) < 0.0f;
+    out_rec->normal = out_rec->front_face ? n : vec3_negate(n);
+    out_rec->geometric_normal = out_rec->front_face ? geometric : vec3_negate(geometric);
+    out_rec->mat_ptr = me->mat_ptr;
+    out_rec->material_id = me->material_id;
+    out_rec->object_id = me->object_id;
+}
+//
+// closest hit, same traversal as bvh_scene_hit with triangles at the leaves
+inline bool
+triangle_mesh_hit (triangle_mesh * me, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    bvh * accel = &me->accel;
+    if (0 == accel->node_count)
+        return false;
+    triangle_ray tr = triangle_ray_setup(r);
+    vec3f inv_dir = {1.0f / r->dir.x, 1.0f / r->dir.y, 1.0f / r->dir.z};
+    float closest_so_far = tmax;
+    int closest = -1;
+    float closest_bary[3] = {0};
+    bvh_stack_entry stack[bvh_stack_size];
+    int sp = 0;
+    int node = 0;
+    if (bvh_node_enter(&accel->nodes[0], r->origin, inv_dir, tmin, tmax) == INFINITY)
+        return false;
+    for (;;) {
+        bvh_node const * n = &accel->nodes[node];
+        if (n->count) {
+            for (int k = n->offset; k < n->offset + n->count; ++k) {
+                int tri = accel->prim_index[k];
+                float bary[3];
+                float t = triangle_intersect(&tr, r, triangle_mesh_vertex(me, tri, 0), triangle_mesh_vertex(me, tri, 1),
+                    triangle_mesh_vertex(me, tri, 2), tmin, closest_so_far, bary);
+                if (t < closest_so_far) {
+                    closest_so_far = t;
+                    closest = tri;
+                    closest_bary[0] = bary[0]; closest_bary[1] = bary[1]; closest_bary[2] = bary[2];
+                }
+            }
+        } else {
+            int c0 = node + 1, c1 = n->offset;
+            float t0 = bvh_node_enter(&accel->nodes[c0], r->origin, inv_dir, tmin, closest_so_far);
+            float t1 = bvh_node_enter(&accel->nodes[c1], r->origin, inv_dir, tmin, closest_so_far);
+            if (t1 < t0) {
+                int ci = c0; c0 = c1; c1 = ci;
+                float tt = t0; t0 = t1; t1 = tt;
+            }
+            if (t0 != INFINITY) {
+                if (t1 != INFINITY)
+                    stack[sp++] = (bvh_stack_entry) {c1, t1};
+                node = c0;
+                continue;
+            }
+        }
+        while (sp > 0 && stack[sp - 1].t > closest_so_far)
+            --sp;
+        if (0 == sp)
+            break;
+        node = stack[--sp].node;
+    }
+    if (closest >= 0)
+        triangle_mesh_fill_record(me, closest, r, closest_so_far, closest_bary, out_rec);
+    return (closest >= 0);
+}
+inline bool
+triangle_mesh_occluded (triangle_mesh * me, ray * r, float tmin, float tmax) {
+    bvh * accel = &me->accel;
+    if (0 == accel->node_count)
+        return false;
+    triangle_ray tr = triangle_ray_setup(r);
+    vec3f inv_dir = {1.0f / r->dir.x, 1.0f / r->dir.y, 1.0f / r->dir.z};
+    int stack[bvh_stack_size];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        bvh_node const * n = &accel->nodes[stack[--sp]];
+        if (bvh_node_enter(n, r->origin, inv_dir, tmin, tmax) == INFINITY)
+            continue;
+        if (n->count) {
+            for (int k = n->offset; k < n->offset + n->count; ++k) {
+                int tri = accel->prim_index[k];
+                float bary[3];
+                if (triangle_intersect(&tr, r, triangle_mesh_vertex(me, tri, 0), triangle_mesh_vertex(me, tri, 1),
+                        triangle_mesh_vertex(me, tri, 2), tmin, tmax, bary) < tmax)
+                    return true;
+            }
+        } else {
+            stack[sp++] = n->offset;
+            stack[sp++] = (int)(n - accel->nodes) + 1;
+        }
+    }
+    return false;
+}
+//
+// overriding virtual function, so a mesh can also live in a hittable_list
+inline bool
+triangle_mesh_virtual_hit (hittable * me, ray * r, float tmin, float tmax, hit_record * out_rec) {
+    return triangle_mesh_hit((triangle_mesh *)me, r, tmin, tmax, out_rec);
+}
+inline void
+triangle_mesh_init (triangle_mesh * me) {
+    static struct HitVtbl vtbl = {  /* triangle mesh vtable */
+        .hit = triangle_mesh_virtual_hit
+    };
+    triangle_mesh zero = {0};
+    *me = zero;
+    me->super.vptr = &vtbl;
+    me->material_id = -1;
+    me->object_id = -1;
+}
+inline void
+triangle_mesh_free (triangle_mesh * me) {
+    free(me->positions);
+    free(me->normals);
+    free(me->indices);
+    bvh_free(&me->accel);
+    triangle_mesh_init(me);
+}
+inline void
+triangle_mesh_prims (triangle_mesh * me, bvh_prim * out_prims) {
+    int32_t i;
+#pragma omp parallel for
+    for (i = 0; i < me->triangle_count; ++i) {
+        point3 p0 = triangle_mesh_vertex(me, i, 0), p1 = triangle_mesh_vertex(me, i, 1), p2 = triangle_mesh_vertex(me, i, 2);
+        out_prims[i].bmin = vec3_min(p0, vec3_min(p1, p2));
+        out_prims[i].bmax = vec3_max(p0, vec3_max(p1, p2));
+        out_prims[i].centroid = vec3_scale(vec3_add(out_prims[i].bmin, out_prims[i].bmax), 0.5f);
+    }
+}
+inline bool
+triangle_mesh_build_bvh (triangle_mesh * me) {
+    bvh_prim * prims = malloc(((size_t)me->triangle_count + 1) * sizeof(bvh_prim));
+    if (NULL == prims)
+        return false;
+    triangle_mesh_prims(me, prims);
+    bvh_free(&me->accel);
+    bool ret = bvh_build(&me->accel, prims, me->triangle_count);
+    free(prims);
+    return ret;
+}
+/* after moving vertices; an sbvh's clipped references grow back to whole triangles */
+inline bool
+triangle_mesh_refit (triangle_mesh * me) {
+    bvh_prim * prims = malloc(((size_t)me->triangle_count + 1) * sizeof(bvh_prim));
+    if (NULL == prims)
+        return false;
+    triangle_mesh_prims(me, prims);
+    bool ret = bvh_refit(&me->accel, prims);
+    free(prims);
+    return ret;
+}
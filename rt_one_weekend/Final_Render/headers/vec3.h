@@ -91,6 +91,18 @@ vec3_mul_elementwise (vec3f const a, vec3f const b) {
     ret.E[2] = a.E[2] * b.E[2];
     return ret;
 }
+// NOTE: plain compares instead of fminf/fmaxf, which compilers call out of line
+// unless fast-math is on
+inline vec3f
+vec3_min (vec3f a, vec3f b) {
+    vec3f ret = {a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z};
+    return ret;
+}
+inline vec3f
+vec3_max (vec3f a, vec3f b) {
+    vec3f ret = {a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z};
+    return ret;
+}
 inline float
 vec3_len_squared (vec3f const v) {
     return vec3_mul_dot(v, v);
@@ -0,0 +1,390 @@
+/* ===========================================================
+   #File: image_regress.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Golden-image regression: renders the tutorial scenes and measures their error against references #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/scene.h"
+#include "headers/light_tree.h"
+#include "headers/render.h"
+#include "headers/progressive.h"
+#include "headers/scene_file.h"
+#include "headers/bvh.h"
+#include "headers/render_setup.h"
+#include "headers/image.h"
+#include <string.h>
+#include <limits.h>
+#include <omp.h>
+
+// NOTE: The image regression test. For every chapter's scene in scenes/ it renders the
+// image progressively, doubling the samples per pixel each pass (1, 2, 4 ... up to -spp),
+// with the tiles seeded with 2021 like final_scene_omp, so a run is the same on any
+// machine and thread count. After each pass the image is compared with the scene's
+// reference, refs/<scene>.pfm:
+//   rmse      root mean squared error of the radiance
+//   relmse    mean squared error relative to the reference's value (see image_relmse)
+//   flip      mean FLIP-style perceptual difference of the displayed images, 0 .. 1
+//   bias      relative difference of the mean luminance, which noise averages out
+//             and a wrong estimator does not
+// and the row goes to the csv with the render time so far: error versus wall time
+// (time spent measuring is left out). A scene passes when, at the last pass, every
+// metric is under its limit and relmse went down from the first pass.
+// References are rendered by -make-refs at many more samples, with a different seed so
+// their noise is independent of the test images'. They are machine independent as well,
+// and the ones in refs/ are kept in the repository at the default width (64, so they stay
+// small): remake them with -make-refs only when the renderer's output is meant to change.
+// A scene without a reference fails the run, it is never made on the fly.
+// Every scene is also rendered once under a time budget already spent when it starts
+// (final_scene_omp -budget): it fails when that leaves any tile without samples.
+// sphere_with_ground and antialiasing are not tested, to the renderer they are the same
+// scene as diffuse_sphere.
+// Options:
+//   -make-refs      render the references instead of testing
+//   -spp n          samples per pixel of the test images (64)
+//   -ref-spp n      samples per pixel of the references (4096)
+//   -width n        image width, the scene's aspect ratio is kept (64, what refs/ holds)
+//   -scenes dir     where the .scene files are (scenes)
+//   -refs dir       where the references are (refs)
+//   -plot file      also plot relmse and flip against time for every scene, as svg
+//   -max-relmse x   limits at the last pass (0.02, 0.08, 0.01)
+//   -max-flip x
+//   -max-bias x
+//   name ...        only these scenes (file names without .scene)
+// Usage: image_regress.exe -make-refs
+//        image_regress.exe -plot error.svg > error.csv
+
+static char const * g_scene_names[] = {
+    "ray_sphere", "diffuse_sphere", "metal_spheres", "hollow_glass_sphere", "positionable_camera", "depth_of_field",
+    "final_scene"
+};
+#define regress_scene_count (int)(sizeof(g_scene_names) / sizeof(g_scene_names[0]))
+#define regress_max_passes 32
+#define regress_seed 2021
+#define regress_ref_seed 1618033
+
+typedef struct {
+    int spp;
+    double seconds;     /* render time up to this pass */
+    double rmse;
+    double relmse;
+    double flip;
+    double bias;
+} regress_point;
+
+typedef struct {
+    char const * name;
+    int count;
+    regress_point points[regress_max_passes];
+} regress_curve;
+
+static bool
+regress_scene_load (render_setup * me, char const * dir, char const * name, int width) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.scene", dir, name);
+    return render_setup_load(me, path) && render_setup_prepare(me, width);
+}
+/* adds pass_spp samples to every tile, returns the wall time it took */
+static double
+render_pass (render_setup * s, film * fb, tile_grid * grid, int pass_spp) {
+    tile_pass tiles;
+    tile_pass_init(&tiles, INT_MAX, pass_spp);     /* no cap, the caller counts the samples */
+    double start = omp_get_wtime();
+#pragma omp parallel
+    render_tiles_pass(&s->ctx, &s->cam, fb, NULL, grid, &tiles);
+    return omp_get_wtime() - start;
+}
+static double
+mean_luminance (color const * pixels, int count) {
+    double sum = 0.0;
+    for (int k = 0; k < count; ++k)
+        sum += luminance(pixels[k]);
+    return sum / count;
+}
+//
+// references
+static bool
+make_reference (char const * dir, char const * refs, char const * name, int width, int spp) {
+    render_setup s;
+    if (!regress_scene_load(&s, dir, name, width))
+        return false;
+    film fb;
+    tile_grid grid;
+    film_alloc(&fb, s.width, s.height);
+    tile_grid_init(&grid, s.width, s.height, 32, regress_ref_seed);
+    // -- in passes of at most 64 so a pass of a dark tile does not hold up the others for long
+    double seconds = 0.0;
+    for (int done = 0; done < spp; ) {
+        int pass_spp = spp - done < 64 ? spp - done : 64;
+        seconds += render_pass(&s, &fb, &grid, pass_spp);
+        done += pass_spp;
+    }
+    color * mean = malloc((size_t)s.width * s.height * sizeof(color));
+    film_resolve(&fb, &grid, mean, NULL, NULL);
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.pfm", refs, name);
+    bool ret = image_write_pfm(path, s.width, s.height, mean);
+    if (ret)
+        fprintf(stderr, "%-20s %dx%d %d spp  %.2fs  -> %s\n", name, s.width, s.height, spp, seconds, path);
+    else
+        fprintf(stderr, "could not write %s\n", path);
+    free(mean);
+    tile_grid_free(&grid);
+    film_free(&fb);
+    render_setup_free(&s);
+    return ret;
+}
+//
+// test: one curve per scene, false when the scene could not be loaded or has no reference
+static bool
+measure_scene (char const * dir, char const * refs, char const * name, int width, int spp, regress_curve * out) {
+    out->name = name;
+    out->count = 0;
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.pfm", refs, name);
+    image ref;
+    if (!image_read_pfm(path, &ref)) {
+        fprintf(stderr, "%s: missing reference, the run fails (-make-refs remakes the references)\n", path);
+        return false;
+    }
+    render_setup s;
+    if (!regress_scene_load(&s, dir, name, width)) {
+        image_free(&ref);
+        return false;
+    }
+    if (ref.width != s.width || ref.height != s.height) {
+        fprintf(stderr, "%s: reference is %dx%d, the test renders %dx%d\n", path, ref.width, ref.height, s.width, s.height);
+        image_free(&ref);
+        render_setup_free(&s);
+        return false;
+    }
+    int count = s.width * s.height;
+    film fb;
+    tile_grid grid;
+    film_alloc(&fb, s.width, s.height);
+    tile_grid_init(&grid, s.width, s.height, 32, regress_seed);
+    color * mean = malloc((size_t)count * sizeof(color));
+    double ref_lum = mean_luminance(ref.pixels, count);
+    double seconds = 0.0;
+    int done = 0;
+    while (done < spp && out->count < regress_max_passes) {
+        int pass_spp = done > 0 ? done : 1;     /* doubles the total */
+        if (done + pass_spp > spp)
+            pass_spp = spp - done;
+        seconds += render_pass(&s, &fb, &grid, pass_spp);
+        done += pass_spp;
+        film_resolve(&fb, &grid, mean, NULL, NULL);
+        regress_point * p = &out->points[out->count++];
+        p->spp = done;
+        p->seconds = seconds;
+        p->rmse = image_rmse(mean, ref.pixels, count);
+        p->relmse = image_relmse(mean, ref.pixels, count);
+        p->flip = image_flip(mean, ref.pixels, s.width, s.height, flip_default_ppd, NULL);
+        p->bias = ref_lum > 0.0 ? (mean_luminance(mean, count) - ref_lum) / ref_lum : 0.0;
+        printf("%s,%d,%.6f,%.6g,%.6g,%.6g,%.6g\n", name, p->spp, p->seconds, p->rmse, p->relmse, p->flip, p->bias);
+    }
+    fflush(stdout);
+    free(mean);
+    tile_grid_free(&grid);
+    film_free(&fb);
+    render_setup_free(&s);
+    image_free(&ref);
+    return true;
+}
+//
+// time budget: passes as final_scene_omp -budget makes them, against a deadline that has
+// passed before the first tile. false when a tile ends without samples (a black hole)
+static bool
+budget_check (char const * dir, char const * name, int width, int spp) {
+    render_setup s;
+    if (!regress_scene_load(&s, dir, name, width))
+        return false;
+    film fb;
+    tile_grid grid;
+    film_alloc(&fb, s.width, s.height);
+    tile_grid_init(&grid, s.width, s.height, 32, regress_seed);
+    tile_pass tiles;
+    tile_pass_init(&tiles, spp, tile_pass_budget_spp);
+    tiles.deadline = omp_get_wtime();       /* spent */
+    for (int done = 0; done < spp; done += tile_pass_budget_spp) {
+#pragma omp parallel
+        render_tiles_pass(&s.ctx, &s.cam, &fb, NULL, &grid, &tiles);
+    }
+    int black = 0;
+    for (int ti = 0; ti < grid.tile_count; ++ti)
+        black += (0 == grid.tiles[ti].spp);
+    if (black)
+        fprintf(stderr, "%s: %d of %d tiles without samples under a spent time budget\n", name, black, grid.tile_count);
+    tile_grid_free(&grid);
+    film_free(&fb);
+    render_setup_free(&s);
+    return (0 == black);
+}
+//
+// plot
+// two log-log panels, relmse and flip against seconds, one polyline per scene
+#define plot_panel_w 420
+#define plot_panel_h 300
+#define plot_margin 50
+
+static void
+plot_range (regress_curve const * curves, int curve_count, int metric, double * lo, double * hi) {
+    *lo = 1e30;
+    *hi = -1e30;
+    for (int c = 0; c < curve_count; ++c) {
+        for (int k = 0; k < curves[c].count; ++k) {
+            regress_point const * p = &curves[c].points[k];
+            double v = 0 == metric ? p->seconds : (1 == metric ? p->relmse : p->flip);
+            if (v <= 0.0)
+                continue;
+            double l = log10(v);
+            *lo = l < *lo ? l : *lo;
+            *hi = l > *hi ? l : *hi;
+        }
+    }
+    if (*lo > *hi)
+        *lo = *hi = 0.0;
+    *lo = floor(*lo);
+    *hi = ceil(*hi) > *lo ? ceil(*hi) : *lo + 1.0;
+}
+static bool
+write_plot (char const * path, regress_curve const * curves, int curve_count) {
+    static char const * colors[] = {
+        "#1f77b4", "#ff7f0e", "#2ca02c", "#d62728", "#9467bd", "#8c564b", "#e377c2", "#7f7f7f", "#bcbd22", "#17becf"
+    };
+    static char const * titles[] = {"relMSE", "FLIP"};
+    FILE * out = fopen(path, "w");
+    if (NULL == out)
+        return false;
+    int width = 2 * (plot_panel_w + 2 * plot_margin) + 160;
+    int height = plot_panel_h + 2 * plot_margin;
+    fprintf(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" font-family=\"sans-serif\" font-size=\"11\">\n",
+        width, height);
+    fprintf(out, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+    double t_lo, t_hi;
+    plot_range(curves, curve_count, 0, &t_lo, &t_hi);
+    for (int panel = 0; panel < 2; ++panel) {
+        double y_lo, y_hi;
+        plot_range(curves, curve_count, panel + 1, &y_lo, &y_hi);
+        int x0 = plot_margin + panel * (plot_panel_w + 2 * plot_margin), y0 = plot_margin;
+        fprintf(out, "<g transform=\"translate(%d,%d)\">\n", x0, y0);
+        fprintf(out, "<rect width=\"%d\" height=\"%d\" fill=\"none\" stroke=\"black\"/>\n", plot_panel_w, plot_panel_h);
+        fprintf(out, "<text x=\"%d\" y=\"-12\" text-anchor=\"middle\" font-size=\"13\">%s vs time</text>\n", plot_panel_w / 2,
+            titles[panel]);
+        fprintf(out, "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">seconds</text>\n", plot_panel_w / 2, plot_panel_h + 34);
+        // -- a grid line per decade
+        for (double d = t_lo; d <= t_hi + 1e-9; d += 1.0) {
+            double x = (d - t_lo) / (t_hi - t_lo) * plot_panel_w;
+            fprintf(out, "<line x1=\"%.1f\" y1=\"0\" x2=\"%.1f\" y2=\"%d\" stroke=\"#ddd\"/>\n", x, x, plot_panel_h);
+            fprintf(out, "<text x=\"%.1f\" y=\"%d\" text-anchor=\"middle\">1e%.0f</text>\n", x, plot_panel_h + 16, d);
+        }
+        for (double d = y_lo; d <= y_hi + 1e-9; d += 1.0) {
+            double y = plot_panel_h - (d - y_lo) / (y_hi - y_lo) * plot_panel_h;
+            fprintf(out, "<line x1=\"0\" y1=\"%.1f\" x2=\"%d\" y2=\"%.1f\" stroke=\"#ddd\"/>\n", y, plot_panel_w, y);
+            fprintf(out, "<text x=\"-6\" y=\"%.1f\" text-anchor=\"end\">1e%.0f</text>\n", y + 4, d);
+        }
+        for (int c = 0; c < curve_count; ++c) {
+            fprintf(out, "<polyline fill=\"none\" stroke-width=\"1.5\" stroke=\"%s\" points=\"", colors[c % 10]);
+            for (int k = 0; k < curves[c].count; ++k) {
+                regress_point const * p = &curves[c].points[k];
+                double v = 0 == panel ? p->relmse : p->flip;
+                if (p->seconds <= 0.0 || v <= 0.0)
+                    continue;
+                fprintf(out, "%.1f,%.1f ", (log10(p->seconds) - t_lo) / (t_hi - t_lo) * plot_panel_w,
+                    plot_panel_h - (log10(v) - y_lo) / (y_hi - y_lo) * plot_panel_h);
+            }
+            fprintf(out, "\"/>\n");
+        }
+        fprintf(out, "</g>\n");
+    }
+    for (int c = 0; c < curve_count; ++c) {
+        int y = plot_margin + 10 + c * 16;
+        int x = width - 150;
+        fprintf(out, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"%s\" stroke-width=\"2\"/>\n", x, y, x + 18, y,
+            colors[c % 10]);
+        fprintf(out, "<text x=\"%d\" y=\"%d\">%s</text>\n", x + 24, y + 4, curves[c].name);
+    }
+    fprintf(out, "</svg>\n");
+    return (0 == fclose(out));
+}
+int main (int argc, char ** argv) {
+    bool make_refs = false;
+    int spp = 64;
+    int ref_spp = 4096;
+    int width = 64;
+    char const * dir = "scenes";
+    char const * refs = "refs";
+    char const * plot_path = NULL;
+    double max_relmse = 0.02, max_flip = 0.08, max_bias = 0.01;
+    char const * only[regress_scene_count];
+    int only_count = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-make-refs"))
+            make_refs = true;
+        else if (0 == strcmp(argv[i], "-spp") && i + 1 < argc)
+            spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-ref-spp") && i + 1 < argc)
+            ref_spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-width") && i + 1 < argc)
+            width = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-scenes") && i + 1 < argc)
+            dir = argv[++i];
+        else if (0 == strcmp(argv[i], "-refs") && i + 1 < argc)
+            refs = argv[++i];
+        else if (0 == strcmp(argv[i], "-plot") && i + 1 < argc)
+            plot_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-max-relmse") && i + 1 < argc)
+            max_relmse = atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-max-flip") && i + 1 < argc)
+            max_flip = atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-max-bias") && i + 1 < argc)
+            max_bias = atof(argv[++i]);
+        else if (argv[i][0] != '-' && only_count < regress_scene_count)
+            only[only_count++] = argv[i];
+        else
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+    }
+    if (spp < 1 || ref_spp < 1 || width < 2) {
+        fprintf(stderr, "-spp, -ref-spp and -width must be positive\n");
+        return(2);
+    }
+    char const ** names = only_count ? only : g_scene_names;
+    int name_count = only_count ? only_count : regress_scene_count;
+
+    int failed = 0;
+    if (make_refs) {
+        for (int s = 0; s < name_count; ++s)
+            failed += !make_reference(dir, refs, names[s], width, ref_spp);
+        return(failed ? 1 : 0);
+    }
+    regress_curve * curves = calloc(name_count, sizeof(regress_curve));
+    int curve_count = 0;
+    printf("scene,spp,seconds,rmse,relmse,flip,bias\n");
+    for (int s = 0; s < name_count; ++s) {
+        regress_curve * curve = &curves[curve_count];
+        if (!measure_scene(dir, refs, names[s], width, spp, curve)) {
+            fprintf(stderr, "%-20s FAIL (not measured)\n", names[s]);
+            ++failed;
+            continue;
+        }
+        ++curve_count;
+        regress_point const * first = &curve->points[0];
+        regress_point const * last = &curve->points[curve->count - 1];
+        bool converging = curve->count < 2 || last->relmse < first->relmse;
+        bool budget = budget_check(dir, names[s], width, spp);
+        bool pass = last->relmse <= max_relmse && last->flip <= max_flip && fabs(last->bias) <= max_bias && converging && budget;
+        fprintf(stderr, "%-20s %s  %4d spp %7.2fs  rmse %.4f  relmse %.5f  flip %.4f  bias %+.4f%s%s\n", names[s],
+            pass ? "ok  " : "FAIL", last->spp, last->seconds, last->rmse, last->relmse, last->flip, last->bias,
+            converging ? "" : "  (not converging)", budget ? "" : "  (black tiles under a budget)");
+        failed += !pass;
+    }
+    if (plot_path && !write_plot(plot_path, curves, curve_count)) {
+        fprintf(stderr, "could not write %s\n", plot_path);
+        ++failed;
+    }
+    free(curves);
+    return(failed ? 1 : 0);
+}
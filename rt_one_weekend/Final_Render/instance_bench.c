@@ -0,0 +1,237 @@
+/* ===========================================================
+   #File: instance_bench.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Two-level instancing vs flattened geometry, memory and time #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/camera.h"
+#include "headers/scene.h"
+#include "headers/bvh.h"
+#include "headers/triangle_mesh.h"
+#include "headers/instance.h"
+#include <omp.h>
+
+// NOTE: Places N copies of a bottom-level object (a 20K-triangle torus, or a cluster
+// of 64 spheres) on a grid, once as instances over a shared blas and once flattened
+// into a single mesh / sphere list with its own bvh. Reports the bytes each layout
+// needs, the build time and the trace rate over the same rays (a camera ray per
+// pixel plus one bounce). Flattening is skipped once it would pass flatten_limit
+// primitives; the instanced side goes on to millions of copies.
+// Usage: instance_bench.exe [max copies] > bench.csv
+
+#define bench_width 512
+#define bench_height 384
+#define flatten_limit 10000000
+
+typedef struct {
+    double build_seconds;
+    double trace_seconds;
+    size_t bytes;
+    int hits;
+} layout_result;
+
+static void
+make_torus (triangle_mesh * me, int n, int m) {
+    triangle_mesh_init(me);
+    me->vertex_count = n * m;
+    me->triangle_count = 2 * n * m;
+    me->positions = malloc(me->vertex_count * sizeof(point3));
+    me->indices = malloc(3 * (size_t)me->triangle_count * sizeof(int32_t));
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < m; ++j) {
+            float u = 6.2831853f * i / n, v = 6.2831853f * j / m;
+            float ring = 1.0f + 0.4f * cosf(v);
+            me->positions[i * m + j] = (point3) {ring * cosf(u), 0.4f + 0.4f * sinf(v), ring * sinf(u)};
+        }
+    }
+    int32_t * idx = me->indices;
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < m; ++j) {
+            int32_t a = i * m + j, b = ((i + 1) % n) * m + j;
+            int32_t c = ((i + 1) % n) * m + (j + 1) % m, d = i * m + (j + 1) % m;
+            int32_t tri[6] = {a, b, c, a, c, d};
+            for (int k = 0; k < 6; ++k)
+                *idx++ = tri[k];
+        }
+    }
+    triangle_mesh_build_bvh(me);
+}
+static void
+make_sphere_cluster (scene * me, int count, material * mat) {
+    scene_init(me);
+    int mat_id = scene_add_material(me, mat);
+    for (int i = 0; i < count; ++i) {
+        float a = 6.2831853f * fmodf(i * 0.618034f, 1.0f);
+        float r = 1.2f * sqrtf((i + 0.5f) / count);
+        scene_add_sphere(me, (point3) {r * cosf(a), 0.15f + 0.3f * (i % 3), r * sinf(a)}, 0.15f, mat_id);
+    }
+}
+/* copy i of count on a grid over [-half_extent, half_extent]^2, turned and uniformly scaled */
+static affine3
+grid_transform (int i, int count, float half_extent) {
+    int side = (int)ceilf(sqrtf((float)count));
+    float cell = 2.0f * half_extent / side;
+    float yaw = 6.2831853f * fmodf(i * 0.618034f, 1.0f);
+    float scale = 0.35f * cell * (0.7f + 0.3f * fmodf(i * 0.414214f, 1.0f));
+    point3 at = {-half_extent + (i % side + 0.5f) * cell, 0.0f, -half_extent + (i / side + 0.5f) * cell};
+    return affine3_trs(at, yaw, (vec3f) {scale, scale, scale});
+}
+//
+// flattened copies
+static void
+flatten_mesh (triangle_mesh * out, triangle_mesh const * m, affine3 const * xf, int count) {
+    triangle_mesh_init(out);
+    out->vertex_count = m->vertex_count * count;
+    out->triangle_count = m->triangle_count * count;
+    out->positions = malloc((size_t)out->vertex_count * sizeof(point3));
+    out->indices = malloc(3 * (size_t)out->triangle_count * sizeof(int32_t));
+    int c;
+#pragma omp parallel for
+    for (c = 0; c < count; ++c) {
+        for (int v = 0; v < m->vertex_count; ++v)
+            out->positions[(size_t)c * m->vertex_count + v] = affine3_point(&xf[c], m->positions[v]);
+        for (int k = 0; k < 3 * m->triangle_count; ++k)
+            out->indices[(size_t)c * 3 * m->triangle_count + k] = c * m->vertex_count + m->indices[k];
+    }
+    triangle_mesh_build_bvh(out);
+}
+static void
+flatten_spheres (scene * out, scene * s, affine3 const * xf, int count) {
+    scene_init(out);
+    scene_add_material(out, s->materials[0]);
+    scene_reserve_spheres(out, s->sphere_count * count);
+    for (int c = 0; c < count; ++c) {
+        float scale = vec3_len(affine3_vector(&xf[c], (vec3f) {1.0f, 0.0f, 0.0f}));    /* uniform */
+        for (int i = 0; i < s->sphere_count; ++i)
+            scene_add_sphere(out, affine3_point(&xf[c], scene_sphere_center(s, i)), scale * s->radius[i], 0);
+    }
+}
+//
+// rays: primary + one bounce, generated against the instanced layout
+static ray *
+make_rays (tlas * t, camera * cam, int * out_count) {
+    ray * rays = malloc(2 * (size_t)bench_width * bench_height * sizeof(ray));
+    int count = 0;
+    for (int j = 0; j < bench_height; ++j) {
+        for (int i = 0; i < bench_width; ++i) {
+            ray r = camera_cast_ray(cam, (i + 0.5f) / bench_width, (j + 0.5f) / bench_height);
+            rays[count++] = r;
+            hit_record rec;
+            if (tlas_hit(t, &r, 0.001f, g_infinity, &rec)) {
+                ray bounce = {.origin = rec.p, .dir = vec3_add(rec.normal, random_unit_vector())};
+                rays[count++] = bounce;
+            }
+        }
+    }
+    *out_count = count;
+    return rays;
+}
+typedef enum { TRACE_TLAS, TRACE_MESH, TRACE_SPHERES } trace_kind;
+
+static void
+trace (trace_kind kind, void * target, bvh * sphere_accel, ray * rays, int count, layout_result * out) {
+    int hits = 0;
+    int i;
+    double t0 = omp_get_wtime();
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+:hits)
+    for (i = 0; i < count; ++i) {
+        hit_record rec;
+        if (TRACE_TLAS == kind)
+            hits += tlas_hit((tlas *)target, &rays[i], 0.001f, g_infinity, &rec);
+        else if (TRACE_MESH == kind)
+            hits += triangle_mesh_hit((triangle_mesh *)target, &rays[i], 0.001f, g_infinity, &rec);
+        else
+            hits += bvh_scene_hit(sphere_accel, (scene *)target, &rays[i], 0.001f, g_infinity, &rec);
+    }
+    out->trace_seconds = omp_get_wtime() - t0;
+    out->hits = hits;
+}
+static void
+report (char const * object, int copies, int64_t primitives, char const * layout, layout_result const * r, int rays) {
+    printf("%s,%d,%lld,%s,%.1f,%.4f,%.4f,%.2f,%d\n", object, copies, (long long)primitives, layout, r->bytes / 1048576.0,
+        r->build_seconds, r->trace_seconds, rays / r->trace_seconds * 1e-6, r->hits);
+    fprintf(stderr, "%-7s %8d copies  %11lld prims  %-9s %9.1f MB  build %7.3fs  trace %6.3fs  %5.2f Mrays/s  hits %d\n",
+        object, copies, (long long)primitives, layout, r->bytes / 1048576.0, r->build_seconds, r->trace_seconds,
+        rays / r->trace_seconds * 1e-6, r->hits);
+}
+int main (int argc, char ** argv) {
+    int max_copies = argc > 1 ? atoi(argv[1]) : 1000000;
+    triangle_mesh torus;
+    make_torus(&torus, 200, 50);
+    static lambertian grey;
+    lambertian_init(&grey, (color) { 0.6f, 0.6f, 0.6f });
+    torus.mat_ptr = (material *)&grey;
+    scene cluster;
+    make_sphere_cluster(&cluster, 64, (material *)&grey);
+    bvh cluster_accel;
+    bvh_build_spheres(&cluster_accel, &cluster);
+    blas blases[2];
+    blas_init_mesh(&blases[0], &torus);
+    blas_init_spheres(&blases[1], &cluster, &cluster_accel);
+    char const * names[2] = {"torus", "spheres"};
+    int prims_per_copy[2] = {torus.triangle_count, cluster.sphere_count};
+
+    printf("object,copies,primitives,layout,memory_mb,build_s,trace_s,mrays_per_s,hits\n");
+    for (int copies = 100; copies <= max_copies; copies *= 10) {
+        float half_extent = 2.0f * sqrtf((float)copies);
+        camera cam = {0};
+        camera_init(&cam, (point3) {0.0f, 0.5f * half_extent, 1.3f * half_extent}, (point3) {0.0f, 0.0f, 0.0f},
+            (vec3f) {0.f, 1.f, 0.f}, 45.0f, (float)bench_width / bench_height, 0.0f, 10.0f);
+        affine3 * xf = malloc(copies * sizeof(affine3));
+        for (int i = 0; i < copies; ++i)
+            xf[i] = grid_transform(i, copies, half_extent);
+
+        for (int b = 0; b < 2; ++b) {
+            int64_t primitives = (int64_t)copies * prims_per_copy[b];
+            layout_result inst = {0};
+            tlas t;
+            tlas_init(&t);
+            double t0 = omp_get_wtime();
+            for (int i = 0; i < copies; ++i)
+                tlas_add_instance(&t, &blases[b], &xf[i]);
+            tlas_build(&t);
+            inst.build_seconds = omp_get_wtime() - t0;
+            inst.bytes = blas_memory_bytes(&blases[b]) + tlas_memory_bytes(&t);
+            random_set_state(random_hash_seed(11, copies));
+            int ray_count;
+            ray * rays = make_rays(&t, &cam, &ray_count);
+            trace(TRACE_TLAS, &t, NULL, rays, ray_count, &inst);
+            report(names[b], copies, primitives, "instanced", &inst, ray_count);
+            tlas_free(&t);
+
+            if (primitives <= flatten_limit) {
+                layout_result flat = {0};
+                blas flat_blas;
+                t0 = omp_get_wtime();
+                if (0 == b) {
+                    triangle_mesh flat_mesh;
+                    flatten_mesh(&flat_mesh, &torus, xf, copies);
+                    flat.build_seconds = omp_get_wtime() - t0;
+                    blas_init_mesh(&flat_blas, &flat_mesh);
+                    flat.bytes = blas_memory_bytes(&flat_blas);
+                    trace(TRACE_MESH, &flat_mesh, NULL, rays, ray_count, &flat);
+                    triangle_mesh_free(&flat_mesh);
+                } else {
+                    scene flat_scene;
+                    bvh flat_accel;
+                    flatten_spheres(&flat_scene, &cluster, xf, copies);
+                    bvh_build_spheres(&flat_accel, &flat_scene);
+                    flat.build_seconds = omp_get_wtime() - t0;
+                    blas_init_spheres(&flat_blas, &flat_scene, &flat_accel);
+                    flat.bytes = blas_memory_bytes(&flat_blas);
+                    trace(TRACE_SPHERES, &flat_scene, &flat_accel, rays, ray_count, &flat);
+                    bvh_free(&flat_accel);
+                    scene_free(&flat_scene);
+                }
+                report(names[b], copies, primitives, "flattened", &flat, ray_count);
+            }
+            free(rays);
+        }
+        free(xf);
+    }
+    return(0);
+}
@@ -0,0 +1,356 @@
+/* ===========================================================
+   #File: kernel_bench.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Microbenchmarks of the vec3, sphere, material, sampler and camera kernels #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/sphere.h"
+#include "headers/material.h"
+#include "headers/camera.h"
+#include <string.h>
+#include <omp.h>
+
+// NOTE: Per-kernel timings, single threaded. Every kernel runs in a loop over a pool of
+// prepared inputs (vectors, rays aimed at or past spheres, hit records, film
+// coordinates) and folds its result into a sink so nothing is optimized away. The sink
+// chains the iterations, so the cheapest kernels bottom out at about one float add.
+//   warm  the pool has 256 entries, everything stays in L1
+//   cold  the pool has 2^19 entries (~100 MB over all arrays) visited with a large odd
+//         stride, so nearly every input is a cache (and TLB) miss
+// The samplers (random_*) read no inputs and only run warm.
+// Runner: the batch size is doubled until one batch takes -min-time ms, a few batches
+// are run as warmup, then -reps batches are timed. Reported are the median ns per
+// operation, its median absolute deviation (MAD, also as a percentage of the median)
+// and the throughput at the median; the median and MAD ignore the odd batch hit by
+// an interrupt or a frequency change, which a mean and standard deviation do not.
+// Options:
+//   -reps n        timed batches per kernel (21)
+//   -min-time ms   length of one batch (2)
+//   -cold / -warm  only that variant
+//   name ...       only kernels whose name contains one of these
+// Usage: kernel_bench.exe > kernels.csv
+
+#define pool_bits_warm 8
+#define pool_bits_cold 19
+#define warmup_batches 3
+#define max_reps 1001
+
+typedef struct {
+    int mask;           /* pool size - 1 */
+    int step;           /* odd, visits every entry once per pool size ops */
+    vec3f * a;
+    vec3f * b;          /* unit vectors */
+    ray * ray_hit;      /* ray_hit[i] hits spheres[i] */
+    ray * ray_miss;     /* ray_miss[i] passes spheres[i] */
+    sphere * spheres;
+    hit_record * recs;
+    ray * ray_in;       /* ray_in[i] arrives at recs[i] */
+    float * s;
+    float * t;
+    lambertian lamb;
+    metal shiny;
+    metal fuzzy;
+    dielectric glass;
+    camera pinhole;
+    camera thin_lens;
+} bench_pool;
+
+typedef float (*kernel_fn) (bench_pool * pool, int64_t first, int64_t count);
+
+typedef struct {
+    char const * name;
+    kernel_fn run;
+    bool reads_pool;    /* false: the cold variant would be the same as the warm one */
+} kernel;
+
+//
+// kernels
+// each runs count operations starting at entry first, i = (first + k) * step & mask
+#define KERNEL_LOOP(body) \
+    float sink = 0.0f; \
+    int64_t idx = first * pool->step; \
+    for (int64_t k = 0; k < count; ++k, idx += pool->step) { \
+        int i = (int)(idx & pool->mask); \
+        body \
+    } \
+    return sink;
+/* the samplers read no pool entries, just count */
+#define SAMPLER_LOOP(body) \
+    float sink = 0.0f; \
+    (void)pool; \
+    (void)first; \
+    for (int64_t k = 0; k < count; ++k) { \
+        body \
+    } \
+    return sink;
+
+static float k_vec3_add (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_add(pool->a[i], pool->b[i]).x;) }
+static float k_vec3_sub (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_sub(pool->a[i], pool->b[i]).y;) }
+static float k_vec3_scale (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_scale(pool->a[i], 0.5f).z;) }
+static float k_vec3_mul_dot (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_mul_dot(pool->a[i], pool->b[i]);) }
+static float k_vec3_mul_cross (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_mul_cross(pool->a[i], pool->b[i]).x;) }
+static float k_vec3_mul_elementwise (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_mul_elementwise(pool->a[i], pool->b[i]).y;) }
+static float k_vec3_min (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_min(pool->a[i], pool->b[i]).z;) }
+static float k_vec3_len (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_len(pool->a[i]);) }
+static float k_vec3_normalize (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_normalize(pool->a[i]).x;) }
+static float k_vec3_reflect (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_reflect(pool->a[i], pool->b[i]).y;) }
+static float k_vec3_refract (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_refract(pool->b[i], pool->recs[i].normal, 0.66f).z;) }
+static float k_vec3_near_zero (bench_pool * pool, int64_t first, int64_t count) { KERNEL_LOOP(sink += vec3_near_zero(pool->a[i]);) }
+static float
+k_vec3_addvarg (bench_pool * pool, int64_t first, int64_t count) {
+    KERNEL_LOOP(sink += vec3_addvarg(5, pool->a[i], pool->b[i], pool->a[i], pool->b[i], pool->a[i]).x;)
+}
+static float
+k_sphere_hit (bench_pool * pool, int64_t first, int64_t count) {
+    KERNEL_LOOP(
+        hit_record rec;
+        sink += sphere_hit(&pool->spheres[i].super, &pool->ray_hit[i], 0.001f, g_infinity, &rec) ? rec.t : 0.0f;
+    )
+}
+static float
+k_sphere_miss (bench_pool * pool, int64_t first, int64_t count) {
+    KERNEL_LOOP(
+        hit_record rec;
+        sink += sphere_hit(&pool->spheres[i].super, &pool->ray_miss[i], 0.001f, g_infinity, &rec) ? rec.t : 0.0f;
+    )
+}
+#define SCATTER_KERNEL(fn_name, scatter, mat) \
+    static float \
+    fn_name (bench_pool * pool, int64_t first, int64_t count) { \
+        KERNEL_LOOP( \
+            color attenuation; \
+            ray scattered; \
+            if (scatter(&pool->mat.super, &pool->ray_in[i], &pool->recs[i], &attenuation, &scattered)) \
+                sink += scattered.dir.x + attenuation.y; \
+        ) \
+    }
+SCATTER_KERNEL(k_lambertian_scatter, lambertian_scatter, lamb)
+SCATTER_KERNEL(k_metal_scatter, metal_scatter, shiny)
+SCATTER_KERNEL(k_metal_scatter_fuzz, metal_scatter, fuzzy)
+SCATTER_KERNEL(k_dielectric_scatter, dielectric_scatter, glass)
+
+static float k_random_u32 (bench_pool * pool, int64_t first, int64_t count) { SAMPLER_LOOP(sink += (float)(random_u32() & 1);) }
+static float k_random_float (bench_pool * pool, int64_t first, int64_t count) { SAMPLER_LOOP(sink += random_float();) }
+static float k_random_vec3 (bench_pool * pool, int64_t first, int64_t count) { SAMPLER_LOOP(sink += random_vec3().x;) }
+static float k_random_vec3_in_unit_sphere (bench_pool * pool, int64_t first, int64_t count) { SAMPLER_LOOP(sink += random_vec3_in_unit_sphere().y;) }
+static float k_random_unit_vector (bench_pool * pool, int64_t first, int64_t count) { SAMPLER_LOOP(sink += random_unit_vector().z;) }
+static float k_random_in_unit_disk (bench_pool * pool, int64_t first, int64_t count) { SAMPLER_LOOP(sink += random_in_unit_disk().x;) }
+static float
+k_random_in_hemisphere (bench_pool * pool, int64_t first, int64_t count) {
+    vec3f up = {0.0f, 1.0f, 0.0f};
+    SAMPLER_LOOP(sink += random_in_hemisphere(up).y;)
+}
+static float
+k_camera_cast_ray (bench_pool * pool, int64_t first, int64_t count) {
+    KERNEL_LOOP(sink += camera_cast_ray(&pool->pinhole, pool->s[i], pool->t[i]).dir.x;)
+}
+static float
+k_camera_cast_ray_lens (bench_pool * pool, int64_t first, int64_t count) {
+    KERNEL_LOOP(sink += camera_cast_ray(&pool->thin_lens, pool->s[i], pool->t[i]).origin.x;)
+}
+
+static kernel g_kernels[] = {
+    {"vec3_add", k_vec3_add, true},
+    {"vec3_sub", k_vec3_sub, true},
+    {"vec3_scale", k_vec3_scale, true},
+    {"vec3_mul_dot", k_vec3_mul_dot, true},
+    {"vec3_mul_cross", k_vec3_mul_cross, true},
+    {"vec3_mul_elementwise", k_vec3_mul_elementwise, true},
+    {"vec3_min", k_vec3_min, true},
+    {"vec3_len", k_vec3_len, true},
+    {"vec3_normalize", k_vec3_normalize, true},
+    {"vec3_reflect", k_vec3_reflect, true},
+    {"vec3_refract", k_vec3_refract, true},
+    {"vec3_near_zero", k_vec3_near_zero, true},
+    {"vec3_addvarg_5", k_vec3_addvarg, true},
+    {"sphere_hit_hit", k_sphere_hit, true},
+    {"sphere_hit_miss", k_sphere_miss, true},
+    {"lambertian_scatter", k_lambertian_scatter, true},
+    {"metal_scatter", k_metal_scatter, true},
+    {"metal_scatter_fuzz", k_metal_scatter_fuzz, true},
+    {"dielectric_scatter", k_dielectric_scatter, true},
+    {"random_u32", k_random_u32, false},
+    {"random_float", k_random_float, false},
+    {"random_vec3", k_random_vec3, false},
+    {"random_vec3_in_unit_sphere", k_random_vec3_in_unit_sphere, false},
+    {"random_unit_vector", k_random_unit_vector, false},
+    {"random_in_hemisphere", k_random_in_hemisphere, false},
+    {"random_in_unit_disk", k_random_in_unit_disk, false},
+    {"camera_cast_ray", k_camera_cast_ray, true},
+    {"camera_cast_ray_thin_lens", k_camera_cast_ray_lens, true},
+};
+#define kernel_count (int)(sizeof(g_kernels) / sizeof(g_kernels[0]))
+
+//
+// inputs
+static bool
+pool_alloc (bench_pool * me, int bits) {
+    int n = 1 << bits;
+    me->mask = n - 1;
+    me->step = bits > pool_bits_warm ? (int)(0x9e3779b1u & (uint32_t)me->mask) | 1 : 1;
+    me->a = malloc(n * sizeof(vec3f));
+    me->b = malloc(n * sizeof(vec3f));
+    me->ray_hit = malloc(n * sizeof(ray));
+    me->ray_miss = malloc(n * sizeof(ray));
+    me->spheres = malloc(n * sizeof(sphere));
+    me->recs = malloc(n * sizeof(hit_record));
+    me->ray_in = malloc(n * sizeof(ray));
+    me->s = malloc(n * sizeof(float));
+    me->t = malloc(n * sizeof(float));
+    if (!me->a || !me->b || !me->ray_hit || !me->ray_miss || !me->spheres || !me->recs || !me->ray_in || !me->s || !me->t)
+        return false;
+    lambertian_init(&me->lamb, (color) {0.5f, 0.5f, 0.5f});
+    metal_init(&me->shiny, (color) {0.7f, 0.6f, 0.5f}, 0.0f);
+    metal_init(&me->fuzzy, (color) {0.7f, 0.6f, 0.5f}, 0.3f);
+    dielectric_init(&me->glass, 1.5f);
+    camera_init(&me->pinhole, (point3) {13.f, 2.f, 3.f}, (point3) {0.f, 0.f, 0.f}, (vec3f) {0.f, 1.f, 0.f}, 20.0f, 1.5f, 0.0f, 10.0f);
+    camera_init(&me->thin_lens, (point3) {13.f, 2.f, 3.f}, (point3) {0.f, 0.f, 0.f}, (vec3f) {0.f, 1.f, 0.f}, 20.0f, 1.5f, 0.1f, 10.0f);
+    random_set_state(random_hash_seed(42, bits));
+    for (int i = 0; i < n; ++i) {
+        me->a[i] = random_vec3_shifted(-10.0f, 10.0f);
+        me->b[i] = random_unit_vector();
+        point3 center = random_vec3_shifted(-100.0f, 100.0f);
+        float radius = random_float_shifted(0.2f, 2.0f);
+        sphere_init(&me->spheres[i], center, radius, &me->lamb.super);
+        // -- from 10 radii away, through the center or past the silhouette
+        vec3f to_center = random_unit_vector();
+        vec3f side = vec3_normalize(vec3_mul_cross(to_center, vec3_add(me->b[i], (vec3f) {0.1f, 0.2f, 0.3f})));
+        point3 origin = vec3_sub(center, vec3_scale(to_center, 10.0f * radius));
+        me->ray_hit[i] = (ray) {origin, to_center};
+        me->ray_miss[i] = (ray) {vec3_add(origin, vec3_scale(side, 1.5f * radius)), to_center};
+        // -- a hit on a unit sphere at the origin, the incoming ray from its outside (or inside)
+        hit_record * rec = &me->recs[i];
+        rec->normal = me->b[i];
+        rec->geometric_normal = me->b[i];
+        rec->p = me->b[i];
+        rec->t = 1.0f;
+        rec->front_face = (i & 3) != 0;
+        rec->mat_ptr = &me->lamb.super;
+        rec->material_id = rec->object_id = 0;
+        vec3f in = vec3_normalize(vec3_sub(vec3_scale(rec->normal, -1.0f), vec3_scale(random_vec3_in_unit_sphere(), 0.8f)));
+        me->ray_in[i] = (ray) {vec3_sub(rec->p, in), in};
+        me->s[i] = random_float();
+        me->t[i] = random_float();
+    }
+    return true;
+}
+static void
+pool_free (bench_pool * me) {
+    free(me->a);
+    free(me->b);
+    free(me->ray_hit);
+    free(me->ray_miss);
+    free(me->spheres);
+    free(me->recs);
+    free(me->ray_in);
+    free(me->s);
+    free(me->t);
+}
+//
+// runner
+typedef struct {
+    double median_ns;
+    double mad_ns;
+    int64_t batch_ops;
+} bench_stats;
+
+static volatile float g_sink;   /* keeps the kernels' results alive */
+
+static int
+compare_double (void const * a, void const * b) {
+    double x = *(double const *)a, y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+static double
+median (double * values, int count) {
+    qsort(values, count, sizeof(double), compare_double);
+    return (count & 1) ? values[count / 2] : 0.5 * (values[count / 2 - 1] + values[count / 2]);
+}
+static double
+time_batch (kernel const * k, bench_pool * pool, int64_t * first, int64_t ops) {
+    double t0 = omp_get_wtime();
+    g_sink += k->run(pool, *first, ops);
+    double ret = omp_get_wtime() - t0;
+    *first += ops;  /* the next batch continues the walk, a cold pool stays cold */
+    return ret;
+}
+static bench_stats
+bench_kernel (kernel const * k, bench_pool * pool, int reps, double min_seconds) {
+    bench_stats ret = {0};
+    int64_t first = 0;
+    int64_t ops = 1024;
+    // -- calibrate, then warm up (caches, branch predictors, clock ramp)
+    while (time_batch(k, pool, &first, ops) < min_seconds && ops < ((int64_t)1 << 40))
+        ops *= 2;
+    for (int w = 0; w < warmup_batches; ++w)
+        time_batch(k, pool, &first, ops);
+    double samples[max_reps];
+    for (int r = 0; r < reps; ++r)
+        samples[r] = time_batch(k, pool, &first, ops) * 1e9 / ops;
+    ret.median_ns = median(samples, reps);
+    for (int r = 0; r < reps; ++r)
+        samples[r] = fabs(samples[r] - ret.median_ns);
+    ret.mad_ns = median(samples, reps);
+    ret.batch_ops = ops;
+    return ret;
+}
+static bool
+selected (char const * name, char const ** filters, int filter_count) {
+    if (0 == filter_count)
+        return true;
+    for (int f = 0; f < filter_count; ++f)
+        if (strstr(name, filters[f]))
+            return true;
+    return false;
+}
+int main (int argc, char ** argv) {
+    int reps = 21;
+    double min_ms = 2.0;
+    bool run_warm = true, run_cold = true;
+    char const * filters[64];
+    int filter_count = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-min-time") && i + 1 < argc)
+            min_ms = atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-cold"))
+            run_warm = false;
+        else if (0 == strcmp(argv[i], "-warm"))
+            run_cold = false;
+        else if (argv[i][0] != '-' && filter_count < 64)
+            filters[filter_count++] = argv[i];
+        else
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+    }
+    reps = reps < 1 ? 1 : (reps > max_reps ? max_reps : reps);
+
+    printf("kernel,cache,median_ns_per_op,mad_ns,mad_pct,mops_per_s,reps,ops_per_rep\n");
+    int const bits[2] = {pool_bits_warm, pool_bits_cold};
+    char const * variants[2] = {"warm", "cold"};
+    for (int v = 0; v < 2; ++v) {
+        if ((0 == v && !run_warm) || (1 == v && !run_cold))
+            continue;
+        bench_pool pool;
+        if (!pool_alloc(&pool, bits[v])) {
+            fprintf(stderr, "not enough memory for the %s pool\n", variants[v]);
+            return(1);
+        }
+        for (int k = 0; k < kernel_count; ++k) {
+            if ((1 == v && !g_kernels[k].reads_pool) || !selected(g_kernels[k].name, filters, filter_count))
+                continue;
+            random_set_state(random_hash_seed(7, k));
+            bench_stats st = bench_kernel(&g_kernels[k], &pool, reps, min_ms * 1e-3);
+            printf("%s,%s,%.4f,%.4f,%.2f,%.2f,%d,%lld\n", g_kernels[k].name, variants[v], st.median_ns, st.mad_ns,
+                100.0 * st.mad_ns / st.median_ns, 1e3 / st.median_ns, reps, (long long)st.batch_ops);
+            fprintf(stderr, "%-28s %s  %9.3f ns/op  +- %7.3f (%5.2f%%)  %9.2f Mops/s\n", g_kernels[k].name, variants[v],
+                st.median_ns, st.mad_ns, 100.0 * st.mad_ns / st.median_ns, 1e3 / st.median_ns);
+        }
+        pool_free(&pool);
+    }
+    return(0);
+}
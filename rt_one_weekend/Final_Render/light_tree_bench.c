@@ -0,0 +1,141 @@
+/* ===========================================================
+   #File: light_tree_bench.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Noise vs light count, uniform light picking vs light tree #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/scene.h"
+#include "headers/light_tree.h"
+#include "headers/render.h"
+#include <omp.h>
+
+// NOTE: Renders a night scene lit only by N small emissive spheres at equal spp
+// with each light picking strategy and prints the relative standard error of the
+// pixel estimates (lower is better) and the render time.
+// Usage: light_tree_bench.exe [light counts...] > bench.csv
+
+#define bench_width 96
+#define bench_height 64
+#define bench_spp 8
+#define bench_max_depth 4
+
+typedef struct {
+    double rel_err;     /* sqrt of the mean relative variance of the pixel means */
+    double seconds;
+} bench_result;
+
+static void
+build_many_lights_scene (scene * world, int light_count, float * out_half_extent) {
+    scene_init(world);
+    random_seed(1234);
+
+    lambertian * ground = malloc(sizeof(lambertian));
+    lambertian_init(ground, (color) { 0.5f, 0.5f, 0.5f });
+    scene_add_plane(world, (point3) { 0.0f, 0.0f, 0.0f }, (vec3f) { 0.0f, 1.0f, 0.0f }, scene_add_material(world, (material *)ground));
+
+    // -- a few large receivers like the final scene
+    float half_extent = 0.5f * sqrtf((float)light_count) + 2.0f;
+    lambertian * big = malloc(sizeof(lambertian));
+    lambertian_init(big, (color) { .4f, .2f, 0.1f });
+    int big_mat = scene_add_material(world, (material *)big);
+    for (int i = -1; i <= 1; ++i)
+        scene_add_sphere(world, (point3) { i * 0.5f * half_extent, 1.0f, 0.0f }, 1.0f, big_mat);
+
+    // -- small emitters with powers spread over two orders of magnitude
+    for (int i = 0; i < light_count; ++i) {
+        float radius = random_float_shifted(0.05f, 0.15f);
+        point3 center = {
+            random_float_shifted(-half_extent, half_extent),
+            radius,
+            random_float_shifted(-half_extent, half_extent)
+        };
+        float intensity = powf(10.0f, random_float_shifted(-1.0f, 1.0f)) * 4.0f;
+        diffuse_light * emitter = malloc(sizeof(diffuse_light));
+        diffuse_light_init(emitter, vec3_scale(random_vec3_shifted(0.5f, 1.0f), intensity));
+        scene_add_sphere(world, center, radius, scene_add_material(world, (material *)emitter));
+    }
+    *out_half_extent = half_extent;
+}
+static bench_result
+render_noise (render_context * ctx, camera * cam) {
+    bench_result ret = {0};
+    double rel_var_sum = 0.0;
+    int counted = 0;
+    double t0 = omp_get_wtime();
+#pragma omp parallel for schedule(dynamic) reduction(+:rel_var_sum, counted)
+    for (int j = 0; j < bench_height; ++j) {
+        random_set_state(random_hash_seed(42, j));     /* same samples for every mode and thread count */
+        for (int i = 0; i < bench_width; ++i) {
+            double sum = 0.0, sum_sq = 0.0;
+            for (int s = 0; s < bench_spp; ++s) {
+                float u = (float)(i + random_float()) / (bench_width - 1);
+                float v = (float)(j + random_float()) / (bench_height - 1);
+                ray r = camera_cast_ray(cam, u, v);
+                double y = luminance(ray_color(ctx, r));
+                sum += y;
+                sum_sq += y * y;
+            }
+            double mean = sum / bench_spp;
+            double var = (sum_sq - sum * mean) / (bench_spp - 1);
+            if (mean > 1e-4) {
+                rel_var_sum += (var / bench_spp) / (mean * mean);
+                ++counted;
+            }
+        }
+    }
+    ret.seconds = omp_get_wtime() - t0;
+    ret.rel_err = counted ? sqrt(rel_var_sum / counted) : 0.0;
+    return ret;
+}
+int main (int argc, char ** argv) {
+    int default_counts[] = {16, 64, 256, 1024, 4096};
+    int count_len = sizeof(default_counts) / sizeof(default_counts[0]);
+    int * counts = default_counts;
+    if (argc > 1) {
+        count_len = argc - 1;
+        counts = malloc(count_len * sizeof(int));
+        for (int i = 0; i < count_len; ++i)
+            counts[i] = atoi(argv[i + 1]);
+    }
+
+    printf("lights,mode,spp,rel_err,seconds,tree_build_ms\n");
+    for (int c = 0; c < count_len; ++c) {
+        scene world;
+        float half_extent;
+        build_many_lights_scene(&world, counts[c], &half_extent);
+
+        double t0 = omp_get_wtime();
+        light_tree lights;
+        if (light_tree_build(&lights, &world) < 0) {
+            fprintf(stderr, "out of memory\n");
+            return(1);
+        }
+        double build_ms = 1000.0 * (omp_get_wtime() - t0);
+
+        camera cam = {0};
+        point3 lookfrom = {0.0f, 0.6f * half_extent + 2.0f, 1.4f * half_extent + 3.0f};
+        point3 lookat = {0.f, 0.f, 0.f};
+        vec3f vup = {0.f, 1.f, 0.f};
+        camera_init(&cam, lookfrom, lookat, vup, 45.0f, (float)bench_width / bench_height, 0.0f, 10.0f);
+
+        render_context ctx;
+        render_context_init(&ctx, &world, &lights, bench_max_depth);
+        ctx.sky_scale = 0.0f;
+
+        light_sampling modes[] = {LIGHT_SAMPLING_UNIFORM, LIGHT_SAMPLING_TREE};
+        char const * names[] = {"uniform", "tree"};
+        for (int m = 0; m < 2; ++m) {
+            ctx.light_mode = modes[m];
+            bench_result res = render_noise(&ctx, &cam);
+            printf("%d,%s,%d,%.5f,%.3f,%.3f\n", lights.light_count, names[m], bench_spp, res.rel_err, res.seconds, build_ms);
+            fprintf(stderr, "%6d lights  %-8s rel_err %.4f  %.2fs\n", lights.light_count, names[m], res.rel_err, res.seconds);
+        }
+        light_tree_free(&lights);
+        scene_free(&world);     // NOTE: materials leak, same as the other apps
+    }
+    return(0);
+}
@@ -0,0 +1,247 @@
+/* ===========================================================
+   #File: numa_bench.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Render throughput with the scene and film placed by the main thread vs numa-aware #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/scene.h"
+#include "headers/light_tree.h"
+#include "headers/render.h"
+#include "headers/progressive.h"
+#include "headers/scene_file.h"
+#include "headers/scene_gen.h"
+#include "headers/bvh.h"
+#include "headers/render_setup.h"
+#include "headers/topology.h"
+#include "headers/numa.h"
+#include <string.h>
+#include <omp.h>
+
+// NOTE: What numa-aware placement (numa.h) buys. Renders one scene, by default a
+// generated stress scene big enough that the bvh does not fit in the caches, once per
+// placement mode with every thread pinned to a node (the numa policy of topology.h),
+// so only where the memory is changes:
+//   malloc      the scene as built by the main thread, a calloc'd film, tiles handed out
+//               dynamically (what final_scene_omp does by default)
+//   interleave  the scene spread page by page over the nodes, the film first written by
+//               each node's band of tiles, the node-banded tile queue
+//   replicate   a copy of the scene on every node, film and queue as above
+//   auto        replicate below -replicate-mb, interleave above (the default policy,
+//               final_scene_omp -numa)
+// The image must be the same in every mode: a mode whose image_hash differs from the
+// first mode's is reported and the run exits with 1.
+// On one node there is nothing to gain and the modes should tie. To see the remote
+// reads of the malloc mode on a 2-socket box, compare against a run with all memory
+// forced onto the other socket:
+//   numactl --cpunodebind=0,1 --membind=1 numa_bench -modes malloc
+// Options:
+//   -scene file        render this scene instead of a generated one
+//   -n count           spheres of the generated scene (2000000)
+//   -layout name       of the generated scene (uniform)
+//   -spp n             samples per pixel (8)
+//   -pass-spp n        samples per pass (2)
+//   -width n           image width (400)
+//   -threads n         (the processor count)
+//   -modes list        comma separated modes (malloc,interleave,replicate,auto)
+//   -replicate-mb n    scene size up to which auto replicates (256)
+// Usage: numa_bench.exe > numa.csv
+
+typedef enum {
+    PLACE_MALLOC,
+    PLACE_INTERLEAVE,
+    PLACE_REPLICATE,
+    PLACE_AUTO,
+    PLACE_MODE_COUNT
+} place_mode;
+
+static char const * g_place_mode_names[PLACE_MODE_COUNT] = {"malloc", "interleave", "replicate", "auto"};
+
+typedef struct {
+    double seconds;
+    int64_t rays;
+    uint64_t image_hash;
+    bool replicated;
+} bench_run;
+
+static int
+parse_modes (char * list, int * out) {
+    int count = 0;
+    for (char * name = strtok(list, ","); name && count < PLACE_MODE_COUNT; name = strtok(NULL, ",")) {
+        int mode = -1;
+        for (int k = 0; k < PLACE_MODE_COUNT; ++k)
+            if (0 == strcmp(name, g_place_mode_names[k]))
+                mode = k;
+        if (mode < 0)
+            fprintf(stderr, "unknown mode %s\n", name);
+        else
+            out[count++] = mode;
+    }
+    return count;
+}
+static bench_run
+render_run (place_mode mode, topology const * topo, render_setup * rs, int spp, int pass_spp, int threads,
+    size_t replicate_limit) {
+    bench_run ret = {0.0, 0, 0, false};
+    int width = rs->width;
+    int height = rs->height;
+    tile_grid grid;
+    tile_grid_init(&grid, width, height, 32, 2021);
+    film fb;
+    numa_tile_queue queue;
+    numa_tile_queue_init(&queue, &grid, topo->node_count);
+    static numa_scene placed;       /* large, and only one is alive at a time */
+    render_context ctxs[topology_max_nodes];
+    int copies = 1;
+    bool numa = (PLACE_MALLOC != mode);
+    if (numa) {
+        size_t limit = PLACE_INTERLEAVE == mode ? 0 : (PLACE_REPLICATE == mode ? SIZE_MAX : replicate_limit);
+        if (!numa_scene_place(&placed, topo, &rs->world, &rs->accel, limit) ||
+            !numa_film_alloc(&fb, topo, &grid, &queue, width, height)) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        copies = placed.copies;
+        ret.replicated = placed.replicated;
+        for (int c = 0; c < copies; ++c) {
+            ctxs[c] = rs->ctx;
+            ctxs[c].world = &placed.worlds[c];
+            ctxs[c].accel = &placed.accels[c];
+        }
+    } else {
+        film_alloc(&fb, width, height);
+        ctxs[0] = rs->ctx;
+    }
+    tile_pass tiles;
+    tile_pass_init(&tiles, spp, pass_spp);
+
+    int64_t rays = 0;
+    omp_set_num_threads(threads);
+    double start = omp_get_wtime();
+#pragma omp parallel reduction(+:rays)
+    {
+        int me = omp_get_thread_num();
+        int node = topology_pin_node(topo, PIN_NUMA, me, threads);
+        topology_pin(topo, PIN_NUMA, me, threads);
+        render_context * ctx = &ctxs[numa ? numa_scene_copy(&placed, node) : 0];
+        int64_t before = g_rays_traced;
+        for (int done = 0; done < spp; done += pass_spp) {
+            if (numa) {
+#pragma omp single
+                numa_tile_queue_reset(&queue, &grid);
+                for (int ti = numa_tile_queue_next(&queue, node); ti >= 0; ti = numa_tile_queue_next(&queue, node))
+                    render_pass_tile(ctx, &rs->cam, &fb, NULL, &grid, &tiles, ti);
+#pragma omp barrier
+            } else {
+                render_tiles_pass(ctx, &rs->cam, &fb, NULL, &grid, &tiles);
+            }
+        }
+        rays += g_rays_traced - before;
+        topology_pin(topo, PIN_NONE, 0, 1);
+    }
+    ret.seconds = omp_get_wtime() - start;
+    ret.rays = rays;
+    ret.image_hash = hash_bytes(hash_seed, fb.sum, (size_t)width * height * sizeof(color));
+    if (numa) {
+        numa_film_free(&fb);
+        numa_scene_free(&placed);
+    } else {
+        film_free(&fb);
+    }
+    tile_grid_free(&grid);
+    return ret;
+}
+int main (int argc, char ** argv) {
+    char const * scene_path = NULL;
+    scene_gen_params gen;
+    scene_gen_params_default(&gen);
+    gen.count = 2000000;
+    int spp = 8;
+    int pass_spp = 2;
+    int width = 400;
+    int threads = omp_get_num_procs();
+    int modes[PLACE_MODE_COUNT] = {PLACE_MALLOC, PLACE_INTERLEAVE, PLACE_REPLICATE, PLACE_AUTO};
+    int mode_count = PLACE_MODE_COUNT;
+    size_t replicate_limit = numa_default_replicate_limit;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-scene") && i + 1 < argc)
+            scene_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            gen.count = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-layout") && i + 1 < argc) {
+            int layout = scene_gen_layout_from_name(argv[++i]);
+            if (layout < 0)
+                fprintf(stderr, "unknown layout %s\n", argv[i]);
+            else
+                gen.layout = (scene_gen_layout)layout;
+        } else if (0 == strcmp(argv[i], "-spp") && i + 1 < argc)
+            spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-pass-spp") && i + 1 < argc)
+            pass_spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-width") && i + 1 < argc)
+            width = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-modes") && i + 1 < argc)
+            mode_count = parse_modes(argv[++i], modes);
+        else if (0 == strcmp(argv[i], "-replicate-mb") && i + 1 < argc)
+            replicate_limit = (size_t)atoi(argv[++i]) << 20;
+        else
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+    }
+    if (spp < 1 || pass_spp < 1 || width < 2 || threads < 1 || gen.count < 1) {
+        fprintf(stderr, "-n, -spp, -pass-spp, -width and -threads must be positive\n");
+        return(2);
+    }
+    topology * topo = malloc(sizeof(topology));
+    topology_init(topo, omp_get_num_procs());
+    fprintf(stderr, "%d processors, %d numa nodes, %d threads\n", topo->cpu_count, topo->node_count, threads);
+
+    // -- built by the main thread alone, as the renderer does
+    render_setup rs;
+    if (scene_path) {
+        if (!render_setup_load(&rs, scene_path))
+            return(1);
+    } else {
+        scene_init(&rs.world);
+        if (!scene_gen_spheres(&rs.world, &rs.settings, &gen)) {
+            fprintf(stderr, "out of memory\n");
+            return(1);
+        }
+    }
+    if (!render_setup_prepare(&rs, width))
+        return(1);
+    double scene_mb = (rs.world.sphere_count * (4.0 * sizeof(float) + sizeof(int32_t)) + rs.accel.node_count * (double)sizeof(bvh_node) +
+        rs.accel.prim_count * (double)sizeof(int32_t)) / 1048576.0;
+    fprintf(stderr, "scene: %d spheres, %d bvh nodes, %.1f MB\n", rs.world.sphere_count, rs.accel.node_count, scene_mb);
+
+    printf("mode,placement,threads,nodes,scene_mb,frame_s,total_mrays_per_s,speedup,image_hash\n");
+    double base = 0.0;
+    uint64_t base_hash = 0;
+    int mismatches = 0;
+    for (int m = 0; m < mode_count; ++m) {
+        place_mode mode = (place_mode)modes[m];
+        bench_run run = render_run(mode, topo, &rs, spp, pass_spp, threads, replicate_limit);
+        double throughput = run.rays / run.seconds;
+        if (0 == m) {
+            base = throughput;
+            base_hash = run.image_hash;
+        }
+        char const * placement = PLACE_MALLOC == mode ? "main_thread" : (run.replicated ? "replicated" : "interleaved");
+        printf("%s,%s,%d,%d,%.1f,%.6f,%.3f,%.3f,%016llx\n", g_place_mode_names[mode], placement, threads, topo->node_count,
+            scene_mb, run.seconds, throughput * 1e-6, throughput / base, (unsigned long long)run.image_hash);
+        fflush(stdout);
+        fprintf(stderr, "%-10s %-12s %8.3fs  %8.2f Mrays/s  %.2fx  (image %016llx)\n", g_place_mode_names[mode], placement,
+            run.seconds, throughput * 1e-6, throughput / base, (unsigned long long)run.image_hash);
+        if (run.image_hash != base_hash) {
+            fprintf(stderr, "%s: image differs from %s's\n", g_place_mode_names[mode], g_place_mode_names[modes[0]]);
+            ++mismatches;
+        }
+    }
+    free(topo);
+    render_setup_free(&rs);
+    return(mismatches ? 1 : 0);
+}
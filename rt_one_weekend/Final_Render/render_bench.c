@@ -0,0 +1,182 @@
+/* ===========================================================
+   #File: render_bench.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Renders the tutorial scenes at fixed settings and reports rays/s as JSON #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/scene.h"
+#include "headers/light_tree.h"
+#include "headers/render.h"
+#include "headers/progressive.h"
+#include "headers/scene_file.h"
+#include "headers/bvh.h"
+#include "headers/render_setup.h"
+#include <string.h>
+#include <omp.h>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// NOTE: The regression benchmark. Loads every chapter's scene from scenes/ (app2 ray_sphere
+// up to the final scene), overrides the image width and samples per pixel so runs stay
+// comparable, and renders it the way final_scene_omp does (32x32 tiles seeded with 2021,
+// one pass) once per thread count. Tiles own their rng streams, so every run of a scene
+// computes the same image whatever the thread count; image_hash shows it.
+// Reported per run: time per frame, primary rays (camera samples) and total rays
+// (every closest-hit and shadow query, counted by render_hit/render_occluded) per
+// second, and the speedup over the first thread count. peak_rss_mb is the process's
+// peak so far, taken after the scene's runs.
+// Options:
+//   -spp n          samples per pixel (16)
+//   -width n        image width, the scene's aspect ratio is kept (400)
+//   -threads list   comma separated thread counts (1,2,4... up to the processor count)
+//   -scenes dir     where the .scene files are (scenes)
+//   name ...        only these scenes (file names without .scene)
+// Usage: render_bench.exe > bench.json
+
+static char const * g_scene_names[] = {
+    "ray_sphere", "sphere_with_ground", "antialiasing", "diffuse_sphere", "metal_spheres",
+    "hollow_glass_sphere", "positionable_camera", "depth_of_field", "final_scene"
+};
+#define bench_scene_count (int)(sizeof(g_scene_names) / sizeof(g_scene_names[0]))
+#define bench_max_threads 64
+
+typedef struct {
+    int threads;
+    double seconds;
+    int64_t total_rays;
+    uint64_t image_hash;
+} bench_run;
+
+static double
+peak_rss_mb (void) {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0.0;
+    return pmc.PeakWorkingSetSize / 1048576.0;
+#elif defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1048576.0;     /* bytes */
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;        /* kilobytes */
+#endif
+}
+/* one frame on threads threads, every tile in a single pass */
+static bench_run
+render_frame (render_context * ctx, camera * cam, int width, int height, int spp, int threads) {
+    bench_run ret = {threads, 0.0, 0, 0};
+    film fb;
+    tile_grid grid;
+    film_alloc(&fb, width, height);
+    tile_grid_init(&grid, width, height, 32, 2021);
+    tile_thread_stats * stats = calloc(threads, sizeof(tile_thread_stats));
+    tile_pass tiles;
+    tile_pass_init(&tiles, spp, spp);
+    tiles.stats = stats;
+    omp_set_num_threads(threads);
+    double start = omp_get_wtime();
+#pragma omp parallel
+    render_tiles_pass(ctx, cam, &fb, NULL, &grid, &tiles);
+    ret.seconds = omp_get_wtime() - start;
+    for (int t = 0; t < threads; ++t)
+        ret.total_rays += stats[t].rays;
+    free(stats);
+    ret.image_hash = hash_bytes(hash_seed, fb.sum, (size_t)width * height * sizeof(color));
+    tile_grid_free(&grid);
+    film_free(&fb);
+    return ret;
+}
+/* false when the scene could not be loaded; its entry then only carries the error */
+static bool
+bench_scene (char const * dir, char const * name, int width, int spp, int const * threads, int thread_count, bool first) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.scene", dir, name);
+    printf("%s\n    {\n      \"name\": \"%s\",\n", first ? "" : ",", name);
+    render_setup rs;
+    double t0 = omp_get_wtime();
+    if (!render_setup_load(&rs, path)) {
+        printf("      \"error\": \"could not load %s\"\n    }", path);
+        return false;
+    }
+    double load_seconds = omp_get_wtime() - t0;
+    t0 = omp_get_wtime();
+    if (!render_setup_prepare(&rs, width)) {
+        printf("      \"error\": \"could not prepare %s\"\n    }", path);
+        scene_free(&rs.world);
+        return false;
+    }
+    double build_seconds = omp_get_wtime() - t0;
+    int height = rs.height;
+
+    printf("      \"width\": %d,\n      \"height\": %d,\n      \"spp\": %d,\n      \"max_depth\": %d,\n", width, height, spp,
+        rs.settings.max_depth);
+    printf("      \"spheres\": %d,\n      \"planes\": %d,\n      \"bvh_nodes\": %d,\n", rs.world.sphere_count, rs.world.plane_count,
+        rs.accel.node_count);
+    printf("      \"load_s\": %.6f,\n      \"build_s\": %.6f,\n      \"runs\": [", load_seconds, build_seconds);
+    double primary_rays = (double)width * height * spp;
+    double base_seconds = 0.0;
+    for (int k = 0; k < thread_count; ++k) {
+        bench_run run = render_frame(&rs.ctx, &rs.cam, width, height, spp, threads[k]);
+        if (0 == k)
+            base_seconds = run.seconds;
+        double speedup = base_seconds / run.seconds;
+        printf("%s\n        {\"threads\": %d, \"frame_s\": %.6f, \"primary_rays\": %.0f, \"total_rays\": %lld, "
+            "\"primary_mrays_per_s\": %.3f, \"total_mrays_per_s\": %.3f, \"speedup\": %.3f, \"efficiency\": %.3f, "
+            "\"image_hash\": \"%016llx\"}", 0 == k ? "" : ",", run.threads, run.seconds, primary_rays, (long long)run.total_rays,
+            primary_rays / run.seconds * 1e-6, run.total_rays / run.seconds * 1e-6, speedup,
+            speedup * threads[0] / run.threads, (unsigned long long)run.image_hash);
+        fprintf(stderr, "%-20s %2d threads  %8.3fs  primary %7.2f Mrays/s  total %7.2f Mrays/s  (%.2fx)\n", name, run.threads,
+            run.seconds, primary_rays / run.seconds * 1e-6, run.total_rays / run.seconds * 1e-6, speedup);
+    }
+    printf("\n      ],\n      \"peak_rss_mb\": %.1f\n    }", peak_rss_mb());
+    render_setup_free(&rs);
+    return true;
+}
+int main (int argc, char ** argv) {
+    int spp = 16;
+    int width = 400;
+    char const * dir = "scenes";
+    int threads[bench_max_threads];
+    int thread_count = 0;
+    char const * only[bench_scene_count];
+    int only_count = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-spp") && i + 1 < argc)
+            spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-width") && i + 1 < argc)
+            width = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-threads") && i + 1 < argc)
+            thread_count = parse_int_list(argv[++i], threads, bench_max_threads);
+        else if (0 == strcmp(argv[i], "-scenes") && i + 1 < argc)
+            dir = argv[++i];
+        else if (argv[i][0] != '-' && only_count < bench_scene_count)
+            only[only_count++] = argv[i];
+        else
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+    }
+    int procs = omp_get_num_procs();
+    if (0 == thread_count)
+        thread_count = thread_sweep_default(procs, threads, bench_max_threads);
+
+    printf("{\n  \"benchmark\": \"render_bench\",\n  \"processors\": %d,\n  \"spp\": %d,\n  \"width\": %d,\n  \"seed\": 2021,\n"
+        "  \"scenes\": [", procs, spp, width);
+    int failed = 0;
+    char const ** names = only_count ? only : g_scene_names;
+    int name_count = only_count ? only_count : bench_scene_count;
+    for (int s = 0; s < name_count; ++s)
+        failed += !bench_scene(dir, names[s], width, spp, threads, thread_count, 0 == s);
+    printf("\n  ]\n}\n");
+    return(failed ? 1 : 0);
+}
@@ -0,0 +1,546 @@
+/* ===========================================================
+   #File: render_farm.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Distributed rendering, a coordinator handing tile jobs to worker processes #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/scene.h"
+#include "headers/light_tree.h"
+#include "headers/render.h"
+#include "headers/image.h"
+#include "headers/progressive.h"
+#include "headers/scene_file.h"
+#include "headers/scene_cache.h"
+#include "headers/bvh.h"
+#include "headers/render_setup.h"
+#include "headers/net.h"
+#include "headers/cluster.h"
+#include <string.h>
+#include <omp.h>
+
+// NOTE: One image, many processes (see cluster.h for the protocol and what happens when a
+// worker dies). Run without -worker this is the coordinator: it reads the scene for the
+// image settings, listens on -listen, hands out jobs of -job-tiles tiles to whoever
+// connects and writes the merged image as final_scene_omp does (ppm on stdout, -pfm).
+// With -worker it is a worker: it connects, loads the same scene file, checks it hashes
+// the same as the coordinator's, and renders jobs on -threads threads until told to stop.
+// The image is bit-identical to final_scene_omp -scene <file> with the same -spp, -width
+// and -pass-spp, whichever worker rendered which job and however many died on the way.
+// With -split n the sample budget is split instead (or as well, with -job-tiles): a job is
+// samples [s, s + n) of every pixel (sample_split.h), so workers of any speed take as many
+// ranges as they manage, and ones joining mid-render help with the frame at once. That
+// image is not final_scene_omp's (other samples) but bit-identical to -single -split, one
+// process rendering every sample itself, for any n and any number of workers.
+// Options:
+//   -scene file        (scenes/final_scene.scene); a worker's own overrides the path the
+//                      coordinator sends, for hosts that keep it elsewhere
+//   -listen address    coordinator: unix:/path or host:port (127.0.0.1:7070)
+//   -worker address    run as a worker of the coordinator at address
+//   -local n           coordinator: also start n workers on this host
+//   -threads n         worker: render threads (the processor count; -local shares them out)
+//   -spp n             samples per pixel (the scene's)
+//   -width n           image width (the scene's)
+//   -pass-spp n        samples per pass as in final_scene_omp (all in one pass)
+//   -job-tiles n       tiles per job (a tile row; the whole frame with -split)
+//   -split n           jobs of n samples per pixel each (at most 8191 spp in all)
+//   -single            coordinator: render every job in this process, no network
+//   -job-timeout s     hand a job out again after s seconds (0: never, a dead worker is
+//                      noticed by its connection closing)
+//   -pfm file          also write the linear image
+//   -crash-after n     worker: exit without answering while holding its n-th job
+//   -local-crash n     coordinator: the first local worker gets -crash-after n
+// Usage:
+//   render_farm.exe -scene scenes/final_scene.scene -local 4 -local-crash 2 > image.ppm
+//   render_farm.exe -scene scenes/final_scene.scene -split 16 -local 4 -pfm farm.pfm > farm.ppm
+//   render_farm.exe -scene scenes/final_scene.scene -split 500 -single -pfm one.pfm > one.ppm
+//   render_farm.exe -listen 0.0.0.0:7070 -scene big.scene -spp 2000 > image.ppm  (coordinator)
+//   render_farm.exe -worker coordinator-host:7070                                 (every node)
+
+#define farm_io_timeout 60.0        /* seconds a started message may take to arrive */
+
+typedef struct {
+    char const * scene_path;
+    char const * listen_address;
+    char const * pfm_path;
+    int local_workers;
+    int local_crash;
+    int spp;
+    int width;
+    int pass_spp;
+    int job_tiles;
+    int job_spp;
+    double job_timeout;
+    bool single;
+} farm_options;
+
+/* what a worker (or -single) renders jobs with */
+typedef struct {
+    render_setup rs;
+    cluster_setup setup;
+    tile_grid grid;
+    tile * initial;         /* the tiles as tile_grid_init made them */
+    film fb;                /* full size, but only the pages of jobs rendered here get touched */
+    split_film sf;
+} farm_renderer;
+
+typedef struct {
+    int id;                 /* never reused, the queue knows workers by it */
+    net_socket sock;
+    bool joined;            /* said hello, got the setup */
+    int job;                /* running, -1 when idle */
+    int pid;
+    int threads;
+    int jobs_done;
+    int64_t rays;
+    double busy;
+} worker_slot;
+
+static void
+farm_sleep (double seconds) {
+#if defined(_WIN32)
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    usleep((useconds_t)(seconds * 1e6));
+#endif
+}
+//
+// rendering
+// the same setup as final_scene_omp. returns false (having said why) when the scene is
+// missing, is not the coordinator's, or gives another image size
+static bool
+farm_renderer_init (farm_renderer * me, char const * scene_path, cluster_setup const * setup) {
+    uint64_t scene_key = 0;
+    if (!hash_file(scene_path, &scene_key) || scene_key != setup->scene_key) {
+        fprintf(stderr, "%s is not the coordinator's scene\n", scene_path);
+        return false;
+    }
+    if (!render_setup_load(&me->rs, scene_path))
+        return false;
+    if ((int)(setup->width / me->rs.settings.aspect_ratio) != setup->height) {
+        fprintf(stderr, "image size differs from the coordinator's\n");
+        scene_free(&me->rs.world);
+        return false;
+    }
+    me->setup = *setup;
+    if (!render_setup_prepare(&me->rs, setup->width))
+        return false;
+    if (!film_alloc(&me->fb, setup->width, setup->height) || !split_film_alloc(&me->sf, setup->width, setup->height) ||
+        !tile_grid_init(&me->grid, setup->width, setup->height, setup->tile_size, setup->seed) ||
+        NULL == (me->initial = malloc(me->grid.tile_count * sizeof(tile)))) {
+        fprintf(stderr, "out of memory\n");
+        return false;
+    }
+    memcpy(me->initial, me->grid.tiles, me->grid.tile_count * sizeof(tile));
+    return true;
+}
+static void
+farm_renderer_free (farm_renderer * me) {
+    free(me->initial);
+    tile_grid_free(&me->grid);
+    split_film_free(&me->sf);
+    film_free(&me->fb);
+    render_setup_free(&me->rs);
+}
+/* renders the job's tiles on all threads, its accumulators into out (cluster_job_bytes); returns the rays traced */
+static int64_t
+farm_render_job (farm_renderer * me, cluster_job const * job, void * out) {
+    int64_t rays = 0;
+    int a;
+#pragma omp parallel for schedule(dynamic) reduction(+:rays)
+    for (a = 0; a < job->tile_count; ++a) {
+        int ti = job->first_tile + a;
+        tile * t = &me->grid.tiles[ti];
+        int64_t before = g_rays_traced;
+        if (job->sample_count > 0) {
+            split_film_clear_tile(&me->sf, t);
+            render_tile_samples(&me->rs.ctx, &me->rs.cam, &me->sf, t, job->first_sample, job->sample_count, me->setup.seed);
+        } else {
+            // -- from the tile's first sample, as if it had never been rendered here
+            *t = me->initial[ti];
+            for (int row = t->y0; row < t->y1; ++row) {
+                memset(&me->fb.sum[row * me->fb.width + t->x0], 0, (t->x1 - t->x0) * sizeof(color));
+                memset(&me->fb.lum_sq[row * me->fb.width + t->x0], 0, (t->x1 - t->x0) * sizeof(float));
+            }
+            while (t->spp < me->setup.spp) {
+                int n = me->setup.spp - t->spp;
+                render_tile_pass(&me->rs.ctx, &me->rs.cam, &me->fb, NULL, t, n < me->setup.pass_spp ? n : me->setup.pass_spp);
+            }
+        }
+        rays += g_rays_traced - before;
+    }
+    if (job->sample_count > 0)
+        cluster_pack_fixed(&me->sf, &me->grid, job, out);
+    else
+        cluster_pack(&me->fb, &me->grid, job, out);
+    return rays;
+}
+//
+// coordinator
+/* the first result of a job goes into the image */
+static void
+merge_result (cluster_setup const * setup, cluster_queue * queue, film * fb, split_film * sf, tile_grid * grid, int id,
+    void const * payload) {
+    if (!cluster_queue_finish(queue, id))
+        return;
+    cluster_job const * job = &queue->slots[id].job;
+    if (job->sample_count > 0) {
+        cluster_add_fixed(sf, grid, job, payload);
+    } else {
+        cluster_unpack(fb, grid, job, payload);
+        for (int ti = job->first_tile; ti < job->first_tile + job->tile_count; ++ti)
+            grid->tiles[ti].spp = setup->spp;
+    }
+}
+static bool
+send_job (worker_slot * w, cluster_queue * queue, double now) {
+    int j = cluster_queue_take(queue, w->id, now);
+    if (j < 0)
+        return true;
+    w->job = j;
+    return net_send_message(w->sock, CLUSTER_JOB, &queue->slots[j].job, sizeof(cluster_job));
+}
+/* one message from the worker; false when it has to go */
+static bool
+serve_worker (worker_slot * w, cluster_setup const * setup, cluster_queue * queue, film * fb, split_film * sf, tile_grid * grid,
+    void ** buffer, size_t * buffer_size) {
+    net_header header;
+    if (!net_recv_header(w->sock, &header))
+        return false;
+    if (CLUSTER_HELLO == header.type && !w->joined) {
+        cluster_hello hello;
+        if (header.size != sizeof(hello) || !net_recv_all(w->sock, &hello, sizeof(hello)) ||
+            hello.magic != cluster_magic || hello.version != cluster_version)
+            return false;
+        w->pid = hello.pid;
+        w->threads = hello.threads;
+        w->joined = true;
+        fprintf(stderr, "\nworker %d joined (pid %d, %d threads)\n", w->id, w->pid, w->threads);
+        return net_send_message(w->sock, CLUSTER_SETUP, setup, sizeof(*setup));
+    }
+    if (CLUSTER_RESULT == header.type && w->joined && w->job >= 0) {
+        cluster_result result;
+        if (header.size < sizeof(result) || !net_recv_all(w->sock, &result, sizeof(result)) || result.id != w->job)
+            return false;
+        cluster_job const * job = &queue->slots[result.id].job;
+        size_t payload = cluster_job_bytes(grid, job);
+        if (result.pixel_count != cluster_job_pixels(grid, job) || header.size != sizeof(result) + payload)
+            return false;
+        if (*buffer_size < payload) {
+            free(*buffer);
+            *buffer = malloc(payload);
+            *buffer_size = *buffer ? payload : 0;
+            if (NULL == *buffer)
+                return false;
+        }
+        if (!net_recv_all(w->sock, *buffer, payload))
+            return false;
+        // -- a job handed out twice is merged once, the results are the same anyway
+        merge_result(setup, queue, fb, sf, grid, result.id, *buffer);
+        w->job = -1;
+        ++w->jobs_done;
+        w->rays += result.rays;
+        w->busy += result.seconds;
+        return true;
+    }
+    return false;
+}
+static int
+run_coordinator (farm_options const * opt, char const * self) {
+    render_setup rs;
+    uint64_t scene_key = 0;
+    if (!render_setup_load(&rs, opt->scene_path) || !hash_file(opt->scene_path, &scene_key))
+        return(1);
+    scene_free(&rs.world);      /* only the settings are needed here */
+    scene_settings settings = rs.settings;
+    if (opt->spp > 0)
+        settings.samples_per_pixel = opt->spp;
+    if (opt->width > 0)
+        settings.width = opt->width;
+    int spp = settings.samples_per_pixel;
+    int width = settings.width;
+    int height = (int)(width / settings.aspect_ratio);
+    int pass_spp = (opt->pass_spp <= 0 || opt->pass_spp > spp) ? spp : opt->pass_spp;
+    if (opt->job_spp > 0 && spp > split_max_spp) {
+        fprintf(stderr, "-split renders at most %d spp\n", split_max_spp);
+        return(1);
+    }
+    cluster_setup setup = {cluster_magic, cluster_version, scene_key, width, height, spp, pass_spp, 32, 2021};
+    snprintf(setup.scene_path, sizeof(setup.scene_path), "%s", opt->scene_path);
+
+    film fb;
+    split_film sf;
+    tile_grid grid;
+    cluster_queue queue;
+    if (!film_alloc(&fb, width, height) || !split_film_alloc(&sf, width, height) ||
+        !tile_grid_init(&grid, width, height, setup.tile_size, setup.seed)) {
+        fprintf(stderr, "out of memory\n");
+        return(1);
+    }
+    int job_tiles = opt->job_tiles > 0 ? opt->job_tiles : (opt->job_spp > 0 ? grid.tile_count : grid.tiles_x);
+    if (!cluster_queue_init(&queue, &grid, job_tiles, spp, opt->job_spp)) {
+        fprintf(stderr, "out of memory\n");
+        return(1);
+    }
+    double start = omp_get_wtime();
+    int64_t rays = 0;
+    if (opt->single) {
+        // -- the reference: every job here, one after the other
+        fprintf(stderr, "one process: %dx%d, %d spp, %d jobs\n", width, height, spp, queue.count);
+        farm_renderer renderer;
+        if (!farm_renderer_init(&renderer, opt->scene_path, &setup))
+            return(1);
+        size_t largest = 0;
+        for (int j = 0; j < queue.count; ++j)
+            largest = cluster_job_bytes(&grid, &queue.slots[j].job) > largest ? cluster_job_bytes(&grid, &queue.slots[j].job) : largest;
+        void * buffer = malloc(largest);
+        for (int j = 0; j < queue.count; ++j) {
+            rays += farm_render_job(&renderer, &queue.slots[j].job, buffer);
+            merge_result(&setup, &queue, &fb, &sf, &grid, j, buffer);
+            fprintf(stderr, "\rjobs done: %d/%d ", queue.done, queue.count);
+        }
+        free(buffer);
+        farm_renderer_free(&renderer);
+        double seconds = omp_get_wtime() - start;
+        fprintf(stderr, "\nrender: %.2fs, %.2f Mrays/s\n", seconds, rays / seconds * 1e-6);
+    } else {
+        net_socket listener = net_listen(opt->listen_address);
+        if (net_invalid == listener) {
+            fprintf(stderr, "could not listen on %s\n", opt->listen_address);
+            return(1);
+        }
+        fprintf(stderr, "coordinator on %s: %dx%d, %d spp, %d jobs of %d tiles", opt->listen_address, width, height, spp,
+            queue.count, queue.slots[0].job.tile_count);
+        if (opt->job_spp > 0)
+            fprintf(stderr, " x %d samples", queue.slots[0].job.sample_count);
+        fprintf(stderr, "\n");
+
+        // -- local workers share the processors
+        cluster_process processes[cluster_max_workers];
+        int process_count = 0;
+        int local_workers = opt->local_workers < cluster_max_workers ? opt->local_workers : cluster_max_workers;
+        for (int k = 0; k < local_workers; ++k) {
+            char threads[16], crash[16];
+            int procs = omp_get_num_procs();
+            snprintf(threads, sizeof(threads), "%d", procs > local_workers ? procs / local_workers : 1);
+            snprintf(crash, sizeof(crash), "%d", opt->local_crash);
+            char * args[] = {(char *)self, "-worker", (char *)opt->listen_address, "-threads", threads, "-crash-after", crash, NULL};
+            if (0 != k || opt->local_crash <= 0)
+                args[5] = NULL;
+            if (cluster_spawn(args, &processes[process_count]))
+                ++process_count;
+            else
+                fprintf(stderr, "could not start a local worker\n");
+        }
+
+        worker_slot workers[cluster_max_workers];
+        int worker_count = 0;
+        int next_id = 0;
+        void * buffer = NULL;
+        size_t buffer_size = 0;
+        int shown_done = -1, shown_workers = -1;
+        while (queue.done < queue.count) {
+            net_socket sockets[cluster_max_workers + 1];
+            bool ready[cluster_max_workers + 1];
+            sockets[0] = listener;
+            for (int w = 0; w < worker_count; ++w)
+                sockets[w + 1] = workers[w].sock;
+            if (net_wait_readable(sockets, worker_count + 1, 1.0, ready) < 0)
+                farm_sleep(0.1);
+            double now = omp_get_wtime();
+            if (ready[0]) {
+                net_socket s = net_accept(listener);
+                if (net_invalid != s && worker_count < cluster_max_workers) {
+                    net_set_timeout(s, farm_io_timeout);
+                    worker_slot fresh = {next_id++, s, false, -1};
+                    workers[worker_count++] = fresh;
+                } else {
+                    net_close(s);
+                }
+            }
+            // -- answers; a worker that broke off or misbehaved leaves, and its job goes back
+            for (int w = 0; w < worker_count; ++w) {
+                if (!ready[w + 1] || serve_worker(&workers[w], &setup, &queue, &fb, &sf, &grid, &buffer, &buffer_size))
+                    continue;
+                int requeued = cluster_queue_release(&queue, workers[w].id);
+                fprintf(stderr, "\nworker %d lost after %d jobs%s\n", workers[w].id, workers[w].jobs_done,
+                    requeued ? ", its job is back in the queue" : "");
+                net_close(workers[w].sock);
+                workers[w] = workers[--worker_count];
+                ready[w + 1] = ready[worker_count + 1];
+                --w;
+            }
+            int expired = cluster_queue_expire(&queue, now, opt->job_timeout);
+            if (expired)
+                fprintf(stderr, "\n%d jobs ran past %.0fs, handed out again\n", expired, opt->job_timeout);
+            for (int w = 0; w < worker_count; ++w) {
+                if (workers[w].joined && workers[w].job < 0 && !send_job(&workers[w], &queue, now)) {
+                    cluster_queue_release(&queue, workers[w].id);
+                    workers[w].job = -1;    /* noticed as lost on its next read */
+                }
+            }
+            if (queue.done != shown_done || worker_count != shown_workers)
+                fprintf(stderr, "\rjobs done: %d/%d, %d workers ", queue.done, queue.count, worker_count);
+            shown_done = queue.done;
+            shown_workers = worker_count;
+        }
+        double seconds = omp_get_wtime() - start;
+
+        // -- every worker still there is told to stop
+        fprintf(stderr, "\nrender: %.2fs, %d jobs handed out again\n", seconds, queue.requeued);
+        for (int w = 0; w < worker_count; ++w) {
+            net_send_message(workers[w].sock, CLUSTER_DONE, NULL, 0);
+            net_close(workers[w].sock);
+            rays += workers[w].rays;
+            fprintf(stderr, "worker %d: %d jobs, %.2fs busy, %.2f Mrays/s\n", workers[w].id, workers[w].jobs_done,
+                workers[w].busy, workers[w].busy > 0.0 ? workers[w].rays / workers[w].busy * 1e-6 : 0.0);
+        }
+        fprintf(stderr, "%.2f Mrays/s over the remaining workers\n", rays / seconds * 1e-6);
+        free(buffer);
+        net_close(listener);
+        net_unlink(opt->listen_address);
+        for (int k = 0; k < process_count; ++k)
+            cluster_wait(processes[k]);
+    }
+
+    int pixel_count = width * height;
+    color * beauty = malloc(pixel_count * sizeof(color));
+    if (opt->job_spp > 0)
+        split_film_resolve(&sf, spp, beauty, NULL);
+    else
+        film_resolve(&fb, &grid, beauty, NULL, NULL);
+    if (opt->pfm_path && !image_write_pfm(opt->pfm_path, width, height, beauty))
+        fprintf(stderr, "could not write %s\n", opt->pfm_path);
+    printf("P3\n%d %d\n255\n", width, height);
+    for (int k = 0; k < pixel_count; ++k) {
+        int rgb[3];
+        write_color(rgb, beauty[k], 1);
+        printf("%d %d %d\n", rgb[0], rgb[1], rgb[2]);
+    }
+    fflush(stdout);
+    free(beauty);
+    cluster_queue_free(&queue);
+    tile_grid_free(&grid);
+    split_film_free(&sf);
+    film_free(&fb);
+    return(0);
+}
+//
+// worker
+static int
+run_worker (char const * address, char const * own_scene_path, int threads, int crash_after) {
+    net_socket s = net_invalid;
+    // -- the coordinator may still be starting
+    for (int attempt = 0; attempt < 100 && net_invalid == s; ++attempt) {
+        s = net_connect(address);
+        if (net_invalid == s)
+            farm_sleep(0.1);
+    }
+    if (net_invalid == s) {
+        fprintf(stderr, "could not connect to %s\n", address);
+        return(1);
+    }
+#if defined(_WIN32)
+    cluster_hello hello = {cluster_magic, cluster_version, (int32_t)GetCurrentProcessId(), threads};
+#else
+    cluster_hello hello = {cluster_magic, cluster_version, (int32_t)getpid(), threads};
+#endif
+    cluster_setup setup;
+    net_header header;
+    if (!net_send_message(s, CLUSTER_HELLO, &hello, sizeof(hello)) || !net_recv_header(s, &header) ||
+        CLUSTER_SETUP != header.type || sizeof(setup) != header.size || !net_recv_all(s, &setup, sizeof(setup)) ||
+        setup.magic != cluster_magic || setup.version != cluster_version) {
+        fprintf(stderr, "%s is not a coordinator of this version\n", address);
+        return(1);
+    }
+    setup.scene_path[sizeof(setup.scene_path) - 1] = '\0';
+    farm_renderer renderer;
+    if (!farm_renderer_init(&renderer, own_scene_path ? own_scene_path : setup.scene_path, &setup))
+        return(1);
+
+    void * buffer = NULL;
+    size_t buffer_size = 0;
+    int jobs = 0;
+    omp_set_num_threads(threads);
+    while (net_recv_header(s, &header) && CLUSTER_JOB == header.type) {
+        cluster_job job;
+        if (sizeof(job) != header.size || !net_recv_all(s, &job, sizeof(job)) ||
+            job.first_tile < 0 || job.tile_count < 1 || job.first_tile + job.tile_count > renderer.grid.tile_count ||
+            job.first_sample < 0 || job.sample_count < 0)
+            break;
+        ++jobs;
+        double start = omp_get_wtime();
+        size_t payload = cluster_job_bytes(&renderer.grid, &job);
+        if (buffer_size < sizeof(cluster_result) + payload) {
+            free(buffer);
+            buffer_size = sizeof(cluster_result) + payload;
+            buffer = malloc(buffer_size);
+        }
+        int64_t rays = farm_render_job(&renderer, &job, (char *)buffer + sizeof(cluster_result));
+        if (jobs == crash_after) {
+            fprintf(stderr, "worker %d: crashing with job %d as asked\n", hello.pid, job.id);
+            exit(3);
+        }
+        cluster_result result = {job.id, cluster_job_pixels(&renderer.grid, &job), rays, omp_get_wtime() - start};
+        memcpy(buffer, &result, sizeof(result));
+        if (!net_send_message(s, CLUSTER_RESULT, buffer, sizeof(result) + payload))
+            break;
+    }
+    net_close(s);
+    free(buffer);
+    farm_renderer_free(&renderer);
+    return(0);
+}
+int main (int argc, char ** argv) {
+    farm_options opt = {0};
+    opt.scene_path = "scenes/final_scene.scene";
+    opt.listen_address = "127.0.0.1:7070";
+    char const * own_scene_path = NULL;
+    char const * worker_address = NULL;
+    int crash_after = 0;
+    int threads = omp_get_num_procs();
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-scene") && i + 1 < argc)
+            opt.scene_path = own_scene_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-listen") && i + 1 < argc)
+            opt.listen_address = argv[++i];
+        else if (0 == strcmp(argv[i], "-worker") && i + 1 < argc)
+            worker_address = argv[++i];
+        else if (0 == strcmp(argv[i], "-local") && i + 1 < argc)
+            opt.local_workers = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-spp") && i + 1 < argc)
+            opt.spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-width") && i + 1 < argc)
+            opt.width = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-pass-spp") && i + 1 < argc)
+            opt.pass_spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-job-tiles") && i + 1 < argc)
+            opt.job_tiles = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-split") && i + 1 < argc)
+            opt.job_spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-single"))
+            opt.single = true;
+        else if (0 == strcmp(argv[i], "-job-timeout") && i + 1 < argc)
+            opt.job_timeout = atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-pfm") && i + 1 < argc)
+            opt.pfm_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-crash-after") && i + 1 < argc)
+            crash_after = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-local-crash") && i + 1 < argc)
+            opt.local_crash = atoi(argv[++i]);
+        else
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+    }
+    if (!net_startup()) {
+        fprintf(stderr, "no sockets\n");
+        return(1);
+    }
+    if (worker_address)
+        return run_worker(worker_address, own_scene_path, threads > 0 ? threads : 1, crash_after);
+    return run_coordinator(&opt, argv[0]);
+}
@@ -0,0 +1,179 @@
+/* ===========================================================
+   #File: scale_bench.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: BVH build and traversal cost against scene size on procedural stress scenes #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/camera.h"
+#include "headers/scene.h"
+#include "headers/bvh.h"
+#include "headers/triangle_mesh.h"
+#include "headers/scene_gen.h"
+#include <string.h>
+#include <omp.h>
+
+// NOTE: The scaling study. For every layout and primitive count it generates a stress
+// scene (scene_gen.h, seed 2021), builds its bvh (binned SAH) and traces the same kind
+// of rays through it as bvh_bench: a pinhole camera ray per pixel of a 512x384 image
+// from the layout's camera, plus one cosine-distributed bounce from every hit. Only the
+// closest-hit queries are timed, on all threads. Spheres are traced with bvh_scene_hit,
+// triangles (-triangles) with triangle_mesh_hit.
+// Per run: generation and build time, nodes, sah cost, memory of the primitives and the
+// bvh, rays, hit rate, and Mrays/s; the build time per primitive and Mrays/s against
+// log n show where the build stops being linear and traversal stops being logarithmic
+// (the tree outgrowing the caches).
+// Options:
+//   -n list          comma separated primitive counts (1000,10000,100000,1000000)
+//   -layouts list    comma separated layouts (all four)
+//   -overlap x       mean diameter over mean spacing (0.5)
+//   -triangles       triangles instead of spheres
+// Usage: scale_bench.exe -n 1000,100000,10000000 > scaling.csv
+
+#define bench_width 512
+#define bench_height 384
+#define bench_max_runs 32
+
+static int
+parse_counts (char const * list, int * out) {
+    int count = 0;
+    while (*list && count < bench_max_runs) {
+        double n = atof(list);      /* so 1e7 works too */
+        if (n >= 1.0)
+            out[count++] = (int)n;
+        while (*list && *list != ',')
+            ++list;
+        if (*list == ',')
+            ++list;
+    }
+    return count;
+}
+static int
+parse_layouts (char * list, int * out) {
+    int count = 0;
+    for (char * name = strtok(list, ","); name && count < SCENE_GEN_LAYOUT_COUNT; name = strtok(NULL, ",")) {
+        int layout = scene_gen_layout_from_name(name);
+        if (layout < 0)
+            fprintf(stderr, "unknown layout %s\n", name);
+        else
+            out[count++] = layout;
+    }
+    return count;
+}
+/* closest hit against the spheres or the mesh, whichever the run is about */
+static bool
+bench_hit (scene * world, bvh * accel, triangle_mesh * mesh, ray * r, hit_record * rec) {
+    if (mesh)
+        return triangle_mesh_hit(mesh, r, 0.001f, g_infinity, rec);
+    return bvh_scene_hit(accel, world, r, 0.001f, g_infinity, rec);
+}
+/* the camera rays and a bounce from each hit, a row per rng stream */
+static ray *
+make_rays (scene * world, bvh * accel, triangle_mesh * mesh, camera * cam, int * out_count) {
+    ray * rays = malloc(2 * (size_t)bench_width * bench_height * sizeof(ray));
+    int count = 0;
+    for (int j = 0; j < bench_height; ++j) {
+        random_set_state(random_hash_seed(7, j));
+        for (int i = 0; i < bench_width; ++i) {
+            ray r = camera_cast_ray(cam, (i + 0.5f) / bench_width, (j + 0.5f) / bench_height);
+            rays[count++] = r;
+            hit_record rec;
+            if (bench_hit(world, accel, mesh, &r, &rec)) {
+                ray bounce = {.origin = rec.p, .dir = vec3_add(rec.normal, random_unit_vector())};
+                rays[count++] = bounce;
+            }
+        }
+    }
+    *out_count = count;
+    return rays;
+}
+static void
+bench_run (int layout, int n, float overlap, bool triangles) {
+    scene_gen_params params;
+    scene_gen_params_default(&params);
+    params.layout = (scene_gen_layout)layout;
+    params.count = n;
+    params.overlap = overlap;
+    scene world;
+    scene_init(&world);
+    scene_settings settings;
+    triangle_mesh mesh;
+    triangle_mesh_init(&mesh);
+    bvh accel = {0};
+    double t0 = omp_get_wtime();
+    bool ok = triangles ? scene_gen_triangles(&mesh, &settings, &params) : scene_gen_spheres(&world, &settings, &params);
+    double gen_seconds = omp_get_wtime() - t0;
+    t0 = omp_get_wtime();
+    ok = ok && (triangles ? triangle_mesh_build_bvh(&mesh) : bvh_build_spheres(&accel, &world));
+    double build_seconds = omp_get_wtime() - t0;
+    char const * kind = triangles ? "triangles" : "spheres";
+    char const * layout_name = g_scene_gen_layout_names[layout];
+    if (!ok) {
+        fprintf(stderr, "%s %s %d: out of memory\n", kind, layout_name, n);
+        triangle_mesh_free(&mesh);
+        bvh_free(&accel);
+        scene_free(&world);
+        return;
+    }
+    bvh * tree = triangles ? &mesh.accel : &accel;
+    double prim_bytes = triangles ? n * (3.0 * sizeof(point3) + 3.0 * sizeof(int32_t)) : n * (4.0 * sizeof(float) + sizeof(int32_t));
+    double bvh_bytes = (double)tree->node_count * sizeof(bvh_node) + (double)tree->prim_count * sizeof(int32_t);
+
+    camera cam = {0};
+    camera_init(&cam, settings.lookfrom, settings.lookat, settings.vup, settings.vfov, (float)bench_width / bench_height,
+        0.0f, settings.focus_dist);
+    triangle_mesh * m = triangles ? &mesh : NULL;
+    int ray_count = 0;
+    ray * rays = make_rays(&world, &accel, m, &cam, &ray_count);
+    int hits = 0;
+    int i;
+    t0 = omp_get_wtime();
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+:hits)
+    for (i = 0; i < ray_count; ++i) {
+        hit_record rec;
+        hits += bench_hit(&world, &accel, m, &rays[i], &rec);
+    }
+    double trace_seconds = omp_get_wtime() - t0;
+
+    printf("%s,%s,%d,%.4f,%.4f,%.1f,%d,%.1f,%.1f,%.1f,%d,%.3f,%.4f,%.3f\n", kind, layout_name, n, gen_seconds, build_seconds,
+        build_seconds / n * 1e9, tree->node_count, bvh_sah_cost(tree), prim_bytes / 1048576.0, bvh_bytes / 1048576.0, ray_count,
+        (double)hits / ray_count, trace_seconds, ray_count / trace_seconds * 1e-6);
+    fflush(stdout);
+    fprintf(stderr, "%-9s %-12s %9d  build %8.3fs (%6.1f ns/prim)  nodes %9d  sah %7.1f  %7.1f MB  hits %5.1f%%  %7.2f Mrays/s\n",
+        kind, layout_name, n, build_seconds, build_seconds / n * 1e9, tree->node_count, bvh_sah_cost(tree),
+        (prim_bytes + bvh_bytes) / 1048576.0, 100.0 * hits / ray_count, ray_count / trace_seconds * 1e-6);
+    free(rays);
+    triangle_mesh_free(&mesh);
+    bvh_free(&accel);
+    scene_free(&world);
+}
+int main (int argc, char ** argv) {
+    int counts[bench_max_runs] = {1000, 10000, 100000, 1000000};
+    int count_count = 4;
+    int layouts[SCENE_GEN_LAYOUT_COUNT] = {SCENE_GEN_UNIFORM, SCENE_GEN_CLUSTERED, SCENE_GEN_LONG_THIN, SCENE_GEN_NESTED_GLASS};
+    int layout_count = SCENE_GEN_LAYOUT_COUNT;
+    float overlap = 0.5f;
+    bool triangles = false;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            count_count = parse_counts(argv[++i], counts);
+        else if (0 == strcmp(argv[i], "-layouts") && i + 1 < argc)
+            layout_count = parse_layouts(argv[++i], layouts);
+        else if (0 == strcmp(argv[i], "-overlap") && i + 1 < argc)
+            overlap = (float)atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-triangles"))
+            triangles = true;
+        else
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+    }
+    fprintf(stderr, "%d threads\n", omp_get_max_threads());
+    printf("kind,layout,primitives,gen_s,build_s,build_ns_per_prim,nodes,sah_cost,primitives_mb,bvh_mb,rays,hit_rate,"
+        "trace_s,mrays_per_s\n");
+    for (int l = 0; l < layout_count; ++l)
+        for (int k = 0; k < count_count; ++k)
+            bench_run(layouts[l], counts[k], overlap, triangles);
+    return(0);
+}
@@ -0,0 +1,140 @@
+/* ===========================================================
+   #File: scene_gen.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Writes procedural stress scenes of n spheres or triangles #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/scene.h"
+#include "headers/scene_file.h"
+#include "headers/scene_cache.h"
+#include "headers/obj_loader.h"
+#include "headers/scene_gen.h"
+#include <string.h>
+#include <omp.h>
+
+// NOTE: Generates a stress scene (see scene_gen.h for the layouts) and writes it where
+// the renderer reads scenes from. Spheres go to a scene description, and with -cache also
+// to the binary scene + bvh cache keyed by that file, so that
+//   final_scene_omp.exe -scene big.scene -cache big.cache
+// maps it without parsing or building anything. Triangles go to an OBJ, for -obj.
+// Options:
+//   -n count          primitives (100000)
+//   -layout name      uniform, clustered, long_thin or nested_glass (uniform)
+//   -overlap x        mean diameter over mean spacing (0.5)
+//   -mix l,m,d,e      relative amounts of lambertian, metal, dielectric, light (0.8,0.15,0.05,0)
+//   -clusters n       clumps of the clustered layout (32)
+//   -extent x         half width of the volume (100)
+//   -seed n           (2021)
+//   -triangles        triangles instead of spheres
+//   -o file           output, .scene for spheres, .obj for triangles (stress.scene / stress.obj)
+//   -cache file       spheres: also build the bvh and write the binary cache
+// Usage: scene_gen.exe -n 10000000 -layout clustered -o big.scene -cache big.cache
+
+static void
+parse_mix (char const * list, float * out) {
+    for (int k = 0; k < 4; ++k) {
+        out[k] = *list ? (float)atof(list) : 0.0f;
+        while (*list && *list != ',')
+            ++list;
+        if (*list == ',')
+            ++list;
+    }
+}
+int main (int argc, char ** argv) {
+    scene_gen_params params;
+    scene_gen_params_default(&params);
+    bool triangles = false;
+    char const * out_path = NULL;
+    char const * cache_path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            params.count = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-layout") && i + 1 < argc) {
+            int layout = scene_gen_layout_from_name(argv[++i]);
+            if (layout < 0) {
+                fprintf(stderr, "unknown layout %s\n", argv[i]);
+                return(2);
+            }
+            params.layout = (scene_gen_layout)layout;
+        } else if (0 == strcmp(argv[i], "-overlap") && i + 1 < argc)
+            params.overlap = (float)atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-mix") && i + 1 < argc)
+            parse_mix(argv[++i], params.mix);
+        else if (0 == strcmp(argv[i], "-clusters") && i + 1 < argc)
+            params.clusters = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-extent") && i + 1 < argc)
+            params.extent = (float)atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-seed") && i + 1 < argc)
+            params.seed = strtoull(argv[++i], NULL, 10);
+        else if (0 == strcmp(argv[i], "-triangles"))
+            triangles = true;
+        else if (0 == strcmp(argv[i], "-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-cache") && i + 1 < argc)
+            cache_path = argv[++i];
+        else
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+    }
+    if (params.count < 1 || params.overlap <= 0.0f || params.extent <= 0.0f) {
+        fprintf(stderr, "-n, -overlap and -extent must be positive\n");
+        return(2);
+    }
+    if (NULL == out_path)
+        out_path = triangles ? "stress.obj" : "stress.scene";
+    char const * layout_name = g_scene_gen_layout_names[params.layout];
+
+    double start = omp_get_wtime();
+    if (triangles) {
+        triangle_mesh mesh;
+        triangle_mesh_init(&mesh);
+        scene_settings settings;
+        if (!scene_gen_triangles(&mesh, &settings, &params)) {
+            fprintf(stderr, "out of memory\n");
+            return(1);
+        }
+        fprintf(stderr, "%s: %d triangles generated in %.3fs\n", layout_name, mesh.triangle_count, omp_get_wtime() - start);
+        start = omp_get_wtime();
+        bool ok = obj_save(out_path, &mesh);
+        fprintf(stderr, ok ? "wrote %s in %.3fs\n" : "could not write %s\n", out_path, omp_get_wtime() - start);
+        triangle_mesh_free(&mesh);
+        return(ok ? 0 : 1);
+    }
+
+    scene world;
+    scene_init(&world);
+    scene_settings settings;
+    if (!scene_gen_spheres(&world, &settings, &params)) {
+        fprintf(stderr, "out of memory\n");
+        return(1);
+    }
+    fprintf(stderr, "%s: %d spheres, %d materials generated in %.3fs\n", layout_name, world.sphere_count,
+        world.material_count, omp_get_wtime() - start);
+    start = omp_get_wtime();
+    if (!scene_save(out_path, &world, &settings)) {
+        fprintf(stderr, "could not write %s\n", out_path);
+        scene_free(&world);
+        return(1);
+    }
+    fprintf(stderr, "wrote %s in %.3fs\n", out_path, omp_get_wtime() - start);
+    int ret = 0;
+    if (cache_path) {
+        // -- keyed by the file just written, the way final_scene_omp looks the cache up
+        uint64_t source_key;
+        bvh accel = {0};
+        start = omp_get_wtime();
+        if (!hash_file(out_path, &source_key) || !bvh_build_spheres(&accel, &world) ||
+            !scene_cache_write(cache_path, source_key, &world, &settings, &accel)) {
+            fprintf(stderr, "could not write %s\n", cache_path);
+            ret = 1;
+        } else {
+            fprintf(stderr, "wrote %s (%d bvh nodes) in %.3fs\n", cache_path, accel.node_count, omp_get_wtime() - start);
+        }
+        bvh_free(&accel);
+    }
+    scene_free(&world);
+    return(ret);
+}
@@ -0,0 +1,181 @@
+/* ===========================================================
+   #File: self_hit_bench.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Counts spurious self-intersections of secondary rays at several scene scales #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/camera.h"
+#include "headers/scene.h"
+#include "headers/bvh.h"
+#include "headers/render.h"
+#include <string.h>
+#include <omp.h>
+
+// NOTE: Two scenes, each scaled by 1, 1e2 ... 1e6:
+//   spheres      the final scene (ground plane, the -11..11 grid of small spheres, the
+//                three big ones)
+//   smooth_mesh  the ground plane and a coarse sphere mesh (16 x 8 quads) shaded with
+//                per-vertex normals, so the shading normal is up to ~11 degrees off the
+//                geometric one; only rays leaving the mesh are counted
+// From every primary hit two secondary rays leave the surface: a cosine-distributed
+// bounce and a shadow ray towards a light high above. Rays that would enter the surface
+// by its geometric normal are dropped, so the rest all leave the outside of a convex
+// primitive and hitting the same sphere, plane or mesh again is always a spurious
+// self-hit. Each ray is traced four ways:
+//   epsilon         origin at the hit point, tmin 0.001 (the book's "Fixing Shadow Acne")
+//   none            origin at the hit point, tmin 0
+//   offset_shading  ray_spawn along the shading normal, tmin 0; a ray that leaves the
+//                   surface below the shading normal's plane is pushed inside the mesh
+//   offset          ray_spawn along the geometric normal, tmin 0, what ray_trace_path uses
+// On the spheres both offsets are the same.
+// Usage: self_hit_bench.exe > self_hits.csv
+
+#define bench_width 320
+#define bench_height 200
+#define mesh_slices 16
+#define mesh_stacks 8
+
+typedef enum { SPAWN_EPSILON, SPAWN_NONE, SPAWN_OFFSET_SHADING, SPAWN_OFFSET, SPAWN_COUNT } spawn_method;
+
+/* a sphere of radius r at center with the normals of the true sphere at its vertices.
+   the ring at each pole collapses to a point, so the pole quads are single triangles */
+static void
+make_smooth_sphere (triangle_mesh * me, point3 center, float r) {
+    triangle_mesh_init(me);
+    me->vertex_count = (mesh_stacks + 1) * mesh_slices;
+    me->triangle_count = mesh_slices * (2 * mesh_stacks - 2);
+    me->positions = malloc(me->vertex_count * sizeof(point3));
+    me->normals = malloc(me->vertex_count * sizeof(vec3f));
+    me->indices = malloc(3 * (size_t)me->triangle_count * sizeof(int32_t));
+    for (int j = 0; j <= mesh_stacks; ++j) {
+        float theta = 3.1415927f * j / mesh_stacks;
+        for (int i = 0; i < mesh_slices; ++i) {
+            float phi = 6.2831853f * i / mesh_slices;
+            vec3f n = {sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)};
+            me->normals[j * mesh_slices + i] = n;
+            me->positions[j * mesh_slices + i] = vec3_add(center, vec3_scale(n, r));
+        }
+    }
+    int32_t * idx = me->indices;
+    for (int j = 0; j < mesh_stacks; ++j) {
+        for (int i = 0; i < mesh_slices; ++i) {
+            int32_t a = j * mesh_slices + i, b = j * mesh_slices + (i + 1) % mesh_slices;
+            int32_t c = (j + 1) * mesh_slices + (i + 1) % mesh_slices, d = (j + 1) * mesh_slices + i;
+            if (j > 0) {
+                *idx++ = a; *idx++ = b; *idx++ = c;
+            }
+            if (j < mesh_stacks - 1) {
+                *idx++ = a; *idx++ = c; *idx++ = d;
+            }
+        }
+    }
+    triangle_mesh_build_bvh(me);
+}
+/* with mesh, the smooth_mesh scene (mesh is built and added), else the spheres */
+static void
+make_world (scene * world, float s, material * mat, triangle_mesh * mesh) {
+    scene_init(world);
+    int mat_id = scene_add_material(world, mat);
+    scene_add_plane(world, (point3) {0.0f, 0.0f, 0.0f}, (vec3f) {0.0f, 1.0f, 0.0f}, mat_id);
+    if (mesh) {
+        make_smooth_sphere(mesh, (point3) {0.0f, s, 0.0f}, s);
+        mesh->mat_ptr = mat;
+        mesh->material_id = mat_id;
+        mesh->object_id = scene_mesh_id_base + scene_add_mesh(world, mesh);
+        return;
+    }
+    random_seed(2021);
+    for (int a = -11; a < 11; ++a) {
+        for (int b = -11; b < 11; ++b) {
+            point3 center = {a + 0.9f * random_float(), 0.2f, b + 0.9f * random_float()};
+            scene_add_sphere(world, vec3_scale(center, s), 0.2f * s, mat_id);
+        }
+    }
+    for (int i = -1; i <= 1; ++i)
+        scene_add_sphere(world, (point3) {4.0f * i * s, s, 0.0f}, s, mat_id);
+}
+static ray
+spawn (spawn_method method, hit_record const * rec, vec3f dir) {
+    if (SPAWN_OFFSET_SHADING == method)
+        return ray_spawn(rec->p, rec->normal, dir);
+    if (SPAWN_OFFSET == method)
+        return ray_spawn(rec->p, rec->geometric_normal, dir);
+    ray ret = {rec->p, dir};
+    return ret;
+}
+
+int main (void) {
+    static lambertian grey;
+    lambertian_init(&grey, (color) {0.5f, 0.5f, 0.5f});
+    char const * names[SPAWN_COUNT] = {"epsilon", "none", "offset_shading", "offset"};
+    char const * scene_names[2] = {"spheres", "smooth_mesh"};
+    printf("scene,scale,method,rays,self_hits,self_hit_pct\n");
+    for (int sc = 0; sc < 2; ++sc) {
+        for (float s = 1.0f; s <= 1e6f; s *= 100.0f) {
+            scene world;
+            bvh accel;
+            triangle_mesh mesh;
+            make_world(&world, s, (material *)&grey, sc ? &mesh : NULL);
+            bvh_build_spheres(&accel, &world);
+            render_context ctx;
+            render_context_init(&ctx, &world, NULL, 1);
+            ctx.accel = &accel;
+            camera cam = {0};
+            camera_init(&cam, vec3_scale((point3) {13.f, 2.f, 3.f}, s), (point3) {0.f, sc ? s : 0.f, 0.f}, (vec3f) {0.f, 1.f, 0.f},
+                20.0f, (float)bench_width / bench_height, 0.0f, 10.0f * s);
+            point3 light_pos = vec3_scale((point3) {5.0f, 50.0f, 10.0f}, s);
+
+            int64_t rays = 0, self_hits[SPAWN_COUNT] = {0};
+            int j;
+#pragma omp parallel for schedule(dynamic) reduction(+:rays)
+            for (j = 0; j < bench_height; ++j) {
+                int64_t row_self[SPAWN_COUNT] = {0};
+                random_set_state(random_hash_seed(s, j));
+                for (int i = 0; i < bench_width; ++i) {
+                    ray r = camera_cast_ray(&cam, (i + 0.5f) / bench_width, (j + 0.5f) / bench_height);
+                    hit_record rec;
+                    if (!render_hit(&ctx, &r, 0.0f, g_infinity, &rec) || (sc && rec.object_id != mesh.object_id))
+                        continue;
+                    // -- the record's normals face the camera ray, the outside of a sphere, plane or the mesh here
+                    vec3f bounce = vec3_add(rec.normal, random_unit_vector());
+                    if (vec3_near_zero(bounce))
+                        bounce = rec.normal;
+                    vec3f to_light = vec3_sub(light_pos, rec.p);
+                    float light_dist = vec3_len(to_light);
+                    to_light = vec3_scale(to_light, 1.0f / light_dist);
+                    vec3f dirs[2] = {bounce, to_light};
+                    float tmax[2] = {g_infinity, light_dist};
+                    for (int k = 0; k < 2; ++k) {
+                        if (vec3_mul_dot(dirs[k], rec.geometric_normal) <= 0.0f)
+                            continue;
+                        ++rays;
+                        for (int m = 0; m < SPAWN_COUNT; ++m) {
+                            ray sr = spawn((spawn_method)m, &rec, dirs[k]);
+                            hit_record hit;
+                            if (render_hit(&ctx, &sr, SPAWN_EPSILON == m ? 0.001f : 0.0f, tmax[k], &hit) && hit.object_id == rec.object_id)
+                                ++row_self[m];
+                        }
+                    }
+                }
+#pragma omp critical
+                for (int m = 0; m < SPAWN_COUNT; ++m)
+                    self_hits[m] += row_self[m];
+            }
+            for (int m = 0; m < SPAWN_COUNT; ++m) {
+                printf("%s,%g,%s,%lld,%lld,%.4f\n", scene_names[sc], s, names[m], (long long)rays, (long long)self_hits[m],
+                    100.0 * self_hits[m] / rays);
+                fprintf(stderr, "%-11s scale %-6g %-14s %8lld rays  %8lld self-hits (%7.3f%%)\n", scene_names[sc], s, names[m],
+                    (long long)rays, (long long)self_hits[m], 100.0 * self_hits[m] / rays);
+            }
+            bvh_free(&accel);
+            scene_free(&world);
+            if (sc)
+                triangle_mesh_free(&mesh);
+        }
+    }
+    return(0);
+}
@@ -0,0 +1,193 @@
+/* ===========================================================
+   #File: thread_bench.c #
+   #Date: 19 October 2026 #
+   #Revision: 1.0 #
+   #Creator: Omid Miresmaeili #
+   #Description: Thread scaling of the tile scheduler under different pinning policies #
+   #Notice: (C) Copyright 2026 by Omid. All Rights Reserved. #
+   =========================================================== */
+
+#include "headers/common.h"
+#include "headers/scene.h"
+#include "headers/light_tree.h"
+#include "headers/render.h"
+#include "headers/progressive.h"
+#include "headers/scene_file.h"
+#include "headers/bvh.h"
+#include "headers/render_setup.h"
+#include "headers/topology.h"
+#include <string.h>
+#include <omp.h>
+
+// NOTE: Where does scaling stop? Renders one scene with final_scene_omp's scheduler
+// (render_tiles_pass: passes of -pass-spp samples over 32x32 tiles handed out
+// dynamically, tiles seeded with 2021) for every thread count and pinning policy (see topology.h), each thread
+// placing itself when the render starts. Every thread times the tiles it renders; the
+// rest of the wall time it spent idle, waiting for work at the end of a pass. The image
+// is the same in every run.
+// Reported per run: wall time, throughput (rays of every kind and camera samples per
+// second), speedup and efficiency against one thread with the same policy (estimated
+// from the smallest thread count when 1 is not in the sweep), and the threads' mean and
+// worst idle share. A table goes to stderr and csv to stdout; -per-thread adds a csv of
+// every thread's busy and idle time and tile count.
+// Options:
+//   -scene file       (scenes/final_scene.scene)
+//   -spp n            samples per pixel (16)
+//   -pass-spp n       samples per pass (4)
+//   -width n          image width, the scene's aspect ratio is kept (400)
+//   -threads list     comma separated thread counts (1,2,4... up to the processor count)
+//   -policies list    comma separated pinning policies (none,compact,scatter,numa)
+//   -per-thread file  csv of every thread of every run
+// Usage: thread_bench.exe -threads 1,8,16,32,64,128 > scaling.csv
+
+#define bench_max_threads 1024
+#define bench_max_runs 64
+
+typedef struct {
+    int threads;
+    pin_policy policy;
+    bool pinned;            /* every thread's affinity was set */
+    double seconds;
+    int64_t rays;
+    double idle_mean;       /* share of the wall time */
+    double idle_max;
+} bench_run;
+
+static int
+parse_policies (char * list, int * out) {
+    int count = 0;
+    for (char * name = strtok(list, ","); name && count < PIN_POLICY_COUNT; name = strtok(NULL, ",")) {
+        int policy = pin_policy_from_name(name);
+        if (policy < 0)
+            fprintf(stderr, "unknown policy %s\n", name);
+        else
+            out[count++] = policy;
+    }
+    return count;
+}
+static bench_run
+render_run (render_context * ctx, camera * cam, topology const * topo, int width, int height, int spp, int pass_spp,
+    int threads, pin_policy policy, tile_thread_stats * times) {
+    bench_run ret = {threads, policy, true, 0.0, 0, 0.0, 0.0};
+    film fb;
+    tile_grid grid;
+    film_alloc(&fb, width, height);
+    tile_grid_init(&grid, width, height, 32, 2021);
+    memset(times, 0, threads * sizeof(tile_thread_stats));
+    tile_pass tiles;
+    tile_pass_init(&tiles, spp, pass_spp);
+    tiles.stats = times;
+    int pin_failures = 0;
+    omp_set_num_threads(threads);
+    double start = omp_get_wtime();
+#pragma omp parallel reduction(+:pin_failures)
+    {
+        pin_failures += !topology_pin(topo, policy, omp_get_thread_num(), threads);
+        for (int done = 0; done < spp; done += pass_spp)
+            render_tiles_pass(ctx, cam, &fb, NULL, &grid, &tiles);
+    }
+    ret.seconds = omp_get_wtime() - start;
+    ret.pinned = (0 == pin_failures);
+    for (int t = 0; t < threads; ++t) {
+        double idle = (ret.seconds - times[t].busy) / ret.seconds;
+        ret.rays += times[t].rays;
+        ret.idle_mean += idle / threads;
+        ret.idle_max = idle > ret.idle_max ? idle : ret.idle_max;
+    }
+    // -- the main thread is one of the workers, it should not stay pinned for the next run
+    topology_pin(topo, PIN_NONE, 0, 1);
+    tile_grid_free(&grid);
+    film_free(&fb);
+    return ret;
+}
+int main (int argc, char ** argv) {
+    char const * scene_path = "scenes/final_scene.scene";
+    char const * per_thread_path = NULL;
+    int spp = 16;
+    int pass_spp = 4;
+    int width = 400;
+    int thread_counts[bench_max_runs];
+    int thread_count_count = 0;
+    int policies[PIN_POLICY_COUNT] = {PIN_NONE, PIN_COMPACT, PIN_SCATTER, PIN_NUMA};
+    int policy_count = PIN_POLICY_COUNT;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-scene") && i + 1 < argc)
+            scene_path = argv[++i];
+        else if (0 == strcmp(argv[i], "-spp") && i + 1 < argc)
+            spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-pass-spp") && i + 1 < argc)
+            pass_spp = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-width") && i + 1 < argc)
+            width = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-threads") && i + 1 < argc)
+            thread_count_count = parse_int_list(argv[++i], thread_counts, bench_max_runs);
+        else if (0 == strcmp(argv[i], "-policies") && i + 1 < argc)
+            policy_count = parse_policies(argv[++i], policies);
+        else if (0 == strcmp(argv[i], "-per-thread") && i + 1 < argc)
+            per_thread_path = argv[++i];
+        else
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+    }
+    if (spp < 1 || pass_spp < 1 || width < 2) {
+        fprintf(stderr, "-spp, -pass-spp and -width must be positive\n");
+        return(2);
+    }
+    int procs = omp_get_num_procs();
+    if (0 == thread_count_count)
+        thread_count_count = thread_sweep_default(procs, thread_counts, bench_max_runs);
+    topology * topo = malloc(sizeof(topology));
+    topology_init(topo, procs);
+    fprintf(stderr, "%d processors: %d packages, %d numa nodes, %d cores\n", topo->cpu_count, topo->package_count,
+        topo->node_count, topo->core_count);
+
+    render_setup rs;
+    if (!render_setup_load(&rs, scene_path) || !render_setup_prepare(&rs, width))
+        return(1);
+    int height = rs.height;
+
+    FILE * per_thread = per_thread_path ? fopen(per_thread_path, "w") : NULL;
+    if (per_thread_path && NULL == per_thread)
+        fprintf(stderr, "could not write %s\n", per_thread_path);
+    if (per_thread)
+        fprintf(per_thread, "policy,threads,thread,tiles,busy_s,idle_s,idle_share\n");
+    int max_threads = 1;
+    for (int k = 0; k < thread_count_count; ++k)
+        max_threads = thread_counts[k] > max_threads ? thread_counts[k] : max_threads;
+    tile_thread_stats * times = malloc((size_t)(max_threads < bench_max_threads ? max_threads : bench_max_threads) * sizeof(tile_thread_stats));
+    double samples = (double)width * height * spp;
+
+    printf("policy,threads,pinned,frame_s,total_mrays_per_s,msamples_per_s,speedup,efficiency,idle_mean,idle_max\n");
+    fprintf(stderr, "%-8s %7s %9s %12s %9s %10s %9s %9s\n", "policy", "threads", "frame s", "Mrays/s", "speedup",
+        "efficiency", "idle avg", "idle max");
+    for (int p = 0; p < policy_count; ++p) {
+        double base = 0.0;      /* one thread's throughput */
+        int knee = 0;
+        for (int k = 0; k < thread_count_count; ++k) {
+            int threads = thread_counts[k] < bench_max_threads ? thread_counts[k] : bench_max_threads;
+            bench_run run = render_run(&rs.ctx, &rs.cam, topo, width, height, spp, pass_spp, threads, (pin_policy)policies[p], times);
+            double throughput = run.rays / run.seconds;
+            if (0 == k)
+                base = throughput / threads;
+            double speedup = throughput / base;
+            double efficiency = speedup / threads;
+            if (efficiency >= 0.8)
+                knee = threads;
+            printf("%s,%d,%d,%.6f,%.3f,%.3f,%.3f,%.3f,%.4f,%.4f\n", g_pin_policy_names[run.policy], threads, run.pinned,
+                run.seconds, throughput * 1e-6, samples / run.seconds * 1e-6, speedup, efficiency, run.idle_mean, run.idle_max);
+            fflush(stdout);
+            fprintf(stderr, "%-8s %7d %9.3f %12.2f %8.2fx %9.1f%% %8.1f%% %8.1f%%%s\n", g_pin_policy_names[run.policy], threads,
+                run.seconds, throughput * 1e-6, speedup, 100.0 * efficiency, 100.0 * run.idle_mean, 100.0 * run.idle_max,
+                run.pinned ? "" : "  (not pinned)");
+            for (int t = 0; per_thread && t < threads; ++t)
+                fprintf(per_thread, "%s,%d,%d,%d,%.6f,%.6f,%.4f\n", g_pin_policy_names[run.policy], threads, t, times[t].tiles,
+                    times[t].busy, run.seconds - times[t].busy, (run.seconds - times[t].busy) / run.seconds);
+        }
+        fprintf(stderr, "%-8s scales to %d threads at 80%% efficiency or better\n", g_pin_policy_names[policies[p]], knee);
+    }
+    if (per_thread)
+        fclose(per_thread);
+    free(times);
+    free(topo);
+    render_setup_free(&rs);
+    return(0);
+}